@@ -0,0 +1,395 @@
+#define _POSIX_C_SOURCE 200809L
+#include "batch.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * @brief Jobs still owned by one worker.
+ *
+ * The half-open range [begin, end) is packed into one word (begin in the
+ * high half) so the owner taking from the front and thieves splitting off
+ * the back both go through a single compare-and-swap. Each queue sits on
+ * its own cache line.
+ */
+typedef struct
+{
+  _Alignas(64) _Atomic uint64_t range;
+} batch_queue_t;
+
+/**
+ * @brief A ROM image read once and copied into every job that runs it.
+ */
+typedef struct
+{
+  const char *path;
+  int status; // 0 if the file was read, -1 otherwise
+  uint16_t size;
+  uint8_t data[MEMORY_SIZE - START_ADDRESS];
+} batch_rom_t;
+
+typedef struct
+{
+  const chip8_batch_job_t *jobs;
+  chip8_batch_result_t *results;
+  const batch_rom_t *roms;
+  const uint32_t *job_roms; // Index into roms for each job
+  batch_queue_t *queues;
+  unsigned workers;
+} batch_t;
+
+typedef struct
+{
+  batch_t *batch;
+  unsigned id;
+  chip8_t *chip8; // Instance reused for every job this worker runs
+} batch_worker_t;
+
+static inline uint64_t range_pack(uint32_t begin, uint32_t end)
+{
+  return (uint64_t)begin << 32 | end;
+}
+
+static inline uint32_t range_begin(uint64_t range) { return (uint32_t)(range >> 32); }
+static inline uint32_t range_end(uint64_t range) { return (uint32_t)range; }
+
+// Take the next job from the front of our own range
+static bool queue_pop(batch_queue_t *queue, uint32_t *job)
+{
+  uint64_t range = atomic_load(&queue->range);
+  while (range_begin(range) < range_end(range))
+  {
+    uint32_t begin = range_begin(range);
+    if (atomic_compare_exchange_weak(&queue->range, &range,
+                                     range_pack(begin + 1, range_end(range))))
+    {
+      *job = begin;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Move the back half of the fullest other queue into ours. Our queue is
+// empty, so no one else touches it while we refill it.
+static bool queue_steal(batch_t *batch, unsigned thief)
+{
+  for (;;)
+  {
+    unsigned victim = thief;
+    uint64_t best = 0;
+    uint32_t most = 0;
+    for (unsigned w = 0; w < batch->workers; ++w)
+    {
+      uint64_t range = atomic_load(&batch->queues[w].range);
+      uint32_t left = range_end(range) - range_begin(range);
+      if (w != thief && range_begin(range) < range_end(range) && left > most)
+      {
+        victim = w;
+        best = range;
+        most = left;
+      }
+    }
+
+    if (most == 0)
+    {
+      return false;
+    }
+
+    uint32_t mid = range_begin(best) + most / 2;
+    if (atomic_compare_exchange_strong(&batch->queues[victim].range, &best,
+                                       range_pack(range_begin(best), mid)))
+    {
+      atomic_store(&batch->queues[thief].range,
+                   range_pack(mid, range_end(best)));
+      return true;
+    }
+    // Lost a race with the owner or another thief; look again
+  }
+}
+
+// Read a ROM the way load_rom() does, without an instance to put it in
+static void batch_load_rom(batch_rom_t *rom, const char *path)
+{
+  rom->path = path;
+  rom->status = -1;
+  rom->size = 0;
+
+  FILE *file = fopen(path, "rb");
+  if (file == NULL)
+  {
+    return;
+  }
+  // One byte more than fits tells a full image from one too large
+  size_t size = fread(rom->data, 1, sizeof(rom->data), file);
+  int extra = fgetc(file);
+  bool failed = ferror(file) != 0;
+  fclose(file);
+  if (!failed && extra == EOF)
+  {
+    rom->size = (uint16_t)size;
+    rom->status = 0;
+  }
+}
+
+static uint64_t path_hash(const char *path)
+{
+  uint64_t hash = 0xCBF29CE484222325ull;
+  for (; *path; ++path)
+  {
+    hash = (hash ^ (uint8_t)*path) * 0x100000001B3ull;
+  }
+  return hash;
+}
+
+/**
+ * @brief Read each distinct ROM path once and map every job to its image.
+ *
+ * Paths go through an open-addressed table, so a sweep of many ROMs is not
+ * quadratic in the number of jobs.
+ *
+ * @return batch_rom_t* The images, or NULL if out of memory.
+ */
+static batch_rom_t *batch_load_roms(const chip8_batch_job_t *jobs,
+                                    uint32_t count, uint32_t *job_roms)
+{
+  uint32_t capacity = 16;
+  while (capacity < (uint64_t)count * 2 && capacity < (1u << 31))
+  {
+    capacity *= 2;
+  }
+  uint32_t *slots = (uint32_t *)malloc(capacity * sizeof(uint32_t));
+  batch_rom_t *roms = NULL;
+  uint32_t loaded = 0;
+  uint32_t allocated = 0;
+  if (slots == NULL)
+  {
+    return NULL;
+  }
+  memset(slots, 0xFF, capacity * sizeof(uint32_t));
+
+  for (uint32_t i = 0; i < count; ++i)
+  {
+    const char *path = jobs[i].rom;
+    uint32_t slot = (uint32_t)path_hash(path) & (capacity - 1);
+    while (slots[slot] != UINT32_MAX &&
+           strcmp(roms[slots[slot]].path, path) != 0)
+    {
+      slot = (slot + 1) & (capacity - 1);
+    }
+
+    if (slots[slot] == UINT32_MAX)
+    {
+      if (loaded == allocated)
+      {
+        uint32_t grown = allocated ? allocated * 2 : 4;
+        batch_rom_t *more =
+            (batch_rom_t *)realloc(roms, grown * sizeof(batch_rom_t));
+        if (more == NULL)
+        {
+          free(roms);
+          free(slots);
+          return NULL;
+        }
+        roms = more;
+        allocated = grown;
+      }
+      batch_load_rom(&roms[loaded], path);
+      slots[slot] = loaded++;
+    }
+    job_roms[i] = slots[slot];
+  }
+
+  free(slots);
+  return roms;
+}
+
+// Run a job from an image already in memory, as load_rom() would leave it
+static void batch_run_loaded(chip8_t *chip8, const chip8_batch_job_t *job,
+                             const batch_rom_t *rom,
+                             chip8_batch_result_t *result)
+{
+  memset(result, 0, sizeof(*result));
+  init_chip8(chip8, job->seed);
+  chip8->stop_mask = job->stop_mask;
+
+  if (rom->status != 0)
+  {
+    result->status = -1;
+    return;
+  }
+  memcpy(&chip8->memory[START_ADDRESS], rom->data, rom->size);
+  chip8_invalidate(chip8, START_ADDRESS, rom->size);
+
+  chip8_exit_reason_t reason = CHIP8_EXIT_BUDGET;
+  size_t next_input = 0;
+  uint32_t frame = 0;
+  while (frame < job->frames && reason == CHIP8_EXIT_BUDGET)
+  {
+    // Apply every script step that has come due
+    while (next_input < job->input_count &&
+           job->inputs[next_input].frame <= frame)
+    {
+      uint16_t keys = job->inputs[next_input].keys;
+      for (uint8_t key = 0; key < KEYS_COUNT; ++key)
+      {
+        chip8->keypad[key] = (keys >> key) & 1u;
+      }
+      ++next_input;
+    }
+
+    ++frame;
+    uint32_t budget = job->cycles_per_frame;
+    while (budget > 0)
+    {
+      chip8_exit_t stop;
+      reason = chip8_run(chip8, budget, &stop);
+      budget -= stop.cycles;
+      if (reason != CHIP8_EXIT_BUDGET)
+      {
+        break;
+      }
+    }
+
+    if (reason == CHIP8_EXIT_BUDGET)
+    {
+      update_timers(chip8);
+    }
+  }
+
+  result->reason = reason;
+  result->frames = frame;
+  result->cycles = chip8->cycles;
+  result->state_hash = chip8_hash_state(chip8);
+  memcpy(result->display, chip8->display, sizeof(result->display));
+}
+
+void chip8_batch_run_job(chip8_t *chip8, const chip8_batch_job_t *job,
+                         chip8_batch_result_t *result)
+{
+  batch_rom_t rom;
+  batch_load_rom(&rom, job->rom);
+  batch_run_loaded(chip8, job, &rom, result);
+}
+
+static void *batch_worker(void *arg)
+{
+  batch_worker_t *worker = (batch_worker_t *)arg;
+  batch_t *batch = worker->batch;
+  batch_queue_t *own = &batch->queues[worker->id];
+
+  for (;;)
+  {
+    uint32_t job;
+    if (queue_pop(own, &job))
+    {
+      batch_run_loaded(worker->chip8, &batch->jobs[job],
+                       &batch->roms[batch->job_roms[job]],
+                       &batch->results[job]);
+    }
+    else if (!queue_steal(batch, worker->id))
+    {
+      // Jobs never spawn jobs, so empty queues everywhere means done
+      return NULL;
+    }
+  }
+}
+
+int chip8_batch_run(const chip8_batch_job_t *jobs,
+                    chip8_batch_result_t *results, size_t count,
+                    unsigned threads)
+{
+  if (count == 0)
+  {
+    return 0;
+  }
+  if (count > UINT32_MAX)
+  {
+    return -1;
+  }
+
+  if (threads == 0)
+  {
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = online > 0 ? (unsigned)online : 1;
+  }
+  if (threads > count)
+  {
+    threads = (unsigned)count;
+  }
+
+  // Each distinct ROM is read once here rather than by every job
+  uint32_t *job_roms = (uint32_t *)malloc(count * sizeof(uint32_t));
+  batch_rom_t *roms =
+      job_roms ? batch_load_roms(jobs, (uint32_t)count, job_roms) : NULL;
+
+  batch_t batch = {jobs, results, roms, job_roms, NULL, threads};
+  batch.queues = (batch_queue_t *)aligned_alloc(
+      _Alignof(batch_queue_t), sizeof(batch_queue_t) * threads);
+  batch_worker_t *workers =
+      (batch_worker_t *)calloc(threads, sizeof(batch_worker_t));
+  pthread_t *handles = (pthread_t *)calloc(threads, sizeof(pthread_t));
+  bool *started = (bool *)calloc(threads, sizeof(bool));
+  if (roms == NULL || batch.queues == NULL || workers == NULL ||
+      handles == NULL || started == NULL)
+  {
+    free(job_roms);
+    free(roms);
+    free(batch.queues);
+    free(workers);
+    free(handles);
+    free(started);
+    return -1;
+  }
+
+  // Deal out contiguous ranges; stealing evens out the rest
+  int status = 0;
+  for (unsigned w = 0; w < threads; ++w)
+  {
+    uint32_t begin = (uint32_t)(count * w / threads);
+    uint32_t end = (uint32_t)(count * (w + 1) / threads);
+    atomic_init(&batch.queues[w].range, range_pack(begin, end));
+    workers[w].batch = &batch;
+    workers[w].id = w;
+    workers[w].chip8 = (chip8_t *)malloc(sizeof(chip8_t));
+    if (workers[w].chip8 == NULL)
+    {
+      status = -1;
+    }
+  }
+
+  if (status == 0)
+  {
+    // The calling thread is worker 0. Workers that fail to start simply
+    // have their ranges stolen by the others.
+    for (unsigned w = 1; w < threads; ++w)
+    {
+      started[w] =
+          pthread_create(&handles[w], NULL, batch_worker, &workers[w]) == 0;
+    }
+    batch_worker(&workers[0]);
+    for (unsigned w = 1; w < threads; ++w)
+    {
+      if (started[w])
+      {
+        pthread_join(handles[w], NULL);
+      }
+    }
+  }
+
+  for (unsigned w = 0; w < threads; ++w)
+  {
+    free(workers[w].chip8);
+  }
+  free(job_roms);
+  free(roms);
+  free(batch.queues);
+  free(workers);
+  free(handles);
+  free(started);
+  return status;
+}
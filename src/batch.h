@@ -0,0 +1,73 @@
+#ifndef CHIP8_BATCH_H
+#define CHIP8_BATCH_H
+
+#include "chip8.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief One step of an input script: the keypad state from a frame on.
+ */
+typedef struct
+{
+  uint32_t frame; // First frame the keys apply to
+  uint16_t keys;  // Bit k set when key k is held
+} chip8_batch_input_t;
+
+/**
+ * @brief A headless run of one ROM with one seed and one input script.
+ */
+typedef struct
+{
+  const char *rom;                   // Path to the ROM image
+  uint32_t seed;                     // RNG seed passed to init_chip8()
+  uint32_t frames;                   // Frame budget (one timer tick each)
+  uint32_t cycles_per_frame;         // Instruction budget per frame
+  uint32_t stop_mask;                // CHIP8_STOP_* events that end the job
+  const chip8_batch_input_t *inputs; // Input script sorted by frame, or NULL
+  size_t input_count;
+} chip8_batch_job_t;
+
+/**
+ * @brief Outcome of a job.
+ */
+typedef struct
+{
+  int status;                 // 0 on success, -1 if the ROM failed to load
+  chip8_exit_reason_t reason; // BUDGET if every frame ran, else the event
+  uint32_t frames;            // Frames started
+  uint64_t cycles;            // Instructions executed (idle included)
+  uint64_t state_hash;        // chip8_hash_state() at the end
+  uint64_t display[DISPLAY_HEIGHT]; // Final framebuffer, packed as in chip8_t
+} chip8_batch_result_t;
+
+/**
+ * @brief Run a list of jobs on a pool of worker threads.
+ *
+ * Each worker owns one chip8_t that is reused for every job it runs. Jobs
+ * are dealt out in contiguous ranges and idle workers steal half of the
+ * largest remaining range, so uneven job lengths still keep every thread
+ * busy. Results do not depend on the number of threads. Each distinct ROM
+ * path is read once before the workers start, and jobs copy the image in.
+ *
+ * @param jobs Jobs to run.
+ * @param results Destination for one result per job.
+ * @param count Number of jobs.
+ * @param threads Worker threads to use, 0 for one per online CPU.
+ * @return int 0 on success, -1 if the workers could not be started.
+ */
+int chip8_batch_run(const chip8_batch_job_t *jobs,
+                    chip8_batch_result_t *results, size_t count,
+                    unsigned threads);
+
+/**
+ * @brief Run a single job on a caller-provided instance.
+ *
+ * @param chip8 Instance to run the job on; it is reinitialized.
+ * @param job Job to run.
+ * @param result Destination for the outcome.
+ */
+void chip8_batch_run_job(chip8_t *chip8, const chip8_batch_job_t *job,
+                         chip8_batch_result_t *result);
+
+#endif // !CHIP8_BATCH_H
@@ -1,13 +1,11 @@
-#include "chip8.h"
-#include <_stdio.h>
+#include "chip8_internal.h"
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
 
-static const uint8_t fontset[FONTSET_SIZE] = {
+const uint8_t chip8_fontset[FONTSET_SIZE] = {
     0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
     0x20, 0x60, 0x20, 0x20, 0x70, // 1
     0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
@@ -27,40 +25,39 @@ static const uint8_t fontset[FONTSET_SIZE] = {
 };
 
 /**
- * @brief Internal state for the random number generator (Xorshift32).
- */
-static uint32_t rng_state = 0x12345678;
-
-/**
- * @brief Seed the random number generator.
+ * @brief Seed an instance's random number generator.
  *
+ * @param chip8 Pointer to the CHIP-8 state structure.
  * @param seed The seed value. If zero, it is replaced with 1.
  */
-static inline void rng_seed(uint32_t seed)
+static inline void rng_seed(chip8_t *chip8, uint32_t seed)
 {
   if (seed == 0)
     seed = 1;
-  rng_state = seed;
+  chip8->rng_state = seed;
 }
 
 /**
  * @brief Generate a random 8-bit value using Xorshift32 algorithm.
  *
+ * @param chip8 Pointer to the CHIP-8 state structure.
  * @return uint8_t Random byte.
  */
-static inline uint8_t rng_byte(void)
+static inline uint8_t rng_byte(chip8_t *chip8)
 {
   // Xorshift32
-  rng_state ^= rng_state << 13;
-  rng_state ^= rng_state >> 17;
-  rng_state ^= rng_state << 5;
-  return (uint8_t)(rng_state);
+  uint32_t state = chip8->rng_state;
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  chip8->rng_state = state;
+  return (uint8_t)(state);
 }
 
 void set_opcode(chip8_t *chip8)
 {
-  uint8_t lhsByte = chip8->memory[chip8->pc];
-  uint8_t rhsByte = chip8->memory[chip8->pc + 1];
+  uint8_t lhsByte = chip8->memory[chip8->pc & 0x0FFFu];
+  uint8_t rhsByte = chip8->memory[(chip8->pc + 1) & 0x0FFFu];
 
   // Immediately increment pc since some instrucions will explicitly change our
   // pc location and need to reference the updated pc and not old
@@ -83,130 +80,180 @@ void update_timers(chip8_t *chip8)
   }
 }
 
-void op_0nnn(chip8_t *chip8) { chip8->pc = chip8->opcode & 0x0FFFu; }
+/**
+ * @brief Rebuild a single predecoded slot from the bytes it covers.
+ *
+ * @param chip8 Pointer to the CHIP-8 state structure.
+ * @param slot Slot index (address / 2).
+ */
+static inline void decode_slot(chip8_t *chip8, uint16_t slot)
+{
+  uint16_t addr = slot << 1;
+  uint16_t opcode = chip8->memory[addr] << 8 | chip8->memory[addr + 1];
+  decode_instr(opcode, &chip8->decoded[slot]);
+}
+
+/**
+ * @brief Write a byte of memory on behalf of an instruction.
+ *
+ * The predecoded slot covering the address is rebuilt so that the next fetch
+ * from it sees the new bytes.
+ */
+static inline void write_memory(chip8_t *chip8, uint16_t addr, uint8_t value)
+{
+  addr &= 0x0FFFu;
+  chip8->memory[addr] = value;
+  decode_slot(chip8, addr >> 1);
+}
+
+/**
+ * @brief Widen the range of memory rewritten since a JIT last looked.
+ */
+static inline void mark_rewritten(chip8_t *chip8, uint16_t begin, uint16_t end)
+{
+  if (chip8->rewritten_begin >= chip8->rewritten_end)
+  {
+    chip8->rewritten_begin = begin;
+    chip8->rewritten_end = end;
+    return;
+  }
+  if (begin < chip8->rewritten_begin)
+  {
+    chip8->rewritten_begin = begin;
+  }
+  if (end > chip8->rewritten_end)
+  {
+    chip8->rewritten_end = end;
+  }
+}
+
+void chip8_invalidate(chip8_t *chip8, uint16_t addr, uint16_t len)
+{
+  if (len == 0 || addr >= MEMORY_SIZE)
+  {
+    return;
+  }
+
+  uint32_t end = (uint32_t)addr + len;
+  if (end > MEMORY_SIZE)
+  {
+    end = MEMORY_SIZE;
+  }
+  mark_rewritten(chip8, addr, (uint16_t)end);
+
+  for (uint32_t slot = addr >> 1; slot < (end + 1) >> 1; ++slot)
+  {
+    decode_slot(chip8, (uint16_t)slot);
+  }
+}
+
+void op_0nnn(chip8_t *chip8, const chip8_instr_t *instr)
+{
+  chip8->pc = instr->nnn;
+}
 
 // Set entire display buffer to 0
-void op_00E0(chip8_t *chip8)
+void op_00E0(chip8_t *chip8, const chip8_instr_t *instr)
 {
+  (void)instr;
+  for (unsigned int y = 0; y < DISPLAY_HEIGHT; ++y)
+  {
+    chip8->dirty_rows |= (uint32_t)(chip8->display[y] != 0) << y;
+  }
   memset(chip8->display, 0, sizeof(chip8->display));
 }
 
 // RETURN from subroutine
-void op_00EE(chip8_t *chip8)
+void op_00EE(chip8_t *chip8, const chip8_instr_t *instr)
 {
+  (void)instr;
+  // The stack index wraps, so runaway calls or returns stay inside the stack
   --chip8->sp;
-  chip8->pc = chip8->stack[chip8->sp];
+  chip8->pc = chip8->stack[chip8->sp & (STACK_SIZE - 1)];
 }
 
 // JP addr
-void op_1nnn(chip8_t *chip8)
+void op_1nnn(chip8_t *chip8, const chip8_instr_t *instr)
 {
-  uint16_t nnn = chip8->opcode & 0x0FFFu;
-  chip8->pc = nnn;
+  chip8->pc = instr->nnn;
 }
 
 // Call subroutine at nnn
-void op_2nnn(chip8_t *chip8)
+void op_2nnn(chip8_t *chip8, const chip8_instr_t *instr)
 {
-  uint16_t nnn = chip8->opcode & 0x0FFFu;
-  chip8->stack[chip8->sp] = chip8->pc;
+  chip8->stack[chip8->sp & (STACK_SIZE - 1)] = chip8->pc;
   ++chip8->sp;
-  chip8->pc = nnn;
+  chip8->pc = instr->nnn;
 }
 
 // SE Vx, byte
-void op3xkk(chip8_t *chip8)
+void op3xkk(chip8_t *chip8, const chip8_instr_t *instr)
 {
-  uint8_t Vx = (chip8->opcode & 0x0F00u) >> 8u;
-  // 3rd + 4th nibble - 0000 0000 1111 1111
-  uint8_t kk = chip8->opcode & 0x00FFu;
-  if (chip8->registers[Vx] == kk)
+  if (chip8->registers[instr->x] == instr->kk)
   {
     chip8->pc += 2;
   }
 }
 
 // SNE Vx, byte
-void op_4xkk(chip8_t *chip8)
+void op_4xkk(chip8_t *chip8, const chip8_instr_t *instr)
 {
-  uint8_t Vx = (chip8->opcode & 0x0F00u) >> 8u;
-  // 3rd + 4th nibble - 0000 0000 1111 1111
-  uint8_t kk = chip8->opcode & 0x00FFu;
-  if (chip8->registers[Vx] != kk)
+  if (chip8->registers[instr->x] != instr->kk)
   {
     chip8->pc += 2;
   }
 }
 
 // SE Vx, Vy
-void op_5xy0(chip8_t *chip8)
+void op_5xy0(chip8_t *chip8, const chip8_instr_t *instr)
 {
-  // 2nd nibble - 0000 1111 0000 0000
-  uint8_t Vx = (chip8->opcode & 0x0F00u) >> 8u;
-  // 3rd nibble - 0000 0000 1111 0000
-  uint8_t Vy = (chip8->opcode & 0x00F0u) >> 4u;
-  if (chip8->registers[Vx] == chip8->registers[Vy])
+  if (chip8->registers[instr->x] == chip8->registers[instr->y])
   {
     chip8->pc += 2;
   }
 }
 
 // LD Vx, byte
-void op_6xkk(chip8_t *chip8)
+void op_6xkk(chip8_t *chip8, const chip8_instr_t *instr)
 {
-  uint8_t Vx = (chip8->opcode & 0x0F00u) >> 8u;
-  // 3rd + 4th nibble - 0000 0000 1111 1111
-  uint8_t kk = chip8->opcode & 0x00FFu;
-  chip8->registers[Vx] = kk;
+  chip8->registers[instr->x] = instr->kk;
 }
 
 // ADD Vx, byte
-void op_7xkk(chip8_t *chip8)
+void op_7xkk(chip8_t *chip8, const chip8_instr_t *instr)
 {
-  uint8_t Vx = (chip8->opcode & 0x0F00u) >> 8u;
-  uint8_t kk = chip8->opcode & 0x00FFu;
-
-  chip8->registers[Vx] += kk;
+  chip8->registers[instr->x] += instr->kk;
 }
 
 // LD Vx, Vy
-void op_8xy0(chip8_t *chip8)
+void op_8xy0(chip8_t *chip8, const chip8_instr_t *instr)
 {
-  uint8_t Vx = (chip8->opcode & 0x0F00u) >> 8u;
-  uint8_t Vy = (chip8->opcode & 0x00F0u) >> 4u;
-
-  chip8->registers[Vx] = chip8->registers[Vy];
+  chip8->registers[instr->x] = chip8->registers[instr->y];
 }
 
 // OR Vx, Vy
-void op_8xy1(chip8_t *chip8)
+void op_8xy1(chip8_t *chip8, const chip8_instr_t *instr)
 {
-  uint8_t Vx = (chip8->opcode & 0x0F00u) >> 8u;
-  uint8_t Vy = (chip8->opcode & 0x00F0u) >> 4u;
-  chip8->registers[Vx] |= chip8->registers[Vy];
+  chip8->registers[instr->x] |= chip8->registers[instr->y];
 }
 
 // AND Vx, Vy
-void op_8xy2(chip8_t *chip8)
+void op_8xy2(chip8_t *chip8, const chip8_instr_t *instr)
 {
-  uint8_t Vx = (chip8->opcode & 0x0F00u) >> 8u;
-  uint8_t Vy = (chip8->opcode & 0x00F0u) >> 4u;
-  chip8->registers[Vx] &= chip8->registers[Vy];
+  chip8->registers[instr->x] &= chip8->registers[instr->y];
 }
 
 // XOR Vx, Vy
-void op_8xy3(chip8_t *chip8)
+void op_8xy3(chip8_t *chip8, const chip8_instr_t *instr)
 {
-  uint8_t Vx = (chip8->opcode & 0x0F00u) >> 8u;
-  uint8_t Vy = (chip8->opcode & 0x00F0u) >> 4u;
-  chip8->registers[Vx] ^= chip8->registers[Vy];
+  chip8->registers[instr->x] ^= chip8->registers[instr->y];
 }
 
 // ADD Vx, Vy
-void op_8xy4(chip8_t *chip8)
+void op_8xy4(chip8_t *chip8, const chip8_instr_t *instr)
 {
-  uint8_t Vx = (chip8->opcode & 0x0F00u) >> 8u;
-  uint8_t Vy = (chip8->opcode & 0x00F0u) >> 4u;
+  uint8_t Vx = instr->x;
+  uint8_t Vy = instr->y;
 
   uint16_t sum = chip8->registers[Vx] + chip8->registers[Vy];
 
@@ -224,14 +271,14 @@ void op_8xy4(chip8_t *chip8)
 }
 
 // SUB Vx, Vy
-void op_8xy5(chip8_t *chip8)
+void op_8xy5(chip8_t *chip8, const chip8_instr_t *instr)
 {
-  uint8_t Vx = (chip8->opcode & 0x0F00u) >> 8u;
-  uint8_t Vy = (chip8->opcode & 0x00F0u) >> 4u;
-
-  uint16_t sum = chip8->registers[Vx] - chip8->registers[Vy];
+  uint8_t Vx = instr->x;
+  uint8_t Vy = instr->y;
+  uint8_t vx = chip8->registers[Vx];
+  uint8_t vy = chip8->registers[Vy];
 
-  if (chip8->registers[Vx] > chip8->registers[Vy])
+  if (vx > vy)
   {
     chip8->registers[0xF] = 1; // Set borrow flag
   }
@@ -244,9 +291,9 @@ void op_8xy5(chip8_t *chip8)
 }
 
 // SHR Vx {, Vy}
-void op_8xy6(chip8_t *chip8)
+void op_8xy6(chip8_t *chip8, const chip8_instr_t *instr)
 {
-  uint8_t Vx = (chip8->opcode & 0x0F00u) >> 8u;
+  uint8_t Vx = instr->x;
   // 0x1u = 0001
   // VF = Vx & 0x1u
   chip8->registers[0xF] = chip8->registers[Vx] & 0x01u; // LSB to VF
@@ -256,10 +303,10 @@ void op_8xy6(chip8_t *chip8)
 }
 
 // SUBN Vx, Vy
-void op_8xy7(chip8_t *chip8)
+void op_8xy7(chip8_t *chip8, const chip8_instr_t *instr)
 {
-  uint8_t Vx = (chip8->opcode & 0x0F00u) >> 8u;
-  uint8_t Vy = (chip8->opcode & 0x00F0u) >> 4u;
+  uint8_t Vx = instr->x;
+  uint8_t Vy = instr->y;
 
   if (chip8->registers[Vy] > chip8->registers[Vx])
   {
@@ -273,9 +320,9 @@ void op_8xy7(chip8_t *chip8)
 }
 
 // SHL Vx {, Vy}
-void op_8xyE(chip8_t *chip8)
+void op_8xyE(chip8_t *chip8, const chip8_instr_t *instr)
 {
-  uint8_t Vx = (chip8->opcode & 0x0F00u) >> 8u;
+  uint8_t Vx = instr->x;
 
   chip8->registers[0xF] = (chip8->registers[Vx] & 0x80u) >> 7u; // MSB to VF
 
@@ -283,403 +330,430 @@ void op_8xyE(chip8_t *chip8)
 }
 
 // SNE Vx, Vy
-void op_9xy0(chip8_t *chip8)
+void op_9xy0(chip8_t *chip8, const chip8_instr_t *instr)
 {
-  uint8_t Vx = (chip8->opcode & 0x0F00u) >> 8u;
-  uint8_t Vy = (chip8->opcode & 0x00F0u) >> 4u;
-
-  if (chip8->registers[Vx] != chip8->registers[Vy])
+  if (chip8->registers[instr->x] != chip8->registers[instr->y])
   {
     chip8->pc += 2;
   }
 }
 
 // LD I, addr
-void op_Annn(chip8_t *chip8)
+void op_Annn(chip8_t *chip8, const chip8_instr_t *instr)
 {
-  uint16_t nnn = chip8->opcode & 0x0FFFu;
-  chip8->index = nnn;
+  chip8->index = instr->nnn;
 }
 
 // JP V0, addr
-void op_Bnnn(chip8_t *chip8)
+void op_Bnnn(chip8_t *chip8, const chip8_instr_t *instr)
 {
-  uint16_t nnn = chip8->opcode & 0x0FFFu;
-  chip8->pc = nnn + chip8->registers[0];
+  chip8->pc = instr->nnn + chip8->registers[0];
 }
 
 // RND Vx, byte
-void op_Cxkk(chip8_t *chip8)
+void op_Cxkk(chip8_t *chip8, const chip8_instr_t *instr)
 {
-  uint8_t Vx = (chip8->opcode & 0x0F00u) >> 8u;
-  uint8_t kk = chip8->opcode & 0x00FFu;
-
-  chip8->registers[Vx] = rng_byte() & kk;
+  chip8->registers[instr->x] = rng_byte(chip8) & instr->kk;
 }
 
 // DRW Vx, Vy, nibble
-void op_Dxyn(chip8_t *chip8)
+void op_Dxyn(chip8_t *chip8, const chip8_instr_t *instr)
 {
-  uint8_t Vx = (chip8->opcode & 0x0F00u) >> 8u;
-  uint8_t Vy = (chip8->opcode & 0x00F0u) >> 4u;
   // n (last nibble)
-  uint8_t height = chip8->opcode & 0x000Fu;
+  uint8_t height = instr->n;
 
-  uint8_t xPos = chip8->registers[Vx] % DISPLAY_WIDTH;
-  uint8_t yPos = chip8->registers[Vy] % DISPLAY_HEIGHT;
+  uint8_t xPos = chip8->registers[instr->x] % DISPLAY_WIDTH;
+  uint8_t yPos = chip8->registers[instr->y] % DISPLAY_HEIGHT;
 
-  chip8->registers[0xF] = 0; // Reset collision flag
+  // Rows past the bottom edge are clipped
+  if (height > DISPLAY_HEIGHT - yPos)
+  {
+    height = DISPLAY_HEIGHT - yPos;
+  }
 
+  uint64_t collision = 0;
   for (unsigned int i = 0; i < height; ++i)
   {
-    uint8_t spriteByte = chip8->memory[chip8->index + i];
-    for (unsigned int j = 0; j < 8; ++j)
-    {
-      uint8_t spritePixel = spriteByte & (0x80 >> j);
-
-      // Check boundaries to prevent buffer overflow
-      if (xPos + j >= DISPLAY_WIDTH || yPos + i >= DISPLAY_HEIGHT)
-      {
-        continue;
-      }
-
-      uint32_t *screenPixel =
-          &chip8->display[(yPos + i) * DISPLAY_WIDTH + (xPos + j)];
-
-      // Sprite Pixel is on
-      if (spritePixel)
-      {
-        // Screen Pixel is on - collision
-        if (*screenPixel == 0xFFFFFFFF)
-        {
-          chip8->registers[0xF] = 1; // Set collision flag
-        }
-        // XOR the pixel onto the display
-        *screenPixel ^= 0xFFFFFFFF;
-      }
-    }
+    // Line the sprite byte up with column xPos; bits shifted out past the
+    // right edge are clipped
+    uint64_t sprite =
+        ((uint64_t)chip8->memory[(chip8->index + i) & 0x0FFFu] << 56) >> xPos;
+    uint64_t *row = &chip8->display[yPos + i];
+
+    collision |= *row & sprite;
+    *row ^= sprite;
+    chip8->dirty_rows |= (uint32_t)(sprite != 0) << (yPos + i);
   }
+
+  chip8->registers[0xF] = collision != 0;
 }
 
 // SKP Vx
-void op_Ex9E(chip8_t *chip8)
+void op_Ex9E(chip8_t *chip8, const chip8_instr_t *instr)
 {
-  uint8_t Vx = (chip8->opcode & 0x0F00u) >> 8u;
-  uint8_t instr = chip8->registers[Vx];
-  if (chip8->keypad[instr])
+  uint8_t key = chip8->registers[instr->x] & 0x0Fu;
+  if (chip8->keypad[key])
   {
     chip8->pc += 2;
   }
 }
 
 // SKNP Vx
-void op_ExA1(chip8_t *chip8)
+void op_ExA1(chip8_t *chip8, const chip8_instr_t *instr)
 {
-  uint8_t Vx = (chip8->opcode & 0x0F00u) >> 8u;
-  uint8_t instr = chip8->registers[Vx];
-  if (!chip8->keypad[instr])
+  uint8_t key = chip8->registers[instr->x] & 0x0Fu;
+  if (!chip8->keypad[key])
   {
     chip8->pc += 2;
   }
 }
 
 // LD Vx, DT
-void op_Fx07(chip8_t *chip8)
+void op_Fx07(chip8_t *chip8, const chip8_instr_t *instr)
 {
-  uint8_t Vx = (chip8->opcode & 0x0F00u) >> 8u;
-  chip8->registers[Vx] = chip8->delay_timer;
+  chip8->registers[instr->x] = chip8->delay_timer;
 }
 
 // LD Vx, K
-void op_Fx0A(chip8_t *chip8)
+void op_Fx0A(chip8_t *chip8, const chip8_instr_t *instr)
 {
-  uint8_t Vx = (chip8->opcode & 0x0F00u) >> 8u;
-
-  if (chip8->keypad[0])
-  {
-    chip8->registers[Vx] = 0;
-  }
-  else if (chip8->keypad[1])
-  {
-    chip8->registers[Vx] = 1;
-  }
-  else if (chip8->keypad[2])
-  {
-    chip8->registers[Vx] = 2;
-  }
-  else if (chip8->keypad[3])
-  {
-    chip8->registers[Vx] = 3;
-  }
-  else if (chip8->keypad[4])
-  {
-    chip8->registers[Vx] = 4;
-  }
-  else if (chip8->keypad[5])
-  {
-    chip8->registers[Vx] = 5;
-  }
-  else if (chip8->keypad[6])
-  {
-    chip8->registers[Vx] = 6;
-  }
-  else if (chip8->keypad[7])
-  {
-    chip8->registers[Vx] = 7;
-  }
-  else if (chip8->keypad[8])
-  {
-    chip8->registers[Vx] = 8;
-  }
-  else if (chip8->keypad[9])
-  {
-    chip8->registers[Vx] = 9;
-  }
-  else if (chip8->keypad[10])
-  {
-    chip8->registers[Vx] = 10;
-  }
-  else if (chip8->keypad[11])
-  {
-    chip8->registers[Vx] = 11;
-  }
-  else if (chip8->keypad[12])
+  for (uint8_t key = 0; key < KEYS_COUNT; ++key)
   {
-    chip8->registers[Vx] = 12;
-  }
-  else if (chip8->keypad[13])
-  {
-    chip8->registers[Vx] = 13;
-  }
-  else if (chip8->keypad[14])
-  {
-    chip8->registers[Vx] = 14;
-  }
-  else if (chip8->keypad[15])
-  {
-    chip8->registers[Vx] = 15;
-  }
-  else
-  {
-    // No key pressed, repeat this instruction
-    chip8->pc -= 2;
+    if (chip8->keypad[key])
+    {
+      chip8->registers[instr->x] = key;
+      return;
+    }
   }
+
+  // No key pressed, repeat this instruction
+  chip8->pc -= 2;
 }
 
 // LD DT, Vx
-void op_Fx15(chip8_t *chip8)
+void op_Fx15(chip8_t *chip8, const chip8_instr_t *instr)
 {
-  uint8_t Vx = (chip8->opcode & 0x0F00u) >> 8u;
-
-  chip8->delay_timer = chip8->registers[Vx];
+  chip8->delay_timer = chip8->registers[instr->x];
 }
 
 // LD ST, Vx
-void op_Fx18(chip8_t *chip8)
+void op_Fx18(chip8_t *chip8, const chip8_instr_t *instr)
 {
-  uint8_t Vx = (chip8->opcode & 0x0F00u) >> 8u;
-
-  chip8->sound_timer = chip8->registers[Vx];
+  chip8->sound_timer = chip8->registers[instr->x];
 }
 
 // ADD I, Vx
-void op_Fx1E(chip8_t *chip8)
+void op_Fx1E(chip8_t *chip8, const chip8_instr_t *instr)
 {
-  uint8_t Vx = (chip8->opcode & 0x0F00u) >> 8u;
-
-  chip8->index += chip8->registers[Vx];
+  chip8->index += chip8->registers[instr->x];
 }
 
 // LD F, Vx
-void op_Fx29(chip8_t *chip8)
+void op_Fx29(chip8_t *chip8, const chip8_instr_t *instr)
 {
-  uint8_t Vx = (chip8->opcode & 0x0F00u) >> 8u;
-
-  uint8_t digit = chip8->registers[Vx];
+  uint8_t digit = chip8->registers[instr->x];
   chip8->index = FONTSET_START_ADDRESS + (digit * 5);
 }
 
 // LD B, Vx
-void op_Fx33(chip8_t *chip8)
+void op_Fx33(chip8_t *chip8, const chip8_instr_t *instr)
 {
-  uint8_t Vx = (chip8->opcode & 0x0F00u) >> 8u;
-  uint8_t value = chip8->registers[Vx];
+  uint8_t value = chip8->registers[instr->x];
+  uint16_t index = chip8->index;
 
-  // Store hundreds digit at I
-  chip8->memory[chip8->index + 2] = value % 10;
+  // Store ones digit at I+2
+  write_memory(chip8, index + 2, value % 10);
   value /= 10;
 
   // Store tens digit at I+1
-  chip8->memory[chip8->index + 1] = value % 10;
+  write_memory(chip8, index + 1, value % 10);
   value /= 10;
 
-  // Store ones digit at I+2
-  chip8->memory[chip8->index] = value % 10;
+  // Store hundreds digit at I
+  write_memory(chip8, index, value % 10);
 }
 
 // LD [I], Vx
-void op_Fx55(chip8_t *chip8)
+void op_Fx55(chip8_t *chip8, const chip8_instr_t *instr)
 {
-  uint8_t Vx = (chip8->opcode & 0x0F00u) >> 8u;
+  // Copy operands first: the store may overwrite the slot we are executing
+  uint8_t Vx = instr->x;
+  uint16_t index = chip8->index;
 
   for (int i = 0; i <= Vx; ++i)
   {
-    chip8->memory[chip8->index + i] = chip8->registers[i];
+    write_memory(chip8, index + i, chip8->registers[i]);
   }
 }
 
 // LD  Vx, [I]
-void op_Fx65(chip8_t *chip8)
+void op_Fx65(chip8_t *chip8, const chip8_instr_t *instr)
 {
-  uint8_t Vx = (chip8->opcode & 0x0F00u) >> 8u;
+  uint8_t Vx = instr->x;
 
   for (int i = 0; i <= Vx; ++i)
   {
-    chip8->registers[i] = chip8->memory[chip8->index + i];
+    chip8->registers[i] = chip8->memory[(chip8->index + i) & 0x0FFFu];
   }
 }
 
-opcodehandler_t opcode_table[16];
-
-void op_0xxx(chip8_t *chip8);
-void op_8xy_(chip8_t *chip8); // Handles all 0x8xy* opcodes
-void op_Ex__(chip8_t *chip8); // Handles all 0xEx** opcodes
-void op_Fx__(chip8_t *chip8); // Handles all 0xFx** opcodes
-
-void init_opcode_table(void)
+// Reached for opcodes that do not map to any instruction
+static void op_invalid(chip8_t *chip8, const chip8_instr_t *instr)
 {
-  opcode_table[0x0] = op_0xxx; // 0x0--- (SYS, CLS, RET)
-  opcode_table[0x1] = op_1nnn; // 0x1nnn (JP addr)
-  opcode_table[0x2] = op_2nnn; // 0x2nnn (CALL addr)
-  opcode_table[0x3] = op3xkk;  // 0x3xkk (SE Vx, byte)
-  opcode_table[0x4] = op_4xkk; // 0x4xkk (SNE Vx, byte)
-  opcode_table[0x5] = op_5xy0; // 0x5xy0 (SE Vx, Vy)
-  opcode_table[0x6] = op_6xkk; // 0x6xkk (LD Vx, byte)
-  opcode_table[0x7] = op_7xkk; // 0x7xkk (ADD Vx, byte)
-  opcode_table[0x8] =
-      op_8xy_;                 // 0x8xy* (arithmetic/logical, handled by op_8xy_)
-  opcode_table[0x9] = op_9xy0; // 0x9xy0 (SNE Vx, Vy)
-  opcode_table[0xA] = op_Annn; // 0xAnnn (LD I, addr)
-  opcode_table[0xB] = op_Bnnn; // 0xBnnn (JP V0, addr)
-  opcode_table[0xC] = op_Cxkk; // 0xCxkk (RND Vx, byte)
-  opcode_table[0xD] = op_Dxyn; // 0xDxyn (DRW Vx, Vy, nibble)
-  opcode_table[0xE] = op_Ex__; // 0xEx** (keypad, handled by op_Ex__)
-  opcode_table[0xF] = op_Fx__; // 0xFx** (misc, handled by op_Fx__)
+  (void)chip8;
+  (void)instr;
 }
 
-void op_0xxx(chip8_t *chip8)
+void op_0xxx(chip8_t *chip8, const chip8_instr_t *instr);
+void op_8xy_(chip8_t *chip8, const chip8_instr_t *instr); // Handles all 0x8xy* opcodes
+void op_Ex__(chip8_t *chip8, const chip8_instr_t *instr); // Handles all 0xEx** opcodes
+void op_Fx__(chip8_t *chip8, const chip8_instr_t *instr); // Handles all 0xFx** opcodes
+
+// First-nibble dispatch used by the reference decode path in cycle().
+// Read-only, so any number of instances can share it across threads.
+static const opcodehandler_t opcode_table[16] = {
+    [0x0] = op_0xxx, // 0x0--- (SYS, CLS, RET)
+    [0x1] = op_1nnn, // 0x1nnn (JP addr)
+    [0x2] = op_2nnn, // 0x2nnn (CALL addr)
+    [0x3] = op3xkk,  // 0x3xkk (SE Vx, byte)
+    [0x4] = op_4xkk, // 0x4xkk (SNE Vx, byte)
+    [0x5] = op_5xy0, // 0x5xy0 (SE Vx, Vy)
+    [0x6] = op_6xkk, // 0x6xkk (LD Vx, byte)
+    [0x7] = op_7xkk, // 0x7xkk (ADD Vx, byte)
+    [0x8] = op_8xy_, // 0x8xy* (arithmetic/logical, handled by op_8xy_)
+    [0x9] = op_9xy0, // 0x9xy0 (SNE Vx, Vy)
+    [0xA] = op_Annn, // 0xAnnn (LD I, addr)
+    [0xB] = op_Bnnn, // 0xBnnn (JP V0, addr)
+    [0xC] = op_Cxkk, // 0xCxkk (RND Vx, byte)
+    [0xD] = op_Dxyn, // 0xDxyn (DRW Vx, Vy, nibble)
+    [0xE] = op_Ex__, // 0xEx** (keypad, handled by op_Ex__)
+    [0xF] = op_Fx__, // 0xFx** (misc, handled by op_Fx__)
+};
+
+// Every leaf operation paired with its handler. Expanded into the handler
+// table below and into the label table of the threaded core.
+#define CHIP8_OP_LIST(X)                                                       \
+  X(CHIP8_OP_INVALID, op_invalid)                                              \
+  X(CHIP8_OP_0NNN, op_0nnn)                                                    \
+  X(CHIP8_OP_00E0, op_00E0)                                                    \
+  X(CHIP8_OP_00EE, op_00EE)                                                    \
+  X(CHIP8_OP_1NNN, op_1nnn)                                                    \
+  X(CHIP8_OP_2NNN, op_2nnn)                                                    \
+  X(CHIP8_OP_3XKK, op3xkk)                                                     \
+  X(CHIP8_OP_4XKK, op_4xkk)                                                    \
+  X(CHIP8_OP_5XY0, op_5xy0)                                                    \
+  X(CHIP8_OP_6XKK, op_6xkk)                                                    \
+  X(CHIP8_OP_7XKK, op_7xkk)                                                    \
+  X(CHIP8_OP_8XY0, op_8xy0)                                                    \
+  X(CHIP8_OP_8XY1, op_8xy1)                                                    \
+  X(CHIP8_OP_8XY2, op_8xy2)                                                    \
+  X(CHIP8_OP_8XY3, op_8xy3)                                                    \
+  X(CHIP8_OP_8XY4, op_8xy4)                                                    \
+  X(CHIP8_OP_8XY5, op_8xy5)                                                    \
+  X(CHIP8_OP_8XY6, op_8xy6)                                                    \
+  X(CHIP8_OP_8XY7, op_8xy7)                                                    \
+  X(CHIP8_OP_8XYE, op_8xyE)                                                    \
+  X(CHIP8_OP_9XY0, op_9xy0)                                                    \
+  X(CHIP8_OP_ANNN, op_Annn)                                                    \
+  X(CHIP8_OP_BNNN, op_Bnnn)                                                    \
+  X(CHIP8_OP_CXKK, op_Cxkk)                                                    \
+  X(CHIP8_OP_DXYN, op_Dxyn)                                                    \
+  X(CHIP8_OP_EX9E, op_Ex9E)                                                    \
+  X(CHIP8_OP_EXA1, op_ExA1)                                                    \
+  X(CHIP8_OP_FX07, op_Fx07)                                                    \
+  X(CHIP8_OP_FX0A, op_Fx0A)                                                    \
+  X(CHIP8_OP_FX15, op_Fx15)                                                    \
+  X(CHIP8_OP_FX18, op_Fx18)                                                    \
+  X(CHIP8_OP_FX1E, op_Fx1E)                                                    \
+  X(CHIP8_OP_FX29, op_Fx29)                                                    \
+  X(CHIP8_OP_FX33, op_Fx33)                                                    \
+  X(CHIP8_OP_FX55, op_Fx55)                                                    \
+  X(CHIP8_OP_FX65, op_Fx65)
+
+#define CHIP8_OP_HANDLER(op, handler) [op] = handler,
+const opcodehandler_t op_handlers[CHIP8_OP_COUNT] = {
+    CHIP8_OP_LIST(CHIP8_OP_HANDLER)};
+#undef CHIP8_OP_HANDLER
+
+/**
+ * @brief Resolve the leaf operation for a 0x0*** opcode.
+ */
+static chip8_op_t resolve_0xxx(uint16_t opcode)
 {
-  switch (chip8->opcode)
+  switch (opcode)
   {
   case 0x00E0:
-    op_00E0(chip8);
-    break; // CLS
+    return CHIP8_OP_00E0; // CLS
   case 0x00EE:
-    op_00EE(chip8);
-    break; // RET
+    return CHIP8_OP_00EE; // RET
   default:
-    op_0nnn(chip8);
-    break; // SYS addr
+    return CHIP8_OP_0NNN; // SYS addr
   }
 }
 
-// Handles all 0x8xy* opcodes (arithmetic/logical)
-void op_8xy_(chip8_t *chip8)
+/**
+ * @brief Resolve the leaf operation for a 0x8xy* opcode.
+ */
+static chip8_op_t resolve_8xy_(uint8_t n)
 {
-  uint16_t opcode = chip8->opcode;
-  uint8_t n = opcode & 0x000F;
   switch (n)
   {
   case 0x0:
-    op_8xy0(chip8);
-    break;
+    return CHIP8_OP_8XY0;
   case 0x1:
-    op_8xy1(chip8);
-    break;
+    return CHIP8_OP_8XY1;
   case 0x2:
-    op_8xy2(chip8);
-    break;
+    return CHIP8_OP_8XY2;
   case 0x3:
-    op_8xy3(chip8);
-    break;
+    return CHIP8_OP_8XY3;
   case 0x4:
-    op_8xy4(chip8);
-    break;
+    return CHIP8_OP_8XY4;
   case 0x5:
-    op_8xy5(chip8);
-    break;
+    return CHIP8_OP_8XY5;
   case 0x6:
-    op_8xy6(chip8);
-    break;
+    return CHIP8_OP_8XY6;
   case 0x7:
-    op_8xy7(chip8);
-    break;
+    return CHIP8_OP_8XY7;
   case 0xE:
-    op_8xyE(chip8);
-    break;
+    return CHIP8_OP_8XYE;
   default: /* Unknown 0x8xy* opcode */
-    break;
+    return CHIP8_OP_INVALID;
   }
 }
 
-// Handles all 0xEx** opcodes (keypad)
-void op_Ex__(chip8_t *chip8)
+/**
+ * @brief Resolve the leaf operation for a 0xEx** opcode.
+ */
+static chip8_op_t resolve_Ex__(uint8_t kk)
 {
-  uint16_t opcode = chip8->opcode;
-  uint8_t kk = opcode & 0x00FF;
   switch (kk)
   {
   case 0x9E:
-    op_Ex9E(chip8);
-    break;
+    return CHIP8_OP_EX9E;
   case 0xA1:
-    op_ExA1(chip8);
-    break;
+    return CHIP8_OP_EXA1;
   default: /* Unknown 0xEx** opcode */
-    break;
+    return CHIP8_OP_INVALID;
   }
 }
 
-// Handles all 0xFx** opcodes (misc)
-void op_Fx__(chip8_t *chip8)
+/**
+ * @brief Resolve the leaf operation for a 0xFx** opcode.
+ */
+static chip8_op_t resolve_Fx__(uint8_t kk)
 {
-  uint16_t opcode = chip8->opcode;
-  uint8_t kk = opcode & 0x00FF;
   switch (kk)
   {
   case 0x07:
-    op_Fx07(chip8);
-    break;
+    return CHIP8_OP_FX07;
   case 0x0A:
-    op_Fx0A(chip8);
-    break;
+    return CHIP8_OP_FX0A;
   case 0x15:
-    op_Fx15(chip8);
-    break;
+    return CHIP8_OP_FX15;
   case 0x18:
-    op_Fx18(chip8);
-    break;
+    return CHIP8_OP_FX18;
   case 0x1E:
-    op_Fx1E(chip8);
-    break;
+    return CHIP8_OP_FX1E;
   case 0x29:
-    op_Fx29(chip8);
-    break;
+    return CHIP8_OP_FX29;
   case 0x33:
-    op_Fx33(chip8);
-    break;
+    return CHIP8_OP_FX33;
   case 0x55:
-    op_Fx55(chip8);
-    break;
+    return CHIP8_OP_FX55;
   case 0x65:
-    op_Fx65(chip8);
-    break;
+    return CHIP8_OP_FX65;
   default: /* Unknown 0xFx** opcode */
+    return CHIP8_OP_INVALID;
+  }
+}
+
+void op_0xxx(chip8_t *chip8, const chip8_instr_t *instr)
+{
+  op_handlers[resolve_0xxx(instr->opcode)](chip8, instr);
+}
+
+// Handles all 0x8xy* opcodes (arithmetic/logical)
+void op_8xy_(chip8_t *chip8, const chip8_instr_t *instr)
+{
+  op_handlers[resolve_8xy_(instr->n)](chip8, instr);
+}
+
+// Handles all 0xEx** opcodes (keypad)
+void op_Ex__(chip8_t *chip8, const chip8_instr_t *instr)
+{
+  op_handlers[resolve_Ex__(instr->kk)](chip8, instr);
+}
+
+// Handles all 0xFx** opcodes (misc)
+void op_Fx__(chip8_t *chip8, const chip8_instr_t *instr)
+{
+  op_handlers[resolve_Fx__(instr->kk)](chip8, instr);
+}
+
+void decode_instr(uint16_t opcode, chip8_instr_t *instr)
+{
+  instr->opcode = opcode;
+  instr->nnn = opcode & 0x0FFFu;
+  instr->x = (opcode & 0x0F00u) >> 8u;
+  instr->y = (opcode & 0x00F0u) >> 4u;
+  instr->kk = opcode & 0x00FFu;
+  instr->n = opcode & 0x000Fu;
+
+  // Resolve the second-level groups once here so execution never has to
+  switch (opcode >> 12u)
+  {
+  case 0x0:
+    instr->op = resolve_0xxx(opcode);
+    break;
+  case 0x1:
+    instr->op = CHIP8_OP_1NNN;
+    break;
+  case 0x2:
+    instr->op = CHIP8_OP_2NNN;
+    break;
+  case 0x3:
+    instr->op = CHIP8_OP_3XKK;
+    break;
+  case 0x4:
+    instr->op = CHIP8_OP_4XKK;
+    break;
+  case 0x5:
+    instr->op = CHIP8_OP_5XY0;
+    break;
+  case 0x6:
+    instr->op = CHIP8_OP_6XKK;
+    break;
+  case 0x7:
+    instr->op = CHIP8_OP_7XKK;
+    break;
+  case 0x8:
+    instr->op = resolve_8xy_(instr->n);
+    break;
+  case 0x9:
+    instr->op = CHIP8_OP_9XY0;
+    break;
+  case 0xA:
+    instr->op = CHIP8_OP_ANNN;
+    break;
+  case 0xB:
+    instr->op = CHIP8_OP_BNNN;
+    break;
+  case 0xC:
+    instr->op = CHIP8_OP_CXKK;
+    break;
+  case 0xD:
+    instr->op = CHIP8_OP_DXYN;
+    break;
+  case 0xE:
+    instr->op = resolve_Ex__(instr->kk);
+    break;
+  default:
+    instr->op = resolve_Fx__(instr->kk);
     break;
   }
 }
 
-void init_chip8(chip8_t *chip8)
+void init_chip8(chip8_t *chip8, uint32_t seed)
 {
   memset(chip8, 0, sizeof(chip8_t));
   // Initialize PC at 0x200
@@ -687,10 +761,145 @@ void init_chip8(chip8_t *chip8)
   // Load Font set into memory
   for (unsigned int i = 0; i < FONTSET_SIZE; ++i)
   {
-    chip8->memory[FONTSET_START_ADDRESS + i] = fontset[i];
+    chip8->memory[FONTSET_START_ADDRESS + i] = chip8_fontset[i];
+  }
+  chip8->stop_mask = CHIP8_STOP_ALL;
+  chip8->dirty_rows = 0xFFFFFFFFu; // Nothing has been presented yet
+  rng_seed(chip8, seed);
+  chip8_invalidate(chip8, 0, MEMORY_SIZE);
+}
+
+uint32_t chip8_take_dirty_rows(chip8_t *chip8)
+{
+  uint32_t rows = chip8->dirty_rows;
+  chip8->dirty_rows = 0;
+  return rows;
+}
+
+void chip8_render_rgba(const chip8_t *chip8, uint32_t *pixels)
+{
+  chip8_render_rows_rgba(chip8, pixels, 0xFFFFFFFFu);
+}
+
+void chip8_render_rows_rgba(const chip8_t *chip8, uint32_t *pixels,
+                            uint32_t rows)
+{
+  for (unsigned int y = 0; y < DISPLAY_HEIGHT; ++y)
+  {
+    if (!(rows & (1u << y)))
+    {
+      continue;
+    }
+
+    uint64_t row = chip8->display[y];
+    for (unsigned int x = 0; x < DISPLAY_WIDTH; ++x)
+    {
+      // Arithmetic on the top bit spreads it to 0x00000000 or 0xFFFFFFFF
+      pixels[y * DISPLAY_WIDTH + x] = 0u - (uint32_t)(row >> 63);
+      row <<= 1;
+    }
+  }
+}
+
+static inline uint64_t load64(const uint8_t *bytes)
+{
+  uint64_t word;
+  memcpy(&word, bytes, sizeof(word));
+  return word;
+}
+
+// The saved state starts at the first field, so one copy covers it
+_Static_assert(offsetof(chip8_t, registers) == 0,
+               "snapshot state must start chip8_t");
+_Static_assert(offsetof(chip8_t, memory) % 8 == 0,
+               "memory is compared a word at a time");
+
+void chip8_snapshot(const chip8_t *chip8, chip8_snapshot_t *snapshot)
+{
+  memcpy(snapshot->data, chip8, CHIP8_SNAPSHOT_SIZE);
+}
+
+void chip8_restore(chip8_t *chip8, const chip8_snapshot_t *snapshot)
+{
+  const uint8_t *saved = (const uint8_t *)snapshot->data;
+  const uint8_t *savedMemory = saved + offsetof(chip8_t, memory);
+  const uint8_t *savedDisplay = saved + offsetof(chip8_t, display);
+
+  // Find the memory words and display rows that will change before the
+  // copy overwrites them
+  uint16_t changed[MEMORY_SIZE / 8];
+  uint32_t changedCount = 0;
+  // Most of memory is unchanged. memcmp() rules out large spans quickly,
+  // then cache lines, then individual words.
+  for (uint32_t chunk = 0; chunk < MEMORY_SIZE; chunk += 512)
+  {
+    if (memcmp(&chip8->memory[chunk], &savedMemory[chunk], 512) == 0)
+    {
+      continue;
+    }
+    for (uint32_t line = chunk; line < chunk + 512; line += 64)
+    {
+      if (memcmp(&chip8->memory[line], &savedMemory[line], 64) == 0)
+      {
+        continue;
+      }
+      for (uint32_t i = line; i < line + 64; i += 8)
+      {
+        changed[changedCount] = (uint16_t)(i / 8);
+        changedCount += load64(&chip8->memory[i]) != load64(&savedMemory[i]);
+      }
+    }
+  }
+
+  for (unsigned int y = 0; y < DISPLAY_HEIGHT; ++y)
+  {
+    uint64_t row = load64(&savedDisplay[y * sizeof(uint64_t)]);
+    chip8->dirty_rows |= (uint32_t)(row != chip8->display[y]) << y;
+  }
+
+  memcpy(chip8, saved, CHIP8_SNAPSHOT_SIZE);
+
+  // Each 8-byte word covers four predecoded slots
+  for (uint32_t i = 0; i < changedCount; ++i)
+  {
+    uint16_t slot = (uint16_t)(changed[i] * 4);
+    decode_slot(chip8, slot);
+    decode_slot(chip8, slot + 1);
+    decode_slot(chip8, slot + 2);
+    decode_slot(chip8, slot + 3);
+  }
+  if (changedCount > 0)
+  {
+    mark_rewritten(chip8, (uint16_t)(changed[0] * 8),
+                   (uint16_t)(changed[changedCount - 1] * 8 + 8));
   }
-  rng_seed((uint32_t)time(NULL));
-  init_opcode_table();
+}
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t len)
+{
+  const uint8_t *bytes = (const uint8_t *)data;
+  for (size_t i = 0; i < len; ++i)
+  {
+    hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+  }
+  return hash;
+}
+
+uint64_t chip8_hash_state(const chip8_t *chip8)
+{
+  // Field by field so struct padding never reaches the hash
+  uint64_t hash = 0xCBF29CE484222325ull;
+  hash = fnv1a(hash, chip8->registers, sizeof(chip8->registers));
+  hash = fnv1a(hash, &chip8->index, sizeof(chip8->index));
+  hash = fnv1a(hash, &chip8->pc, sizeof(chip8->pc));
+  hash = fnv1a(hash, &chip8->sp, sizeof(chip8->sp));
+  hash = fnv1a(hash, chip8->stack, sizeof(chip8->stack));
+  hash = fnv1a(hash, &chip8->delay_timer, sizeof(chip8->delay_timer));
+  hash = fnv1a(hash, &chip8->sound_timer, sizeof(chip8->sound_timer));
+  hash = fnv1a(hash, &chip8->rng_state, sizeof(chip8->rng_state));
+  hash = fnv1a(hash, chip8->memory, sizeof(chip8->memory));
+  hash = fnv1a(hash, chip8->display, sizeof(chip8->display));
+  return hash;
 }
 
 int load_rom(chip8_t *chip8, const char *filename)
@@ -722,6 +931,11 @@ int load_rom(chip8_t *chip8, const char *filename)
 
   size_t bytes_read = fread(buffer, 1, (size_t)file_size, fptr);
   fclose(fptr);
+  if (bytes_read != (size_t)file_size)
+  {
+    free(buffer);
+    return -1; // Short read
+  }
 
   // Copy ROM data into Chip-8 memory starting at 0x200
   for (long i = 0; i < file_size; ++i)
@@ -730,21 +944,395 @@ int load_rom(chip8_t *chip8, const char *filename)
   }
   free(buffer);
 
+  // Build the predecoded program image for the freshly loaded code
+  chip8_invalidate(chip8, START_ADDRESS, (uint16_t)file_size);
+
   return 0;
 }
 
 void cycle(chip8_t *chip8)
 {
-  // Call set_opcode for grabbing instr and incr pc
+#if defined(CHIP8_INSTRUMENTED)
+  // A one-instruction run executes exactly what cycle() does
+  if (chip8->trace || chip8->profile)
+  {
+    chip8_run(chip8, 1, NULL);
+    return;
+  }
+#endif
+
+  uint16_t pc = chip8->pc;
+  ++chip8->cycles;
+
+  // Fast path: even, in-range pc executes straight from the predecoded slot
+  if ((pc & 0xF001u) == 0)
+  {
+    const chip8_instr_t *instr = &chip8->decoded[pc >> 1];
+    chip8->pc = pc + 2;
+    chip8->opcode = instr->opcode;
+    op_handlers[instr->op](chip8, instr);
+    return;
+  }
+
+  // Odd or out of range pc: fetch and decode on the fly
   set_opcode(chip8);
 
-  // Grab correct function pointer from table with first nibble
+  chip8_instr_t instr;
+  decode_instr(chip8->opcode, &instr);
+
+  // Grab correct function pointer from table with first nibble. Every nibble
+  // has a handler; unknown opcodes resolve to a no-op.
   opcodehandler_t handler = opcode_table[(chip8->opcode & 0xF000u) >> 12u];
+  handler(chip8, &instr);
+}
 
-  // Check if function pointer is nil AKA invalid isntruction
-  if (handler)
-    handler(chip8);
-  else
-    // TODO: Better error handling for invalid isntruction
-    printf("Error handling instruction");
+void chip8_set_breakpoint(chip8_t *chip8, uint16_t addr, bool enabled)
+{
+  addr &= 0x0FFFu;
+  uint64_t bit = 1ull << (addr & 63u);
+  bool set = (chip8->breakpoints[addr >> 6] & bit) != 0;
+
+  if (enabled && !set)
+  {
+    chip8->breakpoints[addr >> 6] |= bit;
+    ++chip8->breakpoint_count;
+  }
+  else if (!enabled && set)
+  {
+    chip8->breakpoints[addr >> 6] &= ~bit;
+    --chip8->breakpoint_count;
+  }
+}
+
+// Event each leaf operation can raise once it has executed
+static const uint8_t op_stops[CHIP8_OP_COUNT] = {
+    [CHIP8_OP_INVALID] = CHIP8_EXIT_INVALID,
+    [CHIP8_OP_00E0] = CHIP8_EXIT_DRAW,
+    [CHIP8_OP_DXYN] = CHIP8_EXIT_DRAW,
+    [CHIP8_OP_FX0A] = CHIP8_EXIT_KEY_WAIT,
+    [CHIP8_OP_FX15] = CHIP8_EXIT_TIMER,
+    [CHIP8_OP_FX18] = CHIP8_EXIT_TIMER,
+};
+
+static inline bool breakpoint_hit(const chip8_t *chip8, uint16_t pc)
+{
+  pc &= 0x0FFFu;
+  return (chip8->breakpoints[pc >> 6] >> (pc & 63u)) & 1u;
+}
+
+/**
+ * @brief Find the instruction at pc.
+ *
+ * Even, in-range addresses use the predecoded slot; anything else is decoded
+ * into the caller's scratch instruction.
+ */
+static inline const chip8_instr_t *fetch_instr(chip8_t *chip8, uint16_t pc,
+                                               chip8_instr_t *scratch)
+{
+  if ((pc & 0xF001u) == 0)
+    return &chip8->decoded[pc >> 1];
+
+  uint16_t opcode = (uint16_t)(chip8->memory[pc & 0x0FFFu] << 8 |
+                               chip8->memory[(pc + 1) & 0x0FFFu]);
+  decode_instr(opcode, scratch);
+  return scratch;
 }
+
+/**
+ * @brief Check whether the instruction just executed ends the run.
+ *
+ * op is a constant in the threaded core, so the lookup folds away for every
+ * operation that cannot raise an event.
+ */
+static inline chip8_exit_reason_t check_stop(const chip8_t *chip8, uint8_t op,
+                                             uint16_t pc, uint32_t stop_mask)
+{
+  chip8_exit_reason_t stop = (chip8_exit_reason_t)op_stops[op];
+  if (stop == CHIP8_EXIT_BUDGET || !(stop_mask & (1u << stop)))
+    return CHIP8_EXIT_BUDGET;
+  // Fx0A only blocks when it rewound pc to itself
+  if (stop == CHIP8_EXIT_KEY_WAIT && chip8->pc != pc)
+    return CHIP8_EXIT_BUDGET;
+  return stop;
+}
+
+uint32_t chip8_skip_idle(chip8_t *chip8, uint16_t back_pc, uint32_t budget)
+{
+  uint16_t target = chip8->pc;
+  if (budget == 0 || chip8->breakpoint_count != 0 || target > back_pc ||
+      ((target | back_pc) & 0xF001u) || back_pc - target >= CHIP8_IDLE_LOOP_MAX * 2)
+  {
+    return 0;
+  }
+
+  // Replay one pass over the loop body on a copy of the registers. Every
+  // instruction must be free of side effects and every skip must fall through.
+  uint8_t v[V_REG_COUNT];
+  memcpy(v, chip8->registers, sizeof(v));
+  for (uint16_t addr = target; addr != back_pc; addr += 2)
+  {
+    const chip8_instr_t *instr = &chip8->decoded[addr >> 1];
+    bool taken;
+    switch (instr->op)
+    {
+    case CHIP8_OP_FX07:
+      v[instr->x] = chip8->delay_timer;
+      continue;
+    case CHIP8_OP_3XKK:
+      taken = v[instr->x] == instr->kk;
+      break;
+    case CHIP8_OP_4XKK:
+      taken = v[instr->x] != instr->kk;
+      break;
+    case CHIP8_OP_5XY0:
+      taken = v[instr->x] == v[instr->y];
+      break;
+    case CHIP8_OP_9XY0:
+      taken = v[instr->x] != v[instr->y];
+      break;
+    case CHIP8_OP_EX9E:
+      taken = chip8->keypad[v[instr->x] & 0x0F] != 0;
+      break;
+    case CHIP8_OP_EXA1:
+      taken = chip8->keypad[v[instr->x] & 0x0F] == 0;
+      break;
+    default:
+      return 0;
+    }
+    if (taken)
+    {
+      return 0;
+    }
+  }
+
+  // The loop must close on a jump back to its start, or be an Fx0A that is
+  // still blocked
+  const chip8_instr_t *back = &chip8->decoded[back_pc >> 1];
+  if (back->op == CHIP8_OP_FX0A)
+  {
+    for (uint8_t key = 0; key < KEYS_COUNT; ++key)
+    {
+      if (chip8->keypad[key])
+        return 0;
+    }
+  }
+  else if (back->op != CHIP8_OP_1NNN || back->nnn != target)
+  {
+    return 0;
+  }
+
+  // Only Fx07 writes registers; the next pass repeats this one exactly if
+  // those writes are already in place
+  if (memcmp(v, chip8->registers, sizeof(v)) != 0)
+  {
+    return 0;
+  }
+
+  // Land where budget more passes through the straight-line body would
+  uint32_t length = (uint32_t)(back_pc - target) / 2 + 1;
+  chip8->pc = (uint16_t)(target + (budget % length) * 2);
+  chip8->opcode =
+      chip8->decoded[(target + ((budget - 1) % length) * 2) >> 1].opcode;
+  chip8->idle_cycles += budget;
+  return budget;
+}
+
+// Cheap filter run after every 1nnn and Fx0A before chip8_skip_idle()
+static inline bool idle_candidate(const chip8_t *chip8, uint8_t op, uint16_t pc)
+{
+  if (op != CHIP8_OP_1NNN && op != CHIP8_OP_FX0A)
+    return false;
+  return chip8->pc <= pc && pc - chip8->pc < CHIP8_IDLE_LOOP_MAX * 2;
+}
+
+static chip8_exit_reason_t finish_run(chip8_t *chip8, chip8_exit_t *result,
+                                      chip8_exit_reason_t reason,
+                                      uint32_t executed, uint32_t idle,
+                                      uint16_t pc, uint16_t opcode)
+{
+  chip8->cycles += executed;
+  if (result)
+  {
+    result->reason = reason;
+    result->cycles = executed;
+    result->idle_cycles = idle;
+    result->pc = pc;
+    result->opcode = opcode;
+  }
+  return reason;
+}
+
+// The table loop is expanded once per value of instrumented; a single shared
+// copy would test it on every instruction
+#if defined(__GNUC__)
+#define RUN_TABLE_INLINE inline __attribute__((always_inline))
+#else
+#define RUN_TABLE_INLINE inline
+#endif
+
+/**
+ * @brief The table core's run loop.
+ *
+ * instrumented is a constant at every call, so the plain copy carries no
+ * trace or profile hooks. Traced and profiled runs from the threaded core
+ * come here too.
+ */
+static RUN_TABLE_INLINE chip8_exit_reason_t run_table(chip8_t *chip8,
+                                                      uint32_t max_cycles,
+                                                      chip8_exit_t *result,
+                                                      bool instrumented)
+{
+  const bool breakpoints = chip8->breakpoint_count != 0;
+  const uint32_t stop_mask = chip8->stop_mask;
+  chip8_exit_reason_t reason = CHIP8_EXIT_BUDGET;
+  uint32_t executed = 0;
+  uint32_t idle = 0;
+  chip8_instr_t scratch;
+  uint16_t pc = chip8->pc;
+  struct chip8_trace *trace = instrumented ? chip8->trace : NULL;
+  struct chip8_profile *profile = instrumented ? chip8->profile : NULL;
+  uint16_t index = 0;
+
+  if (trace)
+    chip8_trace_begin(trace, chip8);
+  if (profile)
+    chip8_profile_begin(profile);
+
+  while (executed < max_cycles)
+  {
+    const chip8_instr_t *instr = fetch_instr(chip8, pc, &scratch);
+    if (breakpoints && executed != 0 && breakpoint_hit(chip8, pc))
+      return finish_run(chip8, result, CHIP8_EXIT_BREAKPOINT, executed, 0, pc,
+                        instr->opcode);
+
+    uint8_t op = instr->op;
+    if (trace)
+      index = chip8->index;
+    if (profile && op == CHIP8_OP_DXYN)
+      chip8_profile_draw(profile, chip8, instr);
+    chip8->pc = pc + 2;
+    chip8->opcode = instr->opcode;
+    op_handlers[op](chip8, instr);
+    ++executed;
+    if (trace)
+      chip8_trace_step(trace, chip8, pc, chip8->opcode, op, index);
+    if (profile)
+      chip8_profile_step(profile, chip8, pc, op);
+
+    reason = check_stop(chip8, op, pc, stop_mask);
+    if (reason != CHIP8_EXIT_BUDGET)
+      return finish_run(chip8, result, reason, executed, 0, pc, chip8->opcode);
+    uint16_t target = chip8->pc;
+    if (idle_candidate(chip8, op, pc) &&
+        (idle = chip8_skip_idle(chip8, pc, max_cycles - executed)) != 0)
+    {
+      if (trace)
+        chip8_trace_idle(trace, chip8, idle);
+      if (profile)
+        chip8_profile_idle(profile, chip8, target, pc, idle);
+      executed = max_cycles;
+    }
+    pc = chip8->pc;
+  }
+
+  return finish_run(chip8, result, reason, executed, idle, pc,
+                    fetch_instr(chip8, pc, &scratch)->opcode);
+}
+
+#if defined(CHIP8_CORE_THREADED)
+
+// Labels-as-values are a GNU extension; silence -Wpedantic for the core only
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+
+chip8_exit_reason_t chip8_run(chip8_t *chip8, uint32_t max_cycles,
+                              chip8_exit_t *result)
+{
+#define CHIP8_OP_LABEL(op, handler) [op] = &&do_##handler,
+  static const void *const labels[CHIP8_OP_COUNT] = {
+      CHIP8_OP_LIST(CHIP8_OP_LABEL)};
+#undef CHIP8_OP_LABEL
+
+#if defined(CHIP8_INSTRUMENTED)
+  if (chip8->trace || chip8->profile)
+    return run_table(chip8, max_cycles, result, true);
+#endif
+
+  const bool breakpoints = chip8->breakpoint_count != 0;
+  const uint32_t stop_mask = chip8->stop_mask;
+  chip8_exit_reason_t reason;
+  uint32_t remaining = max_cycles;
+  uint32_t idle = 0;
+  const chip8_instr_t *instr;
+  chip8_instr_t scratch;
+  uint16_t pc;
+
+  // Every handler ends in its own copy of the dispatch so the branch
+  // predictor can learn opcode-to-opcode transitions. Odd pcs and active
+  // breakpoints take the shared slow path.
+#define DISPATCH()                                                             \
+  do                                                                           \
+  {                                                                            \
+    pc = chip8->pc;                                                            \
+    if (remaining == 0)                                                        \
+      goto budget;                                                             \
+    if ((pc & 0xF001u) || breakpoints)                                         \
+      goto slow_path;                                                          \
+    instr = &chip8->decoded[pc >> 1];                                          \
+    chip8->pc = pc + 2;                                                        \
+    chip8->opcode = instr->opcode;                                             \
+    goto *labels[instr->op];                                                   \
+  } while (0)
+
+  DISPATCH();
+
+#define CHIP8_OP_BODY(op, handler)                                             \
+  do_##handler : handler(chip8, instr);                                        \
+  --remaining;                                                                 \
+  if ((reason = check_stop(chip8, op, pc, stop_mask)) != CHIP8_EXIT_BUDGET)    \
+    goto stopped;                                                              \
+  if (idle_candidate(chip8, op, pc) &&                                         \
+      (idle = chip8_skip_idle(chip8, pc, remaining)) != 0)                     \
+    goto skipped;                                                              \
+  DISPATCH();
+  CHIP8_OP_LIST(CHIP8_OP_BODY)
+#undef CHIP8_OP_BODY
+
+slow_path:
+  instr = fetch_instr(chip8, pc, &scratch);
+  if (breakpoints && remaining != max_cycles && breakpoint_hit(chip8, pc))
+  {
+    reason = CHIP8_EXIT_BREAKPOINT;
+    goto stopped;
+  }
+  chip8->pc = pc + 2;
+  chip8->opcode = instr->opcode;
+  goto *labels[instr->op];
+
+#undef DISPATCH
+
+stopped:
+  return finish_run(chip8, result, reason, max_cycles - remaining, 0, pc,
+                    instr->opcode);
+skipped:
+  pc = chip8->pc;
+budget:
+  return finish_run(chip8, result, CHIP8_EXIT_BUDGET, max_cycles, idle, pc,
+                    fetch_instr(chip8, pc, &scratch)->opcode);
+}
+
+#pragma GCC diagnostic pop
+
+#else
+
+chip8_exit_reason_t chip8_run(chip8_t *chip8, uint32_t max_cycles,
+                              chip8_exit_t *result)
+{
+#if defined(CHIP8_INSTRUMENTED)
+  if (chip8->trace || chip8->profile)
+    return run_table(chip8, max_cycles, result, true);
+#endif
+  return run_table(chip8, max_cycles, result, false);
+}
+
+#endif
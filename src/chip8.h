@@ -2,6 +2,7 @@
 #define CHIP8_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #define MEMORY_SIZE 4096
@@ -13,6 +14,7 @@
 #define START_ADDRESS 0x200
 #define FONTSET_START_ADDRESS 0x50
 #define FONTSET_SIZE 80
+#define CHIP8_IDLE_LOOP_MAX 4 // Longest idle loop skipped, in instructions
 
 // --- MEMORY MAP ---
 // +---------------+= 0xFFF (4095) End of Chip-8 RAM
@@ -38,8 +40,113 @@
 // |  interpreter  |
 // +---------------+= 0x000 (0) Start of Chip-8 RAM
 
+typedef struct chip8 chip8_t;
+typedef struct chip8_instr chip8_instr_t;
+
+/**
+ * @brief Leaf operation a decoded instruction resolves to.
+ *
+ * Indexes the handler table of the table-dispatch core and the label table
+ * of the threaded core.
+ */
+typedef enum
+{
+  CHIP8_OP_INVALID = 0,
+  CHIP8_OP_0NNN,
+  CHIP8_OP_00E0,
+  CHIP8_OP_00EE,
+  CHIP8_OP_1NNN,
+  CHIP8_OP_2NNN,
+  CHIP8_OP_3XKK,
+  CHIP8_OP_4XKK,
+  CHIP8_OP_5XY0,
+  CHIP8_OP_6XKK,
+  CHIP8_OP_7XKK,
+  CHIP8_OP_8XY0,
+  CHIP8_OP_8XY1,
+  CHIP8_OP_8XY2,
+  CHIP8_OP_8XY3,
+  CHIP8_OP_8XY4,
+  CHIP8_OP_8XY5,
+  CHIP8_OP_8XY6,
+  CHIP8_OP_8XY7,
+  CHIP8_OP_8XYE,
+  CHIP8_OP_9XY0,
+  CHIP8_OP_ANNN,
+  CHIP8_OP_BNNN,
+  CHIP8_OP_CXKK,
+  CHIP8_OP_DXYN,
+  CHIP8_OP_EX9E,
+  CHIP8_OP_EXA1,
+  CHIP8_OP_FX07,
+  CHIP8_OP_FX0A,
+  CHIP8_OP_FX15,
+  CHIP8_OP_FX18,
+  CHIP8_OP_FX1E,
+  CHIP8_OP_FX29,
+  CHIP8_OP_FX33,
+  CHIP8_OP_FX55,
+  CHIP8_OP_FX65,
+  CHIP8_OP_COUNT
+} chip8_op_t;
+
+/**
+ * @brief A predecoded CHIP-8 instruction.
+ *
+ * Holds the resolved operation together with every operand field so handlers
+ * never have to re-extract nibbles from the raw opcode.
+ */
+struct chip8_instr
+{
+  uint16_t opcode; // Raw opcode the slot was decoded from
+  uint16_t nnn;    // Lowest 12 bits
+  uint8_t op;      // Leaf operation (chip8_op_t), no second-level dispatch
+  uint8_t x;       // Lower 4 bits of the high byte
+  uint8_t y;       // Upper 4 bits of the low byte
+  uint8_t kk;      // Lowest 8 bits
+  uint8_t n;       // Lowest 4 bits
+};
+
+/**
+ * @brief Why chip8_run() returned control to the embedder.
+ */
+typedef enum
+{
+  CHIP8_EXIT_BUDGET = 0, // max_cycles instructions were executed
+  CHIP8_EXIT_DRAW,       // 00E0 or Dxyn changed the display
+  CHIP8_EXIT_KEY_WAIT,   // Fx0A is blocked waiting for a key press
+  CHIP8_EXIT_TIMER,      // Fx15 or Fx18 wrote the delay or sound timer
+  CHIP8_EXIT_BREAKPOINT, // pc reached a breakpoint (not yet executed)
+  CHIP8_EXIT_INVALID,    // Unknown opcode (executed as a no-op)
+} chip8_exit_reason_t;
+
+// Bits for chip8_t.stop_mask selecting which events end a chip8_run() call.
+// Budget exhaustion and breakpoints always stop the run.
+#define CHIP8_STOP_DRAW (1u << CHIP8_EXIT_DRAW)
+#define CHIP8_STOP_KEY_WAIT (1u << CHIP8_EXIT_KEY_WAIT)
+#define CHIP8_STOP_TIMER (1u << CHIP8_EXIT_TIMER)
+#define CHIP8_STOP_INVALID (1u << CHIP8_EXIT_INVALID)
+#define CHIP8_STOP_ALL                                                         \
+  (CHIP8_STOP_DRAW | CHIP8_STOP_KEY_WAIT | CHIP8_STOP_TIMER | CHIP8_STOP_INVALID)
+
+/**
+ * @brief Result of a chip8_run() call.
+ */
 typedef struct
 {
+  chip8_exit_reason_t reason; // Why the run stopped
+  uint32_t cycles;            // Instructions executed by this call
+  uint32_t idle_cycles;       // Of those, cycles fast-forwarded in idle loops
+  uint16_t pc;                // Address of the instruction that caused the
+                              // stop, or the next pc on budget exhaustion
+  uint16_t opcode;            // Opcode at that address
+} chip8_exit_t;
+
+struct chip8
+{
+  // Everything from registers through idle_cycles is the machine state saved
+  // by chip8_snapshot(). Keep new state fields inside that range.
+
   // General Purpose 8bit registers
   // Referred to as Vx where x is a hexadecimal digit (0-F)
   uint8_t registers[V_REG_COUNT]; // 16 General Purpose 8-bit registers
@@ -66,24 +173,67 @@ typedef struct
   uint16_t stack[STACK_SIZE];
 
   // Display and Input
-  uint32_t display[DISPLAY_WIDTH * DISPLAY_HEIGHT];
+  // One word per row, bit 63 is column 0. Use chip8_render_rgba() to get
+  // pixels.
+  uint64_t display[DISPLAY_HEIGHT];
   uint8_t keypad[KEYS_COUNT]; // 16 keys - utilize user input from keyboard
-} chip8_t;
+
+  // Random number generator
+  uint32_t rng_state; // Xorshift32 state used by Cxkk
+
+  // Instruction counters
+  uint64_t cycles;      // Instructions executed since init_chip8()
+  uint64_t idle_cycles; // Of those, cycles fast-forwarded in idle loops
+
+  // End of the saved state
+
+  uint32_t dirty_rows; // Bit y set when row y changed since last taken
+
+  // Memory rewritten from outside the instruction stream (ROM loads,
+  // restores) since a JIT last checked it for translated code
+  uint16_t rewritten_begin;
+  uint16_t rewritten_end;
+
+  // Run control
+  uint32_t stop_mask; // CHIP8_STOP_* events that end chip8_run()
+  uint16_t breakpoint_count;
+  uint64_t breakpoints[MEMORY_SIZE / 64]; // One bit per address
+  struct chip8_trace *trace;     // Execution trace (chip8_trace.h), or NULL
+  struct chip8_profile *profile; // Profile being filled (chip8_profile.h)
+
+  // Predecoded program image
+  // One slot per even address. Slots are rebuilt whenever the bytes they
+  // cover are written, so self-modifying programs stay correct.
+  chip8_instr_t decoded[MEMORY_SIZE / 2];
+};
+
+// Bytes of chip8_t saved by chip8_snapshot(): registers through idle_cycles
+#define CHIP8_SNAPSHOT_SIZE                                                    \
+  (offsetof(chip8_t, idle_cycles) + sizeof(uint64_t))
 
 /**
- * @brief Function pointer type for CHIP-8 opcode handlers.
+ * @brief Saved machine state, see chip8_snapshot().
  *
- * Each handler receives a pointer to the chip8_t state.
+ * Registers, I, pc, sp, stack, timers, memory, display, keypad, RNG state
+ * and the instruction counters. Plain data: it can be copied, compared or
+ * kept in arrays freely.
  */
-typedef void (*opcodehandler_t)(chip8_t *chip8);
-extern opcodehandler_t opcode_table[16];
+typedef struct
+{
+  uint64_t data[(CHIP8_SNAPSHOT_SIZE + 7) / 8];
+} chip8_snapshot_t;
 
 /**
  * @brief Initialize the CHIP-8 system state.
  *
+ * All emulator state lives in the instance, so separate instances can run on
+ * separate threads. Instances initialized with the same seed produce the
+ * same Cxkk random stream.
+ *
  * @param chip8 Pointer to the CHIP-8 state structure.
+ * @param seed Seed for the instance's random number generator.
  */
-void init_chip8(chip8_t *chip8);
+void init_chip8(chip8_t *chip8, uint32_t seed);
 
 /**
  * @brief Load a ROM file into the CHIP-8 memory.
@@ -95,305 +245,152 @@ void init_chip8(chip8_t *chip8);
 int load_rom(chip8_t *chip8, const char *filename);
 
 /**
- * @brief Set the current opcode for the CHIP-8 system.
+ * @brief Expand the packed display into 32-bit pixels.
+ *
+ * Lit pixels become 0xFFFFFFFF and unlit pixels 0x00000000, matching the
+ * streaming texture used by the SDL frontend.
  *
  * @param chip8 Pointer to the CHIP-8 state structure.
+ * @param pixels Destination for DISPLAY_WIDTH * DISPLAY_HEIGHT pixels.
  */
-void set_opcode(chip8_t *chip8);
+void chip8_render_rgba(const chip8_t *chip8, uint32_t *pixels);
 
 /**
- * @brief Process the current instruction for the CHIP-8 system.
+ * @brief Expand only some rows of the packed display into 32-bit pixels.
+ *
+ * Rows not selected are left untouched in pixels.
  *
  * @param chip8 Pointer to the CHIP-8 state structure.
+ * @param pixels Destination for DISPLAY_WIDTH * DISPLAY_HEIGHT pixels.
+ * @param rows Bit y selects row y.
  */
-void cycle(chip8_t *chip8);
+void chip8_render_rows_rgba(const chip8_t *chip8, uint32_t *pixels,
+                            uint32_t rows);
 
 /**
- * @brief Update the CHIP-8 timers (delay and sound).
- * Should be called at 60Hz.
+ * @brief Return and clear the rows changed since the last call.
+ *
+ * A non-zero result means the frame changed. 00E0 and Dxyn only mark rows
+ * whose contents actually changed, and a fresh instance starts fully dirty.
  *
  * @param chip8 Pointer to the CHIP-8 state structure.
+ * @return uint32_t Bit y set when row y changed.
  */
-void update_timers(chip8_t *chip8);
+uint32_t chip8_take_dirty_rows(chip8_t *chip8);
 
 /**
- * @brief Process the current instruction for the CHIP-8 system.
+ * @brief Hash the architectural state of an instance.
+ *
+ * Covers registers, I, pc, sp, stack, timers, RNG state, memory and display
+ * with 64-bit FNV-1a. Caches, counters and run control are left out, so two instances
+ * that would behave identically from here on hash equal.
  *
  * @param chip8 Pointer to the CHIP-8 state structure.
+ * @return uint64_t State hash.
  */
-void process_instruction(chip8_t *chip8);
+uint64_t chip8_hash_state(const chip8_t *chip8);
 
 /**
- * @brief Execute one emulation cycle for the CHIP-8 system.
+ * @brief Save the machine state of an instance.
+ *
+ * A single copy of the state at the front of chip8_t; no allocation.
+ * Run control (stop mask, breakpoints) is not part of the state.
  *
  * @param chip8 Pointer to the CHIP-8 state structure.
+ * @param snapshot Destination for the state.
  */
-void cycle(chip8_t *chip8);
+void chip8_snapshot(const chip8_t *chip8, chip8_snapshot_t *snapshot);
 
 /**
- * @brief Update the CHIP-8 delay and sound timers.
+ * @brief Return an instance to a saved state.
+ *
+ * Only memory words that differ are re-decoded, and only display rows that
+ * differ are marked dirty, so restoring a nearby state is cheap. A JIT on
+ * the instance notices rewritten code on its next run.
  *
  * @param chip8 Pointer to the CHIP-8 state structure.
+ * @param snapshot State saved by chip8_snapshot().
  */
-void update_timers(chip8_t *chip8);
-
-// Instruction (opcode) handling methods
-
-/**
- * 0nnn - SYS addr
- * Jump to a machine code routine at nnn.
- * pc = nnn
- */
-void op_0nnn(chip8_t *chip8);
-
-/**
- * 00E0 - CLS
- * Clear the display.
- */
-void op_00E0(chip8_t *chip8);
-
-/**
- * 00EE - RET
- * Return from subroutine.
- * pc = top of stack, sp -= 1
- */
-void op_00EE(chip8_t *chip8);
-
-/**
- * 1nnn - JP addr
- * Jump to location nnn.
- * pc = nnn
- */
-void op_1nnn(chip8_t *chip8);
-
-/**
- * 2nnn - CALL addr
- * Call subroutine at nnn.
- * sp += 1 and pc -> top stack, pc = nnn
- */
-void op_2nnn(chip8_t *chip8);
-
-/**
- * 3xkk - SE Vx, byte
- * Skip next instruction if Vx == kk.
- * if reg Vx == kk, pc += 2
- */
-void op3xkk(chip8_t *chip8);
-
-/**
- * 4xkk - SNE Vx, byte
- * Skip next instruction if Vx != kk.
- * if reg Vx != kk, pc += 2
- */
-void op_4xkk(chip8_t *chip8);
-
-/**
- * 5xy0 - SE Vx, Vy
- * Skip next instruction if Vx == Vy.
- * if reg Vx == reg Vy, pc += 2
- */
-void op_5xy0(chip8_t *chip8);
-
-/**
- * 6xkk - LD Vx, byte
- * Set Vx = kk.
- */
-void op_6xkk(chip8_t *chip8);
-
-/**
- * 7xkk - ADD Vx, byte
- * Set Vx = Vx + kk.
- */
-void op_7xkk(chip8_t *chip8);
-
-/**
- * 8xy0 - LD Vx, Vy
- * Set Vx = Vy.
- */
-void op_8xy0(chip8_t *chip8);
-
-/**
- * 8xy1 - OR Vx, Vy
- * Set Vx = Vx OR Vy (bitwise OR).
- * If either bit is 1, then same bit in result is 1, else 0.
- */
-void op_8xy1(chip8_t *chip8);
-
-/**
- * 8xy2 - AND Vx, Vy
- * Set Vx = Vx AND Vy (bitwise AND).
- */
-void op_8xy2(chip8_t *chip8);
-
-/**
- * 8xy3 - XOR Vx, Vy
- * Set Vx = Vx XOR Vy (bitwise exclusive OR).
- */
-void op_8xy3(chip8_t *chip8);
-
-/**
- * 8xy4 - ADD Vx, Vy
- * Set Vx = Vx + Vy, set VF = carry.
- * If result > 255, VF = 1, otherwise 0. Only last 8 bits are kept.
- */
-void op_8xy4(chip8_t *chip8);
-/**
- * 8xy5 - SUB Vx, Vy
- * Set Vx = Vx - Vy, set VF = NOT borrow.
- * If Vx > Vy, then VF is set to 1, otherwise 0. Then Vy is subtracted from Vx,
- * and the results stored in Vx.
- */
-void op_8xy5(chip8_t *chip8);
-
-/**
- * 8xy6 - SHR Vx {, Vy}
- * Set Vx = Vx SHR 1.
- * If the least-significant bit of Vx is 1, then VF is set to 1, otherwise 0.
- * Then Vx is divided by 2.
- */
-void op_8xy6(chip8_t *chip8);
-
-/**
- * 8xy7 - SUBN Vx, Vy
- * Set Vx = Vy - Vx, set VF = NOT borrow.
- * If Vy > Vx, then VF is set to 1, otherwise 0. Then Vx is subtracted from Vy,
- * and the results stored in Vx.
- */
-void op_8xy7(chip8_t *chip8);
-
-/**
- * 8xyE - SHL Vx {, Vy}
- * Set Vx = Vx SHL 1.
- * If the most-significant bit of Vx is 1, then VF is set to 1, otherwise to 0.
- * Then Vx is multiplied by 2.
- */
-void op_8xyE(chip8_t *chip8);
-
-/**
- * 9xy0 - SNE Vx, Vy
- * Skip next instruction if Vx != Vy.
- * The values of Vx and Vy are compared, and if they are not equal, the program
- * counter is increased by 2.
- */
-void op_9xy0(chip8_t *chip8);
-
-/**
- * Annn - LD I, addr
- * Set I = nnn.
- * The value of register I is set to nnn.
- */
-void op_Annn(chip8_t *chip8);
-
-/**
- * Bnnn - JP V0, addr
- * Jump to location nnn + V0.
- * The program counter is set to nnn plus the value of V0.
- */
-void op_Bnnn(chip8_t *chip8);
-
-/**
- * Cxkk - RND Vx, byte
- * Set Vx = random byte AND kk.
- * The interpreter generates a random number from 0 to 255, which is then ANDed
- * with the value kk. The results are stored in Vx.
- */
-void op_Cxkk(chip8_t *chip8);
+void chip8_restore(chip8_t *chip8, const chip8_snapshot_t *snapshot);
 
 /**
- * Dxyn - DRW Vx, Vy, nibble
- * Display n-byte sprite starting at memory location I at (Vx, Vy), set VF =
- * collision. The interpreter reads n bytes from memory, starting at the address
- * stored in I. These bytes are then displayed as sprites on screen at
- * coordinates (Vx, Vy). Sprites are XORed onto the existing screen. If this
- * causes any pixels to be erased, VF is set to 1, otherwise it is set to 0. If
- * the sprite is positioned so part of it is outside the coordinates of the
- * display, it wraps around to the opposite side of the screen.
- */
-void op_Dxyn(chip8_t *chip8);
-
-/**
- * Ex9E - SKP Vx
- * Skip next instruction if key with the value of Vx is pressed.
- * Checks the keyboard, and if the key corresponding to the value of Vx is
- * currently in the down position, PC is increased by 2.
- */
-void op_Ex9E(chip8_t *chip8);
-
-/**
- * ExA1 - SKNP Vx
- * Skip next instruction if key with the value of Vx is not pressed.
- * Checks the keyboard, and if the key corresponding to the value of Vx is
- * currently in the up position, PC is increased by 2.
- */
-void op_ExA1(chip8_t *chip8);
-
-/**
- * Fx07 - LD Vx, DT
- * Set Vx = delay timer value.
- * The value of DT is placed into Vx.
- */
-void op_Fx07(chip8_t *chip8);
-
-/**
- * Fx0A - LD Vx, K
- * Wait for a key press, store the value of the key in Vx.
- * All execution stops until a key is pressed, then the value of that key is
- * stored in Vx.
- */
-void op_Fx0A(chip8_t *chip8);
-
-/**
- * Fx15 - LD DT, Vx
- * Set delay timer = Vx.
- * DT is set equal to the value of Vx.
+ * @brief Decode a raw opcode into its handler and operand fields.
+ *
+ * @param opcode The 16-bit instruction.
+ * @param instr Destination for the decoded instruction.
  */
-void op_Fx15(chip8_t *chip8);
+void decode_instr(uint16_t opcode, chip8_instr_t *instr);
 
 /**
- * Fx18 - LD ST, Vx
- * Set sound timer = Vx.
- * ST is set equal to the value of Vx.
+ * @brief Rebuild the predecoded slots covering a range of memory.
+ *
+ * Must be called by embedders that write program bytes into memory directly
+ * instead of going through load_rom(). Writes performed by instructions
+ * (Fx33, Fx55) invalidate the cache on their own.
+ *
+ * @param chip8 Pointer to the CHIP-8 state structure.
+ * @param addr First address that changed.
+ * @param len Number of bytes that changed.
  */
-void op_Fx18(chip8_t *chip8);
+void chip8_invalidate(chip8_t *chip8, uint16_t addr, uint16_t len);
 
 /**
- * Fx1E - ADD I, Vx
- * Set I = I + Vx.
- * The values of I and Vx are added, and the results are stored in I.
+ * @brief Execute instructions until the budget runs out or an event stops it.
+ *
+ * Uses the core selected at build time: the handler-table core by default,
+ * or the direct-threaded core when built with CHIP8_CORE_THREADED. Events
+ * not enabled in chip8->stop_mask are executed without stopping. A
+ * breakpoint on the first instruction is ignored so a stopped run can be
+ * resumed by calling chip8_run() again.
+ *
+ * @param chip8 Pointer to the CHIP-8 state structure.
+ * @param max_cycles Maximum number of instructions to execute.
+ * @param result Optional destination for the stop details (may be NULL).
+ * @return chip8_exit_reason_t Why the run stopped.
  */
-void op_Fx1E(chip8_t *chip8);
+chip8_exit_reason_t chip8_run(chip8_t *chip8, uint32_t max_cycles,
+                              chip8_exit_t *result);
 
 /**
- * Fx29 - LD F, Vx
- * Set I = location of sprite for digit Vx.
- * The value of I is set to the location for the hexadecimal sprite
- * corresponding to the value of Vx.
+ * @brief Fast-forward through an idle loop that just closed.
+ *
+ * Called after the instruction at back_pc sent control backwards (a 1nnn
+ * jump, or an Fx0A with no key down). When the loop from chip8->pc to
+ * back_pc is at most a few instructions long, only reads the delay timer,
+ * registers or keypad, and would repeat identically, the remaining budget
+ * is consumed at once. pc and opcode end up exactly where executing budget
+ * more instructions would leave them. Timers and keys only change between
+ * runs, so the loop cannot exit earlier. Disabled while breakpoints are set.
+ *
+ * @param chip8 Pointer to the CHIP-8 state structure.
+ * @param back_pc Address of the instruction that closed the loop.
+ * @param budget Instructions left in the current run.
+ * @return uint32_t Instructions skipped: budget, or 0 if not idle.
  */
-void op_Fx29(chip8_t *chip8);
+uint32_t chip8_skip_idle(chip8_t *chip8, uint16_t back_pc, uint32_t budget);
 
 /**
- * Fx33 - LD B, Vx
- * Store BCD representation of Vx in memory locations I, I+1, and I+2.
- * The interpreter takes the decimal value of Vx, and places the hundreds digit
- * in memory at location in I, the tens digit at location I+1, and the ones
- * digit at location I+2.
+ * @brief Set or clear a breakpoint checked by chip8_run().
+ *
+ * @param chip8 Pointer to the CHIP-8 state structure.
+ * @param addr Address of the instruction to stop at.
+ * @param enabled true to set the breakpoint, false to clear it.
  */
-void op_Fx33(chip8_t *chip8);
+void chip8_set_breakpoint(chip8_t *chip8, uint16_t addr, bool enabled);
 
 /**
- * Fx55 - LD [I], Vx
- * Store registers V0 through Vx in memory starting at location I.
- * The interpreter copies the values of registers V0 through Vx into memory,
- * starting at the address in I.
+ * @brief Update the CHIP-8 timers (delay and sound).
+ * Should be called at 60Hz.
+ *
+ * @param chip8 Pointer to the CHIP-8 state structure.
  */
-void op_Fx55(chip8_t *chip8);
+void update_timers(chip8_t *chip8);
 
 /**
- * Fx65 - LD Vx, [I]
- * Read registers V0 through Vx from memory starting at location I.
- * The interpreter reads values from memory starting at location I into
- * registers V0 through Vx.
+ * @brief Execute one emulation cycle for the CHIP-8 system.
+ *
+ * @param chip8 Pointer to the CHIP-8 state structure.
  */
-void op_Fx65(chip8_t *chip8);
+void cycle(chip8_t *chip8);
 
 #endif // !CHIP8_H
@@ -0,0 +1,385 @@
+#include "chip8_analyze.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Value of I on entry to an instruction while analysing
+#define INDEX_UNSET 0xFFFFu  // Instruction not reached yet
+#define INDEX_VARIES 0xFFFEu // Reached with different or unknown values
+
+typedef struct
+{
+  const chip8_t *chip8;
+  chip8_analysis_t *analysis;
+  uint16_t index[MEMORY_SIZE]; // I on entry, merged over all paths
+  uint16_t work[MEMORY_SIZE];  // Addresses to (re)visit
+  uint16_t work_count;
+  uint8_t queued[MEMORY_SIZE];
+} analyzer_t;
+
+static uint16_t fetch(const chip8_t *chip8, uint16_t pc)
+{
+  return (uint16_t)(chip8->memory[pc & 0x0FFFu] << 8 |
+                    chip8->memory[(pc + 1) & 0x0FFFu]);
+}
+
+// Flag count bytes from addr, wrapping like the handlers do
+static void mark(chip8_analysis_t *analysis, uint16_t addr, unsigned count,
+                 uint16_t flag)
+{
+  for (unsigned i = 0; i < count; ++i)
+  {
+    analysis->flags[(addr + i) & 0x0FFFu] |= flag;
+  }
+}
+
+// Reach pc with I = index; queue it if that tells something new
+static void reach(analyzer_t *analyzer, uint16_t pc, uint16_t index)
+{
+  pc &= 0x0FFFu;
+  uint16_t old = analyzer->index[pc];
+  uint16_t merged = old == INDEX_UNSET || old == index ? index : INDEX_VARIES;
+  if (merged == old)
+  {
+    return;
+  }
+  analyzer->index[pc] = merged;
+  if (!analyzer->queued[pc])
+  {
+    analyzer->queued[pc] = 1;
+    analyzer->work[analyzer->work_count++] = pc;
+  }
+}
+
+static void add_subroutine(chip8_analysis_t *analysis, uint16_t entry)
+{
+  if (analysis->flags[entry] & CHIP8_BYTE_SUBROUTINE)
+  {
+    return;
+  }
+  analysis->flags[entry] |= CHIP8_BYTE_SUBROUTINE;
+  if (analysis->subroutine_count == CHIP8_ANALYSIS_MAX_SUBROUTINES)
+  {
+    analysis->truncated = true;
+    return;
+  }
+  analysis->subroutines[analysis->subroutine_count].entry = entry;
+  analysis->subroutines[analysis->subroutine_count].end = entry;
+  ++analysis->subroutine_count;
+}
+
+// Follow one instruction: flag its bytes and reach its successors
+static void visit(analyzer_t *analyzer, uint16_t pc)
+{
+  chip8_analysis_t *analysis = analyzer->analysis;
+  uint16_t index = analyzer->index[pc];
+  uint16_t next = (uint16_t)(pc + 2);
+  bool known = index < MEMORY_SIZE;
+
+  chip8_instr_t instr;
+  decode_instr(fetch(analyzer->chip8, pc), &instr);
+  if (!(analysis->flags[pc] & CHIP8_BYTE_CODE))
+  {
+    ++analysis->instructions;
+  }
+  analysis->flags[pc] |= CHIP8_BYTE_CODE;
+  analysis->flags[(pc + 1) & 0x0FFFu] |= CHIP8_BYTE_OPERAND;
+
+  switch (instr.op)
+  {
+  case CHIP8_OP_00EE:
+    break;
+  case CHIP8_OP_0NNN: // This core runs SYS addr as a jump
+  case CHIP8_OP_1NNN:
+    analysis->flags[instr.nnn] |= CHIP8_BYTE_LABEL;
+    reach(analyzer, instr.nnn, index);
+    break;
+  case CHIP8_OP_2NNN:
+    // The callee may change I before it returns
+    add_subroutine(analysis, instr.nnn);
+    reach(analyzer, instr.nnn, index);
+    reach(analyzer, next, INDEX_VARIES);
+    break;
+  case CHIP8_OP_3XKK:
+  case CHIP8_OP_4XKK:
+  case CHIP8_OP_5XY0:
+  case CHIP8_OP_9XY0:
+  case CHIP8_OP_EX9E:
+  case CHIP8_OP_EXA1:
+    analysis->flags[(pc + 4) & 0x0FFFu] |= CHIP8_BYTE_LABEL;
+    reach(analyzer, next, index);
+    reach(analyzer, (uint16_t)(pc + 4), index);
+    break;
+  case CHIP8_OP_BNNN:
+    mark(analysis, instr.nnn, 256 + 1, CHIP8_BYTE_INDIRECT);
+    if (analysis->indirect_count < CHIP8_ANALYSIS_MAX_INDIRECT)
+    {
+      // A pc is visited again when I changes; list it once
+      bool listed = false;
+      for (uint16_t i = 0; i < analysis->indirect_count; ++i)
+      {
+        listed |= analysis->indirect[i] == pc;
+      }
+      if (!listed)
+      {
+        analysis->indirect[analysis->indirect_count++] = pc;
+      }
+    }
+    else
+    {
+      analysis->truncated = true;
+    }
+    break;
+  case CHIP8_OP_ANNN:
+    analysis->flags[instr.nnn] |= CHIP8_BYTE_REFERENCED;
+    reach(analyzer, next, instr.nnn);
+    break;
+  case CHIP8_OP_FX1E:
+  case CHIP8_OP_FX29:
+    reach(analyzer, next, INDEX_VARIES);
+    break;
+  case CHIP8_OP_DXYN:
+    if (known)
+    {
+      mark(analysis, index, instr.n, CHIP8_BYTE_SPRITE);
+    }
+    reach(analyzer, next, index);
+    break;
+  case CHIP8_OP_FX65:
+    if (known)
+    {
+      mark(analysis, index, instr.x + 1u, CHIP8_BYTE_READ);
+    }
+    reach(analyzer, next, index);
+    break;
+  case CHIP8_OP_FX33:
+  case CHIP8_OP_FX55:
+    if (known)
+    {
+      mark(analysis, index,
+           instr.op == CHIP8_OP_FX33 ? 3u : instr.x + 1u, CHIP8_BYTE_WRITTEN);
+    }
+    else
+    {
+      analysis->unknown_writes = true;
+    }
+    reach(analyzer, next, index);
+    break;
+  default:
+    // Everything else, invalid opcodes and Fx0A included, falls through
+    reach(analyzer, next, index);
+    break;
+  }
+}
+
+// Highest address reachable from a subroutine's entry without entering the
+// subroutines it calls
+static uint16_t subroutine_end(const chip8_t *chip8, uint16_t entry)
+{
+  uint8_t seen[MEMORY_SIZE / 8];
+  uint16_t work[MEMORY_SIZE];
+  uint16_t count = 0;
+  uint16_t end = entry;
+  memset(seen, 0, sizeof(seen));
+
+  work[count++] = entry;
+  seen[entry >> 3] |= (uint8_t)(1u << (entry & 7u));
+  while (count > 0)
+  {
+    uint16_t pc = work[--count];
+    chip8_instr_t instr;
+    decode_instr(fetch(chip8, pc), &instr);
+    if (pc + 2 > end)
+    {
+      end = (uint16_t)(pc + 2);
+    }
+
+    uint16_t successors[2];
+    int successor_count = 0;
+    switch (instr.op)
+    {
+    case CHIP8_OP_00EE:
+    case CHIP8_OP_BNNN:
+      break;
+    case CHIP8_OP_0NNN:
+    case CHIP8_OP_1NNN:
+      successors[successor_count++] = instr.nnn;
+      break;
+    case CHIP8_OP_3XKK:
+    case CHIP8_OP_4XKK:
+    case CHIP8_OP_5XY0:
+    case CHIP8_OP_9XY0:
+    case CHIP8_OP_EX9E:
+    case CHIP8_OP_EXA1:
+      successors[successor_count++] = (uint16_t)((pc + 4) & 0x0FFFu);
+      // fall through
+    default:
+      successors[successor_count++] = (uint16_t)((pc + 2) & 0x0FFFu);
+      break;
+    }
+
+    for (int i = 0; i < successor_count; ++i)
+    {
+      uint16_t target = successors[i];
+      if (!(seen[target >> 3] & (1u << (target & 7u))))
+      {
+        seen[target >> 3] |= (uint8_t)(1u << (target & 7u));
+        work[count++] = target;
+      }
+    }
+  }
+  return end;
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+  const chip8_subroutine_t *x = a;
+  const chip8_subroutine_t *y = b;
+  return (int)x->entry - (int)y->entry;
+}
+
+void chip8_analyze(const chip8_t *chip8, chip8_analysis_t *analysis)
+{
+  memset(analysis, 0, sizeof(*analysis));
+  analyzer_t *analyzer = malloc(sizeof(*analyzer));
+  if (analyzer == NULL)
+  {
+    analysis->truncated = true;
+    return;
+  }
+  analyzer->chip8 = chip8;
+  analyzer->analysis = analysis;
+  analyzer->work_count = 0;
+  memset(analyzer->index, 0xFF, sizeof(analyzer->index));
+  memset(analyzer->queued, 0, sizeof(analyzer->queued));
+
+  // I holds whatever the embedder left in it
+  reach(analyzer, START_ADDRESS, INDEX_VARIES);
+  while (analyzer->work_count > 0)
+  {
+    uint16_t pc = analyzer->work[--analyzer->work_count];
+    analyzer->queued[pc] = 0;
+    visit(analyzer, pc);
+  }
+  free(analyzer);
+
+  for (uint16_t i = 0; i < analysis->subroutine_count; ++i)
+  {
+    chip8_subroutine_t *subroutine = &analysis->subroutines[i];
+    subroutine->end = subroutine_end(chip8, subroutine->entry);
+  }
+  qsort(analysis->subroutines, analysis->subroutine_count,
+        sizeof(analysis->subroutines[0]), compare_entries);
+
+  for (int addr = 0; addr < MEMORY_SIZE; ++addr)
+  {
+    uint16_t flags = analysis->flags[addr];
+    if ((flags & CHIP8_BYTE_WRITTEN) &&
+        (flags & (CHIP8_BYTE_CODE | CHIP8_BYTE_OPERAND)))
+    {
+      analysis->self_modifying = true;
+    }
+  }
+}
+
+bool chip8_analysis_is_data(const chip8_analysis_t *analysis, uint16_t addr)
+{
+  uint16_t flags = analysis->flags[addr & 0x0FFFu];
+  return !analysis->self_modifying && !analysis->truncated &&
+         !(flags & (CHIP8_BYTE_CODE | CHIP8_BYTE_OPERAND |
+                    CHIP8_BYTE_INDIRECT));
+}
+
+// Operand layouts for chip8_disassemble()
+typedef enum
+{
+  OPERANDS_NONE,
+  OPERANDS_NNN,
+  OPERANDS_X,
+  OPERANDS_X_KK,
+  OPERANDS_X_Y,
+  OPERANDS_X_Y_N,
+} operands_t;
+
+// Text before and after the operands of each operation
+static const struct
+{
+  const char *prefix;
+  const char *suffix;
+  operands_t operands;
+} syntax[CHIP8_OP_COUNT] = {
+    [CHIP8_OP_INVALID] = {".word", "", OPERANDS_NONE},
+    [CHIP8_OP_0NNN] = {"SYS ", "", OPERANDS_NNN},
+    [CHIP8_OP_00E0] = {"CLS", "", OPERANDS_NONE},
+    [CHIP8_OP_00EE] = {"RET", "", OPERANDS_NONE},
+    [CHIP8_OP_1NNN] = {"JP ", "", OPERANDS_NNN},
+    [CHIP8_OP_2NNN] = {"CALL ", "", OPERANDS_NNN},
+    [CHIP8_OP_3XKK] = {"SE ", "", OPERANDS_X_KK},
+    [CHIP8_OP_4XKK] = {"SNE ", "", OPERANDS_X_KK},
+    [CHIP8_OP_5XY0] = {"SE ", "", OPERANDS_X_Y},
+    [CHIP8_OP_6XKK] = {"LD ", "", OPERANDS_X_KK},
+    [CHIP8_OP_7XKK] = {"ADD ", "", OPERANDS_X_KK},
+    [CHIP8_OP_8XY0] = {"LD ", "", OPERANDS_X_Y},
+    [CHIP8_OP_8XY1] = {"OR ", "", OPERANDS_X_Y},
+    [CHIP8_OP_8XY2] = {"AND ", "", OPERANDS_X_Y},
+    [CHIP8_OP_8XY3] = {"XOR ", "", OPERANDS_X_Y},
+    [CHIP8_OP_8XY4] = {"ADD ", "", OPERANDS_X_Y},
+    [CHIP8_OP_8XY5] = {"SUB ", "", OPERANDS_X_Y},
+    [CHIP8_OP_8XY6] = {"SHR ", "", OPERANDS_X_Y},
+    [CHIP8_OP_8XY7] = {"SUBN ", "", OPERANDS_X_Y},
+    [CHIP8_OP_8XYE] = {"SHL ", "", OPERANDS_X_Y},
+    [CHIP8_OP_9XY0] = {"SNE ", "", OPERANDS_X_Y},
+    [CHIP8_OP_ANNN] = {"LD I, ", "", OPERANDS_NNN},
+    [CHIP8_OP_BNNN] = {"JP V0, ", "", OPERANDS_NNN},
+    [CHIP8_OP_CXKK] = {"RND ", "", OPERANDS_X_KK},
+    [CHIP8_OP_DXYN] = {"DRW ", "", OPERANDS_X_Y_N},
+    [CHIP8_OP_EX9E] = {"SKP ", "", OPERANDS_X},
+    [CHIP8_OP_EXA1] = {"SKNP ", "", OPERANDS_X},
+    [CHIP8_OP_FX07] = {"LD ", ", DT", OPERANDS_X},
+    [CHIP8_OP_FX0A] = {"LD ", ", K", OPERANDS_X},
+    [CHIP8_OP_FX15] = {"LD DT, ", "", OPERANDS_X},
+    [CHIP8_OP_FX18] = {"LD ST, ", "", OPERANDS_X},
+    [CHIP8_OP_FX1E] = {"ADD I, ", "", OPERANDS_X},
+    [CHIP8_OP_FX29] = {"LD F, ", "", OPERANDS_X},
+    [CHIP8_OP_FX33] = {"LD B, ", "", OPERANDS_X},
+    [CHIP8_OP_FX55] = {"LD [I], ", "", OPERANDS_X},
+    [CHIP8_OP_FX65] = {"LD ", ", [I]", OPERANDS_X},
+};
+
+void chip8_disassemble(uint16_t opcode, char *text, size_t size)
+{
+  chip8_instr_t instr;
+  decode_instr(opcode, &instr);
+  const char *prefix = syntax[instr.op].prefix;
+  const char *suffix = syntax[instr.op].suffix;
+
+  switch (syntax[instr.op].operands)
+  {
+  case OPERANDS_NONE:
+    if (instr.op == CHIP8_OP_INVALID)
+    {
+      snprintf(text, size, "%s 0x%04X", prefix, opcode);
+    }
+    else
+    {
+      snprintf(text, size, "%s", prefix);
+    }
+    break;
+  case OPERANDS_NNN:
+    snprintf(text, size, "%s0x%03X", prefix, instr.nnn);
+    break;
+  case OPERANDS_X:
+    snprintf(text, size, "%sV%X%s", prefix, instr.x, suffix);
+    break;
+  case OPERANDS_X_KK:
+    snprintf(text, size, "%sV%X, 0x%02X", prefix, instr.x, instr.kk);
+    break;
+  case OPERANDS_X_Y:
+    snprintf(text, size, "%sV%X, V%X", prefix, instr.x, instr.y);
+    break;
+  case OPERANDS_X_Y_N:
+    snprintf(text, size, "%sV%X, V%X, %u", prefix, instr.x, instr.y,
+             instr.n);
+    break;
+  }
+}
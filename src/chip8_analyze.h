@@ -0,0 +1,96 @@
+#ifndef CHIP8_ANALYZE_H
+#define CHIP8_ANALYZE_H
+
+#include "chip8.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Static analysis of a loaded program: which bytes are code, which are data,
+ * where the subroutines are.
+ *
+ * Control flow is followed from START_ADDRESS through jumps, calls, skips
+ * and returns. The value of I is tracked along the way while it is a
+ * constant set by Annn, so the bytes Dxyn draws, Fx65 reads and Fx33/Fx55
+ * write can be attributed. Bnnn jumps depend on V0 and are not followed;
+ * the 256 bytes each can reach are marked instead.
+ */
+
+// Per-byte flags in chip8_analysis_t.flags
+#define CHIP8_BYTE_CODE 0x01u       // First byte of a reachable instruction
+#define CHIP8_BYTE_OPERAND 0x02u    // Second byte of a reachable instruction
+#define CHIP8_BYTE_LABEL 0x04u      // Target of a jump or skip
+#define CHIP8_BYTE_SUBROUTINE 0x08u // Target of a call
+#define CHIP8_BYTE_REFERENCED 0x10u // Loaded into I by Annn
+#define CHIP8_BYTE_SPRITE 0x20u     // Drawn by Dxyn
+#define CHIP8_BYTE_READ 0x40u       // Read by Fx65
+#define CHIP8_BYTE_WRITTEN 0x80u    // Written by Fx33 or Fx55
+#define CHIP8_BYTE_INDIRECT 0x100u  // Within reach of a Bnnn jump
+
+#define CHIP8_ANALYSIS_MAX_SUBROUTINES 256
+#define CHIP8_ANALYSIS_MAX_INDIRECT 64
+
+/**
+ * @brief A subroutine found through the calls that reach it.
+ */
+typedef struct
+{
+  uint16_t entry; // Call target
+  uint16_t end;   // One past the last instruction reachable without calls
+} chip8_subroutine_t;
+
+/**
+ * @brief Result of chip8_analyze().
+ */
+typedef struct
+{
+  uint16_t flags[MEMORY_SIZE]; // CHIP8_BYTE_* per address
+
+  chip8_subroutine_t subroutines[CHIP8_ANALYSIS_MAX_SUBROUTINES]; // By entry
+  uint16_t subroutine_count;
+  uint16_t indirect[CHIP8_ANALYSIS_MAX_INDIRECT]; // Addresses of Bnnn jumps
+  uint16_t indirect_count;
+
+  uint32_t instructions; // Reachable instructions
+  bool self_modifying;   // Fx33/Fx55 may write reachable code
+  bool unknown_writes;   // Fx33/Fx55 run with an I the analysis lost track of
+  bool truncated;        // More subroutines or Bnnn than the arrays hold
+} chip8_analysis_t;
+
+/**
+ * @brief Recover the control flow of the program in an instance's memory.
+ *
+ * Only memory is read; the instance is not run.
+ *
+ * @param chip8 Instance with the program loaded.
+ * @param analysis Destination for the result.
+ */
+void chip8_analyze(const chip8_t *chip8, chip8_analysis_t *analysis);
+
+/**
+ * @brief Whether an address holds only data as far as the analysis can tell.
+ *
+ * True for bytes no reachable instruction covers and no Bnnn jump can reach.
+ * Writes to such bytes cannot change code, so a translator does not need to
+ * check them. Always false for self-modifying programs, whose rewritten
+ * instructions may lead anywhere.
+ *
+ * @param analysis Result of chip8_analyze().
+ * @param addr Address to check.
+ * @return bool true if the byte is never executed.
+ */
+bool chip8_analysis_is_data(const chip8_analysis_t *analysis, uint16_t addr);
+
+/**
+ * @brief Format an instruction in Cowgod's assembly syntax.
+ *
+ * Opcodes that are not instructions come out as a .word directive.
+ *
+ * @param opcode The 16-bit instruction.
+ * @param text Destination buffer.
+ * @param size Size of the buffer; 24 bytes always suffice.
+ */
+void chip8_disassemble(uint16_t opcode, char *text, size_t size);
+
+#endif // !CHIP8_ANALYZE_H
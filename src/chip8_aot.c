@@ -0,0 +1,747 @@
+#define _POSIX_C_SOURCE 200809L
+#include "chip8_aot.h"
+#include "chip8_analyze.h"
+#include "chip8_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <dlfcn.h>
+#define CHIP8_AOT_DLOPEN 1
+#endif
+
+// --- Translator ---
+
+typedef struct
+{
+  chip8_analysis_t analysis;
+  uint8_t leader[MEMORY_SIZE];
+  uint8_t has_block[MEMORY_SIZE];
+  chip8_aot_block_t blocks[MEMORY_SIZE / 2];
+  uint16_t block_count;
+} translator_t;
+
+static uint16_t fetch(const chip8_t *chip8, uint16_t pc)
+{
+  return (uint16_t)(chip8->memory[pc & 0x0FFFu] << 8 |
+                    chip8->memory[(pc + 1) & 0x0FFFu]);
+}
+
+// Instructions that fall through to the next one inside a block; the rest
+// end it, as in the JIT
+static bool continues_block(uint8_t op)
+{
+  switch (op)
+  {
+  case CHIP8_OP_6XKK:
+  case CHIP8_OP_7XKK:
+  case CHIP8_OP_8XY0:
+  case CHIP8_OP_8XY1:
+  case CHIP8_OP_8XY2:
+  case CHIP8_OP_8XY3:
+  case CHIP8_OP_8XY4:
+  case CHIP8_OP_8XY5:
+  case CHIP8_OP_8XY6:
+  case CHIP8_OP_8XY7:
+  case CHIP8_OP_8XYE:
+  case CHIP8_OP_ANNN:
+  case CHIP8_OP_CXKK:
+  case CHIP8_OP_FX07:
+  case CHIP8_OP_FX1E:
+  case CHIP8_OP_FX29:
+  case CHIP8_OP_FX65:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Event a block-ending instruction raises, mirroring chip8_run()
+static chip8_exit_reason_t aot_stop_reason(uint8_t op)
+{
+  switch (op)
+  {
+  case CHIP8_OP_INVALID:
+    return CHIP8_EXIT_INVALID;
+  case CHIP8_OP_00E0:
+  case CHIP8_OP_DXYN:
+    return CHIP8_EXIT_DRAW;
+  case CHIP8_OP_FX0A:
+    return CHIP8_EXIT_KEY_WAIT;
+  case CHIP8_OP_FX15:
+  case CHIP8_OP_FX18:
+    return CHIP8_EXIT_TIMER;
+  default:
+    return CHIP8_EXIT_BUDGET;
+  }
+}
+
+// Block leaders: the entry point, jump, skip and call targets, whatever
+// follows an instruction that ends a block, and Fx0A, which repeats itself
+// until a key is down
+static void find_leaders(translator_t *t, const chip8_t *chip8)
+{
+  const uint16_t *flags = t->analysis.flags;
+  t->leader[START_ADDRESS] = 1;
+  for (uint16_t addr = 0; addr < MEMORY_SIZE; addr += 2)
+  {
+    if (!(flags[addr] & CHIP8_BYTE_CODE))
+    {
+      continue;
+    }
+    chip8_instr_t instr;
+    decode_instr(fetch(chip8, addr), &instr);
+    if ((flags[addr] & (CHIP8_BYTE_LABEL | CHIP8_BYTE_SUBROUTINE)) ||
+        instr.op == CHIP8_OP_FX0A)
+    {
+      t->leader[addr] = 1;
+    }
+    if (!continues_block(instr.op) && addr + 2 < MEMORY_SIZE &&
+        (flags[addr + 2] & CHIP8_BYTE_CODE))
+    {
+      t->leader[addr + 2] = 1;
+    }
+  }
+}
+
+// Walk each leader's straight-line code. Blocks cut at CHIP8_AOT_BLOCK_MAX
+// make the next address a leader, which the ascending scan reaches later.
+static void find_blocks(translator_t *t, const chip8_t *chip8)
+{
+  for (uint16_t start = 0; start < MEMORY_SIZE; start += 2)
+  {
+    if (!t->leader[start] || !(t->analysis.flags[start] & CHIP8_BYTE_CODE))
+    {
+      continue;
+    }
+
+    chip8_aot_block_t *block = &t->blocks[t->block_count++];
+    uint16_t addr = start;
+    chip8_instr_t instr;
+    memset(block, 0, sizeof(*block));
+    block->start = start;
+    t->has_block[start] = 1;
+    for (;;)
+    {
+      decode_instr(fetch(chip8, addr), &instr);
+      ++block->length;
+      addr += 2;
+      if (!continues_block(instr.op))
+      {
+        break;
+      }
+      if (block->length == CHIP8_AOT_BLOCK_MAX || addr >= MEMORY_SIZE)
+      {
+        if (addr < MEMORY_SIZE)
+        {
+          t->leader[addr] = 1;
+        }
+        break;
+      }
+    }
+
+    if (!continues_block(instr.op))
+    {
+      if (instr.op == CHIP8_OP_FX55)
+        block->write_len = instr.x + 1;
+      else if (instr.op == CHIP8_OP_FX33)
+        block->write_len = 3;
+      block->stop = (uint8_t)aot_stop_reason(instr.op);
+      uint16_t last = (uint16_t)(addr - 2);
+      block->idle = instr.op == CHIP8_OP_FX0A ||
+                    (instr.op == CHIP8_OP_1NNN && instr.nnn <= last &&
+                     last - instr.nnn < CHIP8_IDLE_LOOP_MAX * 2);
+    }
+  }
+}
+
+#define SUCCESSOR_NEXT -2    // Falls through to the next instruction
+#define SUCCESSOR_DYNAMIC -1 // Sets pc to a value only known at run time
+
+// C for one instruction, skips excepted. Returns where control goes next:
+// a static address, SUCCESSOR_NEXT or SUCCESSOR_DYNAMIC. Instructions that
+// end a block leave pc set.
+static int emit_instr(FILE *out, const chip8_instr_t *instr, uint16_t addr)
+{
+  unsigned x = instr->x;
+  unsigned y = instr->y;
+  unsigned next = addr + 2u;
+
+  switch (instr->op)
+  {
+  case CHIP8_OP_0NNN:
+  case CHIP8_OP_1NNN:
+    fprintf(out, "  c->pc = 0x%03X;\n", instr->nnn);
+    return instr->nnn;
+  case CHIP8_OP_00EE:
+    fprintf(out, "  --c->sp;\n"
+                 "  c->pc = c->stack[c->sp & (STACK_SIZE - 1)];\n");
+    return SUCCESSOR_DYNAMIC;
+  case CHIP8_OP_2NNN:
+    fprintf(out, "  c->stack[c->sp & (STACK_SIZE - 1)] = 0x%03X;\n"
+                 "  ++c->sp;\n"
+                 "  c->pc = 0x%03X;\n", next, instr->nnn);
+    return instr->nnn;
+  case CHIP8_OP_6XKK:
+    fprintf(out, "  v[0x%X] = 0x%02X;\n", x, instr->kk);
+    return SUCCESSOR_NEXT;
+  case CHIP8_OP_7XKK:
+    fprintf(out, "  v[0x%X] = (uint8_t)(v[0x%X] + 0x%02X);\n", x, x,
+            instr->kk);
+    return SUCCESSOR_NEXT;
+  case CHIP8_OP_8XY0:
+    fprintf(out, "  v[0x%X] = v[0x%X];\n", x, y);
+    return SUCCESSOR_NEXT;
+  case CHIP8_OP_8XY1:
+    fprintf(out, "  v[0x%X] |= v[0x%X];\n", x, y);
+    return SUCCESSOR_NEXT;
+  case CHIP8_OP_8XY2:
+    fprintf(out, "  v[0x%X] &= v[0x%X];\n", x, y);
+    return SUCCESSOR_NEXT;
+  case CHIP8_OP_8XY3:
+    fprintf(out, "  v[0x%X] ^= v[0x%X];\n", x, y);
+    return SUCCESSOR_NEXT;
+  // The flag is written first and the registers read again afterwards, as
+  // the handlers do, so VF as an operand behaves the same
+  case CHIP8_OP_8XY4:
+    fprintf(out, "  t = (unsigned)v[0x%X] + v[0x%X];\n"
+                 "  v[0xF] = t > 0xFFu;\n"
+                 "  v[0x%X] = (uint8_t)t;\n", x, y, x);
+    return SUCCESSOR_NEXT;
+  case CHIP8_OP_8XY5:
+    fprintf(out, "  v[0xF] = v[0x%X] > v[0x%X];\n"
+                 "  v[0x%X] = (uint8_t)(v[0x%X] - v[0x%X]);\n", x, y, x, x, y);
+    return SUCCESSOR_NEXT;
+  case CHIP8_OP_8XY6:
+    fprintf(out, "  v[0xF] = v[0x%X] & 0x01u;\n"
+                 "  v[0x%X] >>= 1u;\n", x, x);
+    return SUCCESSOR_NEXT;
+  case CHIP8_OP_8XY7:
+    fprintf(out, "  v[0xF] = v[0x%X] > v[0x%X];\n"
+                 "  v[0x%X] = (uint8_t)(v[0x%X] - v[0x%X]);\n", y, x, x, y, x);
+    return SUCCESSOR_NEXT;
+  case CHIP8_OP_8XYE:
+    fprintf(out, "  v[0xF] = (uint8_t)(v[0x%X] >> 7u);\n"
+                 "  v[0x%X] = (uint8_t)(v[0x%X] << 1u);\n", x, x, x);
+    return SUCCESSOR_NEXT;
+  case CHIP8_OP_ANNN:
+    fprintf(out, "  c->index = 0x%03X;\n", instr->nnn);
+    return SUCCESSOR_NEXT;
+  case CHIP8_OP_BNNN:
+    fprintf(out, "  c->pc = (uint16_t)(0x%03X + v[0x0]);\n", instr->nnn);
+    return SUCCESSOR_DYNAMIC;
+  case CHIP8_OP_FX07:
+    fprintf(out, "  v[0x%X] = c->delay_timer;\n", x);
+    return SUCCESSOR_NEXT;
+  case CHIP8_OP_FX15:
+    fprintf(out, "  c->delay_timer = v[0x%X];\n"
+                 "  c->pc = 0x%03X;\n", x, next);
+    return (int)next;
+  case CHIP8_OP_FX18:
+    fprintf(out, "  c->sound_timer = v[0x%X];\n"
+                 "  c->pc = 0x%03X;\n", x, next);
+    return (int)next;
+  case CHIP8_OP_FX1E:
+    fprintf(out, "  c->index = (uint16_t)(c->index + v[0x%X]);\n", x);
+    return SUCCESSOR_NEXT;
+  case CHIP8_OP_FX29:
+    fprintf(out, "  c->index = (uint16_t)(0x%02X + v[0x%X] * 5);\n",
+            FONTSET_START_ADDRESS, x);
+    return SUCCESSOR_NEXT;
+  case CHIP8_OP_FX65:
+    fprintf(out, "  for (unsigned i = 0; i <= 0x%Xu; ++i)\n"
+                 "  {\n"
+                 "    v[i] = c->memory[(c->index + i) & 0x0FFFu];\n"
+                 "  }\n", x);
+    return SUCCESSOR_NEXT;
+  case CHIP8_OP_INVALID:
+    fprintf(out, "  c->pc = 0x%03X;\n", next);
+    return (int)next;
+  // Drawing, random numbers, key waits and stores run the core's handler,
+  // which also leaves pc after the instruction. Fx0A may rewind it, but
+  // always ends its block with a return to the runtime.
+  default:
+    fprintf(out, "  context->call(c, 0x%03X);\n", addr);
+    return continues_block(instr->op) ? SUCCESSOR_NEXT : (int)next;
+  }
+}
+
+// C condition under which a skip instruction skips
+static bool skip_condition(const chip8_instr_t *instr, char *text,
+                           size_t size)
+{
+  switch (instr->op)
+  {
+  case CHIP8_OP_3XKK:
+    snprintf(text, size, "v[0x%X] == 0x%02X", instr->x, instr->kk);
+    return true;
+  case CHIP8_OP_4XKK:
+    snprintf(text, size, "v[0x%X] != 0x%02X", instr->x, instr->kk);
+    return true;
+  case CHIP8_OP_5XY0:
+    if (instr->x == instr->y) // Keeps the compiler quiet about v[x] == v[x]
+    {
+      snprintf(text, size, "1");
+    }
+    else
+    {
+      snprintf(text, size, "v[0x%X] == v[0x%X]", instr->x, instr->y);
+    }
+    return true;
+  case CHIP8_OP_9XY0:
+    if (instr->x == instr->y)
+    {
+      snprintf(text, size, "0");
+    }
+    else
+    {
+      snprintf(text, size, "v[0x%X] != v[0x%X]", instr->x, instr->y);
+    }
+    return true;
+  case CHIP8_OP_EX9E:
+    snprintf(text, size, "c->keypad[v[0x%X] & 0x0Fu]", instr->x);
+    return true;
+  case CHIP8_OP_EXA1:
+    snprintf(text, size, "!c->keypad[v[0x%X] & 0x0Fu]", instr->x);
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Chain straight to the block at target, or through the dispatch switch
+static void emit_goto(FILE *out, const translator_t *t, int target,
+                      const char *indent)
+{
+  if (target >= 0 && target < MEMORY_SIZE && t->has_block[target])
+  {
+    fprintf(out, "%sgoto b_%03X;\n", indent, (unsigned)target);
+  }
+  else
+  {
+    fprintf(out, "%sgoto dispatch;\n", indent);
+  }
+}
+
+static void emit_block(FILE *out, const chip8_t *chip8, const translator_t *t,
+                       const chip8_aot_block_t *block)
+{
+  fprintf(out, "b_%03X:\n"
+               "  if (!valid[0x%03X] || budget < %u)\n"
+               "  {\n"
+               "    return budget;\n"
+               "  }\n"
+               "  budget -= %u;\n", block->start, block->start >> 1,
+          block->length, block->length);
+
+  uint16_t addr = block->start;
+  chip8_instr_t instr;
+  char condition[40];
+  int successor = SUCCESSOR_NEXT;
+  for (uint16_t i = 0; i < block->length; ++i, addr += 2)
+  {
+    char text[24];
+    uint16_t opcode = fetch(chip8, addr);
+    decode_instr(opcode, &instr);
+    chip8_disassemble(opcode, text, sizeof(text));
+    fprintf(out, "  // %03X %04X %s\n", addr, opcode, text);
+    if (i + 1 == block->length)
+    {
+      // Handlers never read it, so it can be set ahead of the last one
+      fprintf(out, "  c->opcode = 0x%04X;\n", opcode);
+    }
+    if (!skip_condition(&instr, condition, sizeof(condition)))
+    {
+      successor = emit_instr(out, &instr, addr);
+    }
+  }
+
+  uint16_t last = (uint16_t)(addr - 2);
+  if (skip_condition(&instr, condition, sizeof(condition)))
+  {
+    fprintf(out, "  if (%s)\n"
+                 "  {\n"
+                 "    c->pc = 0x%03X;\n", condition, last + 4u);
+    emit_goto(out, t, last + 4, "    ");
+    fprintf(out, "  }\n"
+                 "  c->pc = 0x%03X;\n", addr);
+    emit_goto(out, t, addr, "  ");
+    return;
+  }
+  if (successor == SUCCESSOR_NEXT)
+  {
+    fprintf(out, "  c->pc = 0x%03X;\n", addr);
+    successor = addr;
+  }
+
+  // Stores and idle loops always go back to the runtime; events only when
+  // the stop mask asks for them
+  if (block->write_len || block->idle)
+  {
+    fprintf(out, "  context->exit_block = 0x%03X;\n"
+                 "  return budget;\n", block->start);
+    return;
+  }
+  if (block->stop != CHIP8_EXIT_BUDGET)
+  {
+    fprintf(out, "  if (c->stop_mask & 0x%Xu)\n"
+                 "  {\n"
+                 "    context->exit_block = 0x%03X;\n"
+                 "    return budget;\n"
+                 "  }\n", 1u << block->stop, block->start);
+  }
+  emit_goto(out, t, successor, "  ");
+}
+
+static void emit_program(FILE *out, const chip8_t *chip8,
+                         const translator_t *t, const char *name)
+{
+  const chip8_analysis_t *analysis = &t->analysis;
+  uint16_t image_start = MEMORY_SIZE;
+  uint16_t image_end = 0;
+  for (uint16_t i = 0; i < t->block_count; ++i)
+  {
+    uint16_t end = (uint16_t)(t->blocks[i].start + t->blocks[i].length * 2);
+    if (t->blocks[i].start < image_start)
+      image_start = t->blocks[i].start;
+    if (end > image_end)
+      image_end = end;
+  }
+
+  fprintf(out, "// Generated by chip8_aot_translate(). Do not edit.\n"
+               "// %u instructions in %u blocks, %u indirect jump%s%s\n\n"
+               "#include \"chip8_aot.h\"\n\n",
+          analysis->instructions, t->block_count, analysis->indirect_count,
+          analysis->indirect_count == 1 ? "" : "s",
+          analysis->self_modifying ? ", self-modifying" : "");
+
+  fprintf(out, "// Memory the blocks were translated from\n"
+               "static const uint8_t image[] = {");
+  for (uint16_t addr = image_start; addr < image_end; ++addr)
+  {
+    fprintf(out, "%s0x%02X,", (addr - image_start) % 12 ? " " : "\n    ",
+            chip8->memory[addr]);
+  }
+  fprintf(out, "\n};\n\n");
+
+  fprintf(out, "static const chip8_aot_block_t blocks[] = {\n");
+  for (uint16_t i = 0; i < t->block_count; ++i)
+  {
+    const chip8_aot_block_t *block = &t->blocks[i];
+    fprintf(out, "    {0x%03X, %u, %u, %u, %u},\n", block->start,
+            block->length, block->write_len, block->stop, block->idle);
+  }
+  fprintf(out, "};\n\n");
+
+  // Blocks jump straight to static successors. Each checks on entry that
+  // its code is current and fits in the budget, with pc already set.
+  fprintf(out, "static uint32_t run(chip8_t *c, chip8_aot_context_t *context,\n"
+               "                    uint32_t budget)\n"
+               "{\n"
+               "  const uint8_t *valid = context->valid;\n"
+               "  uint8_t *v = c->registers;\n"
+               "  unsigned t;\n"
+               "  (void)t;\n\n"
+               "dispatch:\n"
+               "  switch (c->pc)\n"
+               "  {\n");
+  for (uint16_t i = 0; i < t->block_count; ++i)
+  {
+    fprintf(out, "  case 0x%03X:\n"
+                 "    goto b_%03X;\n", t->blocks[i].start, t->blocks[i].start);
+  }
+  fprintf(out, "  default:\n"
+               "    return budget;\n"
+               "  }\n\n");
+  for (uint16_t i = 0; i < t->block_count; ++i)
+  {
+    emit_block(out, chip8, t, &t->blocks[i]);
+    fprintf(out, "\n");
+  }
+  fprintf(out, "}\n\n");
+
+  fprintf(out, "const chip8_aot_program_t chip8_aot_%s = {\n"
+               "    CHIP8_AOT_ABI, sizeof(chip8_t), \"%s\", 0x%03X,\n"
+               "    sizeof(image), image, blocks, %u, run};\n",
+          name, name, image_start, t->block_count);
+}
+
+int chip8_aot_translate(const chip8_t *chip8, const char *name, FILE *out)
+{
+  translator_t *t = calloc(1, sizeof(*t));
+  if (t == NULL)
+  {
+    return -1;
+  }
+
+  chip8_analyze(chip8, &t->analysis);
+  find_leaders(t, chip8);
+  find_blocks(t, chip8);
+  emit_program(out, chip8, t, name);
+
+  int count = t->block_count;
+  free(t);
+  return count;
+}
+
+const chip8_aot_program_t *chip8_aot_load(const char *path, const char *name)
+{
+#if defined(CHIP8_AOT_DLOPEN)
+  void *library = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+  if (library == NULL)
+  {
+    return NULL;
+  }
+  char symbol[128];
+  snprintf(symbol, sizeof(symbol), "chip8_aot_%s", name);
+  const chip8_aot_program_t *program = dlsym(library, symbol);
+  if (program == NULL)
+  {
+    dlclose(library);
+  }
+  return program;
+#else
+  (void)path;
+  (void)name;
+  return NULL;
+#endif
+}
+
+// --- Runtime ---
+
+struct chip8_aot
+{
+  chip8_t *chip8;
+  const chip8_aot_program_t *program;
+  chip8_aot_context_t context;
+  uint8_t valid[MEMORY_SIZE / 2];    // Block at this slot matches memory
+  uint8_t covered[MEMORY_SIZE / 2];  // Slot is part of some block
+  uint16_t block[MEMORY_SIZE / 2];   // Index of the block starting here
+  chip8_aot_stats_t stats;
+};
+
+// Generated code calls back here for the instructions it does not inline
+static void aot_call(chip8_t *chip8, uint16_t addr)
+{
+  const chip8_instr_t *instr = &chip8->decoded[addr >> 1];
+  chip8->pc = (uint16_t)(addr + 2);
+  op_handlers[instr->op](chip8, instr);
+}
+
+static bool block_current(const chip8_aot_t *aot, const chip8_aot_block_t *b)
+{
+  const chip8_aot_program_t *program = aot->program;
+  uint32_t begin = b->start;
+  uint32_t end = begin + b->length * 2u;
+  if (begin < program->image_start ||
+      end > (uint32_t)program->image_start + program->image_size)
+  {
+    return false;
+  }
+  return memcmp(&aot->chip8->memory[begin],
+                &program->image[begin - program->image_start],
+                end - begin) == 0;
+}
+
+// Recheck every block overlapping [begin, end) against the image
+static void aot_recheck(chip8_aot_t *aot, uint32_t begin, uint32_t end)
+{
+  const chip8_aot_program_t *program = aot->program;
+  for (uint16_t i = 0; i < program->block_count; ++i)
+  {
+    const chip8_aot_block_t *b = &program->blocks[i];
+    if (b->start >= end || b->start + b->length * 2u <= begin)
+    {
+      continue;
+    }
+    uint8_t current = block_current(aot, b);
+    if (aot->valid[b->start >> 1] && !current)
+    {
+      ++aot->stats.invalidations;
+    }
+    aot->valid[b->start >> 1] = current;
+  }
+}
+
+// Recheck blocks if a store of len bytes at I hit any of them
+static void aot_check_write(chip8_aot_t *aot, uint8_t len)
+{
+  uint16_t index = aot->chip8->index;
+  for (uint8_t i = 0; i < len; ++i)
+  {
+    uint16_t addr = (index + i) & 0x0FFFu;
+    if (aot->covered[addr >> 1])
+    {
+      aot_recheck(aot, addr, addr + 1u);
+    }
+  }
+}
+
+// Interpret one instruction, tracking stores into translated code
+static chip8_exit_reason_t aot_interpret(chip8_aot_t *aot, chip8_exit_t *step)
+{
+  chip8_t *chip8 = aot->chip8;
+  uint16_t opcode = fetch(chip8, chip8->pc);
+
+  chip8_exit_reason_t reason = chip8_run(chip8, 1, step);
+  ++aot->stats.interpreted_instructions;
+
+  if ((opcode & 0xF0FFu) == 0xF055u)
+    aot_check_write(aot, ((opcode & 0x0F00u) >> 8u) + 1);
+  else if ((opcode & 0xF0FFu) == 0xF033u)
+    aot_check_write(aot, 3);
+  return reason;
+}
+
+static chip8_exit_reason_t aot_finish(chip8_exit_t *result,
+                                      chip8_exit_reason_t reason,
+                                      uint32_t executed, uint32_t idle,
+                                      uint16_t pc, uint16_t opcode)
+{
+  if (result)
+  {
+    result->reason = reason;
+    result->cycles = executed;
+    result->idle_cycles = idle;
+    result->pc = pc;
+    result->opcode = opcode;
+  }
+  return reason;
+}
+
+chip8_aot_t *chip8_aot_create(chip8_t *chip8,
+                              const chip8_aot_program_t *program)
+{
+  if (program->abi != CHIP8_AOT_ABI || program->state_size != sizeof(chip8_t))
+  {
+    return NULL;
+  }
+  chip8_aot_t *aot = (chip8_aot_t *)calloc(1, sizeof(chip8_aot_t));
+  if (aot == NULL)
+  {
+    return NULL;
+  }
+
+  aot->chip8 = chip8;
+  aot->program = program;
+  aot->context.valid = aot->valid;
+  aot->context.call = aot_call;
+  aot->context.exit_block = CHIP8_AOT_NO_EXIT;
+  memset(aot->block, 0xFF, sizeof(aot->block));
+  for (uint16_t i = 0; i < program->block_count; ++i)
+  {
+    const chip8_aot_block_t *b = &program->blocks[i];
+    if ((b->start & 1u) || b->start >= MEMORY_SIZE)
+    {
+      continue;
+    }
+    aot->block[b->start >> 1] = i;
+    for (uint32_t slot = b->start >> 1;
+         slot < (b->start >> 1) + b->length && slot < MEMORY_SIZE / 2; ++slot)
+    {
+      aot->covered[slot] = 1;
+    }
+  }
+  aot_recheck(aot, 0, MEMORY_SIZE);
+  return aot;
+}
+
+void chip8_aot_destroy(chip8_aot_t *aot) { free(aot); }
+
+chip8_exit_reason_t chip8_aot_run(chip8_aot_t *aot, uint32_t max_cycles,
+                                  chip8_exit_t *result)
+{
+  chip8_t *chip8 = aot->chip8;
+
+  // Recheck blocks whose code was rewritten by a ROM load or a restore
+  if (chip8->rewritten_begin < chip8->rewritten_end)
+  {
+    chip8_aot_invalidate(aot, chip8->rewritten_begin,
+                         chip8->rewritten_end - chip8->rewritten_begin);
+    chip8->rewritten_begin = chip8->rewritten_end = 0;
+  }
+
+  // Translated blocks do not check breakpoints, record traces or count
+  // profiles; let the interpreter do all three. Nothing watches its stores
+  // for translated code, so recheck every block afterwards.
+  if (chip8->breakpoint_count != 0 || chip8->trace != NULL ||
+      chip8->profile != NULL)
+  {
+    chip8_exit_t local;
+    chip8_exit_t *out = result ? result : &local;
+    chip8_exit_reason_t reason = chip8_run(chip8, max_cycles, out);
+    aot->stats.interpreted_instructions += out->cycles - out->idle_cycles;
+    aot->stats.idle_instructions += out->idle_cycles;
+    aot_recheck(aot, 0, MEMORY_SIZE);
+    return reason;
+  }
+
+  uint32_t count = max_cycles;
+  uint32_t idle = 0;
+  while (count)
+  {
+    uint32_t left = aot->program->run(chip8, &aot->context, count);
+    aot->stats.native_instructions += count - left;
+    chip8->cycles += count - left;
+    count = left;
+
+    if (aot->context.exit_block != CHIP8_AOT_NO_EXIT)
+    {
+      uint16_t start = aot->context.exit_block;
+      const chip8_aot_block_t *block =
+          &aot->program->blocks[aot->block[start >> 1]];
+      uint16_t last = (uint16_t)(start + (block->length - 1) * 2);
+      chip8_exit_reason_t stop = (chip8_exit_reason_t)block->stop;
+      aot->context.exit_block = CHIP8_AOT_NO_EXIT;
+
+      if (block->write_len)
+      {
+        aot_check_write(aot, block->write_len);
+      }
+
+      if (stop != CHIP8_EXIT_BUDGET && (chip8->stop_mask & (1u << stop)) &&
+          (stop != CHIP8_EXIT_KEY_WAIT || chip8->pc == last))
+      {
+        return aot_finish(result, stop, max_cycles - count, 0, last,
+                          chip8->opcode);
+      }
+
+      if (block->idle && (idle = chip8_skip_idle(chip8, last, count)) != 0)
+      {
+        aot->stats.idle_instructions += idle;
+        chip8->cycles += idle;
+        count = 0;
+      }
+      continue;
+    }
+
+    if (count == 0)
+    {
+      break;
+    }
+
+    // No current block at pc, or one longer than the budget left: step one
+    // instruction so the executed count stays exact
+    chip8_exit_t step;
+    chip8_exit_reason_t reason = aot_interpret(aot, &step);
+    --count;
+    if (reason != CHIP8_EXIT_BUDGET)
+    {
+      return aot_finish(result, reason, max_cycles - count, 0, step.pc,
+                        step.opcode);
+    }
+  }
+
+  return aot_finish(result, CHIP8_EXIT_BUDGET, max_cycles, idle, chip8->pc,
+                    fetch(chip8, chip8->pc));
+}
+
+void chip8_aot_invalidate(chip8_aot_t *aot, uint16_t addr, uint16_t len)
+{
+  aot_recheck(aot, addr, (uint32_t)addr + len);
+}
+
+void chip8_aot_stats(const chip8_aot_t *aot, chip8_aot_stats_t *stats)
+{
+  *stats = aot->stats;
+}
@@ -0,0 +1,175 @@
+#ifndef CHIP8_AOT_H
+#define CHIP8_AOT_H
+
+#include "chip8.h"
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Ahead-of-time translation of a ROM to C.
+ *
+ * chip8_aot_translate() writes a C file with one switch case per basic
+ * block of the program. Blocks are the same shape as the JIT's: straight
+ * line code up to a jump, skip, call, return, key check, store or an
+ * instruction that can stop chip8_run(). Simple instructions become plain C
+ * on the instance; drawing, Cxkk, Fx0A and the stores call back into the
+ * core's own handlers, so their semantics cannot drift.
+ *
+ * The file is compiled with the system compiler, then either linked into the
+ * embedder or built as a shared object and opened with chip8_aot_load().
+ * chip8_aot_run() dispatches to a block only while the memory it was
+ * translated from is unchanged. Bnnn targets, rewritten code and anything
+ * else without a block are stepped by the interpreter.
+ */
+
+// Bumped whenever the layout below or the generated code's contract changes
+#define CHIP8_AOT_ABI 1u
+
+#define CHIP8_AOT_BLOCK_MAX 64    // Instructions per translated block
+#define CHIP8_AOT_NO_EXIT 0xFFFFu // chip8_aot_context_t.exit_block if none
+
+/**
+ * @brief What the runtime hands to generated code.
+ */
+typedef struct
+{
+  const uint8_t *valid; // Per even address: a block starts here and is current
+  void (*call)(chip8_t *chip8, uint16_t addr); // Run the core's handler for
+                                               // the instruction at addr
+  uint16_t exit_block; // Block that ended with an event, set by generated code
+} chip8_aot_context_t;
+
+/**
+ * @brief A translated block, as listed by the generated file.
+ */
+typedef struct
+{
+  uint16_t start;    // Address of the first instruction
+  uint16_t length;   // Instructions executed by one pass through the block
+  uint8_t write_len; // Bytes stored at I by a trailing Fx33/Fx55, else 0
+  uint8_t stop;      // chip8_exit_reason_t raised by the last instruction
+  uint8_t idle;      // Last instruction may close an idle loop
+} chip8_aot_block_t;
+
+/**
+ * @brief Chain blocks until the budget runs out or the runtime must step in.
+ *
+ * @return uint32_t Budget left.
+ */
+typedef uint32_t (*chip8_aot_entry_t)(chip8_t *chip8,
+                                      chip8_aot_context_t *context,
+                                      uint32_t budget);
+
+/**
+ * @brief A translated program: the descriptor a generated file exports.
+ */
+typedef struct
+{
+  uint32_t abi;        // CHIP8_AOT_ABI the file was generated for
+  uint32_t state_size; // sizeof(chip8_t) the file was compiled against
+  const char *name;
+  uint16_t image_start;  // Memory the blocks were translated from
+  uint16_t image_size;
+  const uint8_t *image;
+  const chip8_aot_block_t *blocks; // By start address
+  uint16_t block_count;
+  chip8_aot_entry_t run;
+} chip8_aot_program_t;
+
+/**
+ * @brief Counters describing where instructions ran.
+ */
+typedef struct
+{
+  uint64_t native_instructions;      // Instructions run by translated blocks
+  uint64_t interpreted_instructions; // Instructions run by the interpreter
+  uint64_t idle_instructions;        // Instructions skipped in idle loops
+  uint64_t invalidations; // Blocks dropped because their code was rewritten
+} chip8_aot_stats_t;
+
+typedef struct chip8_aot chip8_aot_t;
+
+/**
+ * @brief Translate the program in an instance's memory to C.
+ *
+ * Blocks start at 0x200, at jump, skip and call targets, and after every
+ * instruction that ends a block; chip8_analyze() finds them. The file
+ * exports a chip8_aot_program_t named chip8_aot_<name>.
+ *
+ * @param chip8 Instance with the program loaded.
+ * @param name C identifier suffix for the exported program.
+ * @param out Stream the C source is written to.
+ * @return int Number of blocks written, or -1 if out of memory.
+ */
+int chip8_aot_translate(const chip8_t *chip8, const char *name, FILE *out);
+
+/**
+ * @brief Open a translated program built as a shared object.
+ *
+ * The library stays loaded for the rest of the process.
+ *
+ * @param path Path of the shared object.
+ * @param name Name it was translated with.
+ * @return const chip8_aot_program_t* The program, or NULL if the library or
+ * its symbol cannot be found.
+ */
+const chip8_aot_program_t *chip8_aot_load(const char *path, const char *name);
+
+/**
+ * @brief Bind a translated program to one CHIP-8 instance.
+ *
+ * The instance may load its ROM before or after; blocks are checked against
+ * memory whenever it is rewritten.
+ *
+ * @param chip8 Pointer to the CHIP-8 state structure.
+ * @param program Translated program.
+ * @return chip8_aot_t* New runtime, or NULL if the program was generated or
+ * compiled for a different chip8_t.
+ */
+chip8_aot_t *chip8_aot_create(chip8_t *chip8,
+                              const chip8_aot_program_t *program);
+
+/**
+ * @brief Release a runtime.
+ *
+ * @param aot Runtime to destroy (may be NULL).
+ */
+void chip8_aot_destroy(chip8_aot_t *aot);
+
+/**
+ * @brief chip8_run() through the translated blocks.
+ *
+ * Stops for the same reasons and reports the same chip8_exit_t as
+ * chip8_run(). Breakpoints, traces and profiles run the interpreter, after
+ * which every block is checked against memory again.
+ *
+ * @param aot Runtime created for the instance to run.
+ * @param max_cycles Maximum number of instructions to execute.
+ * @param result Optional destination for the stop details (may be NULL).
+ * @return chip8_exit_reason_t Why the run stopped.
+ */
+chip8_exit_reason_t chip8_aot_run(chip8_aot_t *aot, uint32_t max_cycles,
+                                  chip8_exit_t *result);
+
+/**
+ * @brief Recheck the blocks covering a range of memory.
+ *
+ * Needed only after writing memory directly without chip8_invalidate(), as
+ * with chip8_jit_invalidate(). Blocks whose bytes match the translated image
+ * again are re-enabled.
+ *
+ * @param aot Runtime to update.
+ * @param addr First address that changed.
+ * @param len Number of bytes that changed.
+ */
+void chip8_aot_invalidate(chip8_aot_t *aot, uint16_t addr, uint16_t len);
+
+/**
+ * @brief Read the runtime counters.
+ *
+ * @param aot Runtime to query.
+ * @param stats Destination for the counters.
+ */
+void chip8_aot_stats(const chip8_aot_t *aot, chip8_aot_stats_t *stats);
+
+#endif // !CHIP8_AOT_H
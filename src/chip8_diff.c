@@ -0,0 +1,575 @@
+#include "chip8_diff.h"
+#include "chip8_jit.h"
+#include <string.h>
+
+// Program layout of CHIP8_DIFF_STRUCTURED
+#define MAIN_END 0xA00         // Main loop from START_ADDRESS
+#define SUBROUTINE_START 0xA00 // Subroutines follow it
+#define SUBROUTINE_COUNT 6
+#define SUBROUTINE_SIZE 0x80
+#define DATA_START 0xE00 // Sprites and stores, to the end of memory
+#define DATA_SIZE 0x200
+#define STATEMENT_MAX 20 // Longest statement, in words
+
+// Registers of generated programs: V0-VD are free, VE counts loops
+#define LOOP_REGISTER 0xE
+
+static void *interpreter_attach(chip8_t *chip8)
+{
+  (void)chip8;
+  return NULL;
+}
+
+static void interpreter_run(void *context, chip8_t *chip8, uint32_t cycles)
+{
+  (void)context;
+  while (cycles > 0)
+  {
+    chip8_exit_t stop;
+    chip8_run(chip8, cycles, &stop);
+    cycles -= stop.cycles;
+  }
+}
+
+static void *jit_attach(chip8_t *chip8) { return chip8_jit_create(chip8); }
+
+static void jit_detach(void *context) { chip8_jit_destroy(context); }
+
+static void jit_run(void *context, chip8_t *chip8, uint32_t cycles)
+{
+  if (context == NULL)
+  {
+    interpreter_run(NULL, chip8, cycles);
+    return;
+  }
+  while (cycles > 0)
+  {
+    chip8_exit_t stop;
+    chip8_jit_run(context, cycles, &stop);
+    cycles -= stop.cycles;
+  }
+}
+
+const chip8_diff_core_t chip8_diff_interpreter = {
+    "interpreter", interpreter_attach, NULL, interpreter_run};
+
+const chip8_diff_core_t chip8_diff_jit = {"jit", jit_attach, jit_detach,
+                                          jit_run};
+
+// Compare the architectural state of two instances. Prints each difference
+// when out is not NULL and returns how many fields differ.
+static unsigned diff_states(const chip8_t *expected, const chip8_t *actual,
+                            FILE *out)
+{
+  unsigned fields = 0;
+
+#define DIFF_FIELD(label, field)                                               \
+  if (expected->field != actual->field)                                        \
+  {                                                                            \
+    ++fields;                                                                  \
+    if (out)                                                                   \
+      fprintf(out, "  %-14s %#-18llx %#llx\n", label,                          \
+              (unsigned long long)expected->field,                             \
+              (unsigned long long)actual->field);                              \
+  }
+
+  for (int reg = 0; reg < V_REG_COUNT; ++reg)
+  {
+    char label[8];
+    snprintf(label, sizeof(label), "V%X", reg);
+    DIFF_FIELD(label, registers[reg]);
+  }
+  DIFF_FIELD("I", index);
+  DIFF_FIELD("pc", pc);
+  DIFF_FIELD("opcode", opcode);
+  DIFF_FIELD("sp", sp);
+  for (int level = 0; level < STACK_SIZE; ++level)
+  {
+    char label[16];
+    snprintf(label, sizeof(label), "stack[%d]", level);
+    DIFF_FIELD(label, stack[level]);
+  }
+  DIFF_FIELD("delay timer", delay_timer);
+  DIFF_FIELD("sound timer", sound_timer);
+  DIFF_FIELD("rng state", rng_state);
+  DIFF_FIELD("instructions", cycles);
+
+  if (memcmp(expected->memory, actual->memory, MEMORY_SIZE) != 0)
+  {
+    for (int addr = 0; addr < MEMORY_SIZE; ++addr)
+    {
+      char label[16];
+      snprintf(label, sizeof(label), "memory[%03X]", addr);
+      DIFF_FIELD(label, memory[addr]);
+    }
+  }
+
+  if (memcmp(expected->display, actual->display, sizeof(expected->display)))
+  {
+    for (int y = 0; y < DISPLAY_HEIGHT; ++y)
+    {
+      if (expected->display[y] == actual->display[y])
+      {
+        continue;
+      }
+      ++fields;
+      if (out == NULL)
+      {
+        continue;
+      }
+      char rows[2][DISPLAY_WIDTH + 1];
+      for (int x = 0; x < DISPLAY_WIDTH; ++x)
+      {
+        rows[0][x] = (expected->display[y] >> (63 - x)) & 1u ? '#' : '.';
+        rows[1][x] = (actual->display[y] >> (63 - x)) & 1u ? '#' : '.';
+      }
+      rows[0][DISPLAY_WIDTH] = rows[1][DISPLAY_WIDTH] = '\0';
+      fprintf(out, "  display row %-2d expected %s\n", y, rows[0]);
+      fprintf(out, "                 actual   %s\n", rows[1]);
+    }
+  }
+
+#undef DIFF_FIELD
+  return fields;
+}
+
+static uint32_t next_random(uint32_t *state)
+{
+  // Xorshift32, as Cxkk uses
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return x;
+}
+
+// Restore both instances to a checkpoint and run count instructions
+static void replay(chip8_diff_result_t *result, const chip8_diff_core_t *core,
+                   void *context, const chip8_snapshot_t *checkpoint,
+                   uint32_t count)
+{
+  chip8_restore(&result->expected, checkpoint);
+  chip8_restore(&result->actual, checkpoint);
+  for (uint32_t i = 0; i < count; ++i)
+  {
+    cycle(&result->expected);
+  }
+  if (count > 0)
+  {
+    core->run(context, &result->actual, count);
+  }
+}
+
+// A frame ended in different states: find the shortest prefix of it that
+// already differs. The core runs each prefix in one call, so divergences
+// that depend on how it splits its budget still show.
+static void find_divergence(chip8_diff_result_t *result,
+                            const chip8_diff_core_t *core, void *context,
+                            const chip8_snapshot_t *checkpoint,
+                            uint32_t cycles)
+{
+  result->diverged = true;
+
+  replay(result, core, context, checkpoint, cycles);
+  if (diff_states(&result->expected, &result->actual, NULL) == 0)
+  {
+    // Every instruction agreed; the timer tick did not
+    result->in_timers = true;
+    result->instruction = result->agreed + cycles;
+    result->pc = result->expected.pc;
+    result->opcode = 0;
+    update_timers(&result->expected);
+    update_timers(&result->actual);
+    return;
+  }
+
+  uint32_t low = 0; // Longest prefix known to agree
+  uint32_t high = cycles;
+  while (high - low > 1)
+  {
+    uint32_t middle = low + (high - low) / 2;
+    replay(result, core, context, checkpoint, middle);
+    if (diff_states(&result->expected, &result->actual, NULL) == 0)
+    {
+      low = middle;
+    }
+    else
+    {
+      high = middle;
+    }
+  }
+
+  replay(result, core, context, checkpoint, high - 1);
+  uint16_t pc = result->expected.pc;
+  result->instruction = result->agreed + high - 1;
+  result->pc = pc;
+  result->opcode = (uint16_t)(result->expected.memory[pc & 0x0FFFu] << 8 |
+                              result->expected.memory[(pc + 1) & 0x0FFFu]);
+  replay(result, core, context, checkpoint, high);
+}
+
+bool chip8_diff_run(const chip8_t *start, const chip8_diff_core_t *core,
+                    const chip8_diff_options_t *options,
+                    chip8_diff_result_t *result)
+{
+  result->diverged = false;
+  result->in_timers = false;
+  result->instruction = 0;
+  result->frame = 0;
+  result->pc = 0;
+  result->opcode = 0;
+  result->agreed = 0;
+
+  chip8_t *instances[2] = {&result->expected, &result->actual};
+  for (int i = 0; i < 2; ++i)
+  {
+    *instances[i] = *start;
+    instances[i]->stop_mask = 0;
+    instances[i]->breakpoint_count = 0;
+    memset(instances[i]->breakpoints, 0, sizeof(instances[i]->breakpoints));
+    instances[i]->trace = NULL;
+    instances[i]->profile = NULL;
+  }
+  void *context = core->attach ? core->attach(&result->actual) : NULL;
+
+  uint32_t input = options->input_seed;
+  uint32_t ipf = options->cycles_per_frame ? options->cycles_per_frame : 1;
+  chip8_snapshot_t checkpoint;
+
+  while (result->agreed < options->instructions)
+  {
+    uint64_t left = options->instructions - result->agreed;
+    uint32_t cycles = left < ipf ? (uint32_t)left : ipf;
+
+    if (input != 0)
+    {
+      // One key held in about a quarter of the frames
+      uint32_t roll = next_random(&input);
+      uint16_t keys = (roll & 0x30u) == 0 ? (uint16_t)(1u << (roll & 15u)) : 0;
+      for (int key = 0; key < KEYS_COUNT; ++key)
+      {
+        result->expected.keypad[key] = (keys >> key) & 1u;
+        result->actual.keypad[key] = (keys >> key) & 1u;
+      }
+    }
+    chip8_snapshot(&result->expected, &checkpoint);
+
+    for (uint32_t i = 0; i < cycles; ++i)
+    {
+      cycle(&result->expected);
+    }
+    core->run(context, &result->actual, cycles);
+    update_timers(&result->expected);
+    update_timers(&result->actual);
+
+    if (diff_states(&result->expected, &result->actual, NULL) != 0)
+    {
+      find_divergence(result, core, context, &checkpoint, cycles);
+      break;
+    }
+    result->agreed += cycles;
+    ++result->frame;
+  }
+
+  if (core->detach)
+  {
+    core->detach(context);
+  }
+  return !result->diverged;
+}
+
+void chip8_diff_print(const chip8_diff_result_t *result, FILE *out)
+{
+  if (!result->diverged)
+  {
+    fprintf(out, "no divergence in %llu instructions\n",
+            (unsigned long long)result->agreed);
+    return;
+  }
+  if (result->in_timers)
+  {
+    fprintf(out, "diverged in the timer tick after instruction %llu "
+                 "(frame %u)\n",
+            (unsigned long long)result->instruction, result->frame);
+  }
+  else
+  {
+    fprintf(out, "diverged at instruction %llu (frame %u): %03X %04X\n",
+            (unsigned long long)result->instruction, result->frame,
+            result->pc, result->opcode);
+  }
+  fprintf(out, "  %-14s %-18s %s\n", "field", "expected", "actual");
+  diff_states(&result->expected, &result->actual, out);
+}
+
+// --- Program generators ---
+
+typedef struct
+{
+  chip8_t *chip8;
+  uint32_t state;
+  uint16_t addr; // Next address to emit at
+  uint16_t end;  // First address not to emit at
+} emitter_t;
+
+static uint32_t pick(emitter_t *emit, uint32_t count)
+{
+  return next_random(&emit->state) % count;
+}
+
+static bool emit_word(emitter_t *emit, uint16_t opcode)
+{
+  if (emit->addr + 2 > emit->end)
+  {
+    return false;
+  }
+  emit->chip8->memory[emit->addr] = (uint8_t)(opcode >> 8);
+  emit->chip8->memory[emit->addr + 1] = (uint8_t)opcode;
+  emit->addr += 2;
+  return true;
+}
+
+// Room for a statement of up to count words, plus the closing jump
+static bool has_room(const emitter_t *emit, unsigned count)
+{
+  return emit->addr + 2 * (count + 1) <= emit->end;
+}
+
+// A register other than the loop counter
+static uint16_t free_register(emitter_t *emit)
+{
+  return (uint16_t)pick(emit, LOOP_REGISTER);
+}
+
+// An instruction that only changes registers and never branches
+static uint16_t alu_opcode(emitter_t *emit)
+{
+  static const uint8_t alu_ops[] = {0x0, 0x1, 0x2, 0x3, 0x4,
+                                    0x5, 0x6, 0x7, 0xE};
+  uint16_t x = free_register(emit);
+  uint16_t y = (uint16_t)pick(emit, 16);
+  uint16_t kk = (uint16_t)pick(emit, 256);
+  switch (pick(emit, 5))
+  {
+  case 0:
+    return 0x6000 | x << 8 | kk;
+  case 1:
+    return 0x7000 | x << 8 | kk;
+  case 2:
+    return 0xC000 | x << 8 | kk;
+  default:
+    return 0x8000 | x << 8 | y << 4 | alu_ops[pick(emit, sizeof(alu_ops))];
+  }
+}
+
+// A conditional skip; small immediates so that both outcomes happen
+static uint16_t skip_opcode(emitter_t *emit, uint16_t x, uint16_t y)
+{
+  switch (pick(emit, 6))
+  {
+  case 0:
+    return (uint16_t)(0x3000 | x << 8 | pick(emit, 4));
+  case 1:
+    return (uint16_t)(0x4000 | x << 8 | pick(emit, 4));
+  case 2:
+    return 0x5000 | x << 8 | y << 4;
+  case 3:
+    return 0x9000 | x << 8 | y << 4;
+  case 4:
+    return 0xE09E | x << 8;
+  default:
+    return 0xE0A1 | x << 8;
+  }
+}
+
+// One straight-line statement: at most 5 words, falls through at the end
+static void emit_simple(emitter_t *emit)
+{
+  uint16_t x = free_register(emit);
+  uint16_t y = free_register(emit);
+  switch (pick(emit, 9))
+  {
+  case 0:
+  case 1:
+    emit_word(emit, alu_opcode(emit));
+    break;
+  case 2:
+    // A skip over one instruction
+    emit_word(emit, skip_opcode(emit, x, y));
+    emit_word(emit, alu_opcode(emit));
+    break;
+  case 3:
+    // A sprite from the data area or the font
+    emit_word(emit, pick(emit, 2)
+                        ? (uint16_t)(0xA000 | (DATA_START + pick(emit, 0x100)))
+                        : (uint16_t)(0xF029 | x << 8));
+    emit_word(emit, (uint16_t)(0xD000 | x << 8 | y << 4 | pick(emit, 16)));
+    break;
+  case 4:
+  {
+    // A store or load in the data area
+    static const uint16_t memory_ops[] = {0xF033, 0xF055, 0xF065};
+    emit_word(emit, (uint16_t)(0xA000 | (DATA_START + pick(emit, 0x1F0))));
+    emit_word(emit, (uint16_t)(memory_ops[pick(emit, 3)] | x << 8));
+    break;
+  }
+  case 5:
+  {
+    static const uint16_t timer_ops[] = {0xF007, 0xF015, 0xF018, 0xF01E};
+    emit_word(emit, (uint16_t)(timer_ops[pick(emit, 4)] | x << 8));
+    break;
+  }
+  case 6:
+  {
+    // Rewrite the next instruction before it runs
+    uint16_t patch = alu_opcode(emit);
+    emit_word(emit, (uint16_t)(0xA000 | (emit->addr + 8)));
+    emit_word(emit, (uint16_t)(0x6000 | patch >> 8));
+    emit_word(emit, (uint16_t)(0x6100 | (patch & 0xFF)));
+    emit_word(emit, 0xF155);
+    emit_word(emit, 0x6000);
+    break;
+  }
+  case 7:
+    emit_word(emit, pick(emit, 8) ? alu_opcode(emit) : 0x00E0);
+    break;
+  default:
+  {
+    // Jump through a table of four entries with Bnnn
+    uint16_t table = (uint16_t)(emit->addr + 4);
+    uint16_t after = (uint16_t)(table + 8);
+    emit_word(emit, (uint16_t)(0x6000 | pick(emit, 4) * 2));
+    emit_word(emit, (uint16_t)(0xB000 | table));
+    for (int entry = 0; entry < 4; ++entry)
+    {
+      emit_word(emit, (uint16_t)(0x1000 | after));
+    }
+    break;
+  }
+  }
+}
+
+// A statement of the main loop or a subroutine, possibly compound. Calls
+// only go to subroutines first_callee and up, so the stack stays shallow.
+static void emit_statement(emitter_t *emit, unsigned first_callee)
+{
+  if (!has_room(emit, STATEMENT_MAX))
+  {
+    return;
+  }
+  switch (pick(emit, 12))
+  {
+  case 0:
+  {
+    // A counted loop
+    uint16_t top = (uint16_t)(emit->addr + 2);
+    emit_word(emit,
+              (uint16_t)(0x6000 | LOOP_REGISTER << 8 | (1 + pick(emit, 8))));
+    for (uint32_t i = 1 + pick(emit, 3); i > 0; --i)
+    {
+      emit_simple(emit);
+    }
+    emit_word(emit, 0x7000 | LOOP_REGISTER << 8 | 0xFF);
+    emit_word(emit, 0x3000 | LOOP_REGISTER << 8);
+    emit_word(emit, (uint16_t)(0x1000 | top));
+    break;
+  }
+  case 1:
+  {
+    // Wait for the delay timer, which the idle loop skip catches. Each
+    // wait takes a frame or more, so keep them rare.
+    if (pick(emit, 4) != 0)
+    {
+      emit_simple(emit);
+      break;
+    }
+    uint16_t x = free_register(emit);
+    emit_word(emit, (uint16_t)(0x6000 | x << 8 | (1 + pick(emit, 2))));
+    emit_word(emit, (uint16_t)(0xF015 | x << 8));
+    uint16_t top = emit->addr;
+    emit_word(emit, (uint16_t)(0xF007 | x << 8));
+    emit_word(emit, (uint16_t)(0x3000 | x << 8));
+    emit_word(emit, (uint16_t)(0x1000 | top));
+    break;
+  }
+  case 2:
+    if (pick(emit, 4) == 0)
+    {
+      emit_word(emit, (uint16_t)(0xF00A | free_register(emit) << 8));
+      break;
+    }
+    // fall through
+  case 3:
+    if (first_callee < SUBROUTINE_COUNT)
+    {
+      uint32_t target =
+          first_callee + pick(emit, SUBROUTINE_COUNT - first_callee);
+      emit_word(emit, (uint16_t)(0x2000 | (SUBROUTINE_START +
+                                            target * SUBROUTINE_SIZE)));
+      break;
+    }
+    // fall through
+  default:
+    emit_simple(emit);
+    break;
+  }
+}
+
+static void generate_structured(chip8_t *chip8, uint32_t seed)
+{
+  emitter_t emit = {chip8, seed ? seed : 1, START_ADDRESS, MAIN_END};
+
+  for (uint16_t addr = DATA_START; addr < DATA_START + DATA_SIZE; ++addr)
+  {
+    chip8->memory[addr] = (uint8_t)next_random(&emit.state);
+  }
+
+  while (has_room(&emit, STATEMENT_MAX))
+  {
+    emit_statement(&emit, 0);
+  }
+  emit_word(&emit, 0x1000 | START_ADDRESS);
+
+  for (unsigned s = 0; s < SUBROUTINE_COUNT; ++s)
+  {
+    emit.addr = (uint16_t)(SUBROUTINE_START + s * SUBROUTINE_SIZE);
+    emit.end = (uint16_t)(emit.addr + SUBROUTINE_SIZE);
+    for (uint32_t i = 1 + pick(&emit, 3);
+         i > 0 && has_room(&emit, STATEMENT_MAX); --i)
+    {
+      emit_statement(&emit, s + 1);
+    }
+    emit_word(&emit, 0x00EE);
+  }
+}
+
+static void generate_random(chip8_t *chip8, uint32_t seed)
+{
+  uint32_t state = seed ? seed : 1;
+  for (uint16_t addr = START_ADDRESS; addr < MEMORY_SIZE; addr += 2)
+  {
+    // Calls and returns would overflow or underflow the stack
+    uint16_t opcode;
+    do
+    {
+      opcode = (uint16_t)next_random(&state);
+    } while ((opcode >> 12) == 0x2 || opcode == 0x00EE);
+    chip8->memory[addr] = (uint8_t)(opcode >> 8);
+    chip8->memory[addr + 1] = (uint8_t)opcode;
+  }
+}
+
+void chip8_diff_generate(chip8_t *chip8, chip8_diff_program_t kind,
+                         uint32_t seed)
+{
+  if (kind == CHIP8_DIFF_STRUCTURED)
+  {
+    generate_structured(chip8, seed);
+  }
+  else
+  {
+    generate_random(chip8, seed);
+  }
+  chip8_invalidate(chip8, START_ADDRESS, MEMORY_SIZE - START_ADDRESS);
+}
@@ -0,0 +1,107 @@
+#ifndef CHIP8_DIFF_H
+#define CHIP8_DIFF_H
+
+#include "chip8.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Differential testing: runs a program on the reference cycle() and on a
+ * core under test in lockstep, and finds the first instruction after which
+ * their machine states differ.
+ *
+ * Both instances run a frame of instructions at a time, get the same keys
+ * and timer ticks, and are compared after every frame. When a frame ends in
+ * different states both are restored to the start of that frame and stepped
+ * one instruction at a time to find the culprit.
+ */
+
+/**
+ * @brief A core to compare with cycle().
+ *
+ * run() must execute exactly @p cycles instructions on the instance, however
+ * it gets there. The harness may chip8_restore() the instance between calls.
+ */
+typedef struct
+{
+  const char *name;
+  void *(*attach)(chip8_t *chip8); // Per-instance context, or NULL
+  void (*detach)(void *context);   // Release the context (may be NULL)
+  void (*run)(void *context, chip8_t *chip8, uint32_t cycles);
+} chip8_diff_core_t;
+
+extern const chip8_diff_core_t chip8_diff_interpreter; // chip8_run()
+extern const chip8_diff_core_t chip8_diff_jit;         // chip8_jit_run()
+
+/**
+ * @brief How long to run and what input to give.
+ */
+typedef struct
+{
+  uint64_t instructions;     // Stop after this many agree
+  uint32_t cycles_per_frame; // Instructions between timer ticks
+  uint32_t input_seed;       // Keys change every frame from it; 0 for none
+} chip8_diff_options_t;
+
+/**
+ * @brief Where a run diverged, if it did.
+ */
+typedef struct
+{
+  bool diverged;
+  bool in_timers;       // States differ after update_timers(), not a step
+  uint64_t instruction; // Instructions both executed alike before
+  uint32_t frame;       // Frame the divergence happened in
+  uint16_t pc;          // Address of the diverging instruction
+  uint16_t opcode;      // Its opcode, before it executed
+  uint64_t agreed;      // Instructions compared without divergence
+
+  // The instances the run used: the reference and the core under test.
+  // After a divergence they hold the states right after it.
+  chip8_t expected;
+  chip8_t actual;
+} chip8_diff_result_t;
+
+/**
+ * @brief Program shapes produced by chip8_diff_generate().
+ */
+typedef enum
+{
+  CHIP8_DIFF_RANDOM,     // Random opcodes, calls and returns excluded
+  CHIP8_DIFF_STRUCTURED, // Loops, calls, draws, stores and self-modification
+} chip8_diff_program_t;
+
+/**
+ * @brief Fill an instance's program space with a generated program.
+ *
+ * @param chip8 Instance, freshly initialized.
+ * @param kind Shape of the program.
+ * @param seed Same seed, same program.
+ */
+void chip8_diff_generate(chip8_t *chip8, chip8_diff_program_t kind,
+                         uint32_t seed);
+
+/**
+ * @brief Run a state on cycle() and on a core in lockstep.
+ *
+ * @param start State both instances start from; its stop mask and
+ * breakpoints are ignored.
+ * @param core Core under test.
+ * @param options Run length and input.
+ * @param result Destination for the outcome and both final states.
+ * @return bool true if the states agreed throughout.
+ */
+bool chip8_diff_run(const chip8_t *start, const chip8_diff_core_t *core,
+                    const chip8_diff_options_t *options,
+                    chip8_diff_result_t *result);
+
+/**
+ * @brief Print where a run diverged and every field that differs.
+ *
+ * @param result Result of a run that diverged.
+ * @param out Stream to print to.
+ */
+void chip8_diff_print(const chip8_diff_result_t *result, FILE *out);
+
+#endif // !CHIP8_DIFF_H
@@ -0,0 +1,94 @@
+#include "chip8_handoff.h"
+#include <string.h>
+
+#define TRIPLE_FRESH 4u // Set in middle when it holds an unread frame
+#define TRIPLE_SLOT 3u
+
+void chip8_input_queue_init(chip8_input_queue_t *queue)
+{
+  atomic_init(&queue->head, 0);
+  atomic_init(&queue->tail, 0);
+  queue->dropped = 0;
+}
+
+bool chip8_input_push(chip8_input_queue_t *queue,
+                      const chip8_input_event_t *event)
+{
+  uint32_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+  uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+  if (head - tail >= CHIP8_INPUT_QUEUE_SIZE)
+  {
+    ++queue->dropped;
+    return false;
+  }
+  queue->events[head % CHIP8_INPUT_QUEUE_SIZE] = *event;
+  atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+  return true;
+}
+
+bool chip8_input_pop(chip8_input_queue_t *queue, chip8_input_event_t *event)
+{
+  uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+  uint32_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+  if (head == tail)
+  {
+    return false;
+  }
+  *event = queue->events[tail % CHIP8_INPUT_QUEUE_SIZE];
+  atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+  return true;
+}
+
+void chip8_triple_init(chip8_triple_t *triple)
+{
+  memset(triple->frames, 0, sizeof(triple->frames));
+  triple->front = 0;
+  atomic_init(&triple->middle, 1);
+  triple->back = 2;
+  triple->published = 0;
+  triple->shown = 0;
+}
+
+chip8_frame_t *chip8_triple_back(chip8_triple_t *triple)
+{
+  return &triple->frames[triple->back];
+}
+
+void chip8_triple_publish(chip8_triple_t *triple, uint32_t dirty_rows)
+{
+  chip8_frame_t *frame = &triple->frames[triple->back];
+  frame->dirty_rows = dirty_rows;
+  frame->sequence = ++triple->published;
+
+  // Release the frame's contents with it; take back whichever slot the
+  // reader left in the middle
+  uint32_t old = atomic_exchange_explicit(
+      &triple->middle, triple->back | TRIPLE_FRESH, memory_order_acq_rel);
+  triple->back = old & TRIPLE_SLOT;
+}
+
+bool chip8_triple_acquire(chip8_triple_t *triple)
+{
+  if (!(atomic_load_explicit(&triple->middle, memory_order_relaxed) &
+        TRIPLE_FRESH))
+  {
+    return false;
+  }
+  uint32_t old = atomic_exchange_explicit(&triple->middle, triple->front,
+                                          memory_order_acq_rel);
+  triple->front = old & TRIPLE_SLOT;
+
+  // Rows changed in the frames that were replaced are not in dirty_rows
+  chip8_frame_t *frame = &triple->frames[triple->front];
+  if (frame->sequence != triple->shown + 1)
+  {
+    frame->dirty_rows = UINT32_MAX;
+  }
+  triple->shown = frame->sequence;
+  return true;
+}
+
+const chip8_frame_t *chip8_triple_front(const chip8_triple_t *triple)
+{
+  return &triple->frames[triple->front];
+}
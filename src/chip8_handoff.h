@@ -0,0 +1,152 @@
+#ifndef CHIP8_HANDOFF_H
+#define CHIP8_HANDOFF_H
+
+#include "chip8.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Lock-free handoff between an emulation thread and a render thread.
+ *
+ * Finished frames go from emulation to rendering through a triple buffer:
+ * the writer always has a free slot to draw into and the reader always has
+ * the newest complete frame, so neither ever waits for the other. Frames the
+ * reader is too slow to see are replaced, never queued.
+ *
+ * Input goes the other way through a single-producer, single-consumer ring
+ * of events, each stamped with the host time it happened so the consumer can
+ * apply it at the matching emulated instruction.
+ */
+
+#define CHIP8_INPUT_QUEUE_SIZE 256u // Events; a power of two
+
+/**
+ * @brief What an input event reports.
+ */
+typedef enum
+{
+  CHIP8_INPUT_KEY,    // Keypad key pressed or released
+  CHIP8_INPUT_REWIND, // Rewind hotkey pressed or released
+} chip8_input_type_t;
+
+/**
+ * @brief One input event.
+ */
+typedef struct
+{
+  uint64_t time_ns; // When it happened, on chip8_pace_now()'s clock
+  uint8_t type;     // chip8_input_type_t
+  uint8_t key;      // Keypad key, for CHIP8_INPUT_KEY
+  bool down;        // Pressed or held
+} chip8_input_event_t;
+
+/**
+ * @brief Ring of input events from one producer thread to one consumer.
+ */
+typedef struct
+{
+  chip8_input_event_t events[CHIP8_INPUT_QUEUE_SIZE];
+  _Alignas(64) _Atomic uint32_t head; // Events pushed, by the producer
+  uint32_t dropped; // Events refused while full, by the producer
+  _Alignas(64) _Atomic uint32_t tail; // Events popped, by the consumer
+} chip8_input_queue_t;
+
+/**
+ * @brief A frame published by the emulation thread.
+ */
+typedef struct
+{
+  uint32_t pixels[DISPLAY_WIDTH * DISPLAY_HEIGHT];
+  uint32_t dirty_rows; // Rows that differ from the frame the reader had
+  uint64_t sequence;   // Publication number, from 1
+} chip8_frame_t;
+
+/**
+ * @brief Three frames: one being drawn, one being shown, one in between.
+ */
+typedef struct
+{
+  chip8_frame_t frames[3];
+  _Alignas(64) _Atomic uint32_t middle; // Slot in between, | a fresh flag
+  _Alignas(64) uint32_t back;           // Writer's slot
+  uint64_t published;
+  _Alignas(64) uint32_t front; // Reader's slot
+  uint64_t shown;              // Sequence of the reader's frame
+} chip8_triple_t;
+
+/**
+ * @brief Empty a queue. Not thread-safe; call before either side starts.
+ *
+ * @param queue Queue to initialise.
+ */
+void chip8_input_queue_init(chip8_input_queue_t *queue);
+
+/**
+ * @brief Append an event. Producer thread only.
+ *
+ * @param queue Queue to append to.
+ * @param event Event to copy in.
+ * @return bool false if the queue is full; the event is dropped.
+ */
+bool chip8_input_push(chip8_input_queue_t *queue,
+                      const chip8_input_event_t *event);
+
+/**
+ * @brief Take the oldest event. Consumer thread only.
+ *
+ * @param queue Queue to take from.
+ * @param event Destination for the event.
+ * @return bool false if the queue is empty.
+ */
+bool chip8_input_pop(chip8_input_queue_t *queue, chip8_input_event_t *event);
+
+/**
+ * @brief Set up a triple buffer with three blank frames. Not thread-safe;
+ * call before either side starts.
+ *
+ * @param triple Buffer to initialise.
+ */
+void chip8_triple_init(chip8_triple_t *triple);
+
+/**
+ * @brief The frame the writer draws into next. Writer thread only.
+ *
+ * The slot holds whatever frame last used it, so the writer should redraw
+ * it whole.
+ *
+ * @param triple Buffer to draw into.
+ * @return chip8_frame_t* Frame to fill.
+ */
+chip8_frame_t *chip8_triple_back(chip8_triple_t *triple);
+
+/**
+ * @brief Hand the back frame to the reader. Writer thread only.
+ *
+ * @param triple Buffer to publish in.
+ * @param dirty_rows Rows changed since the previous published frame.
+ */
+void chip8_triple_publish(chip8_triple_t *triple, uint32_t dirty_rows);
+
+/**
+ * @brief Take the newest published frame, if there is one. Reader thread
+ * only.
+ *
+ * When frames were skipped, the new frame reports every row dirty.
+ *
+ * @param triple Buffer to read from.
+ * @return bool true if chip8_triple_front() changed.
+ */
+bool chip8_triple_acquire(chip8_triple_t *triple);
+
+/**
+ * @brief The reader's current frame. Reader thread only.
+ *
+ * It stays valid and unchanged until the next chip8_triple_acquire().
+ *
+ * @param triple Buffer to read from.
+ * @return const chip8_frame_t* Frame to show.
+ */
+const chip8_frame_t *chip8_triple_front(const chip8_triple_t *triple);
+
+#endif // !CHIP8_HANDOFF_H
@@ -0,0 +1,963 @@
+#define _DEFAULT_SOURCE
+#include "chip8_jit.h"
+#include "chip8_internal.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if CHIP8_JIT_AVAILABLE
+#include <sys/mman.h>
+
+#if !defined(MAP_ANONYMOUS)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#define JIT_CODE_SIZE (1u << 20) // Bytes of executable memory per JIT
+#define JIT_BLOCK_MAX 32         // Instructions per translated block
+#define JIT_BLOCK_RESERVE 8192   // Worst-case bytes needed by one block
+#define JIT_REG_I V_REG_COUNT    // Register cache slot used for I
+#define JIT_NO_EXIT 0xFFFFu      // jit->exit_block when no block is pending
+
+/**
+ * @brief A translated basic block, keyed by its start address.
+ *
+ * The dispatch trampoline indexes this table with pc * 8, so the layout is
+ * fixed at 16 bytes.
+ */
+typedef struct
+{
+  const uint8_t *entry; // Native code, NULL if not translated
+  uint16_t length;      // Instructions executed by one pass through the block
+  uint8_t write_len;    // Bytes stored at I by a trailing Fx33/Fx55, else 0
+  uint8_t stop;         // chip8_exit_reason_t raised by the last instruction
+  uint8_t idle;         // Last instruction may close an idle loop
+  uint8_t reserved[3];
+} jit_block_t;
+
+_Static_assert(sizeof(jit_block_t) == 16, "trampoline expects 16-byte blocks");
+
+/**
+ * @brief Native dispatch loop.
+ *
+ * Chains translated blocks until the budget runs out or C has to step in
+ * (untranslated block, odd pc, block longer than the budget, a store that
+ * may have hit translated code, or an instruction that can stop the run).
+ *
+ * @return uint32_t Budget left when the trampoline returned.
+ */
+typedef uint32_t (*jit_trampoline_t)(chip8_t *chip8, chip8_jit_t *jit,
+                                     uint32_t budget);
+
+struct chip8_jit
+{
+  chip8_t *chip8;
+  uint8_t *code;
+  size_t code_used;
+  size_t trampoline_size;       // Code preserved across flushes
+  jit_trampoline_t trampoline;  // Entry point at the start of code
+  const uint8_t *dispatch_loop; // Blocks jump here when they finish
+  const uint8_t *dispatch_exit; // Blocks that need C afterwards jump here
+  uint64_t block_entries;       // Bumped by the trampoline on every entry
+  uint16_t exit_block;          // Slot of the block that jumped to the exit
+  jit_block_t blocks[MEMORY_SIZE / 2];
+  uint8_t covered[MEMORY_SIZE / 2]; // Slot is part of some translated block
+  chip8_jit_stats_t stats;
+};
+
+// x86-64 register numbers
+enum
+{
+  RAX = 0,
+  RCX = 1,
+  RDX = 2,
+  RBX = 3,
+  RBP = 5,
+  RSI = 6,
+  RDI = 7,
+  R8 = 8,
+  R14 = 14,
+  R15 = 15
+};
+
+// Condition codes for setcc/cmovcc
+enum
+{
+  CC_E = 0x4,
+  CC_NE = 0x5,
+  CC_A = 0x7
+};
+
+// Host registers that may cache V0-VF and I. rbx holds the chip8_t pointer,
+// r14 the chip8_jit_t pointer and r15 the remaining budget; rax/rcx are
+// scratch and rdi/rsi carry call arguments.
+static const uint8_t jit_pool[] = {R8, 9, 10, 11, 12, 13, RBP, RDX};
+#define JIT_POOL_SIZE (sizeof(jit_pool) / sizeof(jit_pool[0]))
+
+/**
+ * @brief Code emitter state for the block being translated.
+ *
+ * Guest registers are loaded into host registers on first use and written
+ * back before every call into C and at the end of the block.
+ */
+typedef struct
+{
+  uint8_t *buf;
+  size_t len;
+  int8_t host[V_REG_COUNT + 1]; // Host register caching Vx (or I), -1 if none
+  bool dirty[V_REG_COUNT + 1];  // Cached value differs from chip8_t
+  uint8_t in_use;               // Number of pool registers currently caching
+} jit_emit_t;
+
+static inline void emit8(jit_emit_t *e, uint8_t byte) { e->buf[e->len++] = byte; }
+
+static inline void emit32(jit_emit_t *e, uint32_t value)
+{
+  memcpy(&e->buf[e->len], &value, sizeof(value));
+  e->len += sizeof(value);
+}
+
+static inline void emit64(jit_emit_t *e, uint64_t value)
+{
+  memcpy(&e->buf[e->len], &value, sizeof(value));
+  e->len += sizeof(value);
+}
+
+static inline uint8_t modrm(uint8_t mod, uint8_t reg, uint8_t rm)
+{
+  return (uint8_t)(mod << 6 | (reg & 7) << 3 | (rm & 7));
+}
+
+// REX prefix, only emitted when one of the operands needs it
+static inline void emit_rex(jit_emit_t *e, uint8_t reg, uint8_t rm)
+{
+  if (reg >= 8 || rm >= 8)
+  {
+    emit8(e, 0x40 | (reg >> 3) << 2 | (rm >> 3));
+  }
+}
+
+// mov r32, imm32
+static void emit_mov_ri(jit_emit_t *e, uint8_t dst, uint32_t imm)
+{
+  emit_rex(e, 0, dst);
+  emit8(e, 0xB8 + (dst & 7));
+  emit32(e, imm);
+}
+
+// <op> r32, r32 (dst <op>= src) for add/or/and/sub/xor/cmp/mov
+static void emit_alu_rr(jit_emit_t *e, uint8_t opc, uint8_t dst, uint8_t src)
+{
+  emit_rex(e, src, dst);
+  emit8(e, opc);
+  emit8(e, modrm(3, src, dst));
+}
+
+// <op> r32, imm32 where ext selects add(0)/or(1)/and(4)/sub(5)/xor(6)/cmp(7)
+static void emit_alu_ri(jit_emit_t *e, uint8_t ext, uint8_t dst, uint32_t imm)
+{
+  emit_rex(e, 0, dst);
+  emit8(e, 0x81);
+  emit8(e, modrm(3, ext, dst));
+  emit32(e, imm);
+}
+
+// shl(4)/shr(5) r32, imm8
+static void emit_shift_ri(jit_emit_t *e, uint8_t ext, uint8_t dst, uint8_t imm)
+{
+  emit_rex(e, 0, dst);
+  emit8(e, 0xC1);
+  emit8(e, modrm(3, ext, dst));
+  emit8(e, imm);
+}
+
+// movzx r32, byte/word [rbx + disp32]
+static void emit_load(jit_emit_t *e, uint8_t dst, uint32_t disp, bool word)
+{
+  emit_rex(e, dst, RBX);
+  emit8(e, 0x0F);
+  emit8(e, word ? 0xB7 : 0xB6);
+  emit8(e, modrm(2, dst, RBX));
+  emit32(e, disp);
+}
+
+// mov byte/word [rbx + disp32], r
+static void emit_store(jit_emit_t *e, uint8_t src, uint32_t disp, bool word)
+{
+  if (word)
+  {
+    emit8(e, 0x66);
+    emit_rex(e, src, RBX);
+    emit8(e, 0x89);
+  }
+  else
+  {
+    // Always emit REX so registers 4-7 select spl/bpl/sil/dil, not ah/ch/...
+    emit8(e, 0x40 | (src >> 3) << 2);
+    emit8(e, 0x88);
+  }
+  emit8(e, modrm(2, src, RBX));
+  emit32(e, disp);
+}
+
+// mov word [rbx + disp32], imm16
+static void emit_store_imm16(jit_emit_t *e, uint32_t disp, uint16_t imm)
+{
+  emit8(e, 0x66);
+  emit8(e, 0xC7);
+  emit8(e, modrm(2, 0, RBX));
+  emit32(e, disp);
+  emit8(e, imm & 0xFF);
+  emit8(e, imm >> 8);
+}
+
+// cmovcc r32, r32
+static void emit_cmov(jit_emit_t *e, uint8_t cc, uint8_t dst, uint8_t src)
+{
+  emit_rex(e, dst, src);
+  emit8(e, 0x0F);
+  emit8(e, 0x40 | cc);
+  emit8(e, modrm(3, dst, src));
+}
+
+// setcc al; movzx eax, al
+static void emit_setcc_eax(jit_emit_t *e, uint8_t cc)
+{
+  emit8(e, 0x0F);
+  emit8(e, 0x90 | cc);
+  emit8(e, 0xC0);
+  emit8(e, 0x0F);
+  emit8(e, 0xB6);
+  emit8(e, 0xC0);
+}
+
+static uint32_t reg_disp(int v)
+{
+  return v == JIT_REG_I ? (uint32_t)offsetof(chip8_t, index)
+                        : (uint32_t)(offsetof(chip8_t, registers) + v);
+}
+
+// Write back every dirty cached register and empty the cache
+static void reg_flush(jit_emit_t *e)
+{
+  for (int v = 0; v <= JIT_REG_I; ++v)
+  {
+    if (e->host[v] >= 0 && e->dirty[v])
+    {
+      emit_store(e, (uint8_t)e->host[v], reg_disp(v), v == JIT_REG_I);
+    }
+    e->host[v] = -1;
+    e->dirty[v] = false;
+  }
+  e->in_use = 0;
+}
+
+// Guarantee the next instruction can allocate its (at most three) registers
+static void reg_reserve(jit_emit_t *e)
+{
+  if ((size_t)e->in_use + 3 > JIT_POOL_SIZE)
+  {
+    reg_flush(e);
+  }
+}
+
+static uint8_t reg_alloc(jit_emit_t *e, int v, bool load)
+{
+  if (e->host[v] < 0)
+  {
+    uint8_t r = 0;
+    for (size_t i = 0; i < JIT_POOL_SIZE; ++i)
+    {
+      bool taken = false;
+      for (int w = 0; w <= JIT_REG_I; ++w)
+      {
+        taken |= e->host[w] == jit_pool[i];
+      }
+      if (!taken)
+      {
+        r = jit_pool[i];
+        break;
+      }
+    }
+    e->host[v] = (int8_t)r;
+    ++e->in_use;
+    if (load)
+    {
+      emit_load(e, r, reg_disp(v), v == JIT_REG_I);
+    }
+  }
+  return (uint8_t)e->host[v];
+}
+
+// Host register holding the current value of a guest register
+static uint8_t reg_use(jit_emit_t *e, int v) { return reg_alloc(e, v, true); }
+
+// Host register that is about to be fully overwritten
+static uint8_t reg_def(jit_emit_t *e, int v)
+{
+  e->dirty[v] = true;
+  return reg_alloc(e, v, false);
+}
+
+// Host register that is read and then modified
+static uint8_t reg_mod(jit_emit_t *e, int v)
+{
+  e->dirty[v] = true;
+  return reg_alloc(e, v, true);
+}
+
+// jmp rel32 to a location inside the code buffer
+static void emit_jmp(jit_emit_t *e, const uint8_t *target)
+{
+  emit8(e, 0xE9);
+  emit32(e, (uint32_t)(target - (e->buf + e->len + 4)));
+}
+
+// jcc rel32 to a location that is patched later; returns the patch offset
+static size_t emit_jcc_forward(jit_emit_t *e, uint8_t cc)
+{
+  emit8(e, 0x0F);
+  emit8(e, 0x80 | cc);
+  emit32(e, 0);
+  return e->len;
+}
+
+static void patch_jcc(jit_emit_t *e, size_t at)
+{
+  uint32_t rel = (uint32_t)(e->len - at);
+  memcpy(&e->buf[at - 4], &rel, sizeof(rel));
+}
+
+/**
+ * @brief Emit the dispatch trampoline at the start of the code buffer.
+ *
+ * Equivalent C, with rbx = chip8, r14 = jit and r15d = budget:
+ *
+ *   for (;;) {
+ *     pc = chip8->pc;
+ *     if (pc & 0xF001) break;
+ *     block = &jit->blocks[pc >> 1];
+ *     if (!block->entry || block->length > budget) break;
+ *     budget -= block->length; ++jit->block_entries;
+ *     goto *block->entry; // blocks jump back to the top of the loop
+ *   }
+ *   return budget;
+ */
+static void emit_trampoline(chip8_jit_t *jit, jit_emit_t *e)
+{
+  uint32_t blocks = (uint32_t)offsetof(chip8_jit_t, blocks);
+  uint32_t entries = (uint32_t)offsetof(chip8_jit_t, block_entries);
+  size_t exits[3];
+
+  emit8(e, 0x53);                 // push rbx
+  emit8(e, 0x55);                 // push rbp
+  emit8(e, 0x41), emit8(e, 0x54); // push r12
+  emit8(e, 0x41), emit8(e, 0x55); // push r13
+  emit8(e, 0x41), emit8(e, 0x56); // push r14
+  emit8(e, 0x41), emit8(e, 0x57); // push r15
+  emit8(e, 0x48), emit8(e, 0x83); // sub rsp, 8 (keep calls 16-byte aligned)
+  emit8(e, 0xEC), emit8(e, 0x08);
+  emit8(e, 0x48), emit8(e, 0x89), emit8(e, 0xFB); // mov rbx, rdi
+  emit8(e, 0x49), emit8(e, 0x89), emit8(e, 0xF6); // mov r14, rsi
+  emit8(e, 0x41), emit8(e, 0x89), emit8(e, 0xD7); // mov r15d, edx
+
+  jit->dispatch_loop = e->buf + e->len;
+  emit_load(e, RAX, offsetof(chip8_t, pc), true); // movzx eax, word [rbx+pc]
+  emit8(e, 0xA9), emit32(e, 0xF001u);             // test eax, 0xF001
+  exits[0] = emit_jcc_forward(e, CC_NE);
+  emit8(e, 0x49), emit8(e, 0x8D), emit8(e, 0x8C); // lea rcx, [r14+rax*8+d]
+  emit8(e, 0xC6), emit32(e, blocks);
+  emit8(e, 0x48), emit8(e, 0x8B), emit8(e, 0x01); // mov rax, [rcx]
+  emit8(e, 0x48), emit8(e, 0x85), emit8(e, 0xC0); // test rax, rax
+  exits[1] = emit_jcc_forward(e, CC_E);
+  emit8(e, 0x0F), emit8(e, 0xB7), emit8(e, 0x51); // movzx edx, word [rcx+8]
+  emit8(e, 0x08);
+  emit8(e, 0x44), emit8(e, 0x39), emit8(e, 0xFA); // cmp edx, r15d
+  exits[2] = emit_jcc_forward(e, CC_A);
+  emit8(e, 0x41), emit8(e, 0x29), emit8(e, 0xD7); // sub r15d, edx
+  emit8(e, 0x49), emit8(e, 0xFF), emit8(e, 0x86); // inc qword [r14+d]
+  emit32(e, entries);
+  emit8(e, 0xFF), emit8(e, 0xE0);                 // jmp rax
+
+  jit->dispatch_exit = e->buf + e->len;
+  patch_jcc(e, exits[0]);
+  patch_jcc(e, exits[1]);
+  patch_jcc(e, exits[2]);
+  emit8(e, 0x44), emit8(e, 0x89), emit8(e, 0xF8); // mov eax, r15d
+  emit8(e, 0x48), emit8(e, 0x83);                 // add rsp, 8
+  emit8(e, 0xC4), emit8(e, 0x08);
+  emit8(e, 0x41), emit8(e, 0x5F); // pop r15
+  emit8(e, 0x41), emit8(e, 0x5E); // pop r14
+  emit8(e, 0x41), emit8(e, 0x5D); // pop r13
+  emit8(e, 0x41), emit8(e, 0x5C); // pop r12
+  emit8(e, 0x5D);                 // pop rbp
+  emit8(e, 0x5B);                 // pop rbx
+  emit8(e, 0xC3);                 // ret
+}
+
+// Call back into the C handler for an instruction at addr
+static void emit_call_handler(jit_emit_t *e, chip8_t *chip8, uint16_t addr)
+{
+  const chip8_instr_t *instr = &chip8->decoded[addr >> 1];
+
+  reg_flush(e);
+  emit_store_imm16(e, offsetof(chip8_t, pc), (uint16_t)(addr + 2));
+  emit8(e, 0x48), emit8(e, 0x89), emit8(e, 0xDF); // mov rdi, rbx
+  emit8(e, 0x48), emit8(e, 0xBE);                 // mov rsi, imm64
+  emit64(e, (uint64_t)(uintptr_t)instr);
+  emit8(e, 0x48), emit8(e, 0xB8);                 // mov rax, imm64
+  emit64(e, (uint64_t)(uintptr_t)op_handlers[instr->op]);
+  emit8(e, 0xFF), emit8(e, 0xD0);                 // call rax
+}
+
+// Conditional skip: pc = condition ? addr + 4 : addr + 2
+static void emit_skip(jit_emit_t *e, uint8_t cc, uint16_t addr)
+{
+  emit_mov_ri(e, RAX, (uint32_t)(addr + 2) & 0xFFFFu);
+  emit_mov_ri(e, RCX, (uint32_t)(addr + 4) & 0xFFFFu);
+  emit_cmov(e, cc, RAX, RCX);
+  reg_flush(e);
+  emit_store(e, RAX, offsetof(chip8_t, pc), true);
+}
+
+/**
+ * @brief Translate one instruction.
+ *
+ * @return true if the instruction ends the block (it has set pc itself).
+ */
+static bool emit_instr(jit_emit_t *e, chip8_t *chip8, uint16_t addr)
+{
+  const chip8_instr_t *instr = &chip8->decoded[addr >> 1];
+  uint8_t x = instr->x;
+  uint8_t y = instr->y;
+  uint8_t rx, ry, rf;
+
+  reg_reserve(e);
+
+  switch (instr->op)
+  {
+  case CHIP8_OP_1NNN:
+    reg_flush(e);
+    emit_store_imm16(e, offsetof(chip8_t, pc), instr->nnn);
+    return true;
+
+  case CHIP8_OP_3XKK:
+  case CHIP8_OP_4XKK:
+    rx = reg_use(e, x);
+    emit_alu_ri(e, 7, rx, instr->kk); // cmp
+    emit_skip(e, instr->op == CHIP8_OP_3XKK ? CC_E : CC_NE, addr);
+    return true;
+
+  case CHIP8_OP_5XY0:
+  case CHIP8_OP_9XY0:
+    rx = reg_use(e, x);
+    ry = reg_use(e, y);
+    emit_alu_rr(e, 0x39, rx, ry); // cmp
+    emit_skip(e, instr->op == CHIP8_OP_5XY0 ? CC_E : CC_NE, addr);
+    return true;
+
+  case CHIP8_OP_6XKK:
+    rx = reg_def(e, x);
+    emit_mov_ri(e, rx, instr->kk);
+    return false;
+
+  case CHIP8_OP_7XKK:
+    rx = reg_mod(e, x);
+    emit_alu_ri(e, 0, rx, instr->kk); // add
+    emit_alu_ri(e, 4, rx, 0xFF);      // and
+    return false;
+
+  case CHIP8_OP_8XY0:
+    ry = reg_use(e, y);
+    rx = reg_def(e, x);
+    emit_alu_rr(e, 0x89, rx, ry); // mov
+    return false;
+
+  case CHIP8_OP_8XY1:
+  case CHIP8_OP_8XY2:
+  case CHIP8_OP_8XY3:
+  {
+    static const uint8_t opc[] = {0x09, 0x21, 0x31}; // or, and, xor
+    ry = reg_use(e, y);
+    rx = reg_mod(e, x);
+    emit_alu_rr(e, opc[instr->op - CHIP8_OP_8XY1], rx, ry);
+    return false;
+  }
+
+  case CHIP8_OP_8XY4:
+    ry = reg_use(e, y);
+    rx = reg_use(e, x);
+    emit_alu_rr(e, 0x89, RAX, rx); // mov eax, Vx
+    emit_alu_rr(e, 0x01, RAX, ry); // add eax, Vy
+    emit_alu_rr(e, 0x89, RCX, RAX);
+    emit_shift_ri(e, 5, RCX, 8);   // carry
+    emit_alu_ri(e, 4, RAX, 0xFF);
+    rf = reg_def(e, 0xF);
+    emit_alu_rr(e, 0x89, rf, RCX);
+    rx = reg_def(e, x); // Vx is written last, as in op_8xy4
+    emit_alu_rr(e, 0x89, rx, RAX);
+    return false;
+
+  case CHIP8_OP_8XY5:
+  case CHIP8_OP_8XY7:
+  {
+    // 8xy5: Vx = Vx - Vy, 8xy7: Vx = Vy - Vx. VF is set first and the
+    // subtraction then reads the registers again, as the handlers do.
+    bool reverse = instr->op == CHIP8_OP_8XY7;
+    ry = reg_use(e, y);
+    rx = reg_use(e, x);
+    emit_alu_rr(e, 0x39, reverse ? ry : rx, reverse ? rx : ry); // cmp
+    emit_setcc_eax(e, CC_A);
+    rf = reg_def(e, 0xF);
+    emit_alu_rr(e, 0x89, rf, RAX);
+    rx = reg_use(e, x);
+    ry = reg_use(e, y);
+    emit_alu_rr(e, 0x89, RAX, reverse ? ry : rx);
+    emit_alu_rr(e, 0x29, RAX, reverse ? rx : ry); // sub
+    emit_alu_ri(e, 4, RAX, 0xFF);
+    rx = reg_def(e, x);
+    emit_alu_rr(e, 0x89, rx, RAX);
+    return false;
+  }
+
+  case CHIP8_OP_8XY6:
+  case CHIP8_OP_8XYE:
+  {
+    bool left = instr->op == CHIP8_OP_8XYE;
+    rx = reg_use(e, x);
+    emit_alu_rr(e, 0x89, RAX, rx);
+    if (left)
+      emit_shift_ri(e, 5, RAX, 7); // MSB
+    else
+      emit_alu_ri(e, 4, RAX, 0x01); // LSB
+    rf = reg_def(e, 0xF);
+    emit_alu_rr(e, 0x89, rf, RAX);
+    rx = reg_mod(e, x);
+    emit_shift_ri(e, left ? 4 : 5, rx, 1);
+    if (left)
+      emit_alu_ri(e, 4, rx, 0xFF);
+    return false;
+  }
+
+  case CHIP8_OP_ANNN:
+    rx = reg_def(e, JIT_REG_I);
+    emit_mov_ri(e, rx, instr->nnn);
+    return false;
+
+  case CHIP8_OP_FX1E:
+    rx = reg_use(e, x);
+    ry = reg_mod(e, JIT_REG_I);
+    emit_alu_rr(e, 0x01, ry, rx);
+    emit_alu_ri(e, 4, ry, 0xFFFF);
+    return false;
+
+  case CHIP8_OP_FX29:
+    rx = reg_use(e, x);
+    emit_alu_rr(e, 0x89, RAX, rx);
+    emit8(e, 0x8D), emit8(e, 0x04), emit8(e, 0x80); // lea eax, [rax+rax*4]
+    emit_alu_ri(e, 0, RAX, FONTSET_START_ADDRESS);
+    ry = reg_def(e, JIT_REG_I);
+    emit_alu_rr(e, 0x89, ry, RAX);
+    return false;
+
+  // Timer reads, RNG and loads stay in C; execution continues after
+  case CHIP8_OP_CXKK:
+  case CHIP8_OP_FX07:
+  case CHIP8_OP_FX65:
+    emit_call_handler(e, chip8, addr);
+    return false;
+
+  // Control flow, key checks, stores and anything that can stop chip8_run()
+  // (drawing, timer writes, unknown opcodes) end the block
+  default:
+    emit_call_handler(e, chip8, addr);
+    return true;
+  }
+}
+
+// Event a block-ending instruction raises, mirroring chip8_run()
+static chip8_exit_reason_t jit_stop_reason(uint8_t op)
+{
+  switch (op)
+  {
+  case CHIP8_OP_INVALID:
+    return CHIP8_EXIT_INVALID;
+  case CHIP8_OP_00E0:
+  case CHIP8_OP_DXYN:
+    return CHIP8_EXIT_DRAW;
+  case CHIP8_OP_FX0A:
+    return CHIP8_EXIT_KEY_WAIT;
+  case CHIP8_OP_FX15:
+  case CHIP8_OP_FX18:
+    return CHIP8_EXIT_TIMER;
+  default:
+    return CHIP8_EXIT_BUDGET;
+  }
+}
+
+static void jit_flush(chip8_jit_t *jit)
+{
+  memset(jit->blocks, 0, sizeof(jit->blocks));
+  memset(jit->covered, 0, sizeof(jit->covered));
+  jit->code_used = jit->trampoline_size;
+  ++jit->stats.flushes;
+}
+
+static jit_emit_t jit_emitter(chip8_jit_t *jit)
+{
+  jit_emit_t e;
+  e.buf = jit->code + jit->code_used;
+  e.len = 0;
+  memset(e.host, -1, sizeof(e.host));
+  memset(e.dirty, 0, sizeof(e.dirty));
+  e.in_use = 0;
+  return e;
+}
+
+static jit_block_t *jit_compile(chip8_jit_t *jit, uint16_t start)
+{
+  chip8_t *chip8 = jit->chip8;
+
+  if (jit->code_used + JIT_BLOCK_RESERVE > JIT_CODE_SIZE)
+  {
+    jit_flush(jit);
+  }
+
+  if (mprotect(jit->code, JIT_CODE_SIZE, PROT_READ | PROT_WRITE) != 0)
+  {
+    return NULL;
+  }
+
+  jit_emit_t e = jit_emitter(jit);
+
+  uint16_t addr = start;
+  uint16_t length = 0;
+  uint8_t write_len = 0;
+  chip8_exit_reason_t stop = CHIP8_EXIT_BUDGET;
+  bool idle = false;
+  for (;;)
+  {
+    const chip8_instr_t *instr = &chip8->decoded[addr >> 1];
+    bool ends = emit_instr(&e, chip8, addr);
+    ++length;
+    addr += 2;
+
+    if (ends)
+    {
+      if (instr->op == CHIP8_OP_FX55)
+        write_len = instr->x + 1;
+      else if (instr->op == CHIP8_OP_FX33)
+        write_len = 3;
+      stop = jit_stop_reason(instr->op);
+      idle = instr->op == CHIP8_OP_FX0A ||
+             (instr->op == CHIP8_OP_1NNN && instr->nnn <= addr - 2 &&
+              addr - 2 - instr->nnn < CHIP8_IDLE_LOOP_MAX * 2);
+      break;
+    }
+
+    if (length == JIT_BLOCK_MAX || addr >= MEMORY_SIZE)
+    {
+      reg_flush(&e);
+      emit_store_imm16(&e, offsetof(chip8_t, pc), addr);
+      break;
+    }
+  }
+
+  // Leave chip8->opcode as the interpreter would after the last instruction
+  emit_store_imm16(&e, offsetof(chip8_t, opcode),
+                   chip8->decoded[(addr - 2) >> 1].opcode);
+
+  if (write_len || stop != CHIP8_EXIT_BUDGET || idle)
+  {
+    // Hand control back to C so it can check the store against the cache,
+    // report the event or look for an idle loop
+    emit8(&e, 0x66), emit8(&e, 0x41); // mov word [r14+d], slot
+    emit8(&e, 0xC7), emit8(&e, 0x86);
+    emit32(&e, (uint32_t)offsetof(chip8_jit_t, exit_block));
+    emit8(&e, (uint8_t)(start >> 1)), emit8(&e, (uint8_t)(start >> 9));
+    emit_jmp(&e, jit->dispatch_exit);
+  }
+  else
+  {
+    emit_jmp(&e, jit->dispatch_loop);
+  }
+
+  mprotect(jit->code, JIT_CODE_SIZE, PROT_READ | PROT_EXEC);
+
+  for (uint16_t slot = start >> 1; slot < addr >> 1; ++slot)
+  {
+    jit->covered[slot] = 1;
+  }
+
+  jit_block_t *block = &jit->blocks[start >> 1];
+  block->entry = e.buf;
+  block->length = length;
+  block->write_len = write_len;
+  block->stop = (uint8_t)stop;
+  block->idle = idle;
+  jit->code_used += (e.len + 15) & ~(size_t)15;
+  ++jit->stats.blocks_compiled;
+  return block;
+}
+
+// Flush translated code if a store of len bytes at I hit any of it
+static void jit_check_write(chip8_jit_t *jit, uint8_t len)
+{
+  uint16_t index = jit->chip8->index;
+  for (uint8_t i = 0; i < len; ++i)
+  {
+    if (jit->covered[((index + i) & 0x0FFFu) >> 1])
+    {
+      jit_flush(jit);
+      return;
+    }
+  }
+}
+
+static uint16_t jit_opcode_at(const chip8_t *chip8, uint16_t pc)
+{
+  return (uint16_t)(chip8->memory[pc & 0x0FFFu] << 8 |
+                    chip8->memory[(pc + 1) & 0x0FFFu]);
+}
+
+// Interpret one instruction, tracking stores into translated code
+static chip8_exit_reason_t jit_interpret(chip8_jit_t *jit, chip8_exit_t *step)
+{
+  chip8_t *chip8 = jit->chip8;
+  uint16_t opcode = jit_opcode_at(chip8, chip8->pc);
+
+  chip8_exit_reason_t reason = chip8_run(chip8, 1, step);
+  ++jit->stats.interpreted_instructions;
+
+  if ((opcode & 0xF0FFu) == 0xF055u)
+    jit_check_write(jit, ((opcode & 0x0F00u) >> 8u) + 1);
+  else if ((opcode & 0xF0FFu) == 0xF033u)
+    jit_check_write(jit, 3);
+  return reason;
+}
+
+static chip8_exit_reason_t jit_finish(chip8_exit_t *result,
+                                      chip8_exit_reason_t reason,
+                                      uint32_t executed, uint32_t idle,
+                                      uint16_t pc, uint16_t opcode)
+{
+  if (result)
+  {
+    result->reason = reason;
+    result->cycles = executed;
+    result->idle_cycles = idle;
+    result->pc = pc;
+    result->opcode = opcode;
+  }
+  return reason;
+}
+
+chip8_jit_t *chip8_jit_create(chip8_t *chip8)
+{
+  chip8_jit_t *jit = (chip8_jit_t *)calloc(1, sizeof(chip8_jit_t));
+  if (jit == NULL)
+  {
+    return NULL;
+  }
+
+  void *code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (code == MAP_FAILED)
+  {
+    free(jit);
+    return NULL;
+  }
+
+  jit->chip8 = chip8;
+  jit->code = (uint8_t *)code;
+  jit->exit_block = JIT_NO_EXIT;
+
+  jit_emit_t e = jit_emitter(jit);
+  emit_trampoline(jit, &e);
+  jit->trampoline_size = (e.len + 15) & ~(size_t)15;
+  jit->code_used = jit->trampoline_size;
+  memcpy(&jit->trampoline, &code, sizeof(jit->trampoline)); // data -> code
+
+  if (mprotect(code, JIT_CODE_SIZE, PROT_READ | PROT_EXEC) != 0)
+  {
+    munmap(code, JIT_CODE_SIZE);
+    free(jit);
+    return NULL;
+  }
+
+  return jit;
+}
+
+void chip8_jit_destroy(chip8_jit_t *jit)
+{
+  if (jit == NULL)
+  {
+    return;
+  }
+  munmap(jit->code, JIT_CODE_SIZE);
+  free(jit);
+}
+
+chip8_exit_reason_t chip8_jit_run(chip8_jit_t *jit, uint32_t max_cycles,
+                                  chip8_exit_t *result)
+{
+  chip8_t *chip8 = jit->chip8;
+
+  // Drop blocks whose code was rewritten by a ROM load or a restore
+  if (chip8->rewritten_begin < chip8->rewritten_end)
+  {
+    chip8_jit_invalidate(jit, chip8->rewritten_begin,
+                         chip8->rewritten_end - chip8->rewritten_begin);
+    chip8->rewritten_begin = chip8->rewritten_end = 0;
+  }
+
+  // Translated blocks do not check breakpoints, record traces or count
+  // profiles; let the interpreter do all three. Nothing watches its stores
+  // for translated code, so drop that code first.
+  if (chip8->breakpoint_count != 0 || chip8->trace != NULL ||
+      chip8->profile != NULL)
+  {
+    if (jit->code_used != jit->trampoline_size)
+    {
+      jit_flush(jit);
+    }
+    chip8_exit_t local;
+    chip8_exit_t *out = result ? result : &local;
+    chip8_exit_reason_t reason = chip8_run(chip8, max_cycles, out);
+    jit->stats.interpreted_instructions += out->cycles - out->idle_cycles;
+    jit->stats.idle_instructions += out->idle_cycles;
+    return reason;
+  }
+
+  uint32_t count = max_cycles;
+  uint32_t idle = 0;
+  while (count)
+  {
+    uint32_t left = jit->trampoline(chip8, jit, count);
+    jit->stats.native_instructions += count - left;
+    chip8->cycles += count - left;
+    count = left;
+
+    if (jit->exit_block != JIT_NO_EXIT)
+    {
+      // Copy what we need before a flush clears the block
+      uint16_t start = (uint16_t)(jit->exit_block << 1);
+      const jit_block_t *block = &jit->blocks[jit->exit_block];
+      uint16_t last = (uint16_t)(start + (block->length - 1) * 2);
+      chip8_exit_reason_t stop = (chip8_exit_reason_t)block->stop;
+      uint8_t write_len = block->write_len;
+      bool loops = block->idle;
+      jit->exit_block = JIT_NO_EXIT;
+
+      if (write_len)
+      {
+        jit_check_write(jit, write_len);
+      }
+
+      if (stop != CHIP8_EXIT_BUDGET && (chip8->stop_mask & (1u << stop)) &&
+          (stop != CHIP8_EXIT_KEY_WAIT || chip8->pc == last))
+      {
+        return jit_finish(result, stop, max_cycles - count, 0, last,
+                          chip8->opcode);
+      }
+
+      if (loops && (idle = chip8_skip_idle(chip8, last, count)) != 0)
+      {
+        jit->stats.idle_instructions += idle;
+        chip8->cycles += idle;
+        count = 0;
+      }
+      continue;
+    }
+
+    if (count == 0)
+    {
+      break;
+    }
+
+    // The trampoline stopped at something it cannot dispatch on its own
+    uint16_t pc = chip8->pc;
+    if ((pc & 0xF001u) == 0 && jit->blocks[pc >> 1].entry == NULL)
+    {
+      ++jit->stats.cache_misses;
+      if (jit_compile(jit, pc) != NULL)
+      {
+        continue;
+      }
+    }
+
+    // Odd pc, failed translation or a block longer than the budget left:
+    // step one instruction so the executed count stays exact
+    chip8_exit_t step;
+    chip8_exit_reason_t reason = jit_interpret(jit, &step);
+    --count;
+    if (reason != CHIP8_EXIT_BUDGET)
+    {
+      return jit_finish(result, reason, max_cycles - count, 0, step.pc,
+                        step.opcode);
+    }
+  }
+
+  return jit_finish(result, CHIP8_EXIT_BUDGET, max_cycles, idle, chip8->pc,
+                    jit_opcode_at(chip8, chip8->pc));
+}
+
+void chip8_jit_invalidate(chip8_jit_t *jit, uint16_t addr, uint16_t len)
+{
+  for (uint32_t a = addr; a < (uint32_t)addr + len && a < MEMORY_SIZE; ++a)
+  {
+    if (jit->covered[a >> 1])
+    {
+      jit_flush(jit);
+      return;
+    }
+  }
+}
+
+#else
+
+struct chip8_jit
+{
+  chip8_t *chip8;
+  chip8_jit_stats_t stats;
+};
+
+chip8_jit_t *chip8_jit_create(chip8_t *chip8)
+{
+  chip8_jit_t *jit = (chip8_jit_t *)calloc(1, sizeof(chip8_jit_t));
+  if (jit != NULL)
+  {
+    jit->chip8 = chip8;
+  }
+  return jit;
+}
+
+void chip8_jit_destroy(chip8_jit_t *jit) { free(jit); }
+
+chip8_exit_reason_t chip8_jit_run(chip8_jit_t *jit, uint32_t max_cycles,
+                                  chip8_exit_t *result)
+{
+  chip8_exit_t local;
+  chip8_exit_t *out = result ? result : &local;
+  chip8_exit_reason_t reason = chip8_run(jit->chip8, max_cycles, out);
+  jit->stats.interpreted_instructions += out->cycles - out->idle_cycles;
+  jit->stats.idle_instructions += out->idle_cycles;
+  return reason;
+}
+
+void chip8_jit_invalidate(chip8_jit_t *jit, uint16_t addr, uint16_t len)
+{
+  (void)jit;
+  (void)addr;
+  (void)len;
+}
+
+#endif
+
+void chip8_jit_stats(const chip8_jit_t *jit, chip8_jit_stats_t *stats)
+{
+  *stats = jit->stats;
+#if CHIP8_JIT_AVAILABLE
+  stats->cache_hits = jit->block_entries - jit->stats.cache_misses;
+#endif
+}
@@ -0,0 +1,89 @@
+#ifndef CHIP8_JIT_H
+#define CHIP8_JIT_H
+
+#include "chip8.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// The native translator targets x86-64 System V hosts only. Everywhere else
+// the API below is still available and simply runs the interpreter.
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#define CHIP8_JIT_AVAILABLE 1
+#else
+#define CHIP8_JIT_AVAILABLE 0
+#endif
+
+/**
+ * @brief Counters describing how much work the JIT has done.
+ */
+typedef struct
+{
+  uint64_t blocks_compiled;          // Basic blocks translated to native code
+  uint64_t cache_hits;               // Block entries served from the cache
+  uint64_t cache_misses;             // Block entries that needed translating
+  uint64_t flushes;                  // Code cache flushes (SMC or cache full)
+  uint64_t native_instructions;      // Instructions run inside native blocks
+  uint64_t interpreted_instructions; // Instructions run by the interpreter
+  uint64_t idle_instructions;        // Instructions skipped in idle loops
+} chip8_jit_stats_t;
+
+typedef struct chip8_jit chip8_jit_t;
+
+/**
+ * @brief Create a JIT bound to one CHIP-8 instance.
+ *
+ * Translated blocks reference the instance directly, so a JIT must not be
+ * shared between instances.
+ *
+ * @param chip8 Pointer to the CHIP-8 state structure.
+ * @return chip8_jit_t* New JIT, or NULL if executable memory is unavailable.
+ */
+chip8_jit_t *chip8_jit_create(chip8_t *chip8);
+
+/**
+ * @brief Release a JIT and its code cache.
+ *
+ * @param jit JIT to destroy (may be NULL).
+ */
+void chip8_jit_destroy(chip8_jit_t *jit);
+
+/**
+ * @brief chip8_run() for a JIT-backed instance, translating hot blocks.
+ *
+ * Stops for the same reasons and reports the same chip8_exit_t as
+ * chip8_run(). Blocks that do not fit in the remaining budget, odd program
+ * counters, active breakpoints and hosts without JIT support fall back to
+ * the interpreter. So does an attached tracer or profiler. A run that falls
+ * back for breakpoints, a tracer or a profiler first drops all translated
+ * code, since its stores are not checked against it.
+ *
+ * @param jit JIT created for the instance to run.
+ * @param max_cycles Maximum number of instructions to execute.
+ * @param result Optional destination for the stop details (may be NULL).
+ * @return chip8_exit_reason_t Why the run stopped.
+ */
+chip8_exit_reason_t chip8_jit_run(chip8_jit_t *jit, uint32_t max_cycles,
+                                  chip8_exit_t *result);
+
+/**
+ * @brief Drop translated code covering a range of memory.
+ *
+ * Writes made by Fx33/Fx55, load_rom(), chip8_invalidate() and
+ * chip8_restore() are tracked automatically; embedders call this after
+ * writing memory directly without chip8_invalidate().
+ *
+ * @param jit JIT to invalidate.
+ * @param addr First address that changed.
+ * @param len Number of bytes that changed.
+ */
+void chip8_jit_invalidate(chip8_jit_t *jit, uint16_t addr, uint16_t len);
+
+/**
+ * @brief Read the JIT counters.
+ *
+ * @param jit JIT to query.
+ * @param stats Destination for the counters.
+ */
+void chip8_jit_stats(const chip8_jit_t *jit, chip8_jit_stats_t *stats);
+
+#endif // !CHIP8_JIT_H
@@ -0,0 +1,540 @@
+#include "chip8_lanes.h"
+#include "chip8_internal.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Loop over every lane slot. Running the full fixed width, used or not,
+// keeps the trip count constant so the loops vectorize cleanly.
+#define FOR_LANES(l) for (uint32_t l = 0; l < CHIP8_LANES; ++l)
+
+// value where the lane mask is 1, old where it is 0, without branching
+#define LANE_SELECT(T, old, value, m)                                          \
+  (T)((old) ^ (((old) ^ (value)) & (T)((T)0 - (T)(m))))
+
+void chip8_lanes_init(chip8_lanes_t *lanes, uint32_t count,
+                      const uint32_t *seeds)
+{
+  memset(lanes, 0, sizeof(*lanes));
+  lanes->count = count > CHIP8_LANES ? CHIP8_LANES : count;
+
+  for (uint32_t l = 0; l < lanes->count; ++l)
+  {
+    lanes->pc[l] = START_ADDRESS;
+    // Same rule as rng_seed(): zero would lock Xorshift32 at zero
+    lanes->rng_state[l] = seeds[l] ? seeds[l] : 1;
+    memcpy(&lanes->memory[l][FONTSET_START_ADDRESS], chip8_fontset,
+           FONTSET_SIZE);
+  }
+}
+
+int chip8_lanes_load_rom(chip8_lanes_t *lanes, const char *filename)
+{
+  FILE *fptr = fopen(filename, "rb");
+  if (fptr == NULL)
+  {
+    return -1;
+  }
+
+  uint8_t rom[MEMORY_SIZE - START_ADDRESS + 1];
+  size_t size = fread(rom, 1, sizeof(rom), fptr);
+  fclose(fptr);
+
+  // Same limit as load_rom(): 0x200 to 0xFFF
+  if (size > MEMORY_SIZE - START_ADDRESS)
+  {
+    return -1;
+  }
+
+  for (uint32_t l = 0; l < lanes->count; ++l)
+  {
+    memcpy(&lanes->memory[l][START_ADDRESS], rom, size);
+  }
+  return 0;
+}
+
+void chip8_lanes_set_keys(chip8_lanes_t *lanes, uint32_t lane, uint16_t keys)
+{
+  if (lane < CHIP8_LANES)
+  {
+    lanes->keys[lane] = keys;
+  }
+}
+
+void chip8_lanes_update_timers(chip8_lanes_t *lanes)
+{
+  FOR_LANES(l)
+  {
+    lanes->delay_timer[l] -= lanes->delay_timer[l] > 0;
+    lanes->sound_timer[l] -= lanes->sound_timer[l] > 0;
+  }
+}
+
+// DRW Vx, Vy, nibble for one lane, as op_Dxyn()
+static void lane_draw(chip8_lanes_t *lanes, uint32_t l,
+                      const chip8_instr_t *instr)
+{
+  uint8_t height = instr->n;
+  uint8_t xPos = lanes->registers[instr->x][l] % DISPLAY_WIDTH;
+  uint8_t yPos = lanes->registers[instr->y][l] % DISPLAY_HEIGHT;
+
+  if (height > DISPLAY_HEIGHT - yPos)
+  {
+    height = DISPLAY_HEIGHT - yPos;
+  }
+
+  uint64_t collision = 0;
+  for (unsigned int i = 0; i < height; ++i)
+  {
+    uint8_t byte = lanes->memory[l][(lanes->index[l] + i) & 0x0FFFu];
+    uint64_t sprite = ((uint64_t)byte << 56) >> xPos;
+    uint64_t *row = &lanes->display[yPos + i][l];
+
+    collision |= *row & sprite;
+    *row ^= sprite;
+  }
+
+  lanes->registers[0xF][l] = collision != 0;
+}
+
+/**
+ * @brief Draw for lanes that all put the same sprite address at the same spot.
+ *
+ * Converged lanes usually do, and then each sprite row touches one display
+ * row across all lanes, so the lanes can be the inner loop.
+ *
+ * @return bool false if the masked lanes disagree; nothing has been drawn.
+ */
+static bool lanes_draw_uniform(chip8_lanes_t *restrict lanes,
+                               const chip8_instr_t *instr,
+                               const uint8_t *restrict mask, const uint8_t *a,
+                               const uint8_t *b)
+{
+  uint32_t first = 0;
+  while (!mask[first])
+  {
+    ++first;
+  }
+
+  uint8_t xPos = a[first] % DISPLAY_WIDTH;
+  uint8_t yPos = b[first] % DISPLAY_HEIGHT;
+  uint16_t index = lanes->index[first];
+  uint8_t differ = 0;
+  FOR_LANES(l)
+  {
+    differ |= mask[l] & ((a[l] % DISPLAY_WIDTH != xPos) |
+                         (b[l] % DISPLAY_HEIGHT != yPos) |
+                         (lanes->index[l] != index));
+  }
+  if (differ)
+  {
+    return false;
+  }
+
+  uint8_t height = instr->n;
+  if (height > DISPLAY_HEIGHT - yPos)
+  {
+    height = DISPLAY_HEIGHT - yPos;
+  }
+
+  uint64_t collision[CHIP8_LANES] = {0};
+  for (unsigned int i = 0; i < height; ++i)
+  {
+    uint16_t addr = (index + i) & 0x0FFFu;
+    uint64_t *row = lanes->display[yPos + i];
+    FOR_LANES(l)
+    {
+      uint64_t sprite = ((uint64_t)lanes->memory[l][addr] << 56) >> xPos;
+      sprite &= 0 - (uint64_t)mask[l];
+      collision[l] |= row[l] & sprite;
+      row[l] ^= sprite;
+    }
+  }
+
+  uint8_t *vf = lanes->registers[0xF];
+  FOR_LANES(l)
+  {
+    vf[l] = LANE_SELECT(uint8_t, vf[l], collision[l] != 0, mask[l]);
+  }
+  return true;
+}
+
+// VF is written before Vx and the scalar handlers reread their operands in
+// between, so x or y == F sees the new flag. Reload the operand copies.
+static inline void store_flag(chip8_lanes_t *restrict lanes,
+                              const chip8_instr_t *instr,
+                              const uint8_t *restrict mask, const uint8_t *flag,
+                              uint8_t *a, uint8_t *b)
+{
+  uint8_t *vf = lanes->registers[0xF];
+  FOR_LANES(l) { vf[l] = LANE_SELECT(uint8_t, vf[l], flag[l], mask[l]); }
+  memcpy(a, lanes->registers[instr->x], CHIP8_LANES);
+  memcpy(b, lanes->registers[instr->y], CHIP8_LANES);
+}
+
+/**
+ * @brief Execute one decoded instruction on every lane in the mask.
+ *
+ * Register, timer and pc updates run across all lanes with the mask blended
+ * in. Vx and Vy are copied out first and every loop writes a single array,
+ * so the compiler can vectorize without alias checks. Stack, memory and
+ * display accesses whose addresses differ per lane fall back to a scalar
+ * loop over the masked lanes.
+ */
+static void lanes_execute(chip8_lanes_t *restrict lanes,
+                          const chip8_instr_t *instr,
+                          const uint8_t *restrict mask)
+{
+  uint8_t a[CHIP8_LANES], b[CHIP8_LANES], flag[CHIP8_LANES];
+  uint8_t *vx = lanes->registers[instr->x];
+  uint16_t *pc = lanes->pc;
+  memcpy(a, vx, sizeof(a));
+  memcpy(b, lanes->registers[instr->y], sizeof(b));
+
+  switch (instr->op)
+  {
+  case CHIP8_OP_0NNN:
+  case CHIP8_OP_1NNN:
+    FOR_LANES(l) { pc[l] = LANE_SELECT(uint16_t, pc[l], instr->nnn, mask[l]); }
+    break;
+  case CHIP8_OP_00E0:
+    for (unsigned int y = 0; y < DISPLAY_HEIGHT; ++y)
+    {
+      FOR_LANES(l)
+      {
+        lanes->display[y][l] =
+            LANE_SELECT(uint64_t, lanes->display[y][l], 0, mask[l]);
+      }
+    }
+    break;
+  case CHIP8_OP_00EE:
+    FOR_LANES(l)
+    {
+      if (mask[l])
+      {
+        // Wraps like the scalar core
+        --lanes->sp[l];
+        pc[l] = lanes->stack[lanes->sp[l] & (STACK_SIZE - 1)][l];
+      }
+    }
+    break;
+  case CHIP8_OP_2NNN:
+    FOR_LANES(l)
+    {
+      if (mask[l])
+      {
+        lanes->stack[lanes->sp[l] & (STACK_SIZE - 1)][l] = pc[l];
+        ++lanes->sp[l];
+        pc[l] = instr->nnn;
+      }
+    }
+    break;
+  case CHIP8_OP_3XKK:
+    FOR_LANES(l) { pc[l] += (uint16_t)((mask[l] & (a[l] == instr->kk)) << 1); }
+    break;
+  case CHIP8_OP_4XKK:
+    FOR_LANES(l) { pc[l] += (uint16_t)((mask[l] & (a[l] != instr->kk)) << 1); }
+    break;
+  case CHIP8_OP_5XY0:
+    FOR_LANES(l) { pc[l] += (uint16_t)((mask[l] & (a[l] == b[l])) << 1); }
+    break;
+  case CHIP8_OP_6XKK:
+    FOR_LANES(l) { vx[l] = LANE_SELECT(uint8_t, a[l], instr->kk, mask[l]); }
+    break;
+  case CHIP8_OP_7XKK:
+    FOR_LANES(l)
+    {
+      vx[l] = LANE_SELECT(uint8_t, a[l], a[l] + instr->kk, mask[l]);
+    }
+    break;
+  case CHIP8_OP_8XY0:
+    FOR_LANES(l) { vx[l] = LANE_SELECT(uint8_t, a[l], b[l], mask[l]); }
+    break;
+  case CHIP8_OP_8XY1:
+    FOR_LANES(l) { vx[l] = LANE_SELECT(uint8_t, a[l], a[l] | b[l], mask[l]); }
+    break;
+  case CHIP8_OP_8XY2:
+    FOR_LANES(l) { vx[l] = LANE_SELECT(uint8_t, a[l], a[l] & b[l], mask[l]); }
+    break;
+  case CHIP8_OP_8XY3:
+    FOR_LANES(l) { vx[l] = LANE_SELECT(uint8_t, a[l], a[l] ^ b[l], mask[l]); }
+    break;
+  case CHIP8_OP_8XY4:
+  {
+    // The sum is taken before VF changes
+    uint8_t sum[CHIP8_LANES];
+    FOR_LANES(l)
+    {
+      flag[l] = a[l] + b[l] > 0xFF;
+      sum[l] = (uint8_t)(a[l] + b[l]);
+    }
+    store_flag(lanes, instr, mask, flag, a, b);
+    FOR_LANES(l) { vx[l] = LANE_SELECT(uint8_t, a[l], sum[l], mask[l]); }
+    break;
+  }
+  case CHIP8_OP_8XY5:
+    FOR_LANES(l) { flag[l] = a[l] > b[l]; }
+    store_flag(lanes, instr, mask, flag, a, b);
+    FOR_LANES(l) { vx[l] = LANE_SELECT(uint8_t, a[l], a[l] - b[l], mask[l]); }
+    break;
+  case CHIP8_OP_8XY6:
+    FOR_LANES(l) { flag[l] = a[l] & 0x01u; }
+    store_flag(lanes, instr, mask, flag, a, b);
+    FOR_LANES(l) { vx[l] = LANE_SELECT(uint8_t, a[l], a[l] >> 1u, mask[l]); }
+    break;
+  case CHIP8_OP_8XY7:
+    FOR_LANES(l) { flag[l] = b[l] > a[l]; }
+    store_flag(lanes, instr, mask, flag, a, b);
+    FOR_LANES(l) { vx[l] = LANE_SELECT(uint8_t, a[l], b[l] - a[l], mask[l]); }
+    break;
+  case CHIP8_OP_8XYE:
+    FOR_LANES(l) { flag[l] = a[l] >> 7u; }
+    store_flag(lanes, instr, mask, flag, a, b);
+    FOR_LANES(l) { vx[l] = LANE_SELECT(uint8_t, a[l], a[l] << 1u, mask[l]); }
+    break;
+  case CHIP8_OP_9XY0:
+    FOR_LANES(l) { pc[l] += (uint16_t)((mask[l] & (a[l] != b[l])) << 1); }
+    break;
+  case CHIP8_OP_ANNN:
+    FOR_LANES(l)
+    {
+      lanes->index[l] =
+          LANE_SELECT(uint16_t, lanes->index[l], instr->nnn, mask[l]);
+    }
+    break;
+  case CHIP8_OP_BNNN:
+    FOR_LANES(l)
+    {
+      pc[l] = LANE_SELECT(uint16_t, pc[l], instr->nnn + lanes->registers[0][l],
+                          mask[l]);
+    }
+    break;
+  case CHIP8_OP_CXKK:
+  {
+    uint8_t random[CHIP8_LANES];
+    FOR_LANES(l)
+    {
+      // Xorshift32, as rng_byte()
+      uint32_t state = lanes->rng_state[l];
+      state ^= state << 13;
+      state ^= state >> 17;
+      state ^= state << 5;
+      lanes->rng_state[l] =
+          LANE_SELECT(uint32_t, lanes->rng_state[l], state, mask[l]);
+      random[l] = (uint8_t)state;
+    }
+    FOR_LANES(l)
+    {
+      vx[l] = LANE_SELECT(uint8_t, a[l], random[l] & instr->kk, mask[l]);
+    }
+    break;
+  }
+  case CHIP8_OP_DXYN:
+    if (lanes_draw_uniform(lanes, instr, mask, a, b))
+    {
+      break;
+    }
+    FOR_LANES(l)
+    {
+      if (mask[l])
+      {
+        lane_draw(lanes, l, instr);
+      }
+    }
+    break;
+  case CHIP8_OP_EX9E:
+    FOR_LANES(l)
+    {
+      uint8_t held = (lanes->keys[l] >> (a[l] & 0x0Fu)) & 1u;
+      pc[l] += (uint16_t)((mask[l] & held) << 1);
+    }
+    break;
+  case CHIP8_OP_EXA1:
+    FOR_LANES(l)
+    {
+      uint8_t held = (lanes->keys[l] >> (a[l] & 0x0Fu)) & 1u;
+      pc[l] += (uint16_t)((mask[l] & (held ^ 1u)) << 1);
+    }
+    break;
+  case CHIP8_OP_FX07:
+    memcpy(b, lanes->delay_timer, sizeof(b));
+    FOR_LANES(l) { vx[l] = LANE_SELECT(uint8_t, a[l], b[l], mask[l]); }
+    break;
+  case CHIP8_OP_FX0A:
+    FOR_LANES(l)
+    {
+      if (!mask[l])
+      {
+        continue;
+      }
+      if (lanes->keys[l] == 0)
+      {
+        pc[l] -= 2; // No key pressed, repeat this instruction
+        continue;
+      }
+      // Lowest held key wins, as in op_Fx0A()
+      uint8_t key = 0;
+      while (!((lanes->keys[l] >> key) & 1u))
+      {
+        ++key;
+      }
+      vx[l] = key;
+    }
+    break;
+  case CHIP8_OP_FX15:
+    FOR_LANES(l)
+    {
+      lanes->delay_timer[l] =
+          LANE_SELECT(uint8_t, lanes->delay_timer[l], a[l], mask[l]);
+    }
+    break;
+  case CHIP8_OP_FX18:
+    FOR_LANES(l)
+    {
+      lanes->sound_timer[l] =
+          LANE_SELECT(uint8_t, lanes->sound_timer[l], a[l], mask[l]);
+    }
+    break;
+  case CHIP8_OP_FX1E:
+    FOR_LANES(l)
+    {
+      lanes->index[l] = LANE_SELECT(uint16_t, lanes->index[l],
+                                    lanes->index[l] + a[l], mask[l]);
+    }
+    break;
+  case CHIP8_OP_FX29:
+    FOR_LANES(l)
+    {
+      lanes->index[l] = LANE_SELECT(uint16_t, lanes->index[l],
+                                    FONTSET_START_ADDRESS + a[l] * 5, mask[l]);
+    }
+    break;
+  case CHIP8_OP_FX33:
+    FOR_LANES(l)
+    {
+      if (mask[l])
+      {
+        uint16_t index = lanes->index[l];
+        lanes->memory[l][(index + 2) & 0x0FFFu] = a[l] % 10;
+        lanes->memory[l][(index + 1) & 0x0FFFu] = (a[l] / 10) % 10;
+        lanes->memory[l][index & 0x0FFFu] = a[l] / 100;
+      }
+    }
+    break;
+  case CHIP8_OP_FX55:
+    FOR_LANES(l)
+    {
+      if (mask[l])
+      {
+        for (int i = 0; i <= instr->x; ++i)
+        {
+          lanes->memory[l][(lanes->index[l] + i) & 0x0FFFu] =
+              lanes->registers[i][l];
+        }
+      }
+    }
+    break;
+  case CHIP8_OP_FX65:
+    FOR_LANES(l)
+    {
+      if (mask[l])
+      {
+        for (int i = 0; i <= instr->x; ++i)
+        {
+          lanes->registers[i][l] =
+              lanes->memory[l][(lanes->index[l] + i) & 0x0FFFu];
+        }
+      }
+    }
+    break;
+  default: // CHIP8_OP_INVALID: no-op, as in cycle()
+    break;
+  }
+}
+
+void chip8_lanes_run(chip8_lanes_t *lanes, uint32_t cycles)
+{
+  for (; cycles > 0; --cycles)
+  {
+    uint16_t opcode[CHIP8_LANES];
+    uint8_t pending[CHIP8_LANES];
+
+    // Every lane fetches from its own memory, so self-modifying code and
+    // lanes that wrote different data are handled like any divergence
+    FOR_LANES(l)
+    {
+      uint16_t pc = lanes->pc[l];
+      opcode[l] = lanes->memory[l][pc & 0x0FFFu] << 8 |
+                  lanes->memory[l][(pc + 1) & 0x0FFFu];
+    }
+
+    // pc moves past the instruction before it executes, on every lane
+    FOR_LANES(l)
+    {
+      pending[l] = l < lanes->count;
+      lanes->pc[l] += (uint16_t)(pending[l] << 1);
+      lanes->opcode[l] =
+          LANE_SELECT(uint16_t, lanes->opcode[l], opcode[l], pending[l]);
+    }
+
+    // Group lanes by opcode rather than pc: pc-relative effects are per
+    // lane anyway, and lanes at different addresses often run the same code
+    for (uint32_t first = 0; first < lanes->count; ++first)
+    {
+      if (!pending[first])
+      {
+        continue;
+      }
+
+      uint8_t mask[CHIP8_LANES];
+      uint16_t op = opcode[first];
+      FOR_LANES(l)
+      {
+        mask[l] = pending[l] & (opcode[l] == op);
+        pending[l] ^= mask[l];
+      }
+
+      chip8_instr_t instr;
+      decode_instr(op, &instr);
+      lanes_execute(lanes, &instr, mask);
+      ++lanes->groups;
+    }
+
+    ++lanes->cycles;
+  }
+}
+
+void chip8_lanes_extract(const chip8_lanes_t *lanes, uint32_t lane,
+                         chip8_t *chip8)
+{
+  init_chip8(chip8, lanes->rng_state[lane]);
+
+  for (unsigned int i = 0; i < V_REG_COUNT; ++i)
+  {
+    chip8->registers[i] = lanes->registers[i][lane];
+  }
+  for (unsigned int i = 0; i < STACK_SIZE; ++i)
+  {
+    chip8->stack[i] = lanes->stack[i][lane];
+  }
+  for (unsigned int y = 0; y < DISPLAY_HEIGHT; ++y)
+  {
+    chip8->display[y] = lanes->display[y][lane];
+  }
+  for (unsigned int key = 0; key < KEYS_COUNT; ++key)
+  {
+    chip8->keypad[key] = (lanes->keys[lane] >> key) & 1u;
+  }
+
+  chip8->index = lanes->index[lane];
+  chip8->pc = lanes->pc[lane];
+  chip8->opcode = lanes->opcode[lane];
+  chip8->sp = lanes->sp[lane];
+  chip8->delay_timer = lanes->delay_timer[lane];
+  chip8->sound_timer = lanes->sound_timer[lane];
+  chip8->cycles = lanes->cycles;
+
+  memcpy(chip8->memory, lanes->memory[lane], MEMORY_SIZE);
+  chip8_invalidate(chip8, 0, MEMORY_SIZE);
+}
@@ -0,0 +1,100 @@
+#ifndef CHIP8_LANES_H
+#define CHIP8_LANES_H
+
+#include "chip8.h"
+#include <stdint.h>
+
+// Instances stepped together. 32 byte lanes fill one AVX2 register.
+#ifndef CHIP8_LANES
+#define CHIP8_LANES 32
+#endif
+
+/**
+ * @brief Many CHIP-8 instances stored structure-of-arrays and run in lockstep.
+ *
+ * Every per-instance field is indexed [field][lane] so one instruction
+ * applied to all lanes touches contiguous memory, and the lane loops compile
+ * to vector code. Memory stays one 4K image per lane because addresses
+ * diverge. Lanes that fetch different opcodes are regrouped and each group
+ * is executed in turn, so results match stepping each lane with cycle().
+ */
+typedef struct chip8_lanes
+{
+  uint8_t registers[16][CHIP8_LANES];
+  uint16_t index[CHIP8_LANES];
+  uint16_t pc[CHIP8_LANES];
+  uint16_t opcode[CHIP8_LANES];
+  uint8_t delay_timer[CHIP8_LANES];
+  uint8_t sound_timer[CHIP8_LANES];
+  uint8_t sp[CHIP8_LANES];
+  uint16_t stack[STACK_SIZE][CHIP8_LANES];
+  uint16_t keys[CHIP8_LANES]; // Bit k set when key k is held
+  uint32_t rng_state[CHIP8_LANES];
+  uint64_t display[DISPLAY_HEIGHT][CHIP8_LANES];
+
+  uint32_t count;  // Lanes in use, the rest are left untouched
+  uint64_t cycles; // Instructions executed by each lane
+  uint64_t groups; // Lane groups executed; equals cycles while lanes agree
+
+  uint8_t memory[CHIP8_LANES][MEMORY_SIZE];
+} chip8_lanes_t;
+
+/**
+ * @brief Reset every lane as init_chip8() would.
+ *
+ * @param lanes Pointer to the lane set.
+ * @param count Number of lanes to use, at most CHIP8_LANES.
+ * @param seeds One RNG seed per lane.
+ */
+void chip8_lanes_init(chip8_lanes_t *lanes, uint32_t count,
+                      const uint32_t *seeds);
+
+/**
+ * @brief Load the same ROM into every lane.
+ *
+ * @param lanes Pointer to the lane set.
+ * @param filename Path to the ROM file.
+ * @return int 0 on success, -1 if the file could not be read or is too large.
+ */
+int chip8_lanes_load_rom(chip8_lanes_t *lanes, const char *filename);
+
+/**
+ * @brief Set the keys held on one lane.
+ *
+ * @param lanes Pointer to the lane set.
+ * @param lane Lane index.
+ * @param keys Bit k set when key k is held.
+ */
+void chip8_lanes_set_keys(chip8_lanes_t *lanes, uint32_t lane, uint16_t keys);
+
+/**
+ * @brief Execute the same number of instructions on every lane.
+ *
+ * Each lane ends up exactly where calling cycle() @p cycles times on an
+ * equivalent chip8_t would leave it.
+ *
+ * @param lanes Pointer to the lane set.
+ * @param cycles Instructions to execute per lane.
+ */
+void chip8_lanes_run(chip8_lanes_t *lanes, uint32_t cycles);
+
+/**
+ * @brief Tick the delay and sound timers of every lane.
+ *
+ * @param lanes Pointer to the lane set.
+ */
+void chip8_lanes_update_timers(chip8_lanes_t *lanes);
+
+/**
+ * @brief Copy one lane out into an ordinary instance.
+ *
+ * The result can be hashed, rendered or run further with the scalar core.
+ *
+ * @param lanes Pointer to the lane set.
+ * @param lane Lane index.
+ * @param chip8 Destination instance; it is reinitialized.
+ */
+void chip8_lanes_extract(const chip8_lanes_t *lanes, uint32_t lane,
+                         chip8_t *chip8);
+
+#endif // !CHIP8_LANES_H
@@ -0,0 +1,597 @@
+#include "chip8_movie.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// File layout, all integers little-endian:
+//   header   "C8MV", u16 version, u16 0, u32 snapshot size,
+//            u32 keyframe interval, u32 seed, u32 0, u64 start hash
+//   records  varint (value << 2 | kind), then:
+//              MOVIE_FRAME       nothing; value is the frame's instructions
+//              MOVIE_FRAME_KEYS  u16 key mask held from this frame on
+//              MOVIE_KEYFRAME    snapshot bytes; value is 0
+//              MOVIE_KEYS        u16 key mask held from the value-th
+//                                instruction of the next frame record on
+//   index    u64 offset of each keyframe record
+//   trailer  "C8IX", u32 frames, u32 keyframes, u32 0, u64 index offset,
+//            u64 final hash
+// Frame 0 starts with a keyframe and every keyframe_interval frames end
+// with one, so keyframe k holds the state at the start of frame k * interval.
+// A frame's MOVIE_KEYS records come before its frame record, in order; a
+// frame with any of them ends in a MOVIE_FRAME. Version 1 had no MOVIE_KEYS.
+
+#define MOVIE_VERSION 2
+#define MOVIE_OLDEST_VERSION 1
+#define MOVIE_HEADER_SIZE 32
+#define MOVIE_TRAILER_SIZE 32
+#define MOVIE_DEFAULT_KEYFRAME_INTERVAL 600 // Ten seconds at 60 fps
+
+enum
+{
+  MOVIE_FRAME = 0,
+  MOVIE_FRAME_KEYS = 1,
+  MOVIE_KEYFRAME = 2,
+  MOVIE_KEYS = 3,
+};
+
+struct chip8_recorder
+{
+  FILE *file;
+  uint64_t offset; // Bytes written so far
+  bool failed;     // A write came up short
+
+  uint32_t keyframe_interval;
+  uint32_t frames;
+  uint64_t cycles; // chip8->cycles at the end of the last frame
+  uint16_t keys;   // Key mask last recorded
+  bool changed;    // Keys were recorded within the current frame
+
+  uint64_t *index; // Offsets of the keyframe records
+  uint32_t keyframes;
+  uint32_t index_capacity;
+};
+
+struct chip8_movie
+{
+  uint8_t *data; // Whole file
+  size_t size;
+  size_t body_end; // End of the records
+
+  chip8_movie_info_t info;
+  uint64_t *index;
+
+  size_t pos;     // Next record to play
+  uint32_t frame; // Frame that record starts
+
+  chip8_recorder_t *forward; // Gets the key changes played, or NULL
+};
+
+static void put_le(uint8_t *out, uint64_t value, int bytes)
+{
+  for (int i = 0; i < bytes; ++i)
+  {
+    out[i] = (uint8_t)(value >> (8 * i));
+  }
+}
+
+static uint64_t get_le(const uint8_t *in, int bytes)
+{
+  uint64_t value = 0;
+  for (int i = 0; i < bytes; ++i)
+  {
+    value |= (uint64_t)in[i] << (8 * i);
+  }
+  return value;
+}
+
+static uint16_t keypad_mask(const chip8_t *chip8)
+{
+  uint16_t keys = 0;
+  for (int key = 0; key < KEYS_COUNT; ++key)
+  {
+    keys |= (uint16_t)((chip8->keypad[key] != 0) << key);
+  }
+  return keys;
+}
+
+static void recorder_write(chip8_recorder_t *recorder, const void *data,
+                           size_t size)
+{
+  if (fwrite(data, 1, size, recorder->file) != size)
+  {
+    recorder->failed = true;
+  }
+  recorder->offset += size;
+}
+
+static void recorder_record(chip8_recorder_t *recorder, uint64_t value,
+                            uint32_t kind)
+{
+  uint8_t bytes[10];
+  int size = 0;
+  value = value << 2 | kind;
+  do
+  {
+    bytes[size++] = (uint8_t)((value & 0x7F) | (value > 0x7F ? 0x80 : 0));
+    value >>= 7;
+  } while (value != 0);
+  recorder_write(recorder, bytes, (size_t)size);
+}
+
+static void recorder_keyframe(chip8_recorder_t *recorder, const chip8_t *chip8)
+{
+  if (recorder->keyframes == recorder->index_capacity)
+  {
+    uint32_t capacity = recorder->index_capacity * 2;
+    uint64_t *index =
+        (uint64_t *)realloc(recorder->index, capacity * sizeof(uint64_t));
+    if (index == NULL)
+    {
+      recorder->failed = true;
+      return;
+    }
+    recorder->index = index;
+    recorder->index_capacity = capacity;
+  }
+  recorder->index[recorder->keyframes++] = recorder->offset;
+
+  chip8_snapshot_t snapshot;
+  chip8_snapshot(chip8, &snapshot);
+  recorder_record(recorder, 0, MOVIE_KEYFRAME);
+  recorder_write(recorder, snapshot.data, CHIP8_SNAPSHOT_SIZE);
+}
+
+chip8_recorder_t *chip8_recorder_create(const char *path, const chip8_t *chip8,
+                                        uint32_t seed,
+                                        uint32_t keyframe_interval)
+{
+  chip8_recorder_t *recorder =
+      (chip8_recorder_t *)calloc(1, sizeof(chip8_recorder_t));
+  if (recorder == NULL)
+  {
+    return NULL;
+  }
+  recorder->index_capacity = 64;
+  recorder->index = (uint64_t *)malloc(64 * sizeof(uint64_t));
+  recorder->file = fopen(path, "wb");
+  if (recorder->index == NULL || recorder->file == NULL)
+  {
+    if (recorder->file)
+    {
+      fclose(recorder->file);
+    }
+    free(recorder->index);
+    free(recorder);
+    return NULL;
+  }
+
+  recorder->keyframe_interval = keyframe_interval
+                                    ? keyframe_interval
+                                    : MOVIE_DEFAULT_KEYFRAME_INTERVAL;
+  recorder->cycles = chip8->cycles;
+  recorder->keys = keypad_mask(chip8);
+
+  uint8_t header[MOVIE_HEADER_SIZE] = {'C', '8', 'M', 'V'};
+  put_le(&header[4], MOVIE_VERSION, 2);
+  put_le(&header[8], CHIP8_SNAPSHOT_SIZE, 4);
+  put_le(&header[12], recorder->keyframe_interval, 4);
+  put_le(&header[16], seed, 4);
+  put_le(&header[24], chip8_hash_state(chip8), 8);
+  recorder_write(recorder, header, sizeof(header));
+  recorder_keyframe(recorder, chip8);
+  return recorder;
+}
+
+void chip8_recorder_keys(chip8_recorder_t *recorder, const chip8_t *chip8)
+{
+  uint16_t keys = keypad_mask(chip8);
+  if (keys == recorder->keys)
+  {
+    return;
+  }
+
+  uint8_t mask[2];
+  put_le(mask, keys, 2);
+  recorder_record(recorder, chip8->cycles - recorder->cycles, MOVIE_KEYS);
+  recorder_write(recorder, mask, sizeof(mask));
+  recorder->keys = keys;
+  recorder->changed = true;
+}
+
+void chip8_recorder_frame(chip8_recorder_t *recorder, const chip8_t *chip8)
+{
+  // Keys changed without chip8_recorder_keys() count from the frame's start,
+  // unless they changed with it too; then only the end is known
+  if (recorder->changed)
+  {
+    chip8_recorder_keys(recorder, chip8);
+  }
+  recorder->changed = false;
+
+  uint64_t cycles = chip8->cycles - recorder->cycles;
+  uint16_t keys = keypad_mask(chip8);
+  recorder->cycles = chip8->cycles;
+
+  if (keys != recorder->keys)
+  {
+    uint8_t mask[2];
+    put_le(mask, keys, 2);
+    recorder_record(recorder, cycles, MOVIE_FRAME_KEYS);
+    recorder_write(recorder, mask, sizeof(mask));
+    recorder->keys = keys;
+  }
+  else
+  {
+    recorder_record(recorder, cycles, MOVIE_FRAME);
+  }
+
+  if (++recorder->frames % recorder->keyframe_interval == 0)
+  {
+    recorder_keyframe(recorder, chip8);
+  }
+}
+
+int chip8_recorder_close(chip8_recorder_t *recorder, const chip8_t *chip8)
+{
+  if (recorder == NULL)
+  {
+    return 0;
+  }
+
+  uint64_t index_offset = recorder->offset;
+  for (uint32_t i = 0; i < recorder->keyframes; ++i)
+  {
+    uint8_t offset[8];
+    put_le(offset, recorder->index[i], 8);
+    recorder_write(recorder, offset, sizeof(offset));
+  }
+
+  uint8_t trailer[MOVIE_TRAILER_SIZE] = {'C', '8', 'I', 'X'};
+  put_le(&trailer[4], recorder->frames, 4);
+  put_le(&trailer[8], recorder->keyframes, 4);
+  put_le(&trailer[16], index_offset, 8);
+  put_le(&trailer[24], chip8_hash_state(chip8), 8);
+  recorder_write(recorder, trailer, sizeof(trailer));
+
+  int result = recorder->failed ? -1 : 0;
+  if (fclose(recorder->file) != 0)
+  {
+    result = -1;
+  }
+  free(recorder->index);
+  free(recorder);
+  return result;
+}
+
+/**
+ * @brief Decode the record at *pos.
+ *
+ * @return bool false if the record runs past the end of the records.
+ */
+static bool movie_record(const chip8_movie_t *movie, size_t *pos,
+                         uint64_t *value, uint32_t *kind)
+{
+  uint64_t bits = 0;
+  for (int shift = 0;; shift += 7)
+  {
+    if (*pos >= movie->body_end || shift > 63)
+    {
+      return false;
+    }
+    uint8_t byte = movie->data[(*pos)++];
+    bits |= (uint64_t)(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0)
+    {
+      break;
+    }
+  }
+  *value = bits >> 2;
+  *kind = (uint32_t)(bits & 3);
+
+  size_t payload = *kind == MOVIE_FRAME_KEYS || *kind == MOVIE_KEYS ? 2
+                   : *kind == MOVIE_KEYFRAME ? CHIP8_SNAPSHOT_SIZE
+                                             : 0;
+  return movie->body_end - *pos >= payload;
+}
+
+// Read the trailer and index, if the recorder got to write them
+static bool movie_load_index(chip8_movie_t *movie)
+{
+  if (movie->size < MOVIE_HEADER_SIZE + MOVIE_TRAILER_SIZE)
+  {
+    return false;
+  }
+  const uint8_t *trailer = &movie->data[movie->size - MOVIE_TRAILER_SIZE];
+  if (memcmp(trailer, "C8IX", 4) != 0)
+  {
+    return false;
+  }
+
+  uint32_t frames = (uint32_t)get_le(&trailer[4], 4);
+  uint32_t keyframes = (uint32_t)get_le(&trailer[8], 4);
+  uint64_t index_offset = get_le(&trailer[16], 8);
+  uint32_t interval = movie->info.keyframe_interval;
+  if (keyframes != frames / interval + 1 || index_offset < MOVIE_HEADER_SIZE ||
+      index_offset + (uint64_t)keyframes * 8 + MOVIE_TRAILER_SIZE !=
+          movie->size)
+  {
+    return false;
+  }
+
+  movie->index = (uint64_t *)malloc(keyframes * sizeof(uint64_t));
+  if (movie->index == NULL)
+  {
+    return false;
+  }
+  for (uint32_t i = 0; i < keyframes; ++i)
+  {
+    movie->index[i] = get_le(&movie->data[index_offset + 8 * i], 8);
+    if (movie->index[i] + 1 + CHIP8_SNAPSHOT_SIZE > index_offset)
+    {
+      free(movie->index);
+      movie->index = NULL;
+      return false;
+    }
+  }
+
+  movie->body_end = (size_t)index_offset;
+  movie->info.frames = frames;
+  movie->info.keyframes = keyframes;
+  movie->info.final_hash = get_le(&trailer[24], 8);
+  movie->info.complete = true;
+  return true;
+}
+
+// Rebuild the index of a movie that was cut short, up to its last whole frame
+static bool movie_scan(chip8_movie_t *movie)
+{
+  movie->body_end = movie->size;
+  uint32_t capacity = 64;
+  movie->index = (uint64_t *)malloc(capacity * sizeof(uint64_t));
+  if (movie->index == NULL)
+  {
+    return false;
+  }
+
+  uint32_t interval = movie->info.keyframe_interval;
+  uint32_t frames = 0;
+  uint32_t keyframes = 0;
+  size_t end = MOVIE_HEADER_SIZE; // End of the last whole frame
+  size_t pos = MOVIE_HEADER_SIZE;
+  uint64_t value;
+  uint32_t kind;
+  while (movie_record(movie, &pos, &value, &kind))
+  {
+    if (kind == MOVIE_KEYS)
+    {
+      pos += 2;
+      continue;
+    }
+    if (kind != MOVIE_KEYFRAME)
+    {
+      pos += kind == MOVIE_FRAME_KEYS ? 2 : 0;
+      ++frames;
+      end = pos;
+      continue;
+    }
+
+    // Keyframes only ever follow every interval-th frame
+    if (frames != keyframes * interval)
+    {
+      break;
+    }
+    if (keyframes == capacity)
+    {
+      capacity *= 2;
+      uint64_t *index =
+          (uint64_t *)realloc(movie->index, capacity * sizeof(uint64_t));
+      if (index == NULL)
+      {
+        return false;
+      }
+      movie->index = index;
+    }
+    movie->index[keyframes++] = pos - 1;
+    pos += CHIP8_SNAPSHOT_SIZE;
+    end = pos;
+  }
+
+  // Frames past the last whole keyframe replay from the one before it
+  if (keyframes == 0)
+  {
+    return false;
+  }
+  movie->body_end = end;
+  movie->info.frames = frames;
+  movie->info.keyframes = keyframes;
+  movie->info.complete = false;
+  return true;
+}
+
+chip8_movie_t *chip8_movie_open(const char *path)
+{
+  FILE *file = fopen(path, "rb");
+  if (file == NULL)
+  {
+    return NULL;
+  }
+
+  chip8_movie_t *movie = (chip8_movie_t *)calloc(1, sizeof(chip8_movie_t));
+  long size = -1;
+  if (movie != NULL && fseek(file, 0, SEEK_END) == 0)
+  {
+    size = ftell(file);
+    rewind(file);
+  }
+  if (movie != NULL && size >= MOVIE_HEADER_SIZE)
+  {
+    movie->size = (size_t)size;
+    movie->data = (uint8_t *)malloc(movie->size);
+  }
+  bool read = movie != NULL && movie->data != NULL &&
+              fread(movie->data, 1, movie->size, file) == movie->size;
+  fclose(file);
+
+  const uint8_t *header = read ? movie->data : NULL;
+  if (header == NULL || memcmp(header, "C8MV", 4) != 0 ||
+      get_le(&header[4], 2) < MOVIE_OLDEST_VERSION ||
+      get_le(&header[4], 2) > MOVIE_VERSION ||
+      get_le(&header[8], 4) != CHIP8_SNAPSHOT_SIZE ||
+      get_le(&header[12], 4) == 0)
+  {
+    chip8_movie_close(movie);
+    return NULL;
+  }
+  movie->info.keyframe_interval = (uint32_t)get_le(&header[12], 4);
+  movie->info.seed = (uint32_t)get_le(&header[16], 4);
+  movie->info.start_hash = get_le(&header[24], 8);
+
+  if (!movie_load_index(movie) && !movie_scan(movie))
+  {
+    chip8_movie_close(movie);
+    return NULL;
+  }
+  movie->pos = (size_t)movie->index[0];
+  return movie;
+}
+
+void chip8_movie_close(chip8_movie_t *movie)
+{
+  if (movie == NULL)
+  {
+    return;
+  }
+  free(movie->data);
+  free(movie->index);
+  free(movie);
+}
+
+void chip8_movie_info(const chip8_movie_t *movie, chip8_movie_info_t *info)
+{
+  *info = movie->info;
+}
+
+bool chip8_movie_seek(chip8_movie_t *movie, chip8_t *chip8, uint32_t frame)
+{
+  if (frame > movie->info.frames)
+  {
+    return false;
+  }
+
+  uint32_t keyframe = frame / movie->info.keyframe_interval;
+  if (keyframe >= movie->info.keyframes)
+  {
+    keyframe = movie->info.keyframes - 1;
+  }
+
+  chip8_snapshot_t snapshot;
+  size_t pos = (size_t)movie->index[keyframe];
+  uint64_t value;
+  uint32_t kind;
+  if (!movie_record(movie, &pos, &value, &kind) || kind != MOVIE_KEYFRAME)
+  {
+    return false;
+  }
+  memcpy(snapshot.data, &movie->data[pos], CHIP8_SNAPSHOT_SIZE);
+  chip8_restore(chip8, &snapshot);
+  movie->pos = pos + CHIP8_SNAPSHOT_SIZE;
+  movie->frame = keyframe * movie->info.keyframe_interval;
+
+  while (movie->frame < frame)
+  {
+    if (!chip8_movie_play_frame(movie, chip8))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void movie_set_keys(const chip8_movie_t *movie, chip8_t *chip8,
+                           size_t pos)
+{
+  uint16_t keys = (uint16_t)get_le(&movie->data[pos], 2);
+  for (int key = 0; key < KEYS_COUNT; ++key)
+  {
+    chip8->keypad[key] = (keys >> key) & 1u;
+  }
+}
+
+// Run exactly this many instructions; breakpoints may still split the run,
+// but never stop it
+static void movie_run(chip8_t *chip8, uint64_t cycles)
+{
+  uint32_t stop_mask = chip8->stop_mask;
+  chip8->stop_mask = 0;
+  while (cycles > 0)
+  {
+    chip8_exit_t stop;
+    chip8_run(chip8, cycles > UINT32_MAX ? UINT32_MAX : (uint32_t)cycles,
+              &stop);
+    cycles -= stop.cycles;
+  }
+  chip8->stop_mask = stop_mask;
+}
+
+bool chip8_movie_play_frame(chip8_movie_t *movie, chip8_t *chip8)
+{
+  if (movie->frame >= movie->info.frames)
+  {
+    return false;
+  }
+
+  // Key changes within the frame first, each at its instruction
+  uint64_t ran = 0;
+  uint64_t value;
+  uint32_t kind;
+  for (;;)
+  {
+    if (!movie_record(movie, &movie->pos, &value, &kind))
+    {
+      return false;
+    }
+    if (kind == MOVIE_KEYFRAME)
+    {
+      // The state already matches any keyframe passed on the way
+      movie->pos += CHIP8_SNAPSHOT_SIZE;
+      continue;
+    }
+    if (kind != MOVIE_KEYS)
+    {
+      break;
+    }
+    if (value > ran)
+    {
+      movie_run(chip8, value - ran);
+      ran = value;
+    }
+    movie_set_keys(movie, chip8, movie->pos);
+    movie->pos += 2;
+    if (movie->forward)
+    {
+      chip8_recorder_keys(movie->forward, chip8);
+    }
+  }
+
+  if (kind == MOVIE_FRAME_KEYS)
+  {
+    movie_set_keys(movie, chip8, movie->pos);
+    movie->pos += 2;
+  }
+  movie_run(chip8, value > ran ? value - ran : 0);
+
+  update_timers(chip8);
+  ++movie->frame;
+  return true;
+}
+
+void chip8_movie_forward_keys(chip8_movie_t *movie,
+                              chip8_recorder_t *recorder)
+{
+  movie->forward = recorder;
+}
+
+uint32_t chip8_movie_position(const chip8_movie_t *movie)
+{
+  return movie->frame;
+}
@@ -0,0 +1,159 @@
+#ifndef CHIP8_MOVIE_H
+#define CHIP8_MOVIE_H
+
+#include "chip8.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Input movies record a run so it can be replayed exactly.
+ *
+ * A movie starts with the whole machine state, seed and RNG included, and then
+ * stores one record per frame: the instructions the frame ran and, when they
+ * changed, the keys held during it. Key changes reported with
+ * chip8_recorder_keys() are stored instead with the instruction of the frame
+ * they happened before, so presses and releases within a frame replay exactly.
+ * Timers tick once at the end of each frame, as in the frontends. Every
+ * keyframe_interval frames the whole state is stored again, and an index of
+ * those keyframes at the end of the file lets a player seek to any frame by
+ * restoring the keyframe before it and replaying at most keyframe_interval
+ * frames.
+ *
+ * Keyframes are raw snapshots, so a movie only plays back on builds with the
+ * same CHIP8_SNAPSHOT_SIZE.
+ */
+
+/**
+ * @brief What a movie file holds.
+ */
+typedef struct
+{
+  uint32_t seed;              // RNG seed the recording started from
+  uint32_t frames;            // Frames recorded
+  uint32_t keyframes;         // Whole states stored, including frame 0
+  uint32_t keyframe_interval; // Frames between keyframes
+  uint64_t start_hash;        // chip8_hash_state() when recording started
+  uint64_t final_hash;        // chip8_hash_state() after the last frame
+  bool complete;              // false if the recording was cut short; the
+                              // frames up to the cut still play
+} chip8_movie_info_t;
+
+typedef struct chip8_recorder chip8_recorder_t;
+typedef struct chip8_movie chip8_movie_t;
+
+/**
+ * @brief Start recording a movie from the current state of an instance.
+ *
+ * @param path File to write.
+ * @param chip8 Instance as it is before the first frame, ROM loaded.
+ * @param seed Seed the instance was initialised with, kept for reference.
+ * @param keyframe_interval Frames between keyframes (0 picks a default).
+ * @return chip8_recorder_t* New recorder, or NULL if the file cannot be
+ * written.
+ */
+chip8_recorder_t *chip8_recorder_create(const char *path, const chip8_t *chip8,
+                                        uint32_t seed,
+                                        uint32_t keyframe_interval);
+
+/**
+ * @brief Record a key change at the current instruction.
+ *
+ * Call after changing chip8->keypad and before running on. Callers that only
+ * change keys between frames need not call it.
+ *
+ * @param recorder Recorder to append to.
+ * @param chip8 Instance the recording started from.
+ */
+void chip8_recorder_keys(chip8_recorder_t *recorder, const chip8_t *chip8);
+
+/**
+ * @brief Record one frame.
+ *
+ * Call once per frame after update_timers(). Keys changed since the last
+ * chip8_recorder_keys() are recorded from the start of the frame, as if held
+ * while all of it ran; in a frame that already recorded changes, they are
+ * recorded at its end.
+ *
+ * @param recorder Recorder to append to.
+ * @param chip8 Instance the recording started from.
+ */
+void chip8_recorder_frame(chip8_recorder_t *recorder, const chip8_t *chip8);
+
+/**
+ * @brief Write the keyframe index, close the file and free the recorder.
+ *
+ * @param recorder Recorder to finish (may be NULL).
+ * @param chip8 Instance the recording started from, for the final hash.
+ * @return int 0 on success, -1 if any write failed.
+ */
+int chip8_recorder_close(chip8_recorder_t *recorder, const chip8_t *chip8);
+
+/**
+ * @brief Load a movie for playback.
+ *
+ * A file without an index, e.g. from a recorder that never closed, is
+ * scanned instead and plays up to its last whole frame.
+ *
+ * @param path File to read.
+ * @return chip8_movie_t* New movie, or NULL if the file is missing, is not
+ * a movie or was recorded by a build with a different state layout.
+ */
+chip8_movie_t *chip8_movie_open(const char *path);
+
+/**
+ * @brief Free a movie.
+ *
+ * @param movie Movie to free (may be NULL).
+ */
+void chip8_movie_close(chip8_movie_t *movie);
+
+/**
+ * @brief Describe a movie.
+ *
+ * @param movie Movie to query.
+ * @param info Destination for the description.
+ */
+void chip8_movie_info(const chip8_movie_t *movie, chip8_movie_info_t *info);
+
+/**
+ * @brief Put an instance in the state it had at the start of a frame.
+ *
+ * Restores the nearest keyframe at or before @p frame and replays forward
+ * from there. The next chip8_movie_play_frame() plays @p frame.
+ *
+ * @param movie Movie to seek in.
+ * @param chip8 Instance to restore into.
+ * @param frame Frame to seek to; movie frames seeks to the end.
+ * @return bool false if @p frame is past the end of the movie.
+ */
+bool chip8_movie_seek(chip8_movie_t *movie, chip8_t *chip8, uint32_t frame);
+
+/**
+ * @brief Play the next frame: set its keys, run it and tick the timers.
+ *
+ * chip8->stop_mask is ignored while the frame runs, so it always runs the
+ * recorded number of instructions.
+ *
+ * @param movie Movie to play.
+ * @param chip8 Instance positioned by chip8_movie_seek() or by earlier
+ * frames.
+ * @return bool false once every frame has been played.
+ */
+bool chip8_movie_play_frame(chip8_movie_t *movie, chip8_t *chip8);
+
+/**
+ * @brief Pass the key changes of the frames played from now on to a
+ * recorder, so a recording of the playback keeps them at their instructions.
+ *
+ * @param movie Movie being played.
+ * @param recorder Recorder that also gets each played frame, or NULL to stop.
+ */
+void chip8_movie_forward_keys(chip8_movie_t *movie,
+                              chip8_recorder_t *recorder);
+
+/**
+ * @brief Number of the frame chip8_movie_play_frame() plays next.
+ */
+uint32_t chip8_movie_position(const chip8_movie_t *movie);
+
+#endif // !CHIP8_MOVIE_H
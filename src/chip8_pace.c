@@ -0,0 +1,151 @@
+#define _POSIX_C_SOURCE 200809L
+#include "chip8_pace.h"
+#include <errno.h>
+#include <time.h>
+
+#define NS_PER_SECOND 1000000000ull
+#define PACE_INITIAL_MARGIN_NS 1000000u // Until the host's oversleep is known
+#define PACE_MIN_MARGIN_NS 20000u
+#define PACE_MARGIN_DECAY 16 // Excess margin given back per frame: 1/16
+
+uint64_t chip8_pace_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * NS_PER_SECOND + (uint64_t)ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t target)
+{
+#if defined(__APPLE__)
+  // No clock_nanosleep(); a relative sleep is as good once the margin adapts
+  uint64_t now = chip8_pace_now();
+  if (target <= now)
+  {
+    return;
+  }
+  struct timespec ts = {(time_t)((target - now) / NS_PER_SECOND),
+                        (long)((target - now) % NS_PER_SECOND)};
+  nanosleep(&ts, NULL);
+#else
+  struct timespec ts = {(time_t)(target / NS_PER_SECOND),
+                        (long)(target % NS_PER_SECOND)};
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+  {
+  }
+#endif
+}
+
+void chip8_pacer_init(chip8_pacer_t *pacer, uint64_t period_ns)
+{
+  uint64_t now = chip8_pace_now();
+  pacer->period_ns = period_ns;
+  pacer->deadline = now + period_ns;
+  pacer->margin_ns = PACE_INITIAL_MARGIN_NS;
+  pacer->last_frame = now;
+  pacer->total_ns = 0;
+  pacer->frames = 0;
+  pacer->max_ns = 0;
+  for (uint32_t i = 0; i < CHIP8_PACE_BUCKETS; ++i)
+  {
+    pacer->histogram[i] = 0;
+  }
+}
+
+void chip8_pacer_wait(chip8_pacer_t *pacer)
+{
+  uint64_t now = chip8_pace_now();
+  if (pacer->deadline > now + pacer->margin_ns)
+  {
+    uint64_t target = pacer->deadline - pacer->margin_ns;
+    sleep_until(target);
+
+    // Grow the margin at once when the host oversleeps more than it allows,
+    // give the excess back slowly otherwise
+    uint64_t woke = chip8_pace_now();
+    uint64_t oversleep = woke > target ? woke - target : 0;
+    if (oversleep > pacer->margin_ns)
+    {
+      pacer->margin_ns = oversleep;
+    }
+    else
+    {
+      pacer->margin_ns -= (pacer->margin_ns - oversleep) / PACE_MARGIN_DECAY;
+    }
+    if (pacer->margin_ns < PACE_MIN_MARGIN_NS)
+    {
+      pacer->margin_ns = PACE_MIN_MARGIN_NS;
+    }
+  }
+
+  while (chip8_pace_now() < pacer->deadline)
+  {
+  }
+  chip8_pacer_mark(pacer);
+}
+
+void chip8_pacer_mark(chip8_pacer_t *pacer)
+{
+  uint64_t now = chip8_pace_now();
+  chip8_pacer_record(pacer, now - pacer->last_frame);
+  pacer->last_frame = now;
+
+  pacer->deadline += pacer->period_ns;
+  if (pacer->deadline < now)
+  {
+    pacer->deadline = now + pacer->period_ns;
+  }
+}
+
+void chip8_pacer_record(chip8_pacer_t *pacer, uint64_t frame_ns)
+{
+  uint64_t bucket = frame_ns / CHIP8_PACE_BUCKET_NS;
+  ++pacer->histogram[bucket < CHIP8_PACE_BUCKETS ? bucket
+                                                 : CHIP8_PACE_BUCKETS - 1];
+  pacer->total_ns += frame_ns;
+  ++pacer->frames;
+  if (frame_ns > pacer->max_ns)
+  {
+    pacer->max_ns = frame_ns;
+  }
+}
+
+// Upper edge of the bucket holding the given share of frames, in per mille
+static uint64_t percentile(const chip8_pacer_t *pacer, uint32_t per_mille)
+{
+  uint64_t rank = (pacer->frames * per_mille + 999) / 1000;
+  uint64_t seen = 0;
+  for (uint32_t i = 0; i < CHIP8_PACE_BUCKETS; ++i)
+  {
+    seen += pacer->histogram[i];
+    if (seen >= rank)
+    {
+      uint64_t edge = (uint64_t)(i + 1) * CHIP8_PACE_BUCKET_NS;
+      return edge < pacer->max_ns ? edge : pacer->max_ns;
+    }
+  }
+  return pacer->max_ns;
+}
+
+void chip8_pacer_stats(const chip8_pacer_t *pacer, chip8_pace_stats_t *stats)
+{
+  stats->frames = pacer->frames;
+  stats->mean_ns = pacer->frames ? pacer->total_ns / pacer->frames : 0;
+  stats->p50_ns = pacer->frames ? percentile(pacer, 500) : 0;
+  stats->p99_ns = pacer->frames ? percentile(pacer, 990) : 0;
+  stats->max_ns = pacer->max_ns;
+  stats->margin_ns = pacer->margin_ns;
+}
+
+void chip8_pacer_print(const chip8_pacer_t *pacer, const char *label,
+                       FILE *out)
+{
+  chip8_pace_stats_t stats;
+  chip8_pacer_stats(pacer, &stats);
+  fprintf(out,
+          "%s: %llu frames, mean %.3f ms, p50 %.2f ms, p99 %.2f ms, max %.3f "
+          "ms, sleep margin %.3f ms\n",
+          label, (unsigned long long)stats.frames, (double)stats.mean_ns / 1e6,
+          (double)stats.p50_ns / 1e6, (double)stats.p99_ns / 1e6,
+          (double)stats.max_ns / 1e6, (double)stats.margin_ns / 1e6);
+}
@@ -0,0 +1,109 @@
+#ifndef CHIP8_PACE_H
+#define CHIP8_PACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Frame pacing on the monotonic clock.
+ *
+ * chip8_pacer_wait() sleeps until shortly before the next frame's deadline,
+ * then spins the rest of the way. The sleep stops short by the oversleep the
+ * host has shown recently, so on a loaded machine frames still end within
+ * microseconds of their deadline without spinning for the whole frame.
+ *
+ * Every frame's length goes into a histogram of CHIP8_PACE_BUCKET_NS wide
+ * buckets for jitter statistics.
+ */
+
+#define CHIP8_PACE_BUCKET_NS 10000u // Histogram resolution: 10 us
+#define CHIP8_PACE_BUCKETS 5000u    // Up to 50 ms; longer frames share the last
+
+/**
+ * @brief Frame time statistics.
+ */
+typedef struct
+{
+  uint64_t frames;    // Frames measured
+  uint64_t mean_ns;   // Average frame time
+  uint64_t p50_ns;    // Median, to CHIP8_PACE_BUCKET_NS
+  uint64_t p99_ns;    // 99th percentile, to CHIP8_PACE_BUCKET_NS
+  uint64_t max_ns;    // Longest frame, exact
+  uint64_t margin_ns; // Current sleep margin before the deadline
+} chip8_pace_stats_t;
+
+/**
+ * @brief Frame clock of one frontend.
+ */
+typedef struct
+{
+  uint64_t period_ns;  // Frame length
+  uint64_t deadline;   // When the current frame ends, on chip8_pace_now()
+  uint64_t margin_ns;  // Sleep stops this long before the deadline
+  uint64_t last_frame; // When the previous frame ended
+  uint64_t total_ns;
+  uint64_t frames;
+  uint64_t max_ns;
+  uint32_t histogram[CHIP8_PACE_BUCKETS];
+} chip8_pacer_t;
+
+/**
+ * @brief Read the monotonic clock.
+ *
+ * @return uint64_t Nanoseconds since an arbitrary start.
+ */
+uint64_t chip8_pace_now(void);
+
+/**
+ * @brief Start a frame clock whose first frame begins now.
+ *
+ * @param pacer Pacer to initialise.
+ * @param period_ns Frame length.
+ */
+void chip8_pacer_init(chip8_pacer_t *pacer, uint64_t period_ns);
+
+/**
+ * @brief Wait for the end of the current frame and start the next.
+ *
+ * A frame that overran its deadline by more than a period starts the next
+ * one from now instead of trying to catch up.
+ *
+ * @param pacer Pacer to wait on.
+ */
+void chip8_pacer_wait(chip8_pacer_t *pacer);
+
+/**
+ * @brief End the current frame without waiting, e.g. when VSync paced it.
+ *
+ * @param pacer Pacer to record in.
+ */
+void chip8_pacer_mark(chip8_pacer_t *pacer);
+
+/**
+ * @brief Add one frame time to the histogram.
+ *
+ * @param pacer Pacer to record in.
+ * @param frame_ns Frame time.
+ */
+void chip8_pacer_record(chip8_pacer_t *pacer, uint64_t frame_ns);
+
+/**
+ * @brief Summarise the frame times recorded so far.
+ *
+ * @param pacer Pacer to query.
+ * @param stats Destination for the statistics.
+ */
+void chip8_pacer_stats(const chip8_pacer_t *pacer, chip8_pace_stats_t *stats);
+
+/**
+ * @brief Print the statistics on one line, in milliseconds.
+ *
+ * @param pacer Pacer to report.
+ * @param label What the frames are, printed first.
+ * @param out Stream to write to.
+ */
+void chip8_pacer_print(const chip8_pacer_t *pacer, const char *label,
+                       FILE *out);
+
+#endif // !CHIP8_PACE_H
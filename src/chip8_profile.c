@@ -0,0 +1,331 @@
+#define _POSIX_C_SOURCE 200809L
+#include "chip8_profile.h"
+#include "chip8_internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <x86intrin.h>
+#endif
+
+#define HEATMAP_COLUMNS 64 // Instruction slots per heatmap row
+
+static const char *const op_names[CHIP8_OP_COUNT] = {
+    [CHIP8_OP_INVALID] = "invalid",
+    [CHIP8_OP_0NNN] = "0nnn SYS addr",
+    [CHIP8_OP_00E0] = "00E0 CLS",
+    [CHIP8_OP_00EE] = "00EE RET",
+    [CHIP8_OP_1NNN] = "1nnn JP addr",
+    [CHIP8_OP_2NNN] = "2nnn CALL addr",
+    [CHIP8_OP_3XKK] = "3xkk SE Vx, byte",
+    [CHIP8_OP_4XKK] = "4xkk SNE Vx, byte",
+    [CHIP8_OP_5XY0] = "5xy0 SE Vx, Vy",
+    [CHIP8_OP_6XKK] = "6xkk LD Vx, byte",
+    [CHIP8_OP_7XKK] = "7xkk ADD Vx, byte",
+    [CHIP8_OP_8XY0] = "8xy0 LD Vx, Vy",
+    [CHIP8_OP_8XY1] = "8xy1 OR Vx, Vy",
+    [CHIP8_OP_8XY2] = "8xy2 AND Vx, Vy",
+    [CHIP8_OP_8XY3] = "8xy3 XOR Vx, Vy",
+    [CHIP8_OP_8XY4] = "8xy4 ADD Vx, Vy",
+    [CHIP8_OP_8XY5] = "8xy5 SUB Vx, Vy",
+    [CHIP8_OP_8XY6] = "8xy6 SHR Vx",
+    [CHIP8_OP_8XY7] = "8xy7 SUBN Vx, Vy",
+    [CHIP8_OP_8XYE] = "8xyE SHL Vx",
+    [CHIP8_OP_9XY0] = "9xy0 SNE Vx, Vy",
+    [CHIP8_OP_ANNN] = "Annn LD I, addr",
+    [CHIP8_OP_BNNN] = "Bnnn JP V0, addr",
+    [CHIP8_OP_CXKK] = "Cxkk RND Vx, byte",
+    [CHIP8_OP_DXYN] = "Dxyn DRW Vx, Vy, n",
+    [CHIP8_OP_EX9E] = "Ex9E SKP Vx",
+    [CHIP8_OP_EXA1] = "ExA1 SKNP Vx",
+    [CHIP8_OP_FX07] = "Fx07 LD Vx, DT",
+    [CHIP8_OP_FX0A] = "Fx0A LD Vx, K",
+    [CHIP8_OP_FX15] = "Fx15 LD DT, Vx",
+    [CHIP8_OP_FX18] = "Fx18 LD ST, Vx",
+    [CHIP8_OP_FX1E] = "Fx1E ADD I, Vx",
+    [CHIP8_OP_FX29] = "Fx29 LD F, Vx",
+    [CHIP8_OP_FX33] = "Fx33 LD B, Vx",
+    [CHIP8_OP_FX55] = "Fx55 LD [I], Vx",
+    [CHIP8_OP_FX65] = "Fx65 LD Vx, [I]",
+};
+
+static uint64_t monotonic_ns(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+// The time stamp counter costs a few cycles to read, the system clock tens
+// of nanoseconds; detach converts ticks to nanoseconds either way
+static inline uint64_t profile_ticks(void)
+{
+#if defined(__x86_64__) && defined(__GNUC__)
+  return __rdtsc();
+#else
+  return monotonic_ns();
+#endif
+}
+
+// Hooks called by the table core
+
+void chip8_profile_begin(chip8_profile_t *profile)
+{
+  // Time between runs belongs to the embedder
+  profile->last_tick = profile_ticks();
+}
+
+void chip8_profile_step(chip8_profile_t *profile, const chip8_t *chip8,
+                        uint16_t pc, uint8_t op)
+{
+  uint64_t now = profile_ticks();
+  uint16_t addr = pc & (MEMORY_SIZE - 1);
+  ++profile->instructions;
+  ++profile->op_counts[op];
+  ++profile->pc_counts[addr];
+  profile->pc_ticks[addr] += now - profile->last_tick;
+  profile->last_tick = now;
+
+  // A blocked Fx0A steps back onto itself
+  if (op == CHIP8_OP_FX0A && chip8->pc == pc)
+  {
+    ++profile->key_wait_cycles;
+  }
+}
+
+void chip8_profile_draw(chip8_profile_t *profile, const chip8_t *chip8,
+                        const chip8_instr_t *instr)
+{
+  // Same clipping as op_Dxyn, which may overwrite VF with the collision flag
+  uint8_t xPos = chip8->registers[instr->x] % DISPLAY_WIDTH;
+  uint8_t yPos = chip8->registers[instr->y] % DISPLAY_HEIGHT;
+  uint8_t height = instr->n;
+  if (height > DISPLAY_HEIGHT - yPos)
+  {
+    height = DISPLAY_HEIGHT - yPos;
+  }
+  int visible = DISPLAY_WIDTH - xPos < 8 ? DISPLAY_WIDTH - xPos : 8;
+  uint8_t mask = (uint8_t)(0xFFu << (8 - visible));
+
+  ++profile->draws;
+  for (unsigned int i = 0; i < height; ++i)
+  {
+    uint8_t bits = chip8->memory[(chip8->index + i) & 0x0FFFu] & mask;
+    for (; bits != 0; bits &= (uint8_t)(bits - 1))
+    {
+      ++profile->pixels;
+    }
+  }
+}
+
+void chip8_profile_idle(chip8_profile_t *profile, const chip8_t *chip8,
+                        uint16_t target, uint16_t back_pc, uint32_t count)
+{
+  // The skipped passes run the loop's slots in order from its start
+  uint32_t length = (uint32_t)(back_pc - target) / 2 + 1;
+  for (uint32_t slot = 0; slot < length; ++slot)
+  {
+    uint16_t addr = (uint16_t)(target + slot * 2);
+    uint64_t runs = count / length + (slot < count % length);
+    profile->pc_counts[addr] += runs;
+    profile->op_counts[chip8->decoded[addr >> 1].op] += runs;
+    if (chip8->decoded[addr >> 1].op == CHIP8_OP_FX0A)
+    {
+      profile->key_wait_cycles += runs;
+    }
+  }
+  profile->instructions += count;
+  profile->idle_cycles += count;
+}
+
+// Public API
+
+bool chip8_profile_attach(chip8_t *chip8, chip8_profile_t *profile)
+{
+#if defined(CHIP8_PROFILE)
+  if (chip8->profile != NULL)
+  {
+    return false;
+  }
+  memset(profile, 0, sizeof(*profile));
+  profile->start_ns = monotonic_ns();
+  profile->start_tick = profile_ticks();
+  profile->last_tick = profile->start_tick;
+  chip8->profile = profile;
+  return true;
+#else
+  (void)chip8;
+  (void)profile;
+  return false;
+#endif
+}
+
+void chip8_profile_detach(chip8_t *chip8)
+{
+  chip8_profile_t *profile = chip8->profile;
+  if (profile == NULL)
+  {
+    return;
+  }
+  chip8->profile = NULL;
+
+  uint64_t ticks = profile_ticks() - profile->start_tick;
+  uint64_t ns = monotonic_ns() - profile->start_ns;
+  profile->ns_per_tick = ticks ? (double)ns / (double)ticks : 0.0;
+}
+
+uint64_t chip8_profile_pc_ns(const chip8_profile_t *profile, uint16_t pc)
+{
+  return (uint64_t)((double)profile->pc_ticks[pc & (MEMORY_SIZE - 1)] *
+                        profile->ns_per_tick +
+                    0.5);
+}
+
+static double percent(uint64_t part, uint64_t whole)
+{
+  return whole ? 100.0 * (double)part / (double)whole : 0.0;
+}
+
+static int compare_desc(uint64_t a, uint64_t b)
+{
+  return a < b ? 1 : a > b ? -1 : 0;
+}
+
+static const chip8_profile_t *sort_profile; // qsort has no context argument
+
+static int compare_ops(const void *a, const void *b)
+{
+  const uint8_t *x = (const uint8_t *)a;
+  const uint8_t *y = (const uint8_t *)b;
+  int order = compare_desc(sort_profile->op_counts[*x],
+                           sort_profile->op_counts[*y]);
+  return order ? order : *x - *y;
+}
+
+static int compare_pcs(const void *a, const void *b)
+{
+  const uint16_t *x = (const uint16_t *)a;
+  const uint16_t *y = (const uint16_t *)b;
+  int order = compare_desc(sort_profile->pc_ticks[*x],
+                           sort_profile->pc_ticks[*y]);
+  if (order == 0)
+  {
+    order = compare_desc(sort_profile->pc_counts[*x],
+                         sort_profile->pc_counts[*y]);
+  }
+  return order ? order : *x - *y;
+}
+
+void chip8_profile_report(const chip8_profile_t *profile, FILE *out,
+                          unsigned top)
+{
+  uint64_t ticks = 0;
+  for (int pc = 0; pc < MEMORY_SIZE; ++pc)
+  {
+    ticks += profile->pc_ticks[pc];
+  }
+  double total_ns = (double)ticks * profile->ns_per_tick;
+  uint64_t executed = profile->instructions - profile->idle_cycles;
+
+  fprintf(out, "%llu instructions, %.3f ms host time (%.1f ns each)\n",
+          (unsigned long long)profile->instructions, total_ns / 1e6,
+          executed ? total_ns / (double)executed : 0.0);
+  fprintf(out, "idle loops skipped %llu (%.1f%%), key waits %llu (%.1f%%)\n",
+          (unsigned long long)profile->idle_cycles,
+          percent(profile->idle_cycles, profile->instructions),
+          (unsigned long long)profile->key_wait_cycles,
+          percent(profile->key_wait_cycles, profile->instructions));
+  fprintf(out, "draws %llu, %llu pixels (%.1f per draw)\n\n",
+          (unsigned long long)profile->draws,
+          (unsigned long long)profile->pixels,
+          profile->draws ? (double)profile->pixels / (double)profile->draws
+                         : 0.0);
+
+  // Sorting needs the profile; reports are not printed concurrently
+  sort_profile = profile;
+
+  uint8_t ops[CHIP8_OP_COUNT];
+  for (int op = 0; op < CHIP8_OP_COUNT; ++op)
+  {
+    ops[op] = (uint8_t)op;
+  }
+  qsort(ops, CHIP8_OP_COUNT, sizeof(ops[0]), compare_ops);
+  fprintf(out, "%14s %7s  %s\n", "count", "%", "operation");
+  for (int i = 0; i < CHIP8_OP_COUNT && profile->op_counts[ops[i]]; ++i)
+  {
+    fprintf(out, "%14llu %6.2f%%  %s\n",
+            (unsigned long long)profile->op_counts[ops[i]],
+            percent(profile->op_counts[ops[i]], profile->instructions),
+            op_names[ops[i]]);
+  }
+
+  static uint16_t pcs[MEMORY_SIZE];
+  for (int pc = 0; pc < MEMORY_SIZE; ++pc)
+  {
+    pcs[pc] = (uint16_t)pc;
+  }
+  qsort(pcs, MEMORY_SIZE, sizeof(pcs[0]), compare_pcs);
+  fprintf(out, "\n%5s %14s %7s %12s %7s %9s\n", "pc", "count", "%",
+          "host ns", "%", "ns each");
+  for (unsigned i = 0; i < top && i < MEMORY_SIZE; ++i)
+  {
+    uint16_t pc = pcs[i];
+    uint64_t count = profile->pc_counts[pc];
+    if (count == 0)
+    {
+      break;
+    }
+    uint64_t ns = chip8_profile_pc_ns(profile, pc);
+    fprintf(out, "  %03X %14llu %6.2f%% %12llu %6.2f%% %9.1f\n", pc,
+            (unsigned long long)count, percent(count, profile->instructions),
+            (unsigned long long)ns, total_ns ? 100.0 * (double)ns / total_ns
+                                             : 0.0,
+            (double)ns / (double)count);
+  }
+  sort_profile = NULL;
+}
+
+void chip8_profile_heatmap(const chip8_profile_t *profile, FILE *out)
+{
+  static const char shades[] = " .:-=+*#%@";
+  const int levels = (int)sizeof(shades) - 2;
+
+  // Cells cover two bytes, so an instruction at an odd address still shows
+  uint64_t cells[MEMORY_SIZE / 2];
+  uint64_t hottest = 0;
+  for (int cell = 0; cell < MEMORY_SIZE / 2; ++cell)
+  {
+    cells[cell] = profile->pc_ticks[cell * 2] + profile->pc_ticks[cell * 2 + 1];
+    if (cells[cell] > hottest)
+    {
+      hottest = cells[cell];
+    }
+  }
+
+  fprintf(out, "Host time by address, '%c' lowest to '%c' highest:\n",
+          shades[1], shades[levels]);
+  for (int row = 0; row < MEMORY_SIZE / 2 / HEATMAP_COLUMNS; ++row)
+  {
+    char line[HEATMAP_COLUMNS + 1];
+    for (int column = 0; column < HEATMAP_COLUMNS; ++column)
+    {
+      uint64_t ticks = cells[row * HEATMAP_COLUMNS + column];
+      int shade = 0;
+      if (ticks != 0)
+      {
+        // Two doublings per shade below the hottest cell
+        int below = 0;
+        for (uint64_t t = ticks; t < hottest && below < 2 * levels; t <<= 1)
+        {
+          ++below;
+        }
+        shade = levels - below / 2;
+        shade = shade < 1 ? 1 : shade;
+      }
+      line[column] = shades[shade];
+    }
+    line[HEATMAP_COLUMNS] = '\0';
+    fprintf(out, "%03X |%s|\n", row * HEATMAP_COLUMNS * 2, line);
+  }
+}
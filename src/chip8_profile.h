@@ -0,0 +1,94 @@
+#ifndef CHIP8_PROFILE_H
+#define CHIP8_PROFILE_H
+
+#include "chip8.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Execution profiles show where a ROM spends its instructions and host time.
+ *
+ * Profiling is compiled in with -DCHIP8_PROFILE (make PROFILE=1). Without it
+ * the cores contain no profiling code and chip8_profile_attach() fails.
+ *
+ * A profiled instance runs in the table interpreter; the threaded core and
+ * the JIT hand it over, as they do for traces. Every instruction is counted
+ * by operation and by address. The host time from the end of one instruction
+ * to the end of the next is charged to the address of the second, so the
+ * profiler's own bookkeeping is spread evenly. Instructions of idle loops
+ * skipped by chip8_run() are counted on the loop's addresses and take no
+ * host time.
+ */
+
+/**
+ * @brief Counters gathered while an instance is profiled.
+ */
+typedef struct chip8_profile
+{
+  uint64_t instructions;                // Executed, idle skips included
+  uint64_t op_counts[CHIP8_OP_COUNT];   // Executions per chip8_op_t
+  uint64_t pc_counts[MEMORY_SIZE];      // Executions per address
+  uint64_t pc_ticks[MEMORY_SIZE];       // Host clock ticks per address
+  uint64_t draws;                       // Dxyn executions
+  uint64_t pixels;                      // Sprite pixels Dxyn drew on screen
+  uint64_t key_wait_cycles;             // Fx0A executions that found no key
+  uint64_t idle_cycles;                 // Instructions skipped in idle loops
+  double ns_per_tick;                   // Set by chip8_profile_detach()
+
+  // Clock state while attached
+  uint64_t last_tick;
+  uint64_t start_tick;
+  uint64_t start_ns;
+} chip8_profile_t;
+
+/**
+ * @brief Clear a profile and start filling it from an instance.
+ *
+ * Call after init_chip8(), which clears the attachment.
+ *
+ * @param chip8 Instance to profile.
+ * @param profile Counters to fill; must outlive the attachment.
+ * @return bool false if profiling is compiled out or the instance is already
+ * profiled.
+ */
+bool chip8_profile_attach(chip8_t *chip8, chip8_profile_t *profile);
+
+/**
+ * @brief Stop profiling an instance and calibrate the host clock.
+ *
+ * @param chip8 Profiled instance; nothing happens if it is not profiled.
+ */
+void chip8_profile_detach(chip8_t *chip8);
+
+/**
+ * @brief Host time spent at an address.
+ *
+ * @param profile Detached profile.
+ * @param pc Address.
+ * @return uint64_t Nanoseconds.
+ */
+uint64_t chip8_profile_pc_ns(const chip8_profile_t *profile, uint16_t pc);
+
+/**
+ * @brief Print totals, operations by count and the busiest addresses.
+ *
+ * @param profile Detached profile.
+ * @param out Stream to print to.
+ * @param top Addresses to list, by host time.
+ */
+void chip8_profile_report(const chip8_profile_t *profile, FILE *out,
+                          unsigned top);
+
+/**
+ * @brief Print host time over the address space as a character heatmap.
+ *
+ * One row per 128 bytes and one cell per instruction slot, darker for more
+ * time on a log scale.
+ *
+ * @param profile Detached profile.
+ * @param out Stream to print to.
+ */
+void chip8_profile_heatmap(const chip8_profile_t *profile, FILE *out);
+
+#endif // !CHIP8_PROFILE_H
@@ -0,0 +1,312 @@
+#include "chip8_rewind.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define REWIND_WORDS (sizeof(chip8_snapshot_t) / sizeof(uint64_t))
+#define REWIND_DEFAULT_KEYFRAME_INTERVAL 60 // One a second at 60 fps
+#define REWIND_BYTES_PER_ENTRY 256          // Budget share per index slot
+
+// Longest encoding: a run header before every word, plus a final header
+#define REWIND_MAX_ENCODED (REWIND_WORDS * (sizeof(uint64_t) + 4) + 4)
+
+/**
+ * @brief Where one saved state lives in the arena.
+ */
+typedef struct
+{
+  uint32_t offset;   // Start of the encoded state
+  uint32_t size;     // Encoded bytes
+  uint32_t key_back; // Entries back to its keyframe, 0 for a keyframe
+} rewind_entry_t;
+
+struct chip8_rewind
+{
+  uint8_t *arena; // Encoded states, oldest to newest around the ring
+  uint32_t arena_size;
+  uint32_t head; // Where the next state is written
+  size_t bytes_used;
+
+  rewind_entry_t *entries; // Ring of saved states, oldest first
+  uint32_t entry_capacity;
+  uint32_t oldest;
+  uint32_t count;
+  uint32_t keyframes;
+
+  uint32_t keyframe_interval;
+  uint32_t group;        // Entries in the newest keyframe's group
+  chip8_snapshot_t key;  // That keyframe, decoded
+  chip8_snapshot_t work; // Scratch state for push and pop
+  uint8_t encoded[REWIND_MAX_ENCODED];
+};
+
+/**
+ * @brief Run-length encode the XOR of a state against a base.
+ *
+ * The output is a sequence of runs: a uint16_t count of unchanged words, a
+ * uint16_t count of changed words, then the XOR of each changed word.
+ *
+ * @param base Base state, or NULL for all zero (keyframes).
+ * @return uint32_t Encoded bytes.
+ */
+static uint32_t delta_encode(const uint64_t *base, const uint64_t *state,
+                             uint8_t *out)
+{
+  static const uint64_t zero[REWIND_WORDS];
+  if (base == NULL)
+  {
+    base = zero;
+  }
+
+  uint32_t size = 0;
+  uint32_t word = 0;
+  while (word < REWIND_WORDS)
+  {
+    uint32_t start = word;
+    while (word < REWIND_WORDS && base[word] == state[word])
+    {
+      ++word;
+    }
+    uint32_t changed = word;
+    while (word < REWIND_WORDS && base[word] != state[word])
+    {
+      ++word;
+    }
+
+    uint16_t run[2] = {(uint16_t)(changed - start), (uint16_t)(word - changed)};
+    memcpy(&out[size], run, sizeof(run));
+    size += sizeof(run);
+    for (uint32_t i = changed; i < word; ++i)
+    {
+      uint64_t delta = base[i] ^ state[i];
+      memcpy(&out[size], &delta, sizeof(delta));
+      size += sizeof(delta);
+    }
+  }
+  return size;
+}
+
+// Apply an encoding from delta_encode() on top of its base state
+static void delta_apply(const uint8_t *in, uint32_t size, uint64_t *state)
+{
+  uint32_t word = 0;
+  uint32_t pos = 0;
+  while (pos < size)
+  {
+    uint16_t run[2];
+    memcpy(run, &in[pos], sizeof(run));
+    pos += sizeof(run);
+    word += run[0];
+    for (uint16_t i = 0; i < run[1]; ++i, ++word)
+    {
+      uint64_t delta;
+      memcpy(&delta, &in[pos], sizeof(delta));
+      pos += sizeof(delta);
+      state[word] ^= delta;
+    }
+  }
+}
+
+static inline uint32_t entry_index(const chip8_rewind_t *rewind, uint32_t n)
+{
+  return (rewind->oldest + n) % rewind->entry_capacity;
+}
+
+// Decode the state stored in an entry, via its keyframe if it is a delta
+static void decode_entry(const chip8_rewind_t *rewind, uint32_t index,
+                         chip8_snapshot_t *state)
+{
+  const rewind_entry_t *entry = &rewind->entries[index];
+  if (entry->key_back != 0)
+  {
+    uint32_t cap = rewind->entry_capacity;
+    decode_entry(rewind, (index + cap - entry->key_back) % cap, state);
+  }
+  else
+  {
+    memset(state, 0, sizeof(*state));
+  }
+  delta_apply(&rewind->arena[entry->offset], entry->size, state->data);
+}
+
+// Drop the oldest keyframe together with the deltas that depend on it
+static void drop_oldest_group(chip8_rewind_t *rewind)
+{
+  do
+  {
+    const rewind_entry_t *entry = &rewind->entries[rewind->oldest];
+    rewind->bytes_used -= entry->size;
+    rewind->keyframes -= entry->key_back == 0;
+    rewind->oldest = (rewind->oldest + 1) % rewind->entry_capacity;
+    --rewind->count;
+  } while (rewind->count > 0 && rewind->entries[rewind->oldest].key_back != 0);
+
+  if (rewind->count == 0)
+  {
+    rewind->group = 0;
+  }
+}
+
+static inline bool overlaps(const rewind_entry_t *entry, uint32_t begin,
+                            uint32_t end)
+{
+  return entry->offset < end && begin < entry->offset + entry->size;
+}
+
+/**
+ * @brief Find room for @p size bytes, dropping the oldest groups as needed.
+ *
+ * States never wrap around the end of the arena. The states right after the
+ * head are always the oldest, so clearing space only ever drops from the
+ * back of the ring.
+ */
+static uint32_t make_room(chip8_rewind_t *rewind, uint32_t size)
+{
+  uint32_t offset = rewind->head;
+  uint32_t tail = rewind->arena_size; // Skipped end of the arena, if any
+  if (offset + size > rewind->arena_size)
+  {
+    tail = offset;
+    offset = 0;
+  }
+
+  while (rewind->count > 0)
+  {
+    const rewind_entry_t *entry = &rewind->entries[rewind->oldest];
+    if (rewind->count < rewind->entry_capacity &&
+        !overlaps(entry, offset, offset + size) &&
+        !overlaps(entry, tail, rewind->arena_size))
+    {
+      break;
+    }
+    drop_oldest_group(rewind);
+  }
+  return offset;
+}
+
+chip8_rewind_t *chip8_rewind_create(size_t budget, uint32_t keyframe_interval)
+{
+  if (budget > UINT32_MAX)
+  {
+    budget = UINT32_MAX;
+  }
+
+  size_t entries = budget / REWIND_BYTES_PER_ENTRY;
+  size_t index = entries * sizeof(rewind_entry_t);
+  if (entries < 2 || budget - index < REWIND_MAX_ENCODED)
+  {
+    return NULL;
+  }
+
+  chip8_rewind_t *rewind = (chip8_rewind_t *)calloc(1, sizeof(chip8_rewind_t));
+  if (rewind == NULL)
+  {
+    return NULL;
+  }
+  rewind->arena_size = (uint32_t)(budget - index);
+  rewind->arena = (uint8_t *)malloc(rewind->arena_size);
+  rewind->entry_capacity = (uint32_t)entries;
+  rewind->entries = (rewind_entry_t *)malloc(index);
+  rewind->keyframe_interval = keyframe_interval
+                                  ? keyframe_interval
+                                  : REWIND_DEFAULT_KEYFRAME_INTERVAL;
+  if (rewind->arena == NULL || rewind->entries == NULL)
+  {
+    chip8_rewind_destroy(rewind);
+    return NULL;
+  }
+  return rewind;
+}
+
+void chip8_rewind_destroy(chip8_rewind_t *rewind)
+{
+  if (rewind == NULL)
+  {
+    return;
+  }
+  free(rewind->arena);
+  free(rewind->entries);
+  free(rewind);
+}
+
+void chip8_rewind_push(chip8_rewind_t *rewind, const chip8_t *chip8)
+{
+  chip8_snapshot(chip8, &rewind->work);
+
+  bool keyframe =
+      rewind->group == 0 || rewind->group >= rewind->keyframe_interval;
+  uint32_t size;
+  uint32_t offset;
+  for (;;)
+  {
+    size = delta_encode(keyframe ? NULL : rewind->key.data, rewind->work.data,
+                        rewind->encoded);
+    offset = make_room(rewind, size);
+    // Making room may have dropped the keyframe this delta was taken
+    // against; store the state whole instead
+    if (keyframe || rewind->group != 0)
+    {
+      break;
+    }
+    keyframe = true;
+  }
+
+  rewind_entry_t *entry = &rewind->entries[entry_index(rewind, rewind->count)];
+  entry->offset = offset;
+  entry->size = size;
+  entry->key_back = keyframe ? 0 : rewind->group;
+  memcpy(&rewind->arena[offset], rewind->encoded, size);
+
+  rewind->head = offset + size;
+  rewind->bytes_used += size;
+  ++rewind->count;
+  if (keyframe)
+  {
+    rewind->key = rewind->work;
+    rewind->group = 1;
+    ++rewind->keyframes;
+  }
+  else
+  {
+    ++rewind->group;
+  }
+}
+
+bool chip8_rewind_pop(chip8_rewind_t *rewind, chip8_t *chip8)
+{
+  if (rewind->count == 0)
+  {
+    return false;
+  }
+
+  uint32_t newest = entry_index(rewind, rewind->count - 1);
+  decode_entry(rewind, newest, &rewind->work);
+  chip8_restore(chip8, &rewind->work);
+
+  // The newest state sits right before the head, so its space is reclaimed
+  const rewind_entry_t *entry = &rewind->entries[newest];
+  rewind->head = entry->offset;
+  rewind->bytes_used -= entry->size;
+  rewind->keyframes -= entry->key_back == 0;
+  --rewind->count;
+  --rewind->group;
+
+  // Popped a keyframe: later pushes are deltas against the previous one
+  if (rewind->group == 0 && rewind->count > 0)
+  {
+    uint32_t previous = entry_index(rewind, rewind->count - 1);
+    uint32_t back = rewind->entries[previous].key_back;
+    rewind->group = back + 1;
+    decode_entry(rewind, entry_index(rewind, rewind->count - 1 - back),
+                 &rewind->key);
+  }
+  return true;
+}
+
+void chip8_rewind_stats(const chip8_rewind_t *rewind,
+                        chip8_rewind_stats_t *stats)
+{
+  stats->frames = rewind->count;
+  stats->keyframes = rewind->keyframes;
+  stats->bytes_used = rewind->bytes_used;
+  stats->capacity = rewind->arena_size;
+}
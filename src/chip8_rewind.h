@@ -0,0 +1,72 @@
+#ifndef CHIP8_REWIND_H
+#define CHIP8_REWIND_H
+
+#include "chip8.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Counters describing what a rewind buffer holds.
+ */
+typedef struct
+{
+  uint32_t frames;    // States that can be stepped back through
+  uint32_t keyframes; // Of those, stored whole
+  size_t bytes_used;  // Encoded bytes held in the buffer
+  size_t capacity;    // Bytes available for encoded states
+} chip8_rewind_stats_t;
+
+typedef struct chip8_rewind chip8_rewind_t;
+
+/**
+ * @brief Create a rewind buffer with a fixed memory budget.
+ *
+ * States are kept in a ring. Every @p keyframe_interval states one is stored
+ * whole; the rest store only the words that differ from that keyframe,
+ * run-length encoded. When the budget is full the oldest keyframe and its
+ * deltas are dropped.
+ *
+ * @param budget Total bytes to use, index included.
+ * @param keyframe_interval States per keyframe (0 picks a default).
+ * @return chip8_rewind_t* New buffer, or NULL if the budget cannot hold a
+ * keyframe or allocation fails.
+ */
+chip8_rewind_t *chip8_rewind_create(size_t budget, uint32_t keyframe_interval);
+
+/**
+ * @brief Free a rewind buffer.
+ *
+ * @param rewind Buffer to free (may be NULL).
+ */
+void chip8_rewind_destroy(chip8_rewind_t *rewind);
+
+/**
+ * @brief Save the current state of an instance as the newest entry.
+ *
+ * @param rewind Buffer to save into.
+ * @param chip8 Instance to save.
+ */
+void chip8_rewind_push(chip8_rewind_t *rewind, const chip8_t *chip8);
+
+/**
+ * @brief Restore the newest saved state and drop it from the buffer.
+ *
+ * Calling this once per frame steps back one frame at a time.
+ *
+ * @param rewind Buffer to take the state from.
+ * @param chip8 Instance to restore with chip8_restore().
+ * @return bool false if the buffer is empty; @p chip8 is left untouched.
+ */
+bool chip8_rewind_pop(chip8_rewind_t *rewind, chip8_t *chip8);
+
+/**
+ * @brief Read the buffer counters.
+ *
+ * @param rewind Buffer to query.
+ * @param stats Destination for the counters.
+ */
+void chip8_rewind_stats(const chip8_rewind_t *rewind,
+                        chip8_rewind_stats_t *stats);
+
+#endif // !CHIP8_REWIND_H
@@ -0,0 +1,92 @@
+#include "chip8_sched.h"
+
+#define NS_PER_SECOND 1000000000ull
+#define NS_PER_MS 1000000ull
+
+void chip8_sched_init(chip8_sched_t *sched, uint32_t ips)
+{
+  if (ips == 0)
+  {
+    ips = CHIP8_SCHED_DEFAULT_IPS;
+  }
+  // At least one instruction per tick, so a slice never spans two ticks
+  if (ips < CHIP8_SCHED_TIMER_HZ)
+  {
+    ips = CHIP8_SCHED_TIMER_HZ;
+  }
+
+  sched->ips = ips;
+  sched->owed = 0;
+  sched->time_remainder = 0;
+  sched->timer_phase = 0;
+  sched->ticks = 0;
+  sched->dropped = 0;
+  sched->cycles = 0;
+  sched->window_end = 0;
+  sched->window_cycles = 0;
+  sched->window_ns = 0;
+}
+
+void chip8_sched_elapse(chip8_sched_t *sched, uint64_t nanoseconds)
+{
+  uint64_t max_lag = CHIP8_SCHED_MAX_LAG_MS * NS_PER_MS;
+  uint64_t max_owed = sched->ips * max_lag / NS_PER_SECOND;
+
+  // Clamp first so ns * ips cannot overflow after a very long stall
+  if (nanoseconds > max_lag)
+  {
+    sched->dropped += (nanoseconds - max_lag) * sched->ips / NS_PER_SECOND;
+    nanoseconds = max_lag;
+  }
+
+  uint64_t scaled = sched->time_remainder + nanoseconds * sched->ips;
+  uint64_t added = scaled / NS_PER_SECOND;
+  sched->owed += added;
+  sched->time_remainder = scaled % NS_PER_SECOND;
+
+  if (sched->owed > max_owed)
+  {
+    uint64_t excess = sched->owed - max_owed;
+    sched->dropped += excess;
+    sched->owed = max_owed;
+    added = excess < added ? added - excess : 0;
+  }
+
+  sched->window_end = sched->cycles + sched->owed;
+  sched->window_cycles = added;
+  sched->window_ns = nanoseconds;
+}
+
+uint32_t chip8_sched_slice(const chip8_sched_t *sched)
+{
+  // Smallest n with timer_phase + n * 60 >= ips
+  uint64_t to_tick = (sched->ips - sched->timer_phase +
+                      CHIP8_SCHED_TIMER_HZ - 1) / CHIP8_SCHED_TIMER_HZ;
+  uint64_t slice = sched->owed < to_tick ? sched->owed : to_tick;
+  return slice > UINT32_MAX ? UINT32_MAX : (uint32_t)slice;
+}
+
+bool chip8_sched_advance(chip8_sched_t *sched, uint32_t cycles)
+{
+  sched->owed = cycles < sched->owed ? sched->owed - cycles : 0;
+  sched->cycles += cycles;
+  sched->timer_phase += (uint64_t)cycles * CHIP8_SCHED_TIMER_HZ;
+  if (sched->timer_phase < sched->ips)
+  {
+    return false;
+  }
+  sched->timer_phase -= sched->ips;
+  ++sched->ticks;
+  return true;
+}
+
+uint64_t chip8_sched_cycle_ago(const chip8_sched_t *sched, uint64_t ago_ns)
+{
+  uint64_t back = sched->window_cycles;
+  if (ago_ns < sched->window_ns)
+  {
+    back = ago_ns * sched->window_cycles / sched->window_ns;
+  }
+  uint64_t cycle = sched->window_end - back;
+  return cycle > sched->cycles ? cycle : sched->cycles;
+}
@@ -0,0 +1,97 @@
+#ifndef CHIP8_SCHED_H
+#define CHIP8_SCHED_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Real-time pacing for frontends.
+ *
+ * The scheduler turns host time into instructions owed at a set rate and
+ * tells the frontend when to tick the timers. Both are kept in exact integer
+ * units. Host nanoseconds times the rate carry their remainder between calls,
+ * and timer ticks fall every ips / 60 instructions of emulated time with the
+ * remainder carried the same way. The emulated clock therefore neither
+ * drifts nor rounds to whole frames or milliseconds.
+ *
+ * After a stall the owed instructions are run to catch up, up to
+ * CHIP8_SCHED_MAX_LAG_MS worth. Anything beyond that is dropped rather than
+ * run as a burst.
+ *
+ * The instructions owed by each chip8_sched_elapse() stand for the host time
+ * it was given, so chip8_sched_cycle_ago() can place a host event, such as a
+ * key press, on the instruction that corresponds to when it happened.
+ */
+
+#define CHIP8_SCHED_DEFAULT_IPS 600u // Instructions per second
+#define CHIP8_SCHED_TIMER_HZ 60u     // Delay and sound timer rate
+#define CHIP8_SCHED_MAX_LAG_MS 250u  // Longest stall caught up on
+
+/**
+ * @brief Emulated clock of one frontend.
+ */
+typedef struct
+{
+  uint32_t ips;            // Instructions per emulated second
+  uint64_t owed;           // Instructions due but not yet run
+  uint64_t time_remainder; // Host ns * ips carried below one instruction
+  uint64_t timer_phase;    // Instructions since the last tick, times 60
+  uint64_t ticks;          // Timer ticks so far
+  uint64_t dropped;        // Instructions dropped after stalls
+  uint64_t cycles;         // Instructions accounted for so far
+  uint64_t window_end;     // cycles + owed after the last elapse
+  uint64_t window_cycles;  // Instructions the last elapse added
+  uint64_t window_ns;      // Host time the last elapse covered
+} chip8_sched_t;
+
+/**
+ * @brief Start a clock with nothing owed.
+ *
+ * @param sched Scheduler to initialise.
+ * @param ips Instructions per second (0 picks CHIP8_SCHED_DEFAULT_IPS).
+ */
+void chip8_sched_init(chip8_sched_t *sched, uint32_t ips);
+
+/**
+ * @brief Add host time that has passed.
+ *
+ * @param sched Scheduler to advance.
+ * @param nanoseconds Host time since the previous call.
+ */
+void chip8_sched_elapse(chip8_sched_t *sched, uint64_t nanoseconds);
+
+/**
+ * @brief Instructions to run next.
+ *
+ * A slice never crosses a timer tick, so the frontend can tick the timers
+ * between slices and each tick happens after exactly the right instruction.
+ *
+ * @param sched Scheduler to query.
+ * @return uint32_t Instructions owed up to the next tick, 0 if none.
+ */
+uint32_t chip8_sched_slice(const chip8_sched_t *sched);
+
+/**
+ * @brief Account for instructions run, or time spent blocked.
+ *
+ * @param sched Scheduler to advance.
+ * @param cycles Instructions, at most the last chip8_sched_slice().
+ * @return bool true when the timers are due to tick now.
+ */
+bool chip8_sched_advance(chip8_sched_t *sched, uint32_t cycles);
+
+/**
+ * @brief Instruction a host event falls on.
+ *
+ * The event is placed in proportion within the host time of the last
+ * chip8_sched_elapse(). Events from before that window, or before the
+ * instructions already run, fall on the next instruction to run.
+ *
+ * @param sched Scheduler to query.
+ * @param ago_ns How long before the end of the last elapse the event
+ * happened.
+ * @return uint64_t Value of sched->cycles at which to apply the event.
+ */
+uint64_t chip8_sched_cycle_ago(const chip8_sched_t *sched, uint64_t ago_ns);
+
+#endif // !CHIP8_SCHED_H
@@ -0,0 +1,746 @@
+#define _POSIX_C_SOURCE 200809L
+#include "chip8_trace.h"
+#include "chip8_internal.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+// File layout, all integers little-endian:
+//   header  "C8TR", u16 version, u16 0, u32 block size
+//   blocks  u32 instance, u32 bytes, then that many bytes of records
+// Records:
+//   step    u8 flags, u16 opcode, then u16 pc if TRACE_PC, u16 I if
+//           TRACE_INDEX, and the registers it wrote: one value if
+//           TRACE_ONE_REG (register number in flags bits 3-6), or a u16 mask
+//           and a value per set bit if TRACE_REGS
+//   sync    TRACE_SYNC, u64 cycle, u16 pc, u16 I, V0-VF, u32 lost
+//   idle    TRACE_IDLE, u32 instructions skipped, u16 pc after
+// A step without TRACE_PC executed at the address after the previous step.
+
+#define TRACE_VERSION 1
+#define TRACE_HEADER_SIZE 12
+#define TRACE_BLOCK_SIZE (16u << 10)
+#define TRACE_BLOCKS 256 // 4 MB of buffering per instance
+#define TRACE_SYNC_SIZE 33
+#define TRACE_MAX_RECORD TRACE_SYNC_SIZE // Steps take at most 25 bytes
+#define TRACE_IDLE_WAIT_NS 1000000       // Writer poll interval
+
+typedef struct chip8_trace chip8_trace_t;
+
+enum
+{
+  TRACE_PC = 0x01,
+  TRACE_INDEX = 0x02,
+  TRACE_ONE_REG = 0x04,
+  TRACE_REGS = 0x08,
+  TRACE_SYNC = 0x80,
+  TRACE_IDLE = 0x81,
+};
+
+struct chip8_trace
+{
+  // Producer side, only touched by the thread running the instance
+  uint8_t *block; // Block being filled, NULL while the ring is full
+  uint32_t pos;
+  uint32_t head;    // Blocks published
+  uint64_t cycle;   // Cycle number of the next instruction
+  uint16_t next_pc; // pc a step is assumed to execute at
+  uint16_t pc;      // chip8->pc after the last record
+  uint64_t lost;    // Instructions unrecorded since the last sync
+  uint64_t lost_total;
+  uint32_t instance;
+
+  // Shared with the writer
+  _Alignas(64) _Atomic uint32_t produced;
+  _Alignas(64) _Atomic uint32_t consumed;
+  _Atomic bool detached;
+
+  struct chip8_trace *next; // Tracer's list, guarded by its lock
+  uint32_t used[TRACE_BLOCKS];
+  uint8_t blocks[TRACE_BLOCKS][TRACE_BLOCK_SIZE];
+};
+
+struct chip8_tracer
+{
+  pthread_t thread;
+  pthread_mutex_t lock;
+  struct chip8_trace *traces;
+  _Atomic bool stop;
+
+  // Output: stdio, or a file mapping grown as it fills
+  FILE *file;
+  int fd;
+  uint8_t *map;
+  size_t mapped;
+  size_t size;
+  bool failed;
+};
+
+struct chip8_trace_reader
+{
+  FILE *file;
+  uint8_t block[TRACE_BLOCK_SIZE];
+  uint32_t used;
+  uint32_t pos;
+
+  // Decoding state of each instance seen so far
+  chip8_trace_record_t *states;
+  uint32_t state_count;
+  chip8_trace_record_t *state; // Instance of the current block
+};
+
+static void put_le(uint8_t *out, uint64_t value, int bytes)
+{
+  for (int i = 0; i < bytes; ++i)
+  {
+    out[i] = (uint8_t)(value >> (8 * i));
+  }
+}
+
+static uint64_t get_le(const uint8_t *in, int bytes)
+{
+  uint64_t value = 0;
+  for (int i = 0; i < bytes; ++i)
+  {
+    value |= (uint64_t)in[i] << (8 * i);
+  }
+  return value;
+}
+
+// Producer
+
+// Write the whole state; the next step executes at its pc
+static void trace_sync(chip8_trace_t *trace, const chip8_t *chip8)
+{
+  uint8_t *out = &trace->block[trace->pos];
+  out[0] = TRACE_SYNC;
+  put_le(&out[1], trace->cycle, 8);
+  put_le(&out[9], chip8->pc, 2);
+  put_le(&out[11], chip8->index, 2);
+  memcpy(&out[13], chip8->registers, V_REG_COUNT);
+  put_le(&out[29], trace->lost > UINT32_MAX ? UINT32_MAX : trace->lost, 4);
+  trace->pos += TRACE_SYNC_SIZE;
+  trace->next_pc = trace->pc = chip8->pc;
+  trace->lost = 0;
+}
+
+static void trace_publish(chip8_trace_t *trace)
+{
+  if (trace->block == NULL)
+  {
+    return;
+  }
+  trace->used[trace->head % TRACE_BLOCKS] = trace->pos;
+  ++trace->head;
+  atomic_store_explicit(&trace->produced, trace->head, memory_order_release);
+  trace->block = NULL;
+}
+
+// Start a block with the current state, unless every block is waiting for
+// the writer
+static void trace_open(chip8_trace_t *trace, const chip8_t *chip8)
+{
+  uint32_t consumed =
+      atomic_load_explicit(&trace->consumed, memory_order_acquire);
+  if (trace->head - consumed >= TRACE_BLOCKS)
+  {
+    return;
+  }
+  trace->block = trace->blocks[trace->head % TRACE_BLOCKS];
+  trace->pos = 0;
+  trace_sync(trace, chip8);
+}
+
+// An open block always has room for one more record of any kind
+static void trace_make_room(chip8_trace_t *trace, const chip8_t *chip8)
+{
+  if (trace->pos > TRACE_BLOCK_SIZE - TRACE_MAX_RECORD)
+  {
+    trace_publish(trace);
+    trace_open(trace, chip8);
+  }
+}
+
+// Account for instructions that ran while the ring was full
+static void trace_lose(chip8_trace_t *trace, const chip8_t *chip8,
+                       uint32_t count)
+{
+  trace->cycle += count;
+  trace->lost += count;
+  trace->lost_total += count;
+  trace->next_pc = trace->pc = chip8->pc;
+  trace_open(trace, chip8);
+}
+
+void chip8_trace_begin(chip8_trace_t *trace, const chip8_t *chip8)
+{
+  // Restores and direct edits move the machine without steps to show it
+  if (trace->cycle == chip8->cycles && trace->pc == chip8->pc)
+  {
+    return;
+  }
+  trace->cycle = chip8->cycles;
+  if (trace->block == NULL)
+  {
+    trace_open(trace, chip8);
+    return;
+  }
+  trace_sync(trace, chip8);
+  trace_make_room(trace, chip8);
+}
+
+// Registers each operation writes, whether or not the value changes
+enum
+{
+  WRITES_VX = 1,
+  WRITES_VF = 2,
+  WRITES_V0_VX = 4,
+};
+
+static const uint8_t op_writes[CHIP8_OP_COUNT] = {
+    [CHIP8_OP_6XKK] = WRITES_VX,
+    [CHIP8_OP_7XKK] = WRITES_VX,
+    [CHIP8_OP_8XY0] = WRITES_VX,
+    [CHIP8_OP_8XY1] = WRITES_VX,
+    [CHIP8_OP_8XY2] = WRITES_VX,
+    [CHIP8_OP_8XY3] = WRITES_VX,
+    [CHIP8_OP_8XY4] = WRITES_VX | WRITES_VF,
+    [CHIP8_OP_8XY5] = WRITES_VX | WRITES_VF,
+    [CHIP8_OP_8XY6] = WRITES_VX | WRITES_VF,
+    [CHIP8_OP_8XY7] = WRITES_VX | WRITES_VF,
+    [CHIP8_OP_8XYE] = WRITES_VX | WRITES_VF,
+    [CHIP8_OP_CXKK] = WRITES_VX,
+    [CHIP8_OP_DXYN] = WRITES_VF,
+    [CHIP8_OP_FX07] = WRITES_VX,
+    [CHIP8_OP_FX0A] = WRITES_VX,
+    [CHIP8_OP_FX65] = WRITES_V0_VX,
+};
+
+void chip8_trace_step(chip8_trace_t *trace, const chip8_t *chip8, uint16_t pc,
+                      uint16_t opcode, uint8_t op, uint16_t index)
+{
+  if (trace->block == NULL)
+  {
+    trace_lose(trace, chip8, 1);
+    return;
+  }
+
+  uint8_t *out = &trace->block[trace->pos];
+  uint8_t *end = out + 3;
+  uint8_t flags = 0;
+  out[1] = (uint8_t)opcode;
+  out[2] = (uint8_t)(opcode >> 8);
+  if (pc != trace->next_pc)
+  {
+    flags |= TRACE_PC;
+    put_le(end, pc, 2);
+    end += 2;
+  }
+  if (chip8->index != index)
+  {
+    flags |= TRACE_INDEX;
+    put_le(end, chip8->index, 2);
+    end += 2;
+  }
+
+  // Store what the operation wrote rather than diffing the register file,
+  // which would cost more than the instruction itself
+  uint8_t writes = op_writes[op];
+  if (writes == WRITES_VX || writes == WRITES_VF)
+  {
+    int reg = writes == WRITES_VX ? (opcode >> 8 & 0x0F) : 0x0F;
+    flags |= (uint8_t)(TRACE_ONE_REG | reg << 3);
+    *end++ = chip8->registers[reg];
+  }
+  else if (writes != 0)
+  {
+    int x = opcode >> 8 & 0x0F;
+    uint16_t written = writes == WRITES_V0_VX
+                           ? (uint16_t)((2u << x) - 1)
+                           : (uint16_t)(1u << x | 1u << 0x0F);
+    flags |= TRACE_REGS;
+    put_le(end, written, 2);
+    end += 2;
+    for (int reg = 0; reg < V_REG_COUNT; ++reg)
+    {
+      if (written >> reg & 1u)
+      {
+        *end++ = chip8->registers[reg];
+      }
+    }
+  }
+
+  out[0] = flags;
+  trace->pos = (uint32_t)(end - trace->block);
+  trace->next_pc = (uint16_t)(pc + 2);
+  trace->pc = chip8->pc;
+  ++trace->cycle;
+  trace_make_room(trace, chip8);
+}
+
+void chip8_trace_idle(chip8_trace_t *trace, const chip8_t *chip8,
+                      uint32_t count)
+{
+  if (trace->block == NULL)
+  {
+    trace_lose(trace, chip8, count);
+    return;
+  }
+
+  // The skipped loop wrote nothing, so only the count and the pc it left
+  uint8_t *out = &trace->block[trace->pos];
+  out[0] = TRACE_IDLE;
+  put_le(&out[1], count, 4);
+  put_le(&out[5], chip8->pc, 2);
+  trace->pos += 7;
+  trace->cycle += count;
+  trace->next_pc = trace->pc = chip8->pc;
+  trace_make_room(trace, chip8);
+}
+
+// Writer
+
+static void output_write(chip8_tracer_t *tracer, const void *data, size_t size)
+{
+  if (tracer->file != NULL)
+  {
+    if (fwrite(data, 1, size, tracer->file) != size)
+    {
+      tracer->failed = true;
+    }
+    return;
+  }
+
+  if (tracer->size + size > tracer->mapped)
+  {
+    // Grow the file and remap it whole, doubling so remaps stay rare
+    size_t mapped = tracer->mapped ? tracer->mapped * 2 : 1u << 20;
+    while (mapped < tracer->size + size)
+    {
+      mapped *= 2;
+    }
+    if (tracer->map != NULL)
+    {
+      munmap(tracer->map, tracer->mapped);
+      tracer->map = NULL;
+      tracer->mapped = 0;
+    }
+    void *map = MAP_FAILED;
+    if (ftruncate(tracer->fd, (off_t)mapped) == 0)
+    {
+      map = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, tracer->fd,
+                 0);
+    }
+    if (map == MAP_FAILED)
+    {
+      tracer->failed = true;
+      return;
+    }
+    tracer->map = (uint8_t *)map;
+    tracer->mapped = mapped;
+  }
+  memcpy(&tracer->map[tracer->size], data, size);
+  tracer->size += size;
+}
+
+// Write every block the instance has published; returns the blocks written
+static uint32_t tracer_drain(chip8_tracer_t *tracer, chip8_trace_t *trace)
+{
+  uint32_t produced =
+      atomic_load_explicit(&trace->produced, memory_order_acquire);
+  uint32_t consumed =
+      atomic_load_explicit(&trace->consumed, memory_order_relaxed);
+  for (uint32_t n = consumed; n != produced; ++n)
+  {
+    uint32_t slot = n % TRACE_BLOCKS;
+    uint8_t header[8];
+    put_le(&header[0], trace->instance, 4);
+    put_le(&header[4], trace->used[slot], 4);
+    output_write(tracer, header, sizeof(header));
+    output_write(tracer, trace->blocks[slot], trace->used[slot]);
+    atomic_store_explicit(&trace->consumed, n + 1, memory_order_release);
+  }
+  return produced - consumed;
+}
+
+static void *tracer_main(void *arg)
+{
+  chip8_tracer_t *tracer = (chip8_tracer_t *)arg;
+  for (;;)
+  {
+    // Read before draining so everything published before the stop is
+    // written by this pass
+    bool stop = atomic_load(&tracer->stop);
+    uint32_t written = 0;
+
+    pthread_mutex_lock(&tracer->lock);
+    chip8_trace_t **link = &tracer->traces;
+    while (*link != NULL)
+    {
+      chip8_trace_t *trace = *link;
+      bool detached = atomic_load(&trace->detached);
+      written += tracer_drain(tracer, trace);
+      if (detached)
+      {
+        *link = trace->next;
+        free(trace);
+      }
+      else
+      {
+        link = &trace->next;
+      }
+    }
+    pthread_mutex_unlock(&tracer->lock);
+
+    if (written == 0)
+    {
+      if (stop)
+      {
+        break;
+      }
+      struct timespec wait = {0, TRACE_IDLE_WAIT_NS};
+      nanosleep(&wait, NULL);
+    }
+  }
+  return NULL;
+}
+
+chip8_tracer_t *chip8_tracer_create(const char *path, uint32_t flags)
+{
+  chip8_tracer_t *tracer = (chip8_tracer_t *)calloc(1, sizeof(chip8_tracer_t));
+  if (tracer == NULL)
+  {
+    return NULL;
+  }
+  tracer->fd = -1;
+  if (flags & CHIP8_TRACE_MMAP)
+  {
+    tracer->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  }
+  else
+  {
+    tracer->file = fopen(path, "wb");
+  }
+  if (tracer->fd < 0 && tracer->file == NULL)
+  {
+    free(tracer);
+    return NULL;
+  }
+
+  uint8_t header[TRACE_HEADER_SIZE] = {'C', '8', 'T', 'R'};
+  put_le(&header[4], TRACE_VERSION, 2);
+  put_le(&header[8], TRACE_BLOCK_SIZE, 4);
+  output_write(tracer, header, sizeof(header));
+
+  atomic_init(&tracer->stop, false);
+  pthread_mutex_init(&tracer->lock, NULL);
+  if (pthread_create(&tracer->thread, NULL, tracer_main, tracer) != 0)
+  {
+    tracer->failed = true;
+    pthread_mutex_destroy(&tracer->lock);
+    if (tracer->file != NULL)
+    {
+      fclose(tracer->file);
+    }
+    else
+    {
+      if (tracer->map != NULL)
+      {
+        munmap(tracer->map, tracer->mapped);
+      }
+      close(tracer->fd);
+    }
+    free(tracer);
+    return NULL;
+  }
+  return tracer;
+}
+
+int chip8_tracer_destroy(chip8_tracer_t *tracer)
+{
+  if (tracer == NULL)
+  {
+    return 0;
+  }
+  atomic_store(&tracer->stop, true);
+  pthread_join(tracer->thread, NULL);
+  pthread_mutex_destroy(&tracer->lock);
+
+  // Anything still attached is abandoned; its instance must not run again
+  while (tracer->traces != NULL)
+  {
+    chip8_trace_t *trace = tracer->traces;
+    tracer->traces = trace->next;
+    free(trace);
+  }
+
+  bool failed = tracer->failed;
+  if (tracer->file != NULL)
+  {
+    failed |= fclose(tracer->file) != 0;
+  }
+  else
+  {
+    if (tracer->map != NULL)
+    {
+      failed |= munmap(tracer->map, tracer->mapped) != 0;
+    }
+    failed |= ftruncate(tracer->fd, (off_t)tracer->size) != 0;
+    failed |= close(tracer->fd) != 0;
+  }
+  free(tracer);
+  return failed ? -1 : 0;
+}
+
+bool chip8_trace_attach(chip8_tracer_t *tracer, chip8_t *chip8,
+                        uint32_t instance)
+{
+#if defined(CHIP8_TRACE)
+  if (chip8->trace != NULL)
+  {
+    return false;
+  }
+  chip8_trace_t *trace = (chip8_trace_t *)malloc(sizeof(chip8_trace_t));
+  if (trace == NULL)
+  {
+    return false;
+  }
+  memset(trace, 0, offsetof(chip8_trace_t, used));
+  trace->instance = instance;
+  trace->cycle = chip8->cycles;
+  atomic_init(&trace->produced, 0);
+  atomic_init(&trace->consumed, 0);
+  atomic_init(&trace->detached, false);
+
+  // Open the first block now, so a trace always starts with the state
+  trace_open(trace, chip8);
+
+  pthread_mutex_lock(&tracer->lock);
+  trace->next = tracer->traces;
+  tracer->traces = trace;
+  pthread_mutex_unlock(&tracer->lock);
+  chip8->trace = trace;
+  return true;
+#else
+  (void)tracer;
+  (void)chip8;
+  (void)instance;
+  return false;
+#endif
+}
+
+uint64_t chip8_trace_detach(chip8_t *chip8)
+{
+  chip8_trace_t *trace = chip8->trace;
+  if (trace == NULL)
+  {
+    return 0;
+  }
+  chip8->trace = NULL;
+
+  // The writer frees the trace once it has written the last block
+  uint64_t lost = trace->lost_total;
+  trace_publish(trace);
+  atomic_store(&trace->detached, true);
+  return lost;
+}
+
+// Reader
+
+chip8_trace_reader_t *chip8_trace_reader_open(const char *path)
+{
+  FILE *file = fopen(path, "rb");
+  if (file == NULL)
+  {
+    return NULL;
+  }
+
+  uint8_t header[TRACE_HEADER_SIZE];
+  if (fread(header, 1, sizeof(header), file) != sizeof(header) ||
+      memcmp(header, "C8TR", 4) != 0 ||
+      get_le(&header[4], 2) != TRACE_VERSION ||
+      get_le(&header[8], 4) != TRACE_BLOCK_SIZE)
+  {
+    fclose(file);
+    return NULL;
+  }
+
+  chip8_trace_reader_t *reader =
+      (chip8_trace_reader_t *)calloc(1, sizeof(chip8_trace_reader_t));
+  if (reader == NULL)
+  {
+    fclose(file);
+    return NULL;
+  }
+  reader->file = file;
+  return reader;
+}
+
+void chip8_trace_reader_close(chip8_trace_reader_t *reader)
+{
+  if (reader == NULL)
+  {
+    return;
+  }
+  fclose(reader->file);
+  free(reader->states);
+  free(reader);
+}
+
+// Load the next block and find the decoding state of its instance
+static bool reader_next_block(chip8_trace_reader_t *reader)
+{
+  uint8_t header[8];
+  if (fread(header, 1, sizeof(header), reader->file) != sizeof(header))
+  {
+    return false;
+  }
+  uint32_t instance = (uint32_t)get_le(&header[0], 4);
+  uint32_t used = (uint32_t)get_le(&header[4], 4);
+  if (used > TRACE_BLOCK_SIZE ||
+      fread(reader->block, 1, used, reader->file) != used)
+  {
+    return false;
+  }
+  reader->used = used;
+  reader->pos = 0;
+
+  for (uint32_t i = 0; i < reader->state_count; ++i)
+  {
+    if (reader->states[i].instance == instance)
+    {
+      reader->state = &reader->states[i];
+      return true;
+    }
+  }
+  chip8_trace_record_t *states = (chip8_trace_record_t *)realloc(
+      reader->states, (reader->state_count + 1) * sizeof(chip8_trace_record_t));
+  if (states == NULL)
+  {
+    return false;
+  }
+  reader->states = states;
+  reader->state = &states[reader->state_count++];
+  memset(reader->state, 0, sizeof(*reader->state));
+  reader->state->instance = instance;
+  return true;
+}
+
+bool chip8_trace_read(chip8_trace_reader_t *reader,
+                      chip8_trace_record_t *record)
+{
+  while (reader->pos >= reader->used)
+  {
+    if (!reader_next_block(reader))
+    {
+      return false;
+    }
+  }
+
+  chip8_trace_record_t *state = reader->state;
+  const uint8_t *in = &reader->block[reader->pos];
+  uint32_t left = reader->used - reader->pos;
+  uint8_t flags = in[0];
+
+  if (flags == TRACE_SYNC || flags == TRACE_IDLE)
+  {
+    uint32_t size = flags == TRACE_SYNC ? TRACE_SYNC_SIZE : 7;
+    if (left < size)
+    {
+      return false;
+    }
+    if (flags == TRACE_SYNC)
+    {
+      state->kind = CHIP8_TRACE_SYNC;
+      state->cycle = get_le(&in[1], 8);
+      state->pc = (uint16_t)get_le(&in[9], 2);
+      state->index = (uint16_t)get_le(&in[11], 2);
+      memcpy(state->registers, &in[13], V_REG_COUNT);
+      state->count = (uint32_t)get_le(&in[29], 4);
+    }
+    else
+    {
+      state->kind = CHIP8_TRACE_IDLE;
+      state->count = (uint32_t)get_le(&in[1], 4);
+      state->pc = (uint16_t)get_le(&in[5], 2);
+    }
+    state->written = 0;
+    reader->pos += size;
+    *record = *state;
+    if (flags == TRACE_IDLE)
+    {
+      state->cycle += state->count;
+    }
+    return true;
+  }
+  if (flags & 0x80)
+  {
+    return false;
+  }
+
+  // Step: size it before reading it
+  uint32_t size = 3;
+  size += flags & TRACE_PC ? 2 : 0;
+  size += flags & TRACE_INDEX ? 2 : 0;
+  uint16_t written = 0;
+  if (flags & TRACE_ONE_REG)
+  {
+    written = (uint16_t)(1u << (flags >> 3 & 0x0F));
+    size += 1;
+  }
+  else if (flags & TRACE_REGS)
+  {
+    if (left < size + 2)
+    {
+      return false;
+    }
+    written = (uint16_t)get_le(&in[size], 2);
+    size += 2;
+    for (uint16_t bits = written; bits != 0; bits &= (uint16_t)(bits - 1))
+    {
+      ++size;
+    }
+  }
+  if (left < size)
+  {
+    return false;
+  }
+
+  const uint8_t *field = &in[3];
+  record->kind = CHIP8_TRACE_STEP;
+  record->instance = state->instance;
+  record->cycle = state->cycle;
+  record->opcode = (uint16_t)get_le(&in[1], 2);
+  record->pc = state->pc;
+  if (flags & TRACE_PC)
+  {
+    record->pc = (uint16_t)get_le(field, 2);
+    field += 2;
+  }
+  state->index = flags & TRACE_INDEX ? (uint16_t)get_le(field, 2)
+                                     : state->index;
+  field += flags & TRACE_INDEX ? 2 : 0;
+  field += (flags & (TRACE_ONE_REG | TRACE_REGS)) == TRACE_REGS ? 2 : 0;
+  for (int reg = 0; reg < V_REG_COUNT; ++reg)
+  {
+    if (written >> reg & 1u)
+    {
+      state->registers[reg] = *field++;
+    }
+  }
+
+  record->index = state->index;
+  record->written = written;
+  record->count = 0;
+  memcpy(record->registers, state->registers, V_REG_COUNT);
+  state->pc = (uint16_t)(record->pc + 2);
+  ++state->cycle;
+  reader->pos += size;
+  return true;
+}
@@ -0,0 +1,132 @@
+#ifndef CHIP8_TRACE_H
+#define CHIP8_TRACE_H
+
+#include "chip8.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Execution traces record every instruction an instance executes.
+ *
+ * Tracing is compiled in with -DCHIP8_TRACE (make TRACE=1). Without it the
+ * cores contain no tracing code and chip8_trace_attach() fails.
+ *
+ * Each attached instance fills its own ring of blocks with compact records: pc
+ * only when it does not follow on, the opcode, I when it changed and the
+ * registers the instruction wrote. A writer thread per tracer drains full
+ * blocks to the file. The emulation thread never waits: if the writer falls
+ * behind, instructions go unrecorded and the next block says how many were
+ * lost. Every block starts with the whole register state, so the file can be
+ * decoded from any block.
+ *
+ * Traced instances always run in the table interpreter: the threaded core
+ * and the JIT hand traced runs to it. Idle loops skipped by chip8_run() are
+ * recorded as one record with the number of instructions skipped.
+ */
+
+// Options for chip8_tracer_create()
+#define CHIP8_TRACE_MMAP 1u // Write through a memory-mapped file
+
+/**
+ * @brief Kinds of decoded trace records.
+ */
+typedef enum
+{
+  CHIP8_TRACE_STEP = 0, // One instruction executed
+  CHIP8_TRACE_IDLE,     // An idle loop was skipped
+  CHIP8_TRACE_SYNC,     // Whole register state; instructions may be lost
+} chip8_trace_kind_t;
+
+/**
+ * @brief One decoded trace record.
+ */
+typedef struct
+{
+  chip8_trace_kind_t kind;
+  uint32_t instance; // Id given to chip8_trace_attach()
+  uint64_t cycle;    // Instructions executed before this record
+  uint16_t pc;       // STEP: address executed; IDLE, SYNC: next pc
+  uint16_t opcode;   // STEP: instruction executed
+  uint16_t index;    // I after the record
+  uint16_t written;  // STEP: registers the instruction wrote, bit per Vx
+  uint32_t count;    // IDLE: instructions skipped; SYNC: instructions lost
+  uint8_t registers[V_REG_COUNT]; // V0-VF after the record
+} chip8_trace_record_t;
+
+typedef struct chip8_tracer chip8_tracer_t;
+typedef struct chip8_trace_reader chip8_trace_reader_t;
+
+/**
+ * @brief Create a trace file and start its writer thread.
+ *
+ * @param path File to write.
+ * @param flags CHIP8_TRACE_* options.
+ * @return chip8_tracer_t* New tracer, or NULL if the file or thread cannot
+ * be created.
+ */
+chip8_tracer_t *chip8_tracer_create(const char *path, uint32_t flags);
+
+/**
+ * @brief Stop the writer thread once everything published is written.
+ *
+ * Detach every instance first.
+ *
+ * @param tracer Tracer to finish (may be NULL).
+ * @return int 0 on success, -1 if any write failed.
+ */
+int chip8_tracer_destroy(chip8_tracer_t *tracer);
+
+/**
+ * @brief Start tracing an instance.
+ *
+ * Call after init_chip8(), which clears the attachment. Only the thread
+ * running the instance may call the run functions while it is attached.
+ *
+ * @param tracer Tracer to write to.
+ * @param chip8 Instance to trace.
+ * @param instance Id stored with its records.
+ * @return bool false if tracing is compiled out, the instance is already
+ * traced or allocation fails.
+ */
+bool chip8_trace_attach(chip8_tracer_t *tracer, chip8_t *chip8,
+                        uint32_t instance);
+
+/**
+ * @brief Stop tracing an instance and hand its last records to the writer.
+ *
+ * @param chip8 Traced instance; nothing happens if it is not traced.
+ * @return uint64_t Instructions that went unrecorded because the writer
+ * fell behind.
+ */
+uint64_t chip8_trace_detach(chip8_t *chip8);
+
+/**
+ * @brief Open a trace file for decoding.
+ *
+ * @param path File to read.
+ * @return chip8_trace_reader_t* New reader, or NULL if the file is missing or
+ * is not a trace.
+ */
+chip8_trace_reader_t *chip8_trace_reader_open(const char *path);
+
+/**
+ * @brief Decode the next record.
+ *
+ * Records of one instance come in execution order. Records of different
+ * instances are interleaved a block at a time.
+ *
+ * @param reader Reader to advance.
+ * @param record Destination for the record.
+ * @return bool false at the end of the file or at a damaged block.
+ */
+bool chip8_trace_read(chip8_trace_reader_t *reader,
+                      chip8_trace_record_t *record);
+
+/**
+ * @brief Close a trace file.
+ *
+ * @param reader Reader to close (may be NULL).
+ */
+void chip8_trace_reader_close(chip8_trace_reader_t *reader);
+
+#endif // !CHIP8_TRACE_H
@@ -1,8 +1,16 @@
 #include "chip8.h"
+#include "chip8_handoff.h"
+#include "chip8_jit.h"
+#include "chip8_movie.h"
+#include "chip8_pace.h"
+#include "chip8_rewind.h"
+#include "chip8_sched.h"
 #include "platform.h"
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 void handle_help() {
   printf("Usage: chip8_emulator [options]\n");
@@ -11,16 +19,40 @@ void handle_help() {
   printf("  --version, -v    Show version information and exit\n");
   printf("  --rom <file> -r     Specify the ROM file to load\n");
   printf("  --scale <num> -s   Set the window scale (default is 10)\n");
-  printf("  --delay <num> -d   Set the instruction delay in milliseconds "
-         "(default is 0)\n");
+  printf("  --ips <num>        Instructions per second (default is %u)\n",
+         CHIP8_SCHED_DEFAULT_IPS);
+  printf("  --turbo            Run as fast as possible, without throttling\n");
+  printf("  --vsync            Pace frames by the display's refresh\n");
+  printf("  --frame-stats      Print frame time statistics on exit\n");
+  printf("  --run-ahead <num>  Show the frame this many frames ahead, to hide "
+         "input lag\n");
+  printf("  --jit              Translate hot blocks to native code (x86-64)\n");
+  printf("  --rewind <MB>      Rewind history budget, 0 to disable "
+         "(default is 16)\n");
+  printf("  --record <file>    Record the seed and input to a movie file\n");
+  printf("  --play <file>      Play a movie back, then continue live\n");
+  printf("Hold Backspace to step back through the last frames.\n");
 }
 
-char *handle_params(int argc, char *argv[]) {
-  char *filename = NULL;
+// Command line settings, with their defaults set by main()
+typedef struct {
+  char *filename;
+  int videoScale;
+  uint32_t ips;
+  bool turbo;
+  bool vsync;
+  bool frameStats;
+  uint32_t runAhead;
+  bool useJit;
+  int rewindMegabytes;
+  char *recordPath;
+  char *playPath;
+} options_t;
 
+void handle_params(int argc, char *argv[], options_t *options) {
   if (argc == 1) {
     handle_help();
-    return filename;
+    return;
   }
 
   for (int i = 1; i < argc; i++) {
@@ -31,76 +63,488 @@ char *handle_params(int argc, char *argv[]) {
     else if ((strcmp(argv[i], "--version") == 0) ||
              (strcmp(argv[i], "-v") == 0)) {
       printf("chip8_emulator version 1.0.0\n");
-    } else if ((strcmp(argv[i], "--rom") == 0) && (i + 1 < argc)) {
-      filename = argv[++i];
-      printf("ROM file specified: %s\n", filename);
-    } else if ((strcmp(argv[i], "--scale") == 0) && (i + 1 < argc)) {
+    } else if ((strcmp(argv[i], "--rom") == 0 || strcmp(argv[i], "-r") == 0) &&
+               (i + 1 < argc)) {
+      options->filename = argv[++i];
+      printf("ROM file specified: %s\n", options->filename);
+    } else if ((strcmp(argv[i], "--scale") == 0 ||
+                strcmp(argv[i], "-s") == 0) && (i + 1 < argc)) {
       int scale = atoi(argv[++i]);
-      printf("Window scale set to: %d\n", scale);
-    } else if ((strcmp(argv[i], "--delay") == 0) && (i + 1 < argc)) {
-      int delay = atoi(argv[++i]);
-      printf("Instruction delay set to: %d ms\n", delay);
+      if (scale > 0) {
+        options->videoScale = scale;
+      }
+      printf("Window scale set to: %d\n", options->videoScale);
+    } else if ((strcmp(argv[i], "--ips") == 0) && (i + 1 < argc)) {
+      options->ips = (uint32_t)strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--turbo") == 0) {
+      options->turbo = true;
+    } else if (strcmp(argv[i], "--vsync") == 0) {
+      options->vsync = true;
+    } else if (strcmp(argv[i], "--frame-stats") == 0) {
+      options->frameStats = true;
+    } else if ((strcmp(argv[i], "--run-ahead") == 0) && (i + 1 < argc)) {
+      options->runAhead = (uint32_t)strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--jit") == 0) {
+      options->useJit = true;
+    } else if ((strcmp(argv[i], "--rewind") == 0) && (i + 1 < argc)) {
+      options->rewindMegabytes = atoi(argv[++i]);
+    } else if ((strcmp(argv[i], "--record") == 0) && (i + 1 < argc)) {
+      options->recordPath = argv[++i];
+    } else if ((strcmp(argv[i], "--play") == 0) && (i + 1 < argc)) {
+      options->playPath = argv[++i];
     } else {
       printf("Unknown option: %s\n", argv[i]);
       printf("Use --help or -h for usage information.\n");
     }
   }
+}
+
+// Run a slice of instructions. A program blocked on Fx0A spends the rest of
+// the slice waiting, as it would on hardware.
+static void run_slice(chip8_t *chip8, chip8_jit_t *jit, uint32_t budget) {
+  while (budget > 0) {
+    chip8_exit_t stop;
+    if (jit) {
+      chip8_jit_run(jit, budget, &stop);
+    } else {
+      chip8_run(chip8, budget, &stop);
+    }
+    budget -= stop.cycles;
+
+    if (stop.reason == CHIP8_EXIT_KEY_WAIT) {
+      break;
+    }
+    if (stop.reason == CHIP8_EXIT_INVALID) {
+      fprintf(stderr, "Invalid opcode %04X at %03X\n", stop.opcode, stop.pc);
+    }
+  }
+}
+
+// How input reached the program
+typedef struct {
+  uint64_t presses;
+  uint64_t missed;       // Released on the instruction they were pressed on
+  uint64_t keyEvents;    // Presses and releases applied
+  uint64_t latencyNs;    // Total host time from key event to applying it
+  uint64_t maxLatencyNs;
+} input_stats_t;
+
+// What running ahead cost, per frame shown
+typedef struct {
+  uint64_t frames;
+  uint64_t totalNs; // Saving, running ahead and restoring
+  uint64_t stateNs; // Saving and restoring alone
+  uint64_t maxNs;
+} run_ahead_stats_t;
+
+// Everything the emulation thread owns while it runs
+typedef struct {
+  chip8_t chip8;
+  chip8_jit_t *jit;
+  chip8_movie_t *movie;
+  chip8_recorder_t *recorder;
+  chip8_rewind_t *rewind;
+  uint32_t ips;
+  bool turbo;
+  uint32_t runAhead; // Frames to show ahead of the real state, 0 for none
+  chip8_snapshot_t realState;
+
+  // Shared with the render thread
+  chip8_input_queue_t input;
+  chip8_triple_t frames;
+  _Atomic bool stop;
+
+  chip8_pacer_t pacer;
+  input_stats_t inputStats;
+  run_ahead_stats_t runAheadStats;
+} emulator_t;
+
+static const uint64_t FRAME_NS = 1000000000ull / 60;
+
+// Take the next input event and find the instruction it falls on, from how
+// long before the last elapse it happened. Turbo has no host time to match,
+// so its events apply at once.
+static bool next_input(emulator_t *emu, const chip8_sched_t *sched,
+                       uint64_t elapsedAt, chip8_input_event_t *event,
+                       uint64_t *at) {
+  if (!chip8_input_pop(&emu->input, event)) {
+    return false;
+  }
+  uint64_t ago = elapsedAt > event->time_ns ? elapsedAt - event->time_ns : 0;
+  *at = emu->turbo ? sched->cycles : chip8_sched_cycle_ago(sched, ago);
+  return true;
+}
+
+static void apply_input(emulator_t *emu, const chip8_input_event_t *event,
+                        uint64_t cycle, uint8_t *keys, bool *rewinding,
+                        uint64_t *pressedAt) {
+  if (event->type == CHIP8_INPUT_REWIND) {
+    *rewinding = event->down;
+    return;
+  }
+
+  keys[event->key] = event->down;
+  if (emu->movie == NULL) {
+    emu->chip8.keypad[event->key] = event->down;
+    if (emu->recorder) {
+      chip8_recorder_keys(emu->recorder, &emu->chip8);
+    }
+  }
+
+  input_stats_t *stats = &emu->inputStats;
+  uint64_t now = chip8_pace_now();
+  uint64_t latency = now > event->time_ns ? now - event->time_ns : 0;
+  ++stats->keyEvents;
+  stats->latencyNs += latency;
+  if (latency > stats->maxLatencyNs) {
+    stats->maxLatencyNs = latency;
+  }
+  if (event->down) {
+    ++stats->presses;
+    pressedAt[event->key] = cycle;
+  } else if (pressedAt[event->key] == cycle) {
+    ++stats->missed;
+  }
+}
+
+// Save the real state, then run on through the given number of timer ticks
+// with the keys held now. The frame drawn afterwards is the one those keys
+// lead to, and end_run_ahead() puts the real state back. Returns the host
+// time this took, of which stateNs went on saving.
+static uint64_t begin_run_ahead(emulator_t *emu, const chip8_sched_t *sched,
+                                uint64_t *stateNs) {
+  chip8_t *chip8 = &emu->chip8;
+  uint64_t start = chip8_pace_now();
+  chip8_snapshot(chip8, &emu->realState);
+  *stateNs = chip8_pace_now() - start;
+
+  // A copy of the clock keeps the ticks in phase with the real ones
+  chip8_sched_t ahead = *sched;
+  ahead.owed = UINT64_MAX;
+  for (uint32_t frames = 0; frames < emu->runAhead;) {
+    uint32_t slice = chip8_sched_slice(&ahead);
+    run_slice(chip8, emu->jit, slice);
+    if (chip8_sched_advance(&ahead, slice)) {
+      update_timers(chip8);
+      ++frames;
+    }
+  }
+  return chip8_pace_now() - start;
+}
+
+static void end_run_ahead(emulator_t *emu, uint64_t aheadNs,
+                          uint64_t stateNs) {
+  uint64_t start = chip8_pace_now();
+  chip8_restore(&emu->chip8, &emu->realState);
+  uint64_t restoreNs = chip8_pace_now() - start;
+
+  run_ahead_stats_t *stats = &emu->runAheadStats;
+  uint64_t total = aheadNs + restoreNs;
+  ++stats->frames;
+  stats->totalNs += total;
+  stats->stateNs += stateNs + restoreNs;
+  if (total > stats->maxNs) {
+    stats->maxNs = total;
+  }
+}
+
+static void *emulate(void *arg) {
+  emulator_t *emu = (emulator_t *)arg;
+  chip8_t *chip8 = &emu->chip8;
+
+  chip8_sched_t sched;
+  chip8_sched_init(&sched, emu->ips);
+  chip8_pacer_init(&emu->pacer, FRAME_NS);
+  uint64_t lastTime = chip8_pace_now();
 
-  return (char *)filename;
+  // Keys held on the host; the movie owns the keypad while it plays
+  uint8_t keys[KEYS_COUNT] = {0};
+  uint64_t pressedAt[KEYS_COUNT] = {0};
+  bool rewinding = false;
+
+  // Next input event and the instruction it applies before
+  chip8_input_event_t pending;
+  uint64_t pendingAt = 0;
+  bool hasPending = false;
+
+  while (!atomic_load(&emu->stop)) {
+    uint64_t now = chip8_pace_now();
+    if (!emu->turbo) {
+      chip8_sched_elapse(&sched, now - lastTime);
+    }
+    lastTime = now;
+
+    // Turbo keeps owing emulated frames until this host frame is used up
+    bool owing = true;
+    while (owing) {
+      if (emu->turbo) {
+        chip8_sched_elapse(&sched, 1000000000ull / CHIP8_SCHED_TIMER_HZ);
+      }
+
+      // Slices end at timer ticks, so the timers tick at exactly 60 Hz of
+      // emulated time; movies, rewind and recordings work in those frames.
+      // They also end at input events, so each key changes on the
+      // instruction matching when it changed on the host.
+      for (;;) {
+        if (!hasPending) {
+          hasPending = next_input(emu, &sched, now, &pending, &pendingAt);
+        }
+        while (hasPending && pendingAt <= sched.cycles) {
+          apply_input(emu, &pending, sched.cycles, keys, &rewinding,
+                      pressedAt);
+          hasPending = next_input(emu, &sched, now, &pending, &pendingAt);
+        }
+
+        uint32_t slice = chip8_sched_slice(&sched);
+        if (slice == 0) {
+          break;
+        }
+        if (hasPending && pendingAt - sched.cycles < slice) {
+          slice = (uint32_t)(pendingAt - sched.cycles);
+        }
+
+        bool replaying = emu->movie || (emu->rewind && rewinding);
+        if (!replaying) {
+          run_slice(chip8, emu->jit, slice);
+        }
+        if (!chip8_sched_advance(&sched, slice)) {
+          continue;
+        }
+
+        if (emu->movie) {
+          if (chip8_movie_play_frame(emu->movie, chip8)) {
+            if (emu->recorder) {
+              chip8_recorder_frame(emu->recorder, chip8);
+            }
+          } else {
+            printf("Movie ended after %u frames\n",
+                   chip8_movie_position(emu->movie));
+            chip8_movie_close(emu->movie);
+            emu->movie = NULL;
+            memcpy(chip8->keypad, keys, sizeof(keys));
+            if (emu->recorder) {
+              chip8_recorder_keys(emu->recorder, chip8);
+            }
+          }
+        } else if (replaying) {
+          // Step back one frame per tick. The newest entry is the state on
+          // screen, so drop it and show the one before, which stays the
+          // newest for the next step or for resuming. At the oldest entry
+          // the state stays put. The keys held right now stay held when play
+          // resumes.
+          chip8_rewind_pop(emu->rewind, chip8);
+          chip8_rewind_pop(emu->rewind, chip8);
+          chip8_rewind_push(emu->rewind, chip8);
+          memcpy(chip8->keypad, keys, sizeof(keys));
+        } else {
+          update_timers(chip8);
+          if (emu->recorder) {
+            chip8_recorder_frame(emu->recorder, chip8);
+          }
+          if (emu->rewind) {
+            chip8_rewind_push(emu->rewind, chip8);
+          }
+        }
+      }
+      owing = emu->turbo && chip8_pace_now() - now < FRAME_NS;
+    }
+
+    // Rows the restore marks dirty are where the next frame shown may differ
+    // from this one, so dirty rows still add up across frames
+    bool runningAhead =
+        emu->runAhead > 0 && !emu->movie && !(emu->rewind && rewinding);
+    uint64_t aheadNs = 0;
+    uint64_t stateNs = 0;
+    if (runningAhead) {
+      aheadNs = begin_run_ahead(emu, &sched, &stateNs);
+    }
+
+    // Publish only frames that changed; the slot may hold any older frame,
+    // so it is drawn whole
+    uint32_t dirtyRows = chip8_take_dirty_rows(chip8);
+    if (dirtyRows != 0) {
+      chip8_frame_t *frame = chip8_triple_back(&emu->frames);
+      chip8_render_rows_rgba(chip8, frame->pixels, UINT32_MAX);
+      chip8_triple_publish(&emu->frames, dirtyRows);
+    }
+    if (runningAhead) {
+      end_run_ahead(emu, aheadNs, stateNs);
+    }
+
+    if (emu->turbo) {
+      chip8_pacer_mark(&emu->pacer);
+    } else {
+      chip8_pacer_wait(&emu->pacer);
+    }
+  }
+
+  // A movie holds whole frames and its final hash is taken on close, so
+  // finish the frame in progress; a playing movie only runs whole frames
+  if (emu->recorder && emu->movie == NULL && sched.timer_phase != 0) {
+    sched.owed = UINT64_MAX;
+    uint32_t slice = chip8_sched_slice(&sched);
+    run_slice(chip8, emu->jit, slice);
+    chip8_sched_advance(&sched, slice);
+    update_timers(chip8);
+    chip8_recorder_frame(emu->recorder, chip8);
+  }
+  return NULL;
 }
 
 int main(int argc, char *argv[]) {
-  char *filename = handle_params(argc, argv);
-  if (filename == NULL) {
+  options_t options = {0};
+  options.videoScale = 10;
+  options.ips = CHIP8_SCHED_DEFAULT_IPS;
+  options.rewindMegabytes = 16;
+  handle_params(argc, argv, &options);
+  char *filename = options.filename;
+  char *recordPath = options.recordPath;
+  char *playPath = options.playPath;
+  if (filename == NULL && playPath == NULL) {
     return 0;
   }
 
-  int videoScale = 10;
-  int instructionDelay = 0;
-
   platform_t platform;
-  init_platform(&platform, "Chip-8 Emulator", DISPLAY_WIDTH * videoScale,
-                DISPLAY_HEIGHT * videoScale, DISPLAY_WIDTH, DISPLAY_HEIGHT);
+  init_platform(&platform, "Chip-8 Emulator",
+                DISPLAY_WIDTH * options.videoScale,
+                DISPLAY_HEIGHT * options.videoScale, DISPLAY_WIDTH,
+                DISPLAY_HEIGHT, options.vsync);
+  if (options.vsync && !platform.vsync) {
+    fprintf(stderr, "VSync unavailable, pacing with the timer\n");
+  }
 
-  chip8_t chip8;
-  init_chip8(&chip8);
+  static emulator_t emu;
+  chip8_t *chip8 = &emu.chip8;
+  uint32_t seed = (uint32_t)time(NULL);
+  init_chip8(chip8, seed);
+  chip8->stop_mask = CHIP8_STOP_KEY_WAIT | CHIP8_STOP_INVALID;
 
-  if (load_rom(&chip8, filename) != 0) {
+  // A movie starts from its own first keyframe, so it needs no ROM
+  if (playPath) {
+    emu.movie = chip8_movie_open(playPath);
+    if (emu.movie == NULL || !chip8_movie_seek(emu.movie, chip8, 0)) {
+      fprintf(stderr, "Failed to load movie: %s\n", playPath);
+      chip8_movie_close(emu.movie);
+      destroy_platform(&platform);
+      return 1;
+    }
+    chip8_movie_info_t info;
+    chip8_movie_info(emu.movie, &info);
+    seed = info.seed;
+  } else if (load_rom(chip8, filename) != 0) {
     fprintf(stderr, "Failed to load ROM: %s\n", filename);
     destroy_platform(&platform);
     return 1;
   }
 
-  int videoPitch = sizeof(chip8.display[0]) * DISPLAY_WIDTH;
+  if (recordPath) {
+    emu.recorder = chip8_recorder_create(recordPath, chip8, seed, 0);
+    if (emu.recorder == NULL) {
+      fprintf(stderr, "Failed to create movie: %s\n", recordPath);
+    } else if (emu.movie) {
+      chip8_movie_forward_keys(emu.movie, emu.recorder);
+    }
+  }
 
-  const int FPS = 60;
-  const int frameDelay = 1000 / FPS;
+  if (options.useJit) {
+    emu.jit = chip8_jit_create(chip8);
+    if (emu.jit == NULL) {
+      fprintf(stderr, "JIT unavailable, using the interpreter\n");
+    }
+  }
 
-  uint32_t frameStart;
-  int frameTime;
+  // Stepping back would make the movie's frames disagree with the run
+  if (options.rewindMegabytes > 0 && emu.movie == NULL &&
+      emu.recorder == NULL) {
+    emu.rewind = chip8_rewind_create((size_t)options.rewindMegabytes << 20, 0);
+    if (emu.rewind == NULL) {
+      fprintf(stderr, "Rewind unavailable\n");
+    }
+  }
 
-  // Instructions per frame
-  const int instructionsPerFrame = 10;
+  // The core runs on its own thread from here on, so a slow present never
+  // holds up emulation and emulation never holds up the window
+  emu.ips = options.ips;
+  emu.turbo = options.turbo;
+  emu.runAhead = options.runAhead;
+  chip8_input_queue_init(&emu.input);
+  chip8_triple_init(&emu.frames);
+  atomic_init(&emu.stop, false);
+  pthread_t thread;
+  bool running = pthread_create(&thread, NULL, emulate, &emu) == 0;
+  if (!running) {
+    fprintf(stderr, "Failed to start the emulation thread\n");
+  }
+
+  int videoPitch = sizeof(uint32_t) * DISPLAY_WIDTH;
+  static chip8_pacer_t displayPacer;
+  chip8_pacer_init(&displayPacer, FRAME_NS);
 
-  bool quit = false;
+  bool quit = !running;
   while (!quit) {
-    frameStart = SDL_GetTicks();
+    quit = process_input(&platform, &emu.input);
 
-    quit = process_input(chip8.keypad);
+    bool fresh = chip8_triple_acquire(&emu.frames);
+    const chip8_frame_t *frame = chip8_triple_front(&emu.frames);
+    update_platform(&platform, frame->pixels, videoPitch,
+                    fresh ? frame->dirty_rows : 0);
 
-    for (int i = 0; i < instructionsPerFrame; ++i) {
-      cycle(&chip8);
+    // VSync already waited in the present
+    if (platform.vsync) {
+      chip8_pacer_mark(&displayPacer);
+    } else {
+      chip8_pacer_wait(&displayPacer);
     }
+  }
 
-    update_timers(&chip8);
-    update_platform(&platform, chip8.display, videoPitch);
+  if (running) {
+    atomic_store(&emu.stop, true);
+    pthread_join(thread, NULL);
+  }
 
-    frameTime = SDL_GetTicks() - frameStart;
-    if (frameDelay > frameTime) {
-      SDL_Delay(frameDelay - frameTime);
+  if (options.frameStats) {
+    chip8_pacer_print(&emu.pacer, "Emulation", stdout);
+    chip8_pacer_print(&displayPacer, "Display", stdout);
+    const input_stats_t *input = &emu.inputStats;
+    printf("Input: %llu presses, %llu missed, latency mean %.2f ms, "
+           "max %.2f ms\n",
+           (unsigned long long)input->presses,
+           (unsigned long long)(input->missed + emu.input.dropped),
+           input->keyEvents
+               ? (double)input->latencyNs / (double)input->keyEvents / 1e6
+               : 0.0,
+           (double)input->maxLatencyNs / 1e6);
+
+    const run_ahead_stats_t *ahead = &emu.runAheadStats;
+    if (ahead->frames) {
+      printf("Run-ahead: %u frames, mean %.3f ms per frame shown (save and "
+             "restore %.2f us), max %.3f ms\n",
+             emu.runAhead,
+             (double)ahead->totalNs / (double)ahead->frames / 1e6,
+             (double)ahead->stateNs / (double)ahead->frames / 1e3,
+             (double)ahead->maxNs / 1e6);
     }
   }
 
+  if (emu.jit) {
+    chip8_jit_stats_t stats;
+    chip8_jit_stats(emu.jit, &stats);
+    printf("JIT: %llu blocks, %llu cache hits, %llu misses, %llu flushes, "
+           "%llu native / %llu interpreted instructions\n",
+           (unsigned long long)stats.blocks_compiled,
+           (unsigned long long)stats.cache_hits,
+           (unsigned long long)stats.cache_misses,
+           (unsigned long long)stats.flushes,
+           (unsigned long long)stats.native_instructions,
+           (unsigned long long)stats.interpreted_instructions);
+    chip8_jit_destroy(emu.jit);
+  }
+
+  if (emu.recorder && chip8_recorder_close(emu.recorder, chip8) != 0) {
+    fprintf(stderr, "Failed to write movie: %s\n", recordPath);
+  }
+  chip8_movie_close(emu.movie);
+  chip8_rewind_destroy(emu.rewind);
   destroy_platform(&platform);
 
   return 0;
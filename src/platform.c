@@ -1,15 +1,31 @@
 #include "platform.h"
+#include "chip8_pace.h"
 
-void init_platform(platform_t *platform, char const *title, int windowWidth, int windowHeight, int textureWidth, int textureHeight)
+void init_platform(platform_t *platform, char const *title, int windowWidth, int windowHeight, int textureWidth, int textureHeight, bool vsync)
 {
     SDL_Init(SDL_INIT_VIDEO);
 
     platform->window = SDL_CreateWindow(title, 0, 0, windowWidth, windowHeight, SDL_WINDOW_SHOWN);
 
-    platform->renderer = SDL_CreateRenderer(platform->window, -1, SDL_RENDERER_ACCELERATED);
+    Uint32 flags = SDL_RENDERER_ACCELERATED | (vsync ? SDL_RENDERER_PRESENTVSYNC : 0);
+    platform->renderer = SDL_CreateRenderer(platform->window, -1, flags);
+
+    // The driver may not honour the request; then the caller paces itself
+    SDL_RendererInfo info;
+    platform->vsync = vsync && SDL_GetRendererInfo(platform->renderer, &info) == 0 &&
+                      (info.flags & SDL_RENDERER_PRESENTVSYNC);
 
     platform->texture = SDL_CreateTexture(
         platform->renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, textureWidth, textureHeight);
+
+    platform->redraw = true;
+    platform->rewind = false;
+    platform->sentRewind = false;
+    for (int i = 0; i < KEYS_COUNT; ++i)
+    {
+        platform->keys[i] = false;
+        platform->sentKeys[i] = false;
+    }
 }
 
 void destroy_platform(platform_t *platform)
@@ -20,18 +36,89 @@ void destroy_platform(platform_t *platform)
     SDL_Quit();
 }
 
-void update_platform(platform_t *platform, void const *buffer, int pitch)
+void update_platform(platform_t *platform, void const *buffer, int pitch, uint32_t dirtyRows)
 {
-    SDL_UpdateTexture(platform->texture, NULL, buffer, pitch);
+    // Nothing changed and the window still shows the last frame; with VSync
+    // the present still happens, since it is what paces the frame
+    if (dirtyRows == 0 && !platform->redraw && !platform->vsync)
+    {
+        return;
+    }
+
+    // Upload each run of consecutive dirty rows with one call
+    int textureWidth = pitch / (int)sizeof(uint32_t);
+    int y = 0;
+    while (y < 32)
+    {
+        if (!(dirtyRows & (1u << y)))
+        {
+            ++y;
+            continue;
+        }
+
+        int first = y;
+        while (y < 32 && (dirtyRows & (1u << y)))
+        {
+            ++y;
+        }
+
+        SDL_Rect rows = {0, first, textureWidth, y - first};
+        SDL_UpdateTexture(platform->texture, &rows, (uint8_t const *)buffer + first * pitch, pitch);
+    }
+
+    platform->redraw = false;
     SDL_RenderClear(platform->renderer);
     SDL_RenderCopy(platform->renderer, platform->texture, NULL, NULL);
     SDL_RenderPresent(platform->renderer);
 }
 
-bool process_input(uint8_t *keys)
+// Keypad key + 1 for each host key, in the usual 1234 / QWER / ASDF / ZXCV
+// layout; 0 for keys that are not mapped
+static const uint8_t KEYMAP[128] = {
+    ['1'] = 0x1 + 1, ['2'] = 0x2 + 1, ['3'] = 0x3 + 1, ['4'] = 0xC + 1,
+    ['q'] = 0x4 + 1, ['w'] = 0x5 + 1, ['e'] = 0x6 + 1, ['r'] = 0xD + 1,
+    ['a'] = 0x7 + 1, ['s'] = 0x8 + 1, ['d'] = 0x9 + 1, ['f'] = 0xE + 1,
+    ['z'] = 0xA + 1, ['x'] = 0x0 + 1, ['c'] = 0xB + 1, ['v'] = 0xF + 1,
+};
+
+static int keypad_key(SDL_Keycode code)
+{
+    return code >= 0 && code < 128 ? KEYMAP[code] - 1 : -1;
+}
+
+// Queue a key state. One refused by a full queue is sent again by the next
+// process_input(), so a dropped release cannot leave the key held.
+static void send_key(platform_t *platform, chip8_input_queue_t *input, const chip8_input_event_t *event)
+{
+    bool *sent = event->type == CHIP8_INPUT_REWIND ? &platform->sentRewind : &platform->sentKeys[event->key];
+    if (chip8_input_push(input, event))
+    {
+        *sent = event->down;
+    }
+}
+
+bool process_input(platform_t *platform, chip8_input_queue_t *input)
 {
     bool quit = false;
 
+    // Event timestamps are SDL ticks; place them on the pacing clock
+    uint64_t now = chip8_pace_now();
+    Uint32 ticks = SDL_GetTicks();
+
+    for (uint8_t i = 0; i < KEYS_COUNT; ++i)
+    {
+        if (platform->keys[i] != platform->sentKeys[i])
+        {
+            chip8_input_event_t key = {now, CHIP8_INPUT_KEY, i, platform->keys[i]};
+            send_key(platform, input, &key);
+        }
+    }
+    if (platform->rewind != platform->sentRewind)
+    {
+        chip8_input_event_t key = {now, CHIP8_INPUT_REWIND, 0, platform->rewind};
+        send_key(platform, input, &key);
+    }
+
     SDL_Event event;
 
     while (SDL_PollEvent(&event))
@@ -44,214 +131,51 @@ bool process_input(uint8_t *keys)
         }
         break;
 
-        case SDL_KEYDOWN:
+        case SDL_WINDOWEVENT:
         {
-            switch (event.key.keysym.sym)
-            {
-            case SDLK_ESCAPE:
-            {
-                quit = true;
-            }
-            break;
-
-            case SDLK_x:
-            {
-                keys[0] = 1;
-            }
-            break;
-
-            case SDLK_1:
-            {
-                keys[1] = 1;
-            }
-            break;
-
-            case SDLK_2:
-            {
-                keys[2] = 1;
-            }
-            break;
-
-            case SDLK_3:
-            {
-                keys[3] = 1;
-            }
-            break;
-
-            case SDLK_q:
-            {
-                keys[4] = 1;
-            }
-            break;
-
-            case SDLK_w:
-            {
-                keys[5] = 1;
-            }
-            break;
-
-            case SDLK_e:
-            {
-                keys[6] = 1;
-            }
-            break;
-
-            case SDLK_a:
-            {
-                keys[7] = 1;
-            }
-            break;
-
-            case SDLK_s:
-            {
-                keys[8] = 1;
-            }
-            break;
-
-            case SDLK_d:
-            {
-                keys[9] = 1;
-            }
-            break;
-
-            case SDLK_z:
-            {
-                keys[0xA] = 1;
-            }
-            break;
-
-            case SDLK_c:
-            {
-                keys[0xB] = 1;
-            }
-            break;
-
-            case SDLK_4:
-            {
-                keys[0xC] = 1;
-            }
-            break;
-
-            case SDLK_r:
+            if (event.window.event == SDL_WINDOWEVENT_EXPOSED || event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED)
             {
-                keys[0xD] = 1;
-            }
-            break;
-
-            case SDLK_f:
-            {
-                keys[0xE] = 1;
-            }
-            break;
-
-            case SDLK_v:
-            {
-                keys[0xF] = 1;
-            }
-            break;
+                platform->redraw = true;
             }
         }
         break;
 
+        case SDL_KEYDOWN:
         case SDL_KEYUP:
         {
-            switch (event.key.keysym.sym)
+            bool down = event.type == SDL_KEYDOWN;
+            if (event.key.repeat)
             {
-            case SDLK_x:
-            {
-                keys[0] = 0;
+                break;
             }
-            break;
 
-            case SDLK_1:
+            chip8_input_event_t key = {now, CHIP8_INPUT_KEY, 0, down};
+            uint64_t age = event.key.timestamp <= ticks ? (uint64_t)(ticks - event.key.timestamp) * 1000000u : 0;
+            if (age < now)
             {
-                keys[1] = 0;
+                key.time_ns = now - age;
             }
-            break;
 
-            case SDLK_2:
+            SDL_Keycode code = event.key.keysym.sym;
+            int index = keypad_key(code);
+            if (code == SDLK_ESCAPE)
             {
-                keys[2] = 0;
+                if (down)
+                {
+                    quit = true;
+                }
             }
-            break;
-
-            case SDLK_3:
+            else if (code == SDLK_BACKSPACE)
             {
-                keys[3] = 0;
+                platform->rewind = down;
+                key.type = CHIP8_INPUT_REWIND;
+                send_key(platform, input, &key);
             }
-            break;
-
-            case SDLK_q:
+            else if (index >= 0)
             {
-                keys[4] = 0;
-            }
-            break;
-
-            case SDLK_w:
-            {
-                keys[5] = 0;
-            }
-            break;
-
-            case SDLK_e:
-            {
-                keys[6] = 0;
-            }
-            break;
-
-            case SDLK_a:
-            {
-                keys[7] = 0;
-            }
-            break;
-
-            case SDLK_s:
-            {
-                keys[8] = 0;
-            }
-            break;
-
-            case SDLK_d:
-            {
-                keys[9] = 0;
-            }
-            break;
-
-            case SDLK_z:
-            {
-                keys[0xA] = 0;
-            }
-            break;
-
-            case SDLK_c:
-            {
-                keys[0xB] = 0;
-            }
-            break;
-
-            case SDLK_4:
-            {
-                keys[0xC] = 0;
-            }
-            break;
-
-            case SDLK_r:
-            {
-                keys[0xD] = 0;
-            }
-            break;
-
-            case SDLK_f:
-            {
-                keys[0xE] = 0;
-            }
-            break;
-
-            case SDLK_v:
-            {
-                keys[0xF] = 0;
-            }
-            break;
+                platform->keys[index] = down;
+                key.key = (uint8_t)index;
+                send_key(platform, input, &key);
             }
         }
         break;
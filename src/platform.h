@@ -1,6 +1,7 @@
 #ifndef PLATFORM_H
 #define PLATFORM_H
 
+#include "chip8_handoff.h"
 #include <SDL2/SDL.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -10,11 +11,19 @@ typedef struct
   SDL_Window *window;
   SDL_Renderer *renderer;
   SDL_Texture *texture;
+  bool redraw; // Window contents were lost and must be presented again
+  bool rewind; // Rewind hotkey (Backspace) is held
+  bool vsync;  // Presenting waits for the display's refresh
+
+  // Held on the host, and as last queued for the emulation thread
+  bool keys[KEYS_COUNT];
+  bool sentKeys[KEYS_COUNT];
+  bool sentRewind;
 } platform_t;
 
-void init_platform(platform_t *platform, char const *title, int windowWidth, int windowHeight, int textureWidth, int textureHeight);
+void init_platform(platform_t *platform, char const *title, int windowWidth, int windowHeight, int textureWidth, int textureHeight, bool vsync);
 void destroy_platform(platform_t *platform);
-void update_platform(platform_t *platform, void const *buffer, int pitch);
-bool process_input(uint8_t *keys);
+void update_platform(platform_t *platform, void const *buffer, int pitch, uint32_t dirtyRows);
+bool process_input(platform_t *platform, chip8_input_queue_t *input);
 
 #endif // !PLATFORM_H
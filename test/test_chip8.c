@@ -1,18 +1,1775 @@
 #include "unity.h"
 #include "chip8.h"
+#include "chip8_diff.h"
+#include "chip8_handoff.h"
+#include "chip8_jit.h"
+#include "batch.h"
+#include "chip8_analyze.h"
+#include "chip8_aot.h"
+#include "chip8_lanes.h"
+#include "chip8_movie.h"
+#include "chip8_pace.h"
+#include "chip8_profile.h"
+#include "chip8_rewind.h"
+#include "chip8_sched.h"
+#include "chip8_trace.h"
+#include <pthread.h>
+#include <string.h>
 
-void setUp(void) {}
+static chip8_t chip8;
+
+void setUp(void) { init_chip8(&chip8, 1); }
 void tearDown(void) {}
 
-// Example test - add your tests here
-void test_placeholder(void)
+// Write a program at START_ADDRESS and rebuild its predecoded slots
+static void load_program(const uint16_t *program, uint16_t count)
+{
+    for (uint16_t i = 0; i < count; ++i)
+    {
+        chip8.memory[START_ADDRESS + i * 2] = program[i] >> 8;
+        chip8.memory[START_ADDRESS + i * 2 + 1] = program[i] & 0xFF;
+    }
+    chip8_invalidate(&chip8, START_ADDRESS, count * 2);
+}
+
+void test_decode_instr_extracts_operands(void)
+{
+    chip8_instr_t instr;
+    decode_instr(0xD12F, &instr);
+
+    TEST_ASSERT_EQUAL_HEX16(0xD12F, instr.opcode);
+    TEST_ASSERT_EQUAL_HEX16(0x12F, instr.nnn);
+    TEST_ASSERT_EQUAL_UINT8(0x1, instr.x);
+    TEST_ASSERT_EQUAL_UINT8(0x2, instr.y);
+    TEST_ASSERT_EQUAL_HEX8(0x2F, instr.kk);
+    TEST_ASSERT_EQUAL_UINT8(0xF, instr.n);
+    TEST_ASSERT_EQUAL_UINT8(CHIP8_OP_DXYN, instr.op);
+}
+
+void test_decode_instr_resolves_second_level(void)
+{
+    chip8_instr_t instr;
+
+    decode_instr(0x00E0, &instr);
+    TEST_ASSERT_EQUAL_UINT8(CHIP8_OP_00E0, instr.op);
+    decode_instr(0x8AB4, &instr);
+    TEST_ASSERT_EQUAL_UINT8(CHIP8_OP_8XY4, instr.op);
+    decode_instr(0xE3A1, &instr);
+    TEST_ASSERT_EQUAL_UINT8(CHIP8_OP_EXA1, instr.op);
+    decode_instr(0xF265, &instr);
+    TEST_ASSERT_EQUAL_UINT8(CHIP8_OP_FX65, instr.op);
+}
+
+void test_cycle_executes_alu_program(void)
+{
+    const uint16_t program[] = {0x6005, 0x61FF, 0x8014};
+    load_program(program, 3);
+
+    for (int i = 0; i < 3; ++i)
+        cycle(&chip8);
+
+    TEST_ASSERT_EQUAL_HEX8(0x04, chip8.registers[0]);
+    TEST_ASSERT_EQUAL_HEX8(0x01, chip8.registers[0xF]);
+    TEST_ASSERT_EQUAL_HEX16(START_ADDRESS + 6, chip8.pc);
+}
+
+void test_dxyn_clips_and_detects_collision(void)
+{
+    // Draw the "0" glyph at (60, 30) twice: it is clipped on the right and
+    // bottom edges and the second draw erases it with VF = 1
+    const uint16_t program[] = {0x603C, 0x611E, 0xA050, 0xD015, 0xD015};
+    load_program(program, 5);
+
+    for (int i = 0; i < 4; ++i)
+        cycle(&chip8);
+    TEST_ASSERT_EQUAL_HEX64(0xFull, chip8.display[30]);
+    TEST_ASSERT_EQUAL_HEX64(0x9ull, chip8.display[31]);
+    TEST_ASSERT_EQUAL_HEX64(0, chip8.display[0]);
+    TEST_ASSERT_EQUAL_UINT8(0, chip8.registers[0xF]);
+
+    static uint32_t pixels[DISPLAY_WIDTH * DISPLAY_HEIGHT];
+    chip8_render_rgba(&chip8, pixels);
+    TEST_ASSERT_EQUAL_HEX32(0xFFFFFFFF, pixels[31 * DISPLAY_WIDTH + 60]);
+    TEST_ASSERT_EQUAL_HEX32(0x00000000, pixels[31 * DISPLAY_WIDTH + 61]);
+    TEST_ASSERT_EQUAL_HEX32(0xFFFFFFFF, pixels[31 * DISPLAY_WIDTH + 63]);
+
+    cycle(&chip8);
+    TEST_ASSERT_EQUAL_HEX64(0, chip8.display[30]);
+    TEST_ASSERT_EQUAL_HEX64(0, chip8.display[31]);
+    TEST_ASSERT_EQUAL_UINT8(1, chip8.registers[0xF]);
+}
+
+void test_display_tracks_dirty_rows(void)
+{
+    // Draw the "1" glyph at (0, 4), clear, then clear an already blank screen
+    const uint16_t program[] = {0x6000, 0x6104, 0xA055, 0xD015, 0x00E0, 0x00E0};
+    load_program(program, 6);
+
+    TEST_ASSERT_EQUAL_HEX32(0xFFFFFFFF, chip8_take_dirty_rows(&chip8));
+    TEST_ASSERT_EQUAL_HEX32(0, chip8_take_dirty_rows(&chip8));
+
+    for (int i = 0; i < 4; ++i)
+        cycle(&chip8);
+    TEST_ASSERT_EQUAL_HEX32(0x1F0, chip8_take_dirty_rows(&chip8));
+
+    cycle(&chip8);
+    TEST_ASSERT_EQUAL_HEX32(0x1F0, chip8_take_dirty_rows(&chip8));
+    cycle(&chip8);
+    TEST_ASSERT_EQUAL_HEX32(0, chip8_take_dirty_rows(&chip8));
+}
+
+void test_cxkk_random_stream_is_per_instance(void)
+{
+    // RND V0, 0xFF in a loop
+    const uint16_t program[] = {0xC0FF, 0x1200};
+    load_program(program, 2);
+    chip8.stop_mask = 0;
+
+    // Running another instance in between must not change this one's stream
+    static chip8_t other, alone;
+    other = chip8;
+    alone = chip8;
+    for (int i = 0; i < 64; ++i)
+    {
+        chip8_run(&chip8, 2, NULL);
+        chip8_run(&other, 7, NULL);
+        chip8_run(&alone, 2, NULL);
+        TEST_ASSERT_EQUAL_HEX8(alone.registers[0], chip8.registers[0]);
+    }
+
+    // A different seed gives a different stream
+    init_chip8(&other, 2);
+    init_chip8(&alone, 1);
+    TEST_ASSERT_NOT_EQUAL(alone.rng_state, other.rng_state);
+}
+
+void test_fx55_invalidates_overwritten_code(void)
+{
+    // V0..V1 = 0x6A 0x42 (LD VA, 0x42); store them over the next instruction
+    const uint16_t program[] = {0x606A, 0x6142, 0xA208, 0xF155, 0x6A00};
+    load_program(program, 5);
+
+    for (int i = 0; i < 5; ++i)
+        cycle(&chip8);
+
+    TEST_ASSERT_EQUAL_HEX16(0x6A42, chip8.decoded[(START_ADDRESS + 8) >> 1].opcode);
+    TEST_ASSERT_EQUAL_HEX8(0x42, chip8.registers[0xA]);
+}
+
+void test_fx33_invalidates_overwritten_code(void)
+{
+    // BCD of 0x7B (123) written over the following two instructions
+    const uint16_t program[] = {0x607B, 0xA206, 0xF033, 0x6F00};
+    load_program(program, 4);
+
+    for (int i = 0; i < 3; ++i)
+        cycle(&chip8);
+
+    TEST_ASSERT_EQUAL_HEX16(0x0102, chip8.decoded[(START_ADDRESS + 6) >> 1].opcode);
+    TEST_ASSERT_EQUAL_HEX16(0x0300, chip8.decoded[(START_ADDRESS + 8) >> 1].opcode);
+}
+
+void test_cycle_handles_odd_pc(void)
+{
+    // Jump into the middle of an instruction pair: 0x12 0x03 0x60 0x11 0x00
+    chip8.memory[START_ADDRESS + 0] = 0x12;
+    chip8.memory[START_ADDRESS + 1] = 0x03;
+    chip8.memory[START_ADDRESS + 2] = 0x00;
+    chip8.memory[START_ADDRESS + 3] = 0x61;
+    chip8.memory[START_ADDRESS + 4] = 0x23;
+    chip8_invalidate(&chip8, START_ADDRESS, 5);
+
+    cycle(&chip8);
+    TEST_ASSERT_EQUAL_HEX16(START_ADDRESS + 3, chip8.pc);
+    cycle(&chip8);
+    TEST_ASSERT_EQUAL_HEX8(0x23, chip8.registers[1]);
+}
+
+void test_call_stack_wraps(void)
+{
+    // Runaway recursion stays inside the stack instead of overwriting the
+    // display behind it
+    const uint16_t program[] = {0x2200};
+    load_program(program, 1);
+    chip8.stop_mask = 0;
+    chip8_run(&chip8, 40, NULL);
+    TEST_ASSERT_EQUAL_UINT8(40, chip8.sp);
+    TEST_ASSERT_EQUAL_HEX16(0x202, chip8.stack[15]);
+    TEST_ASSERT_EQUAL_HEX64(0, chip8.display[0]);
+}
+
+void test_chip8_run_matches_single_steps(void)
+{
+    // Count V0 down from 3 through a subroutine, then spin
+    const uint16_t program[] = {0x6003, 0x220A, 0x3000, 0x1202, 0x1208,
+                                0x70FF, 0x00EE};
+    load_program(program, 7);
+
+    static chip8_t reference;
+    reference = chip8;
+
+    chip8_exit_t result;
+    TEST_ASSERT_EQUAL_INT(CHIP8_EXIT_BUDGET, chip8_run(&chip8, 40, &result));
+    TEST_ASSERT_EQUAL_UINT32(40, result.cycles);
+    for (int i = 0; i < 40; ++i)
+        cycle(&reference);
+
+    TEST_ASSERT_EQUAL_UINT8(0, chip8.registers[0]);
+    TEST_ASSERT_EQUAL_HEX16(START_ADDRESS + 8, chip8.pc);
+    TEST_ASSERT_EQUAL_HEX16(reference.pc, chip8.pc);
+    TEST_ASSERT_EQUAL_UINT8(reference.sp, chip8.sp);
+    TEST_ASSERT_EQUAL_MEMORY(reference.registers, chip8.registers,
+                             sizeof(chip8.registers));
+    TEST_ASSERT_EQUAL_UINT64(40, chip8.cycles);
+}
+
+void test_chip8_run_stops_on_events(void)
+{
+    // CLS, LD DT, unknown opcode, DRW, then LD V0, K
+    const uint16_t program[] = {0x00E0, 0xF015, 0xF0FF, 0xD001, 0xF00A};
+    load_program(program, 5);
+    chip8_exit_t result;
+
+    TEST_ASSERT_EQUAL_INT(CHIP8_EXIT_DRAW, chip8_run(&chip8, 100, &result));
+    TEST_ASSERT_EQUAL_UINT32(1, result.cycles);
+    TEST_ASSERT_EQUAL_HEX16(START_ADDRESS, result.pc);
+    TEST_ASSERT_EQUAL_HEX16(0x00E0, result.opcode);
+
+    TEST_ASSERT_EQUAL_INT(CHIP8_EXIT_TIMER, chip8_run(&chip8, 100, &result));
+    TEST_ASSERT_EQUAL_INT(CHIP8_EXIT_INVALID, chip8_run(&chip8, 100, &result));
+    TEST_ASSERT_EQUAL_HEX16(START_ADDRESS + 4, result.pc);
+    TEST_ASSERT_EQUAL_HEX16(0xF0FF, result.opcode);
+    TEST_ASSERT_EQUAL_INT(CHIP8_EXIT_DRAW, chip8_run(&chip8, 100, &result));
+
+    // Fx0A blocks until a key is down, then runs off the end into 0x0000
+    TEST_ASSERT_EQUAL_INT(CHIP8_EXIT_KEY_WAIT, chip8_run(&chip8, 100, &result));
+    TEST_ASSERT_EQUAL_HEX16(START_ADDRESS + 8, chip8.pc);
+    chip8.keypad[0x7] = 1;
+    chip8.stop_mask = 0;
+    TEST_ASSERT_EQUAL_INT(CHIP8_EXIT_BUDGET, chip8_run(&chip8, 1, &result));
+    TEST_ASSERT_EQUAL_HEX8(0x7, chip8.registers[0]);
+    TEST_ASSERT_EQUAL_HEX16(START_ADDRESS + 10, result.pc);
+    TEST_ASSERT_EQUAL_UINT64(6, chip8.cycles);
+}
+
+void test_chip8_run_stops_at_breakpoints(void)
+{
+    // Loop forever incrementing V0
+    const uint16_t program[] = {0x7001, 0x7101, 0x1200};
+    load_program(program, 3);
+    chip8_set_breakpoint(&chip8, START_ADDRESS + 2, true);
+    chip8_exit_t result;
+
+    TEST_ASSERT_EQUAL_INT(CHIP8_EXIT_BREAKPOINT,
+                          chip8_run(&chip8, 100, &result));
+    TEST_ASSERT_EQUAL_UINT32(1, result.cycles);
+    TEST_ASSERT_EQUAL_HEX16(START_ADDRESS + 2, chip8.pc);
+    TEST_ASSERT_EQUAL_HEX16(0x7101, result.opcode);
+
+    // Resuming steps over the breakpoint and stops on the next pass
+    TEST_ASSERT_EQUAL_INT(CHIP8_EXIT_BREAKPOINT,
+                          chip8_run(&chip8, 100, &result));
+    TEST_ASSERT_EQUAL_UINT32(3, result.cycles);
+    TEST_ASSERT_EQUAL_UINT8(2, chip8.registers[0]);
+
+    chip8_set_breakpoint(&chip8, START_ADDRESS + 2, false);
+    TEST_ASSERT_EQUAL_INT(CHIP8_EXIT_BUDGET, chip8_run(&chip8, 30, &result));
+    TEST_ASSERT_EQUAL_UINT8(12, chip8.registers[0]);
+}
+
+// Compare everything an idle-loop fast-forward is allowed to touch
+static void assert_same_machine(const chip8_t *expected, const chip8_t *actual)
+{
+    TEST_ASSERT_EQUAL_HEX16(expected->pc, actual->pc);
+    TEST_ASSERT_EQUAL_HEX16(expected->opcode, actual->opcode);
+    TEST_ASSERT_EQUAL_UINT64(expected->cycles, actual->cycles);
+    TEST_ASSERT_EQUAL_MEMORY(expected->registers, actual->registers,
+                             sizeof(actual->registers));
+}
+
+void test_chip8_run_skips_self_jump(void)
+{
+    const uint16_t program[] = {0x6001, 0x1202};
+    load_program(program, 2);
+
+    static chip8_t reference;
+    reference = chip8;
+
+    chip8_exit_t result;
+    TEST_ASSERT_EQUAL_INT(CHIP8_EXIT_BUDGET, chip8_run(&chip8, 1000, &result));
+    for (int i = 0; i < 1000; ++i)
+        cycle(&reference);
+
+    TEST_ASSERT_EQUAL_UINT32(1000, result.cycles);
+    TEST_ASSERT_EQUAL_UINT32(998, result.idle_cycles);
+    TEST_ASSERT_EQUAL_UINT64(998, chip8.idle_cycles);
+    assert_same_machine(&reference, &chip8);
+}
+
+void test_chip8_run_skips_delay_timer_poll(void)
+{
+    // DT = 2, then spin on "LD V1, DT; SE V1, 0; JP" until it runs out
+    const uint16_t program[] = {0x6002, 0xF015, 0xF107, 0x3100, 0x1204,
+                                0x6242, 0x120C};
+    load_program(program, 7);
+    chip8.stop_mask = 0;
+
+    static chip8_t reference;
+    reference = chip8;
+
+    for (int frame = 0; frame < 4; ++frame)
+    {
+        // Odd budgets leave the fast-forward mid-loop
+        chip8_exit_t result;
+        chip8_run(&chip8, 101, &result);
+        for (int i = 0; i < 101; ++i)
+            cycle(&reference);
+        TEST_ASSERT_TRUE(result.idle_cycles > 0);
+        assert_same_machine(&reference, &chip8);
+        update_timers(&chip8);
+        update_timers(&reference);
+    }
+
+    TEST_ASSERT_EQUAL_HEX8(0x42, chip8.registers[2]);
+}
+
+void test_chip8_run_does_not_skip_changing_loop(void)
+{
+    // The loop body increments V0, so every pass is different
+    const uint16_t program[] = {0x7001, 0x1200};
+    load_program(program, 2);
+
+    chip8_exit_t result;
+    chip8_run(&chip8, 100, &result);
+    TEST_ASSERT_EQUAL_UINT32(0, result.idle_cycles);
+    TEST_ASSERT_EQUAL_UINT8(50, chip8.registers[0]);
+}
+
+void test_jit_skips_idle_loops(void)
+{
+    const uint16_t program[] = {0x6002, 0xF015, 0xF107, 0x3100, 0x1204,
+                                0x6242, 0x120C};
+    load_program(program, 7);
+    chip8.stop_mask = 0;
+
+    static chip8_t reference;
+    reference = chip8;
+
+    chip8_jit_t *jit = chip8_jit_create(&chip8);
+    for (int frame = 0; frame < 4; ++frame)
+    {
+        chip8_jit_run(jit, 101, NULL);
+        chip8_run(&reference, 101, NULL);
+        assert_same_machine(&reference, &chip8);
+        update_timers(&chip8);
+        update_timers(&reference);
+    }
+
+    chip8_jit_stats_t stats;
+    chip8_jit_stats(jit, &stats);
+    TEST_ASSERT_TRUE(stats.idle_instructions > 0);
+    TEST_ASSERT_EQUAL_HEX8(0x42, chip8.registers[2]);
+    chip8_jit_destroy(jit);
+}
+
+// Run a ROM on the JIT and on the interpreter and compare the machines
+static void assert_jit_matches_interpreter(const char *rom)
+{
+    static chip8_t reference;
+    init_chip8(&chip8, 0xC8);
+    init_chip8(&reference, 0xC8);
+    TEST_ASSERT_EQUAL_INT(0, load_rom(&chip8, rom));
+    TEST_ASSERT_EQUAL_INT(0, load_rom(&reference, rom));
+
+    chip8_jit_t *jit = chip8_jit_create(&chip8);
+    TEST_ASSERT_NOT_NULL(jit);
+
+    for (int frame = 0; frame < 600; ++frame)
+    {
+        // Both sides must stop at the same events with the same details
+        uint32_t budget = 37;
+        while (budget > 0)
+        {
+            chip8_exit_t native, interpreted;
+            chip8_jit_run(jit, budget, &native);
+            chip8_run(&reference, budget, &interpreted);
+            TEST_ASSERT_EQUAL_INT(interpreted.reason, native.reason);
+            TEST_ASSERT_EQUAL_UINT32(interpreted.cycles, native.cycles);
+            TEST_ASSERT_EQUAL_HEX16(interpreted.pc, native.pc);
+            TEST_ASSERT_EQUAL_HEX16(interpreted.opcode, native.opcode);
+            TEST_ASSERT_EQUAL_HEX16(reference.pc, chip8.pc);
+            budget -= native.cycles;
+            if (native.reason == CHIP8_EXIT_KEY_WAIT)
+                break;
+        }
+        update_timers(&chip8);
+        update_timers(&reference);
+    }
+
+    TEST_ASSERT_EQUAL_MEMORY(reference.registers, chip8.registers,
+                             sizeof(chip8.registers));
+    TEST_ASSERT_EQUAL_HEX16(reference.index, chip8.index);
+    TEST_ASSERT_EQUAL_MEMORY(reference.memory, chip8.memory,
+                             sizeof(chip8.memory));
+    TEST_ASSERT_EQUAL_MEMORY(reference.display, chip8.display,
+                             sizeof(chip8.display));
+    TEST_ASSERT_EQUAL_UINT64(reference.cycles, chip8.cycles);
+
+    chip8_jit_stats_t stats;
+    chip8_jit_stats(jit, &stats);
+    TEST_ASSERT_EQUAL_UINT64(chip8.cycles,
+                             stats.native_instructions +
+                                 stats.interpreted_instructions +
+                                 stats.idle_instructions);
+    chip8_jit_destroy(jit);
+}
+
+void test_jit_matches_interpreter_on_games(void)
+{
+    assert_jit_matches_interpreter("games/test_opcode.ch8");
+    assert_jit_matches_interpreter("games/Pong.ch8");
+    assert_jit_matches_interpreter("games/Airplane.ch8");
+}
+
+void test_jit_alu_and_flags(void)
+{
+    // Exercise every natively translated ALU form, including VF as operand
+    const uint16_t program[] = {0x60F0, 0x6122, 0x8014, 0x8F04, 0x6203,
+                                0x8125, 0x8127, 0x8236, 0x830E, 0x8F1E,
+                                0xA123, 0xF21E, 0xF329, 0x7005, 0x8401,
+                                0x8512, 0x8643, 0x1234};
+    load_program(program, 18);
+
+    static chip8_t reference;
+    reference = chip8;
+
+    chip8_jit_t *jit = chip8_jit_create(&chip8);
+    chip8_jit_run(jit, 18, NULL);
+    chip8_run(&reference, 18, NULL);
+
+    TEST_ASSERT_EQUAL_MEMORY(reference.registers, chip8.registers,
+                             sizeof(chip8.registers));
+    TEST_ASSERT_EQUAL_HEX16(reference.index, chip8.index);
+    TEST_ASSERT_EQUAL_HEX16(reference.pc, chip8.pc);
+    chip8_jit_destroy(jit);
+}
+
+void test_jit_invalidates_on_self_modifying_store(void)
+{
+    // Call a translated subroutine, overwrite its "LD V2, 0x00" with
+    // "LD V2, 0x07" through Fx55, then call it again
+    const uint16_t program[] = {0x6062, 0x6107, 0x2210, 0xA210, 0xF155,
+                                0x2210, 0x120C, 0x0000, 0x6200, 0x00EE};
+    load_program(program, 10);
+
+    chip8_jit_t *jit = chip8_jit_create(&chip8);
+    chip8_jit_run(jit, 10, NULL);
+
+    TEST_ASSERT_EQUAL_HEX8(0x07, chip8.registers[2]);
+    TEST_ASSERT_EQUAL_HEX16(START_ADDRESS + 0x0C, chip8.pc);
+    chip8_jit_stats_t stats;
+    chip8_jit_stats(jit, &stats);
+    TEST_ASSERT_TRUE(stats.flushes >= 1);
+    TEST_ASSERT_EQUAL_UINT64(10, stats.native_instructions);
+    chip8_jit_destroy(jit);
+}
+
+/**
+ * Translate a subroutine, store over it while the JIT defers to the
+ * interpreter, then call it natively again. The call must run the new bytes.
+ */
+static void assert_jit_sees_interpreted_store(void (*attach)(void),
+                                              void (*detach)(void))
+{
+    const uint16_t program[] = {0x6062, 0x6107, 0x2210, 0xA210, 0xF155,
+                                0x2210, 0x120C, 0x0000, 0x6200, 0x00EE};
+    load_program(program, 10);
+
+    chip8_jit_t *jit = chip8_jit_create(&chip8);
+    chip8_jit_run(jit, 5, NULL);
+    TEST_ASSERT_EQUAL_HEX16(START_ADDRESS + 0x06, chip8.pc);
+
+    attach();
+    chip8_jit_run(jit, 2, NULL);
+    detach();
+    chip8_jit_run(jit, 3, NULL);
+
+    TEST_ASSERT_EQUAL_HEX8(0x07, chip8.registers[2]);
+    TEST_ASSERT_EQUAL_HEX16(START_ADDRESS + 0x0C, chip8.pc);
+    chip8_jit_destroy(jit);
+}
+
+static void set_unreachable_breakpoint(void)
+{
+    chip8_set_breakpoint(&chip8, 0xFFE, true);
+}
+
+static void clear_unreachable_breakpoint(void)
+{
+    chip8_set_breakpoint(&chip8, 0xFFE, false);
+}
+
+void test_jit_invalidates_on_store_under_breakpoints(void)
+{
+    assert_jit_sees_interpreted_store(set_unreachable_breakpoint,
+                                      clear_unreachable_breakpoint);
+}
+
+#if defined(CHIP8_TRACE)
+static chip8_tracer_t *jit_tracer;
+
+static void attach_jit_tracer(void)
+{
+    jit_tracer = chip8_tracer_create("test_jit_trace.c8t", 0);
+    TEST_ASSERT_NOT_NULL(jit_tracer);
+    TEST_ASSERT_TRUE(chip8_trace_attach(jit_tracer, &chip8, 1));
+}
+
+static void detach_jit_tracer(void)
+{
+    chip8_trace_detach(&chip8);
+    TEST_ASSERT_EQUAL_INT(0, chip8_tracer_destroy(jit_tracer));
+    remove("test_jit_trace.c8t");
+}
+#endif
+
+void test_jit_invalidates_on_store_while_traced(void)
+{
+#if defined(CHIP8_TRACE)
+    assert_jit_sees_interpreted_store(attach_jit_tracer, detach_jit_tracer);
+#else
+    TEST_IGNORE_MESSAGE("tracing compiled out; build with -DCHIP8_TRACE");
+#endif
+}
+
+#if defined(CHIP8_PROFILE)
+static chip8_profile_t jit_profile;
+
+static void attach_jit_profile(void)
+{
+    TEST_ASSERT_TRUE(chip8_profile_attach(&chip8, &jit_profile));
+}
+
+static void detach_jit_profile(void)
+{
+    chip8_profile_detach(&chip8);
+}
+#endif
+
+void test_jit_invalidates_on_store_while_profiled(void)
+{
+#if defined(CHIP8_PROFILE)
+    assert_jit_sees_interpreted_store(attach_jit_profile, detach_jit_profile);
+#else
+    TEST_IGNORE_MESSAGE("profiling compiled out; build with -DCHIP8_PROFILE");
+#endif
+}
+
+// Same ROM x seed x script combinations on 1 and 4 threads
+void test_batch_results_do_not_depend_on_threads(void)
+{
+    static const chip8_batch_input_t script[] = {{10, 0x0010}, {40, 0x0000}};
+    static const char *roms[] = {"games/Pong.ch8", "games/Airplane.ch8",
+                                 "games/test_opcode.ch8", "games/missing.ch8"};
+    chip8_batch_job_t jobs[24];
+    static chip8_batch_result_t single[24], parallel[24];
+
+    for (int i = 0; i < 24; ++i)
+    {
+        jobs[i].rom = roms[i % 4];
+        jobs[i].seed = (uint32_t)(i / 4 + 1);
+        jobs[i].frames = 60 + (uint32_t)i * 5;
+        jobs[i].cycles_per_frame = 50;
+        jobs[i].stop_mask = CHIP8_STOP_INVALID;
+        jobs[i].inputs = (i & 1) ? script : NULL;
+        jobs[i].input_count = (i & 1) ? 2 : 0;
+    }
+
+    TEST_ASSERT_EQUAL_INT(0, chip8_batch_run(jobs, single, 24, 1));
+    TEST_ASSERT_EQUAL_INT(0, chip8_batch_run(jobs, parallel, 24, 4));
+
+    for (int i = 0; i < 24; ++i)
+    {
+        TEST_ASSERT_EQUAL_INT(single[i].status, parallel[i].status);
+        TEST_ASSERT_EQUAL_HEX64(single[i].state_hash, parallel[i].state_hash);
+        TEST_ASSERT_EQUAL_UINT64(single[i].cycles, parallel[i].cycles);
+        TEST_ASSERT_EQUAL_MEMORY(single[i].display, parallel[i].display,
+                                 sizeof(single[i].display));
+    }
+    TEST_ASSERT_EQUAL_INT(-1, single[3].status);
+    TEST_ASSERT_EQUAL_INT(0, single[0].status);
+
+    // Jobs sharing one image read up front match jobs that read their own
+    static chip8_t worker;
+    chip8_batch_result_t own;
+    for (int i = 0; i < 24; ++i)
+    {
+        chip8_batch_run_job(&worker, &jobs[i], &own);
+        TEST_ASSERT_EQUAL_INT(own.status, single[i].status);
+        TEST_ASSERT_EQUAL_HEX64(own.state_hash, single[i].state_hash);
+    }
+}
+
+void test_batch_job_matches_direct_run(void)
 {
-    TEST_PASS();
+    chip8_batch_job_t job = {"games/Pong.ch8", 7, 120, 25, 0, NULL, 0};
+    chip8_batch_result_t result;
+    static chip8_t worker;
+    chip8_batch_run_job(&worker, &job, &result);
+
+    init_chip8(&chip8, 7);
+    chip8.stop_mask = 0;
+    TEST_ASSERT_EQUAL_INT(0, load_rom(&chip8, "games/Pong.ch8"));
+    for (int frame = 0; frame < 120; ++frame)
+    {
+        chip8_run(&chip8, 25, NULL);
+        update_timers(&chip8);
+    }
+
+    TEST_ASSERT_EQUAL_INT(CHIP8_EXIT_BUDGET, result.reason);
+    TEST_ASSERT_EQUAL_UINT32(120, result.frames);
+    TEST_ASSERT_EQUAL_UINT64(120 * 25, result.cycles);
+    TEST_ASSERT_EQUAL_HEX64(chip8_hash_state(&chip8), result.state_hash);
+
+    // A stop event ends the job inside its first frame
+    job.stop_mask = CHIP8_STOP_DRAW;
+    chip8_batch_run_job(&worker, &job, &result);
+    TEST_ASSERT_EQUAL_INT(CHIP8_EXIT_DRAW, result.reason);
+    TEST_ASSERT_EQUAL_UINT32(1, result.frames);
+}
+
+void test_restore_replays_identically(void)
+{
+    static chip8_t branch;
+    chip8_snapshot_t start;
+    TEST_ASSERT_EQUAL_INT(0, load_rom(&chip8, "games/Pong.ch8"));
+    chip8_run(&chip8, 500, NULL);
+    chip8_snapshot(&chip8, &start);
+    uint64_t hash = chip8_hash_state(&chip8);
+
+    for (int frame = 0; frame < 60; ++frame)
+    {
+        chip8_run(&chip8, 20, NULL);
+        update_timers(&chip8);
+    }
+    uint64_t later = chip8_hash_state(&chip8);
+    uint64_t cycles = chip8.cycles;
+
+    // Restoring into a fresh instance gives the same machine and the same
+    // future, random numbers included
+    init_chip8(&branch, 99);
+    chip8_restore(&branch, &start);
+    TEST_ASSERT_EQUAL_HEX64(hash, chip8_hash_state(&branch));
+    for (int frame = 0; frame < 60; ++frame)
+    {
+        chip8_run(&branch, 20, NULL);
+        update_timers(&branch);
+    }
+    TEST_ASSERT_EQUAL_HEX64(later, chip8_hash_state(&branch));
+    TEST_ASSERT_EQUAL_UINT64(cycles, branch.cycles);
+}
+
+void test_restore_redecodes_rewritten_code(void)
+{
+    // Fx55 overwrites the instruction at 0x208; restoring must undo that in
+    // the predecoded image as well as in memory
+    const uint16_t program[] = {0x606A, 0x6142, 0xA208, 0xF155, 0x6A00};
+    chip8_snapshot_t before;
+    load_program(program, 5);
+    chip8_snapshot(&chip8, &before);
+
+    chip8_run(&chip8, 4, NULL);
+    TEST_ASSERT_EQUAL_HEX16(0x6A42, chip8.decoded[(START_ADDRESS + 8) >> 1].opcode);
+
+    chip8_restore(&chip8, &before);
+    TEST_ASSERT_EQUAL_HEX16(0x6A00, chip8.decoded[(START_ADDRESS + 8) >> 1].opcode);
+    chip8.registers[0xA] = 0x55;
+    chip8.pc = START_ADDRESS + 8;
+    chip8_run(&chip8, 1, NULL);
+    TEST_ASSERT_EQUAL_HEX8(0x00, chip8.registers[0xA]);
+}
+
+void test_restore_marks_changed_rows_dirty(void)
+{
+    chip8_snapshot_t blank;
+    chip8_snapshot(&chip8, &blank);
+    chip8.display[3] = 1;
+    chip8.display[17] = 1ull << 63;
+    chip8_take_dirty_rows(&chip8);
+
+    chip8_restore(&chip8, &blank);
+    TEST_ASSERT_EQUAL_HEX32((1u << 3) | (1u << 17), chip8_take_dirty_rows(&chip8));
+    TEST_ASSERT_EQUAL_UINT64(0, chip8.display[3]);
+}
+
+void test_jit_drops_code_rewritten_by_restore(void)
+{
+    // Translate a loop, then restore a state where the loop body differs
+    const uint16_t loopA[] = {0x7001, 0x1200};
+    const uint16_t loopB[] = {0x7002, 0x1200};
+    chip8_snapshot_t other;
+    load_program(loopB, 2);
+    chip8_snapshot(&chip8, &other);
+    load_program(loopA, 2);
+
+    chip8_jit_t *jit = chip8_jit_create(&chip8);
+    TEST_ASSERT_NOT_NULL(jit);
+    chip8_jit_run(jit, 100, NULL);
+    TEST_ASSERT_EQUAL_UINT8(50, chip8.registers[0]);
+
+    chip8_restore(&chip8, &other);
+    chip8_jit_run(jit, 100, NULL);
+    TEST_ASSERT_EQUAL_UINT8(100, chip8.registers[0]);
+    chip8_jit_destroy(jit);
+}
+
+// Key state that differs per lane and changes often, to force divergence
+static uint16_t lane_keys(uint32_t lane, int frame)
+{
+    if ((frame + lane) % 3 != 0)
+        return 0;
+    return (uint16_t)(1u << ((frame / 8 + lane) & 15));
+}
+
+// Step a scalar twin of every lane with cycle() and compare whole machines
+static void assert_lanes_match_cycle(chip8_lanes_t *lanes, int frames,
+                                     uint32_t cycles_per_frame)
+{
+    static chip8_t twins[CHIP8_LANES];
+    for (uint32_t l = 0; l < lanes->count; ++l)
+    {
+        chip8_lanes_extract(lanes, l, &twins[l]);
+    }
+
+    for (int frame = 0; frame < frames; ++frame)
+    {
+        for (uint32_t l = 0; l < lanes->count; ++l)
+        {
+            uint16_t keys = lane_keys(l, frame);
+            chip8_lanes_set_keys(lanes, l, keys);
+            for (int key = 0; key < KEYS_COUNT; ++key)
+            {
+                twins[l].keypad[key] = (keys >> key) & 1u;
+            }
+            for (uint32_t i = 0; i < cycles_per_frame; ++i)
+            {
+                cycle(&twins[l]);
+            }
+            update_timers(&twins[l]);
+        }
+        chip8_lanes_run(lanes, cycles_per_frame);
+        chip8_lanes_update_timers(lanes);
+    }
+
+    for (uint32_t l = 0; l < lanes->count; ++l)
+    {
+        chip8_lanes_extract(lanes, l, &chip8);
+        TEST_ASSERT_EQUAL_HEX16(twins[l].pc, chip8.pc);
+        TEST_ASSERT_EQUAL_HEX16(twins[l].opcode, chip8.opcode);
+        TEST_ASSERT_EQUAL_UINT64(twins[l].cycles, chip8.cycles);
+        TEST_ASSERT_EQUAL_MEMORY(twins[l].display, chip8.display,
+                                 sizeof(chip8.display));
+        TEST_ASSERT_EQUAL_HEX64(chip8_hash_state(&twins[l]),
+                                chip8_hash_state(&chip8));
+    }
+}
+
+void test_lanes_match_cycle_on_games(void)
+{
+    static const char *roms[] = {"games/test_opcode.ch8", "games/Pong.ch8",
+                                 "games/Airplane.ch8"};
+    static chip8_lanes_t lanes;
+    uint32_t seeds[CHIP8_LANES];
+    for (uint32_t l = 0; l < CHIP8_LANES; ++l)
+    {
+        seeds[l] = 0x1000u + l * 7919u;
+    }
+
+    for (size_t r = 0; r < sizeof(roms) / sizeof(roms[0]); ++r)
+    {
+        chip8_lanes_init(&lanes, CHIP8_LANES, seeds);
+        TEST_ASSERT_EQUAL_INT(0, chip8_lanes_load_rom(&lanes, roms[r]));
+        assert_lanes_match_cycle(&lanes, 600, 20);
+        TEST_ASSERT_EQUAL_UINT64(600 * 20, lanes.cycles);
+    }
+
+    // A partial set leaves the unused lanes alone
+    chip8_lanes_init(&lanes, 3, seeds);
+    TEST_ASSERT_EQUAL_INT(0, chip8_lanes_load_rom(&lanes, roms[1]));
+    assert_lanes_match_cycle(&lanes, 60, 20);
+    TEST_ASSERT_EQUAL_HEX16(0, lanes.pc[3]);
+    TEST_ASSERT_EQUAL_INT(-1,
+                          chip8_lanes_load_rom(&lanes, "games/missing.ch8"));
+}
+
+void test_lanes_match_cycle_on_random_code(void)
+{
+    // Random opcodes reach every handler, VF as an operand, invalid opcodes,
+    // odd pcs and self-modifying stores. Calls and returns are left out:
+    // the scalar core does not guard against stack overflow.
+    static chip8_lanes_t lanes;
+    uint32_t seeds[CHIP8_LANES];
+    uint32_t state = 0x2545F491u;
+    for (uint32_t l = 0; l < CHIP8_LANES; ++l)
+    {
+        seeds[l] = l + 1;
+    }
+    chip8_lanes_init(&lanes, CHIP8_LANES, seeds);
+
+    for (uint16_t addr = START_ADDRESS; addr < MEMORY_SIZE; addr += 2)
+    {
+        uint16_t opcode;
+        do
+        {
+            state = state * 1664525u + 1013904223u;
+            opcode = (uint16_t)(state >> 16);
+        } while ((opcode >> 12) == 0x2 || opcode == 0x00EE);
+
+        for (uint32_t l = 0; l < CHIP8_LANES; ++l)
+        {
+            lanes.memory[l][addr] = (uint8_t)(opcode >> 8);
+            lanes.memory[l][addr + 1] = (uint8_t)opcode;
+        }
+    }
+
+    assert_lanes_match_cycle(&lanes, 200, 50);
+    TEST_ASSERT_TRUE(lanes.groups > lanes.cycles);
+}
+
+void test_rewind_steps_back_through_frames(void)
+{
+    enum { FRAMES = 300 };
+    static uint64_t hashes[FRAMES];
+    chip8_rewind_t *rewind = chip8_rewind_create(1 << 20, 16);
+    TEST_ASSERT_NOT_NULL(rewind);
+    TEST_ASSERT_EQUAL_INT(0, load_rom(&chip8, "games/Pong.ch8"));
+
+    int depth = 0;
+    for (int frame = 0; frame < FRAMES; ++frame)
+    {
+        hashes[depth++] = chip8_hash_state(&chip8);
+        chip8_rewind_push(rewind, &chip8);
+        chip8.keypad[1] = (frame / 7) & 1;
+        chip8_run(&chip8, 10, NULL);
+        update_timers(&chip8);
+
+        // Step back across a keyframe now and then, then play on from there
+        if (frame % 50 == 49)
+        {
+            for (int i = 0; i < 20; ++i)
+            {
+                TEST_ASSERT_TRUE(chip8_rewind_pop(rewind, &chip8));
+                TEST_ASSERT_EQUAL_HEX64(hashes[--depth], chip8_hash_state(&chip8));
+            }
+        }
+    }
+
+    chip8_rewind_stats_t stats;
+    chip8_rewind_stats(rewind, &stats);
+    TEST_ASSERT_EQUAL_UINT32(depth, stats.frames);
+    TEST_ASSERT_LESS_THAN(stats.frames * sizeof(chip8_snapshot_t) / 4, stats.bytes_used);
+
+    while (depth > 0)
+    {
+        TEST_ASSERT_TRUE(chip8_rewind_pop(rewind, &chip8));
+        TEST_ASSERT_EQUAL_HEX64(hashes[--depth], chip8_hash_state(&chip8));
+    }
+    uint64_t hash = chip8_hash_state(&chip8);
+    TEST_ASSERT_FALSE(chip8_rewind_pop(rewind, &chip8));
+    TEST_ASSERT_EQUAL_HEX64(hash, chip8_hash_state(&chip8));
+    chip8_rewind_destroy(rewind);
+}
+
+static void assert_rewind_keeps_newest(size_t budget, uint32_t keyframe_interval)
+{
+    enum { FRAMES = 2000 };
+    static uint64_t hashes[FRAMES];
+    chip8_rewind_t *rewind = chip8_rewind_create(budget, keyframe_interval);
+    TEST_ASSERT_NOT_NULL(rewind);
+    init_chip8(&chip8, 1);
+    TEST_ASSERT_EQUAL_INT(0, load_rom(&chip8, "games/Pong.ch8"));
+
+    for (int frame = 0; frame < FRAMES; ++frame)
+    {
+        // Scribble on unused memory so states vary in size and the arena
+        // wraps at odd offsets
+        for (int i = 0; i < frame % 13; ++i)
+        {
+            chip8.memory[0xE00 + (frame * 31 + i * 97) % 0x1A0] ^= (uint8_t)(frame + i);
+        }
+        hashes[frame] = chip8_hash_state(&chip8);
+        chip8_rewind_push(rewind, &chip8);
+        chip8_run(&chip8, 10, NULL);
+        update_timers(&chip8);
+    }
+
+    chip8_rewind_stats_t stats;
+    chip8_rewind_stats(rewind, &stats);
+    TEST_ASSERT_GREATER_THAN(1, stats.frames);
+    TEST_ASSERT_LESS_THAN(FRAMES, stats.frames);
+    TEST_ASSERT_LESS_OR_EQUAL(stats.capacity, stats.bytes_used);
+    for (uint32_t i = 1; i <= stats.frames; ++i)
+    {
+        TEST_ASSERT_TRUE(chip8_rewind_pop(rewind, &chip8));
+        TEST_ASSERT_EQUAL_HEX64(hashes[FRAMES - i], chip8_hash_state(&chip8));
+    }
+    TEST_ASSERT_FALSE(chip8_rewind_pop(rewind, &chip8));
+    chip8_rewind_destroy(rewind);
+}
+
+void test_rewind_drops_oldest_when_full(void)
+{
+    TEST_ASSERT_NULL(chip8_rewind_create(1024, 0));
+    assert_rewind_keeps_newest(48 << 10, 1);
+    assert_rewind_keeps_newest(48 << 10, 3);
+    assert_rewind_keeps_newest(48 << 10, 8);
+    // Smaller than one keyframe interval: deltas lose their keyframe
+    assert_rewind_keeps_newest(12 << 10, 60);
+}
+
+static void record_pong_movie(const char *path, uint64_t *hashes, int frames)
+{
+    init_chip8(&chip8, 1234);
+    TEST_ASSERT_EQUAL_INT(0, load_rom(&chip8, "games/Pong.ch8"));
+    chip8.stop_mask = CHIP8_STOP_KEY_WAIT;
+    chip8_recorder_t *recorder = chip8_recorder_create(path, &chip8, 1234, 32);
+    TEST_ASSERT_NOT_NULL(recorder);
+
+    for (int frame = 0; frame < frames; ++frame)
+    {
+        hashes[frame] = chip8_hash_state(&chip8);
+        chip8.keypad[1] = (frame / 9) & 1;
+        chip8.keypad[4] = (frame / 23) % 3 == 0;
+
+        // Frames end early on key waits, like the frontend's
+        uint32_t budget = 10 + frame % 7;
+        chip8_exit_t stop = {CHIP8_EXIT_BUDGET, 0, 0, 0, 0};
+        while (budget > 0 && stop.reason != CHIP8_EXIT_KEY_WAIT)
+        {
+            chip8_run(&chip8, budget, &stop);
+            budget -= stop.cycles;
+        }
+        update_timers(&chip8);
+        chip8_recorder_frame(recorder, &chip8);
+    }
+    hashes[frames] = chip8_hash_state(&chip8);
+    TEST_ASSERT_EQUAL_INT(0, chip8_recorder_close(recorder, &chip8));
+}
+
+void test_movie_replays_and_seeks(void)
+{
+    enum { FRAMES = 400 };
+    static uint64_t hashes[FRAMES + 1];
+    static chip8_t player;
+    const char *path = "test_movie.c8m";
+    record_pong_movie(path, hashes, FRAMES);
+
+    chip8_movie_t *movie = chip8_movie_open(path);
+    TEST_ASSERT_NOT_NULL(movie);
+    chip8_movie_info_t info;
+    chip8_movie_info(movie, &info);
+    TEST_ASSERT_TRUE(info.complete);
+    TEST_ASSERT_EQUAL_UINT32(FRAMES, info.frames);
+    TEST_ASSERT_EQUAL_UINT32(FRAMES / 32 + 1, info.keyframes);
+    TEST_ASSERT_EQUAL_UINT32(1234, info.seed);
+    TEST_ASSERT_EQUAL_HEX64(hashes[0], info.start_hash);
+    TEST_ASSERT_EQUAL_HEX64(hashes[FRAMES], info.final_hash);
+
+    // Playback from the start into a fresh instance follows the recording
+    init_chip8(&player, 99);
+    TEST_ASSERT_TRUE(chip8_movie_seek(movie, &player, 0));
+    for (int frame = 0; frame < FRAMES; ++frame)
+    {
+        TEST_ASSERT_EQUAL_HEX64(hashes[frame], chip8_hash_state(&player));
+        TEST_ASSERT_TRUE(chip8_movie_play_frame(movie, &player));
+    }
+    TEST_ASSERT_EQUAL_HEX64(hashes[FRAMES], chip8_hash_state(&player));
+    TEST_ASSERT_FALSE(chip8_movie_play_frame(movie, &player));
+
+    // Seeking lands on any frame, on or between keyframes, in any order
+    const uint32_t targets[] = {250, 0, 31, 32, 33, 399, 400, 127};
+    for (size_t i = 0; i < sizeof(targets) / sizeof(targets[0]); ++i)
+    {
+        init_chip8(&player, 7);
+        TEST_ASSERT_TRUE(chip8_movie_seek(movie, &player, targets[i]));
+        TEST_ASSERT_EQUAL_UINT32(targets[i], chip8_movie_position(movie));
+        TEST_ASSERT_EQUAL_HEX64(hashes[targets[i]], chip8_hash_state(&player));
+    }
+    TEST_ASSERT_FALSE(chip8_movie_seek(movie, &player, FRAMES + 1));
+    chip8_movie_close(movie);
+    remove(path);
+}
+
+void test_movie_plays_a_cut_short_recording(void)
+{
+    enum { FRAMES = 200 };
+    static uint64_t hashes[FRAMES + 1];
+    static uint8_t bytes[1 << 16];
+    const char *path = "test_movie.c8m";
+    record_pong_movie(path, hashes, FRAMES);
+
+    // Drop the index and part of the last keyframe, as if the recorder
+    // had been killed
+    FILE *file = fopen(path, "rb");
+    TEST_ASSERT_NOT_NULL(file);
+    size_t size = fread(bytes, 1, sizeof(bytes), file);
+    fclose(file);
+    uint32_t keyframes = FRAMES / 32 + 1;
+    size_t body = size - 32 - keyframes * 8;
+    file = fopen(path, "wb");
+    fwrite(bytes, 1, body - 30 - CHIP8_SNAPSHOT_SIZE / 2, file);
+    fclose(file);
+
+    chip8_movie_t *movie = chip8_movie_open(path);
+    TEST_ASSERT_NOT_NULL(movie);
+    chip8_movie_info_t info;
+    chip8_movie_info(movie, &info);
+    TEST_ASSERT_FALSE(info.complete);
+    TEST_ASSERT_GREATER_THAN(FRAMES - 32, info.frames);
+    TEST_ASSERT_LESS_THAN(FRAMES, info.frames);
+
+    init_chip8(&chip8, 1);
+    TEST_ASSERT_TRUE(chip8_movie_seek(movie, &chip8, info.frames));
+    TEST_ASSERT_EQUAL_HEX64(hashes[info.frames], chip8_hash_state(&chip8));
+    TEST_ASSERT_FALSE(chip8_movie_play_frame(movie, &chip8));
+    chip8_movie_close(movie);
+    remove(path);
+
+    TEST_ASSERT_NULL(chip8_movie_open("games/Pong.ch8"));
+    TEST_ASSERT_NULL(chip8_movie_open(path));
+}
+
+void test_movie_replays_keys_at_their_instruction(void)
+{
+    // Count instructions with key 5 held in V1, and all of them in V2
+    const uint16_t program[] = {0x6505, 0xE59E, 0x1208, 0x7101,
+                                0x7201, 0x1202};
+    load_program(program, 6);
+    chip8.stop_mask = 0;
+    const char *path = "test_movie_keys.c8m";
+    chip8_recorder_t *recorder = chip8_recorder_create(path, &chip8, 1, 0);
+    TEST_ASSERT_NOT_NULL(recorder);
+
+    // Held for part of frame 0, tapped within frame 1, then pressed between
+    // frames through the keypad alone
+    const uint32_t runs[3][3] = {{7, 9, 8}, {3, 4, 17}, {24, 0, 0}};
+    for (int frame = 0; frame < 3; ++frame)
+    {
+        for (int part = 0; part < 3; ++part)
+        {
+            chip8_run(&chip8, runs[frame][part], NULL);
+            if (frame < 2 && part < 2)
+            {
+                chip8.keypad[5] = part == 0;
+                chip8_recorder_keys(recorder, &chip8);
+            }
+        }
+        update_timers(&chip8);
+        chip8_recorder_frame(recorder, &chip8);
+        chip8.keypad[5] = frame == 1;
+    }
+    uint8_t held = chip8.registers[1];
+    TEST_ASSERT_TRUE(held > 0);
+    TEST_ASSERT_EQUAL_INT(0, chip8_recorder_close(recorder, &chip8));
+
+    static chip8_t player;
+    init_chip8(&player, 99);
+    chip8_movie_t *movie = chip8_movie_open(path);
+    TEST_ASSERT_NOT_NULL(movie);
+    chip8_movie_info_t info;
+    chip8_movie_info(movie, &info);
+    TEST_ASSERT_TRUE(chip8_movie_seek(movie, &player, 0));
+    while (chip8_movie_play_frame(movie, &player))
+    {
+    }
+    TEST_ASSERT_EQUAL_UINT32(3, chip8_movie_position(movie));
+    TEST_ASSERT_EQUAL_UINT8(held, player.registers[1]);
+    TEST_ASSERT_EQUAL_UINT64(info.final_hash, chip8_hash_state(&player));
+    chip8_movie_close(movie);
+    remove(path);
+}
+
+#if defined(CHIP8_TRACE)
+/**
+ * Trace two instances into one file and check every record against an
+ * untraced instance stepped one cycle() at a time.
+ */
+static void assert_trace_matches_cycle(uint32_t flags)
+{
+    static chip8_t traced[2], reference[2];
+    const char *roms[2] = {"games/Pong.ch8", "games/Airplane.ch8"};
+    const char *path = "test_trace.c8t";
+    chip8_tracer_t *tracer = chip8_tracer_create(path, flags);
+    TEST_ASSERT_NOT_NULL(tracer);
+
+    for (int i = 0; i < 2; ++i)
+    {
+        init_chip8(&traced[i], 5 + i);
+        init_chip8(&reference[i], 5 + i);
+        TEST_ASSERT_EQUAL_INT(0, load_rom(&traced[i], roms[i]));
+        TEST_ASSERT_EQUAL_INT(0, load_rom(&reference[i], roms[i]));
+        traced[i].stop_mask = 0;
+        TEST_ASSERT_TRUE(chip8_trace_attach(tracer, &traced[i], 10 + i));
+        TEST_ASSERT_FALSE(chip8_trace_attach(tracer, &traced[i], 10 + i));
+    }
+    for (int frame = 0; frame < 300; ++frame)
+    {
+        for (int i = 0; i < 2; ++i)
+        {
+            traced[i].keypad[4] = (frame / 40) & 1;
+            chip8_run(&traced[i], 20, NULL);
+            update_timers(&traced[i]);
+        }
+    }
+    // A restore between runs shows up as a sync
+    chip8_snapshot_t start;
+    chip8_snapshot(&reference[0], &start);
+    chip8_restore(&traced[0], &start);
+    for (int i = 0; i < 50; ++i)
+    {
+        cycle(&traced[0]);
+    }
+    for (int i = 0; i < 2; ++i)
+    {
+        TEST_ASSERT_EQUAL_UINT64(0, chip8_trace_detach(&traced[i]));
+        TEST_ASSERT_NULL(traced[i].trace);
+    }
+    TEST_ASSERT_EQUAL_INT(0, chip8_tracer_destroy(tracer));
+
+    chip8_trace_reader_t *reader = chip8_trace_reader_open(path);
+    TEST_ASSERT_NOT_NULL(reader);
+    chip8_trace_record_t record;
+    uint64_t steps[2] = {0, 0};
+    uint64_t frame_cycles[2] = {0, 0};
+    bool restored = false;
+    while (chip8_trace_read(reader, &record))
+    {
+        TEST_ASSERT_TRUE(record.instance == 10 || record.instance == 11);
+        int i = (int)record.instance - 10;
+        chip8_t *expected = &reference[i];
+
+        if (record.kind == CHIP8_TRACE_SYNC)
+        {
+            TEST_ASSERT_EQUAL_UINT32(0, record.count);
+            if (record.cycle != expected->cycles)
+            {
+                // The restore: start over from the same snapshot
+                TEST_ASSERT_EQUAL_INT(0, i);
+                TEST_ASSERT_EQUAL_UINT64(0, record.cycle);
+                chip8_restore(expected, &start);
+                restored = true;
+            }
+            TEST_ASSERT_EQUAL_HEX16(expected->pc, record.pc);
+            TEST_ASSERT_EQUAL_HEX8_ARRAY(expected->registers, record.registers,
+                                         V_REG_COUNT);
+            continue;
+        }
+
+        TEST_ASSERT_EQUAL_UINT64(expected->cycles, record.cycle);
+        uint32_t count = record.kind == CHIP8_TRACE_IDLE ? record.count : 1;
+        if (record.kind == CHIP8_TRACE_STEP)
+        {
+            TEST_ASSERT_EQUAL_HEX16(expected->pc, record.pc);
+        }
+        // After the restore the traced instance only steps with cycle()
+        bool frames = !(restored && i == 0);
+        for (uint32_t n = 0; n < count; ++n)
+        {
+            if (frames)
+            {
+                expected->keypad[4] = (frame_cycles[i] / 20 / 40) & 1;
+            }
+            uint8_t before[V_REG_COUNT];
+            memcpy(before, expected->registers, sizeof(before));
+            cycle(expected);
+            ++steps[i];
+            if (record.kind == CHIP8_TRACE_STEP)
+            {
+                uint16_t changed = 0;
+                for (int reg = 0; reg < V_REG_COUNT; ++reg)
+                {
+                    changed |= (uint16_t)((before[reg] != expected->registers[reg]) << reg);
+                }
+                TEST_ASSERT_EQUAL_HEX16(expected->opcode, record.opcode);
+                TEST_ASSERT_EQUAL_HEX16(0, changed & ~record.written);
+            }
+            if (frames && ++frame_cycles[i] % 20 == 0)
+            {
+                update_timers(expected);
+            }
+        }
+        TEST_ASSERT_EQUAL_HEX16(expected->index, record.index);
+        TEST_ASSERT_EQUAL_HEX8_ARRAY(expected->registers, record.registers,
+                                     V_REG_COUNT);
+    }
+    chip8_trace_reader_close(reader);
+    remove(path);
+
+    TEST_ASSERT_TRUE(restored);
+    TEST_ASSERT_EQUAL_UINT64(traced[0].cycles, reference[0].cycles);
+    TEST_ASSERT_EQUAL_UINT64(traced[1].cycles, reference[1].cycles);
+    TEST_ASSERT_EQUAL_UINT64(300 * 20 + 50, steps[0]);
+    TEST_ASSERT_EQUAL_HEX64(chip8_hash_state(&traced[1]),
+                            chip8_hash_state(&reference[1]));
+}
+#endif
+
+void test_trace_records_every_instruction(void)
+{
+#if defined(CHIP8_TRACE)
+    assert_trace_matches_cycle(0);
+    assert_trace_matches_cycle(CHIP8_TRACE_MMAP);
+#else
+    chip8_tracer_t *tracer = chip8_tracer_create("test_trace.c8t", 0);
+    TEST_ASSERT_NOT_NULL(tracer);
+    TEST_ASSERT_FALSE(chip8_trace_attach(tracer, &chip8, 0));
+    TEST_ASSERT_EQUAL_INT(0, chip8_tracer_destroy(tracer));
+    remove("test_trace.c8t");
+    TEST_IGNORE_MESSAGE("tracing compiled out; build with -DCHIP8_TRACE");
+#endif
+}
+
+void test_profile_counts_every_instruction(void)
+{
+    static chip8_profile_t profile;
+#if defined(CHIP8_PROFILE)
+    // Two draws, the first clipped to two columns, then a key wait
+    const uint16_t program[] = {0x6000, 0xF029, 0x613E, 0xD105, 0xD005,
+                                0xF20A, 0x1200};
+    load_program(program, 7);
+    chip8.stop_mask = 0;
+    TEST_ASSERT_TRUE(chip8_profile_attach(&chip8, &profile));
+    TEST_ASSERT_FALSE(chip8_profile_attach(&chip8, &profile));
+    chip8_run(&chip8, 100, NULL);
+    cycle(&chip8);
+    chip8.keypad[7] = 1;
+    chip8_run(&chip8, 2, NULL);
+    chip8_profile_detach(&chip8);
+    TEST_ASSERT_NULL(chip8.profile);
+
+    TEST_ASSERT_EQUAL_UINT64(103, profile.instructions);
+    TEST_ASSERT_EQUAL_UINT64(2, profile.draws);
+    TEST_ASSERT_EQUAL_UINT64(7 + 14, profile.pixels);
+    TEST_ASSERT_EQUAL_UINT64(96, profile.key_wait_cycles);
+    TEST_ASSERT_EQUAL_UINT64(94, profile.idle_cycles);
+    TEST_ASSERT_EQUAL_UINT64(97, profile.op_counts[CHIP8_OP_FX0A]);
+    TEST_ASSERT_EQUAL_UINT64(97, profile.pc_counts[0x20A]);
+    TEST_ASSERT_EQUAL_UINT64(1, profile.pc_counts[0x20C]);
+    TEST_ASSERT_EQUAL_UINT64(2, profile.op_counts[CHIP8_OP_DXYN]);
+
+    // Per-operation and per-address counts match stepping with cycle(),
+    // idle skips and all
+    static chip8_t reference;
+    init_chip8(&chip8, 3);
+    init_chip8(&reference, 3);
+    TEST_ASSERT_EQUAL_INT(0, load_rom(&chip8, "games/Pong.ch8"));
+    TEST_ASSERT_EQUAL_INT(0, load_rom(&reference, "games/Pong.ch8"));
+    chip8.stop_mask = 0;
+    TEST_ASSERT_TRUE(chip8_profile_attach(&chip8, &profile));
+    static uint64_t op_counts[CHIP8_OP_COUNT], pc_counts[MEMORY_SIZE];
+    for (int frame = 0; frame < 300; ++frame)
+    {
+        chip8_run(&chip8, 50, NULL);
+        update_timers(&chip8);
+        for (int i = 0; i < 50; ++i)
+        {
+            ++op_counts[reference.decoded[reference.pc >> 1].op];
+            ++pc_counts[reference.pc];
+            cycle(&reference);
+        }
+        update_timers(&reference);
+    }
+    chip8_profile_detach(&chip8);
+    TEST_ASSERT_EQUAL_UINT64(300 * 50, profile.instructions);
+    TEST_ASSERT_GREATER_THAN_UINT64(0, profile.idle_cycles);
+    TEST_ASSERT_EQUAL_HEX64(chip8_hash_state(&reference),
+                            chip8_hash_state(&chip8));
+    TEST_ASSERT_EQUAL_UINT64_ARRAY(op_counts, profile.op_counts,
+                                   CHIP8_OP_COUNT);
+    TEST_ASSERT_EQUAL_UINT64_ARRAY(pc_counts, profile.pc_counts, MEMORY_SIZE);
+    TEST_ASSERT_EQUAL_UINT64(op_counts[CHIP8_OP_DXYN], profile.draws);
+
+    uint64_t ns = 0;
+    for (int pc = 0; pc < MEMORY_SIZE; ++pc)
+    {
+        ns += chip8_profile_pc_ns(&profile, (uint16_t)pc);
+    }
+    TEST_ASSERT_GREATER_THAN_UINT64(0, ns);
+
+    FILE *out = tmpfile();
+    TEST_ASSERT_NOT_NULL(out);
+    chip8_profile_report(&profile, out, 10);
+    chip8_profile_heatmap(&profile, out);
+    rewind(out);
+    static char text[16384];
+    size_t length = fread(text, 1, sizeof(text) - 1, out);
+    text[length] = '\0';
+    fclose(out);
+    TEST_ASSERT_NOT_NULL(strstr(text, "Dxyn DRW Vx, Vy, n"));
+    TEST_ASSERT_NOT_NULL(strstr(text, "200 |"));
+#else
+    TEST_ASSERT_FALSE(chip8_profile_attach(&chip8, &profile));
+    TEST_IGNORE_MESSAGE("profiling compiled out; build with -DCHIP8_PROFILE");
+#endif
+}
+
+void test_analyze_separates_code_and_data(void)
+{
+    static chip8_analysis_t analysis;
+    const uint16_t program[] = {0xA220, 0x220A, 0x3001, 0x1204,
+                                0xB300, 0xD015, 0xF155, 0x00EE};
+    load_program(program, 8);
+    chip8_analyze(&chip8, &analysis);
+
+    TEST_ASSERT_EQUAL_UINT32(8, analysis.instructions);
+    TEST_ASSERT_EQUAL_HEX16(CHIP8_BYTE_CODE, analysis.flags[0x200]);
+    TEST_ASSERT_EQUAL_HEX16(CHIP8_BYTE_OPERAND, analysis.flags[0x201]);
+    TEST_ASSERT_TRUE(analysis.flags[0x204] & CHIP8_BYTE_LABEL);
+    TEST_ASSERT_TRUE(analysis.flags[0x208] & CHIP8_BYTE_LABEL);
+    TEST_ASSERT_EQUAL_UINT16(1, analysis.subroutine_count);
+    TEST_ASSERT_EQUAL_HEX16(0x20A, analysis.subroutines[0].entry);
+    TEST_ASSERT_EQUAL_HEX16(0x210, analysis.subroutines[0].end);
+    TEST_ASSERT_EQUAL_UINT16(1, analysis.indirect_count);
+    TEST_ASSERT_EQUAL_HEX16(0x208, analysis.indirect[0]);
+
+    // I is known inside the subroutine, so the sprite and the store land
+    TEST_ASSERT_EQUAL_HEX16(CHIP8_BYTE_REFERENCED | CHIP8_BYTE_SPRITE |
+                                CHIP8_BYTE_WRITTEN,
+                            analysis.flags[0x220]);
+    TEST_ASSERT_EQUAL_HEX16(CHIP8_BYTE_SPRITE, analysis.flags[0x222]);
+    TEST_ASSERT_EQUAL_HEX16(CHIP8_BYTE_SPRITE, analysis.flags[0x224]);
+    TEST_ASSERT_EQUAL_HEX16(0, analysis.flags[0x225]);
+    TEST_ASSERT_FALSE(analysis.self_modifying);
+    TEST_ASSERT_FALSE(analysis.unknown_writes);
+
+    TEST_ASSERT_TRUE(chip8_analysis_is_data(&analysis, 0x220));
+    TEST_ASSERT_TRUE(chip8_analysis_is_data(&analysis, 0x210));
+    TEST_ASSERT_FALSE(chip8_analysis_is_data(&analysis, 0x20E));
+    TEST_ASSERT_FALSE(chip8_analysis_is_data(&analysis, 0x300));
+    TEST_ASSERT_FALSE(chip8_analysis_is_data(&analysis, 0x400));
+    TEST_ASSERT_TRUE(chip8_analysis_is_data(&analysis, 0x401));
+
+    // This core runs SYS addr as a jump: its target is code, the next word
+    // is not, and it can end a subroutine's extent like JP
+    const uint16_t sys[] = {0x2206, 0x0300, 0x00EE, 0x0204};
+    init_chip8(&chip8, 1);
+    load_program(sys, 4);
+    chip8.memory[0x300] = 0x13;
+    chip8.memory[0x301] = 0x00;
+    chip8_analyze(&chip8, &analysis);
+    TEST_ASSERT_EQUAL_HEX16(CHIP8_BYTE_CODE | CHIP8_BYTE_LABEL,
+                            analysis.flags[0x300]);
+    TEST_ASSERT_FALSE(chip8_analysis_is_data(&analysis, 0x300));
+    TEST_ASSERT_EQUAL_HEX16(CHIP8_BYTE_CODE | CHIP8_BYTE_LABEL,
+                            analysis.flags[0x204]);
+    TEST_ASSERT_FALSE(analysis.flags[0x208] & CHIP8_BYTE_CODE);
+    TEST_ASSERT_EQUAL_UINT16(1, analysis.subroutine_count);
+    TEST_ASSERT_EQUAL_HEX16(0x206, analysis.subroutines[0].entry);
+    TEST_ASSERT_EQUAL_HEX16(0x208, analysis.subroutines[0].end);
+
+    // A store over code makes nothing provably data
+    const uint16_t modifying[] = {0xA200, 0xF055, 0xF01E, 0xF055, 0x1202};
+    init_chip8(&chip8, 1);
+    load_program(modifying, 5);
+    chip8_analyze(&chip8, &analysis);
+    TEST_ASSERT_TRUE(analysis.self_modifying);
+    TEST_ASSERT_TRUE(analysis.unknown_writes);
+    TEST_ASSERT_FALSE(chip8_analysis_is_data(&analysis, 0x220));
+
+    // The sprite table at the top of test_opcode.ch8 is jumped over
+    init_chip8(&chip8, 1);
+    TEST_ASSERT_EQUAL_INT(0, load_rom(&chip8, "games/test_opcode.ch8"));
+    chip8_analyze(&chip8, &analysis);
+    TEST_ASSERT_EQUAL_HEX16(CHIP8_BYTE_SPRITE, analysis.flags[0x202] &
+                                                   (CHIP8_BYTE_SPRITE |
+                                                    CHIP8_BYTE_CODE));
+    TEST_ASSERT_TRUE(chip8_analysis_is_data(&analysis, 0x202));
+
+    char text[24];
+    chip8_disassemble(0xD015, text, sizeof(text));
+    TEST_ASSERT_EQUAL_STRING("DRW V0, V1, 5", text);
+    chip8_disassemble(0xF265, text, sizeof(text));
+    TEST_ASSERT_EQUAL_STRING("LD V2, [I]", text);
+    chip8_disassemble(0xB300, text, sizeof(text));
+    TEST_ASSERT_EQUAL_STRING("JP V0, 0x300", text);
+    chip8_disassemble(0xF0FF, text, sizeof(text));
+    TEST_ASSERT_EQUAL_STRING(".word 0xF0FF", text);
+}
+
+// Hand translation of 7A01 1200, as chip8_aot_translate() would emit it
+static uint32_t aot_loop_run(chip8_t *c, chip8_aot_context_t *context,
+                             uint32_t budget)
+{
+    if (c->pc != 0x200 || !context->valid[0x100] || budget < 2)
+        return budget;
+    budget -= 2;
+    c->registers[0xA] = (uint8_t)(c->registers[0xA] + 0x01);
+    c->opcode = 0x1200;
+    c->pc = 0x200;
+    context->exit_block = 0x200; // Closes a loop: the runtime checks idle
+    return budget;
+}
+
+void test_aot_runs_blocks_while_code_matches(void)
+{
+    const uint16_t program[] = {0x7A01, 0x1200};
+    load_program(program, 2);
+
+    FILE *out = tmpfile();
+    TEST_ASSERT_NOT_NULL(out);
+    TEST_ASSERT_EQUAL_INT(1, chip8_aot_translate(&chip8, "test", out));
+    static char source[8192];
+    rewind(out);
+    source[fread(source, 1, sizeof(source) - 1, out)] = '\0';
+    fclose(out);
+    TEST_ASSERT_NOT_NULL(strstr(source, "chip8_aot_program_t chip8_aot_test"));
+    TEST_ASSERT_NOT_NULL(strstr(source, "// 200 7A01 ADD VA, 0x01"));
+    TEST_ASSERT_NOT_NULL(strstr(source, "{0x200, 2, 0, 0, 1}"));
+
+    static const uint8_t image[] = {0x7A, 0x01, 0x12, 0x00};
+    static const chip8_aot_block_t blocks[] = {{0x200, 2, 0, 0, 1}};
+    chip8_aot_program_t translated = {CHIP8_AOT_ABI, sizeof(chip8_t), "test",
+                                      0x200, 4, image, blocks, 1,
+                                      aot_loop_run};
+    static chip8_t reference;
+    reference = chip8;
+    chip8_aot_t *aot = chip8_aot_create(&chip8, &translated);
+    TEST_ASSERT_NOT_NULL(aot);
+
+    // An odd budget leaves one instruction for the interpreter
+    chip8_exit_t stop;
+    TEST_ASSERT_EQUAL(CHIP8_EXIT_BUDGET, chip8_aot_run(aot, 1001, &stop));
+    chip8_run(&reference, 1001, NULL);
+    TEST_ASSERT_EQUAL_UINT32(1001, stop.cycles);
+    TEST_ASSERT_EQUAL_HEX64(chip8_hash_state(&reference),
+                            chip8_hash_state(&chip8));
+    chip8_aot_stats_t stats;
+    chip8_aot_stats(aot, &stats);
+    TEST_ASSERT_EQUAL_UINT64(1000, stats.native_instructions);
+    TEST_ASSERT_EQUAL_UINT64(1, stats.interpreted_instructions);
+
+    // Rewritten code drops the block and the interpreter takes over
+    chip8.memory[0x201] = reference.memory[0x201] = 0x02;
+    chip8_invalidate(&chip8, 0x201, 1);
+    chip8_invalidate(&reference, 0x201, 1);
+    chip8_aot_run(aot, 101, NULL);
+    chip8_run(&reference, 101, NULL);
+    TEST_ASSERT_EQUAL_HEX64(chip8_hash_state(&reference),
+                            chip8_hash_state(&chip8));
+    chip8_aot_stats(aot, &stats);
+    TEST_ASSERT_EQUAL_UINT64(1, stats.invalidations);
+    TEST_ASSERT_EQUAL_UINT64(1000, stats.native_instructions);
+    chip8_aot_destroy(aot);
+
+    translated.state_size = 0;
+    TEST_ASSERT_NULL(chip8_aot_create(&chip8, &translated));
+}
+
+/**
+ * Store over the translated 7A01 1200 loop while the runtime defers to the
+ * interpreter, then run into it. The block must not run the old bytes.
+ */
+static void assert_aot_sees_interpreted_store(void (*attach)(void),
+                                              void (*detach)(void))
+{
+    const uint16_t program[] = {0x7A01, 0x1200, 0xA203, 0xF055, 0x1200};
+    load_program(program, 5);
+    chip8.registers[0] = 0x02;
+    chip8.pc = 0x204;
+    static chip8_t reference;
+    reference = chip8;
+
+    static const uint8_t image[] = {0x7A, 0x01, 0x12, 0x00};
+    static const chip8_aot_block_t blocks[] = {{0x200, 2, 0, 0, 1}};
+    chip8_aot_program_t translated = {CHIP8_AOT_ABI, sizeof(chip8_t), "test",
+                                      0x200, 4, image, blocks, 1,
+                                      aot_loop_run};
+    chip8_aot_t *aot = chip8_aot_create(&chip8, &translated);
+    TEST_ASSERT_NOT_NULL(aot);
+
+    attach();
+    chip8_aot_run(aot, 2, NULL);
+    detach();
+    chip8_aot_run(aot, 5, NULL);
+    chip8_run(&reference, 2, NULL);
+    chip8_run(&reference, 5, NULL);
+
+    TEST_ASSERT_EQUAL_HEX16(0x202, chip8.pc);
+    TEST_ASSERT_EQUAL_HEX64(chip8_hash_state(&reference),
+                            chip8_hash_state(&chip8));
+    chip8_aot_stats_t stats;
+    chip8_aot_stats(aot, &stats);
+    TEST_ASSERT_EQUAL_UINT64(1, stats.invalidations);
+    TEST_ASSERT_EQUAL_UINT64(0, stats.native_instructions);
+    chip8_aot_destroy(aot);
+}
+
+void test_aot_rechecks_after_interpreted_stores(void)
+{
+    assert_aot_sees_interpreted_store(set_unreachable_breakpoint,
+                                      clear_unreachable_breakpoint);
+#if defined(CHIP8_TRACE)
+    assert_aot_sees_interpreted_store(attach_jit_tracer, detach_jit_tracer);
+#endif
+#if defined(CHIP8_PROFILE)
+    assert_aot_sees_interpreted_store(attach_jit_profile, detach_jit_profile);
+#endif
+}
+
+// Runs like chip8_run() but corrupts VA as instruction 778 executes
+static void broken_run(void *context, chip8_t *instance, uint32_t cycles)
+{
+    (void)context;
+    for (uint32_t i = 0; i < cycles; ++i)
+    {
+        chip8_run(instance, 1, NULL);
+        if (instance->cycles == 778)
+            instance->registers[0xA] ^= 0x40;
+    }
+}
+
+void test_diff_finds_first_divergence(void)
+{
+    static chip8_diff_result_t result;
+    const chip8_diff_options_t options = {20000, 100, 7};
+    const chip8_diff_core_t *cores[] = {&chip8_diff_interpreter,
+                                        &chip8_diff_jit};
+    for (uint32_t seed = 1; seed <= 3; ++seed)
+    {
+        for (int kind = CHIP8_DIFF_RANDOM; kind <= CHIP8_DIFF_STRUCTURED;
+             ++kind)
+        {
+            init_chip8(&chip8, seed);
+            chip8_diff_generate(&chip8, (chip8_diff_program_t)kind, seed);
+            for (size_t c = 0; c < 2; ++c)
+            {
+                TEST_ASSERT_TRUE(
+                    chip8_diff_run(&chip8, cores[c], &options, &result));
+                TEST_ASSERT_EQUAL_UINT64(20000, result.agreed);
+            }
+        }
+    }
+
+    const chip8_diff_core_t broken = {"broken", NULL, NULL, broken_run};
+    const uint16_t program[] = {0x7001, 0x1200};
+    init_chip8(&chip8, 1);
+    load_program(program, 2);
+    TEST_ASSERT_FALSE(chip8_diff_run(&chip8, &broken, &options, &result));
+    TEST_ASSERT_TRUE(result.diverged);
+    TEST_ASSERT_FALSE(result.in_timers);
+    TEST_ASSERT_EQUAL_UINT64(777, result.instruction);
+    TEST_ASSERT_EQUAL_UINT32(7, result.frame);
+    TEST_ASSERT_EQUAL_UINT64(700, result.agreed);
+    TEST_ASSERT_EQUAL_HEX16(0x202, result.pc);
+    TEST_ASSERT_EQUAL_HEX16(0x1200, result.opcode);
+    TEST_ASSERT_EQUAL_UINT64(778, result.expected.cycles);
+    TEST_ASSERT_EQUAL_HEX8(0x40, result.expected.registers[0xA] ^
+                                     result.actual.registers[0xA]);
+
+    FILE *out = tmpfile();
+    TEST_ASSERT_NOT_NULL(out);
+    chip8_diff_print(&result, out);
+    rewind(out);
+    char text[1024];
+    size_t length = fread(text, 1, sizeof(text) - 1, out);
+    text[length] = '\0';
+    fclose(out);
+    TEST_ASSERT_NOT_NULL(strstr(text, "instruction 777 (frame 7): 202 1200"));
+    TEST_ASSERT_NOT_NULL(strstr(text, "VA "));
+    TEST_ASSERT_NULL(strstr(text, "V0 "));
+}
+
+void test_sched_owes_exact_cycles_and_ticks(void)
+{
+    // 1000 ips over 3 ms steps: one tick every 16 2/3 instructions
+    chip8_sched_t sched;
+    chip8_sched_init(&sched, 1000);
+    uint64_t ran = 0;
+    uint64_t ticks = 0;
+    for (int step = 0; step < 1000; ++step)
+    {
+        chip8_sched_elapse(&sched, 3000000);
+        uint32_t slice;
+        while ((slice = chip8_sched_slice(&sched)) > 0)
+        {
+            ran += slice;
+            if (chip8_sched_advance(&sched, slice))
+            {
+                // Tick k lands on the first instruction at or past k/60 s
+                ++ticks;
+                TEST_ASSERT_EQUAL_UINT64((ticks * 1000 + 59) / 60, ran);
+            }
+        }
+    }
+    TEST_ASSERT_EQUAL_UINT64(3000, ran);
+    TEST_ASSERT_EQUAL_UINT64(180, ticks);
+    TEST_ASSERT_EQUAL_UINT64(0, sched.dropped);
+
+    // A 5 s stall catches up on 250 ms and drops the rest
+    chip8_sched_elapse(&sched, 5000000000ull);
+    TEST_ASSERT_EQUAL_UINT64(250, sched.owed);
+    TEST_ASSERT_EQUAL_UINT64(4750, sched.dropped);
+
+    chip8_sched_init(&sched, 0);
+    TEST_ASSERT_EQUAL_UINT32(CHIP8_SCHED_DEFAULT_IPS, sched.ips);
+
+    // Host events land in proportion within the last elapse, never before
+    // what has already run
+    chip8_sched_init(&sched, 1000);
+    chip8_sched_elapse(&sched, 10000000);
+    TEST_ASSERT_EQUAL_UINT64(10, chip8_sched_cycle_ago(&sched, 0));
+    TEST_ASSERT_EQUAL_UINT64(5, chip8_sched_cycle_ago(&sched, 5000000));
+    TEST_ASSERT_EQUAL_UINT64(0, chip8_sched_cycle_ago(&sched, 30000000));
+    chip8_sched_advance(&sched, 4);
+    TEST_ASSERT_EQUAL_UINT64(4, chip8_sched_cycle_ago(&sched, 8000000));
+    TEST_ASSERT_EQUAL_UINT64(7, chip8_sched_cycle_ago(&sched, 3000000));
+}
+
+void test_pacer_reports_frame_percentiles(void)
+{
+    static chip8_pacer_t pacer;
+    chip8_pacer_init(&pacer, 2000000);
+
+    // Frames never end before their deadline, so 20 average a full period
+    uint64_t start = pacer.last_frame;
+    for (int i = 0; i < 20; ++i)
+    {
+        chip8_pacer_wait(&pacer);
+    }
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT64(20 * 2000000ull, pacer.last_frame - start);
+
+    // 98 frames of 16.7 ms, one of 18 ms and one stall of 80 ms
+    chip8_pacer_init(&pacer, 16666667);
+    for (int i = 0; i < 98; ++i)
+    {
+        chip8_pacer_record(&pacer, 16666667);
+    }
+    chip8_pacer_record(&pacer, 18000000);
+    chip8_pacer_record(&pacer, 80000000);
+    chip8_pace_stats_t stats;
+    chip8_pacer_stats(&pacer, &stats);
+    TEST_ASSERT_EQUAL_UINT64(100, stats.frames);
+    TEST_ASSERT_EQUAL_UINT64(16670000, stats.p50_ns);
+    TEST_ASSERT_EQUAL_UINT64(18010000, stats.p99_ns);
+    TEST_ASSERT_EQUAL_UINT64(80000000, stats.max_ns);
+    TEST_ASSERT_EQUAL_UINT64((98 * 16666667ull + 98000000) / 100, stats.mean_ns);
+}
+
+enum { HANDOFF_FRAMES = 20000, HANDOFF_EVENTS = 100000 };
+static chip8_triple_t handoff_frames;
+static chip8_input_queue_t handoff_input;
+
+// Publishes frames filled with their own sequence number, then pushes
+// events numbered in order
+static void *handoff_writer(void *arg)
+{
+    (void)arg;
+    for (uint32_t n = 1; n <= HANDOFF_FRAMES; ++n)
+    {
+        chip8_frame_t *frame = chip8_triple_back(&handoff_frames);
+        for (size_t i = 0; i < DISPLAY_WIDTH * DISPLAY_HEIGHT; ++i)
+            frame->pixels[i] = n;
+        chip8_triple_publish(&handoff_frames, 1u << (n % 32));
+    }
+    for (uint32_t n = 0; n < HANDOFF_EVENTS; ++n)
+    {
+        chip8_input_event_t event = {n, CHIP8_INPUT_KEY, (uint8_t)(n % 251), n & 1};
+        while (!chip8_input_push(&handoff_input, &event))
+        {
+        }
+    }
+    return NULL;
+}
+
+void test_handoff_passes_whole_frames_and_ordered_events(void)
+{
+    chip8_triple_init(&handoff_frames);
+    chip8_input_queue_init(&handoff_input);
+    TEST_ASSERT_FALSE(chip8_triple_acquire(&handoff_frames));
+
+    pthread_t thread;
+    TEST_ASSERT_EQUAL_INT(0, pthread_create(&thread, NULL, handoff_writer, NULL));
+
+    // Every frame seen is complete, and they only move forward
+    uint64_t last = 0;
+    while (last < HANDOFF_FRAMES)
+    {
+        if (!chip8_triple_acquire(&handoff_frames))
+            continue;
+        const chip8_frame_t *frame = chip8_triple_front(&handoff_frames);
+        TEST_ASSERT_GREATER_THAN_UINT64(last, frame->sequence);
+        TEST_ASSERT_EQUAL_UINT32(frame->sequence, frame->pixels[0]);
+        TEST_ASSERT_EQUAL_UINT32(frame->sequence,
+                                 frame->pixels[DISPLAY_WIDTH * DISPLAY_HEIGHT - 1]);
+        if (frame->sequence == last + 1)
+            TEST_ASSERT_EQUAL_HEX32(1u << (frame->sequence % 32), frame->dirty_rows);
+        else
+            TEST_ASSERT_EQUAL_HEX32(UINT32_MAX, frame->dirty_rows);
+        last = frame->sequence;
+    }
+
+    for (uint32_t n = 0; n < HANDOFF_EVENTS; ++n)
+    {
+        chip8_input_event_t event;
+        while (!chip8_input_pop(&handoff_input, &event))
+        {
+        }
+        TEST_ASSERT_EQUAL_UINT64(n, event.time_ns);
+        TEST_ASSERT_EQUAL_UINT8(n % 251, event.key);
+        TEST_ASSERT_EQUAL(n & 1, event.down);
+    }
+    pthread_join(thread, NULL);
+    chip8_input_event_t event;
+    TEST_ASSERT_FALSE(chip8_input_pop(&handoff_input, &event));
 }
 
 int main(void)
 {
     UNITY_BEGIN();
-    RUN_TEST(test_placeholder);
+    RUN_TEST(test_decode_instr_extracts_operands);
+    RUN_TEST(test_decode_instr_resolves_second_level);
+    RUN_TEST(test_cycle_executes_alu_program);
+    RUN_TEST(test_dxyn_clips_and_detects_collision);
+    RUN_TEST(test_display_tracks_dirty_rows);
+    RUN_TEST(test_cxkk_random_stream_is_per_instance);
+    RUN_TEST(test_fx55_invalidates_overwritten_code);
+    RUN_TEST(test_fx33_invalidates_overwritten_code);
+    RUN_TEST(test_cycle_handles_odd_pc);
+    RUN_TEST(test_call_stack_wraps);
+    RUN_TEST(test_chip8_run_matches_single_steps);
+    RUN_TEST(test_chip8_run_stops_on_events);
+    RUN_TEST(test_chip8_run_stops_at_breakpoints);
+    RUN_TEST(test_chip8_run_skips_self_jump);
+    RUN_TEST(test_chip8_run_skips_delay_timer_poll);
+    RUN_TEST(test_chip8_run_does_not_skip_changing_loop);
+    RUN_TEST(test_jit_matches_interpreter_on_games);
+    RUN_TEST(test_jit_alu_and_flags);
+    RUN_TEST(test_jit_invalidates_on_self_modifying_store);
+    RUN_TEST(test_jit_invalidates_on_store_under_breakpoints);
+    RUN_TEST(test_jit_invalidates_on_store_while_traced);
+    RUN_TEST(test_jit_invalidates_on_store_while_profiled);
+    RUN_TEST(test_jit_skips_idle_loops);
+    RUN_TEST(test_batch_results_do_not_depend_on_threads);
+    RUN_TEST(test_batch_job_matches_direct_run);
+    RUN_TEST(test_restore_replays_identically);
+    RUN_TEST(test_restore_redecodes_rewritten_code);
+    RUN_TEST(test_restore_marks_changed_rows_dirty);
+    RUN_TEST(test_jit_drops_code_rewritten_by_restore);
+    RUN_TEST(test_lanes_match_cycle_on_games);
+    RUN_TEST(test_lanes_match_cycle_on_random_code);
+    RUN_TEST(test_rewind_steps_back_through_frames);
+    RUN_TEST(test_rewind_drops_oldest_when_full);
+    RUN_TEST(test_movie_replays_and_seeks);
+    RUN_TEST(test_movie_plays_a_cut_short_recording);
+    RUN_TEST(test_movie_replays_keys_at_their_instruction);
+    RUN_TEST(test_trace_records_every_instruction);
+    RUN_TEST(test_profile_counts_every_instruction);
+    RUN_TEST(test_diff_finds_first_divergence);
+    RUN_TEST(test_analyze_separates_code_and_data);
+    RUN_TEST(test_aot_runs_blocks_while_code_matches);
+    RUN_TEST(test_aot_rechecks_after_interpreted_stores);
+    RUN_TEST(test_sched_owes_exact_cycles_and_ticks);
+    RUN_TEST(test_pacer_reports_frame_percentiles);
+    RUN_TEST(test_handoff_passes_whole_frames_and_ordered_events);
     return UNITY_END();
 }
@@ -0,0 +1,246 @@
+#define _POSIX_C_SOURCE 200809L
+#include "chip8_aot.h"
+#include "chip8_diff.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_INSTRUCTIONS 5000000
+#define DEFAULT_CYCLES_PER_FRAME 1000
+#define MAX_NAME 64
+
+void handle_help() {
+  printf("Usage: chip8-aot [options] rom\n");
+  printf("Translates a ROM to C, or checks and times a translation built as "
+         "a shared\nobject.\n");
+  printf("Options:\n");
+  printf("  --output <file> -o    Write the C source to file (default "
+         "stdout)\n");
+  printf("  --name <name> -n      Exported program is chip8_aot_<name> "
+         "(default from\n");
+  printf("                        the ROM file name)\n");
+  printf("  --check <lib>         Compare the translation in lib with cycle() "
+         "and time\n");
+  printf("                        it against cycle() and chip8_run()\n");
+  printf("  --instructions <n>    Instructions to compare and time (default "
+         "%d)\n", DEFAULT_INSTRUCTIONS);
+  printf("  --ipf <n> -c          Instructions per frame (default %d)\n",
+         DEFAULT_CYCLES_PER_FRAME);
+  printf("  --help -h             Show this help message and exit\n");
+}
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// ROM file name without directory or extension, as a C identifier
+static void name_from_path(const char *path, char *name, size_t size) {
+  const char *slash = strrchr(path, '/');
+  const char *base = slash ? slash + 1 : path;
+  size_t length = 0;
+  while (base[length] != '\0' && base[length] != '.' && length + 1 < size) {
+    unsigned char ch = (unsigned char)base[length];
+    name[length] = isalnum(ch) ? (char)tolower(ch) : '_';
+    ++length;
+  }
+  name[length] = '\0';
+}
+
+// The translation under test, as a core for chip8_diff_run()
+static const chip8_aot_program_t *checked;
+
+static void *aot_attach(chip8_t *chip8) {
+  return chip8_aot_create(chip8, checked);
+}
+
+static void aot_detach(void *context) { chip8_aot_destroy(context); }
+
+static void aot_run(void *context, chip8_t *chip8, uint32_t cycles) {
+  (void)chip8;
+  while (cycles > 0) {
+    chip8_exit_t stop;
+    chip8_aot_run(context, cycles, &stop);
+    cycles -= stop.cycles;
+  }
+}
+
+static const chip8_diff_core_t aot_core = {"aot", aot_attach, aot_detach,
+                                           aot_run};
+
+typedef enum { TIME_CYCLE, TIME_RUN, TIME_AOT } timed_t;
+
+// Run whole frames from start, ticking the timers between them; returns ns
+// per instruction and the share of idle-loop instructions. Runs of the
+// translation also fill stats.
+static double time_core(timed_t core, const chip8_t *start,
+                        uint64_t instructions, uint32_t cyclesPerFrame,
+                        double *idle, chip8_aot_stats_t *stats) {
+  static chip8_t chip8;
+  chip8 = *start;
+  chip8.stop_mask = 0;
+  chip8_aot_t *aot = core == TIME_AOT ? chip8_aot_create(&chip8, checked)
+                                      : NULL;
+  uint64_t end = chip8.cycles + instructions;
+
+  double began = now_seconds();
+  while (chip8.cycles < end) {
+    if (core == TIME_CYCLE) {
+      for (uint32_t i = 0; i < cyclesPerFrame; ++i) {
+        cycle(&chip8);
+      }
+    } else {
+      uint32_t left = cyclesPerFrame;
+      while (left > 0) {
+        chip8_exit_t stop;
+        if (aot) {
+          chip8_aot_run(aot, left, &stop);
+        } else {
+          chip8_run(&chip8, left, &stop);
+        }
+        left -= stop.cycles;
+      }
+    }
+    update_timers(&chip8);
+  }
+  double elapsed = now_seconds() - began;
+
+  if (aot) {
+    chip8_aot_stats(aot, stats);
+  }
+  chip8_aot_destroy(aot);
+  uint64_t executed = chip8.cycles - start->cycles;
+  *idle = 100.0 * (double)(chip8.idle_cycles - start->idle_cycles) /
+          (double)executed;
+  return elapsed * 1e9 / (double)executed;
+}
+
+static int check(const char *library, const char *rom, const char *name,
+                 uint64_t instructions, uint32_t cyclesPerFrame) {
+  checked = chip8_aot_load(library, name);
+  if (checked == NULL) {
+    fprintf(stderr, "Failed to load chip8_aot_%s from %s\n", name, library);
+    return 1;
+  }
+
+  static chip8_t start;
+  init_chip8(&start, 1);
+  if (load_rom(&start, rom) != 0) {
+    fprintf(stderr, "Failed to load ROM: %s\n", rom);
+    return 1;
+  }
+  chip8_aot_t *probe = chip8_aot_create(&start, checked);
+  if (probe == NULL) {
+    fprintf(stderr, "%s was built for a different chip8_t\n", library);
+    return 1;
+  }
+  chip8_aot_destroy(probe);
+
+  static chip8_diff_result_t result;
+  chip8_diff_options_t options = {instructions, cyclesPerFrame, 1};
+  if (!chip8_diff_run(&start, &aot_core, &options, &result)) {
+    printf("%s: ", name);
+    chip8_diff_print(&result, stdout);
+    return 3;
+  }
+  printf("%s: %llu instructions agree with cycle()\n", name,
+         (unsigned long long)result.agreed);
+
+  static const char *labels[] = {"cycle()", "chip8_run()", "aot"};
+  chip8_aot_stats_t stats;
+  double base = 0.0;
+  for (int core = TIME_CYCLE; core <= TIME_AOT; ++core) {
+    double idle;
+    double ns = time_core((timed_t)core, &start, instructions, cyclesPerFrame,
+                          &idle, &stats);
+    if (core == TIME_CYCLE) {
+      base = ns;
+    }
+    printf("  %-12s %8.2f ns/inst %8.1f MIPS %7.2fx  idle %5.1f%%\n",
+           labels[core], ns, 1e3 / ns, base / ns, idle);
+  }
+  uint64_t total = stats.native_instructions +
+                   stats.interpreted_instructions + stats.idle_instructions;
+  printf("  aot ran %.1f%% of instructions native, %.1f%% interpreted; "
+         "%llu blocks invalidated\n",
+         100.0 * (double)stats.native_instructions / (double)total,
+         100.0 * (double)stats.interpreted_instructions / (double)total,
+         (unsigned long long)stats.invalidations);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  const char *romPath = NULL;
+  const char *outputPath = NULL;
+  const char *library = NULL;
+  char name[MAX_NAME] = "";
+  uint64_t instructions = DEFAULT_INSTRUCTIONS;
+  uint32_t cyclesPerFrame = DEFAULT_CYCLES_PER_FRAME;
+
+  for (int i = 1; i < argc; i++) {
+    int hasValue = i + 1 < argc;
+    if ((strcmp(argv[i], "--help") == 0) || (strcmp(argv[i], "-h") == 0)) {
+      handle_help();
+      return 0;
+    } else if ((strcmp(argv[i], "--output") == 0 ||
+                strcmp(argv[i], "-o") == 0) && hasValue) {
+      outputPath = argv[++i];
+    } else if ((strcmp(argv[i], "--name") == 0 ||
+                strcmp(argv[i], "-n") == 0) && hasValue) {
+      name_from_path(argv[++i], name, sizeof(name));
+    } else if (strcmp(argv[i], "--check") == 0 && hasValue) {
+      library = argv[++i];
+    } else if (strcmp(argv[i], "--instructions") == 0 && hasValue) {
+      instructions = strtoull(argv[++i], NULL, 10);
+    } else if ((strcmp(argv[i], "--ipf") == 0 || strcmp(argv[i], "-c") == 0) &&
+               hasValue) {
+      cyclesPerFrame = (uint32_t)strtoul(argv[++i], NULL, 10);
+    } else if (argv[i][0] == '-') {
+      fprintf(stderr, "Unknown option: %s\n", argv[i]);
+      fprintf(stderr, "Use --help or -h for usage information.\n");
+      return 1;
+    } else {
+      romPath = argv[i];
+    }
+  }
+  if (romPath == NULL) {
+    handle_help();
+    return 1;
+  }
+  if (instructions == 0 || cyclesPerFrame == 0) {
+    fprintf(stderr, "Instructions and --ipf must be above 0\n");
+    return 1;
+  }
+  if (name[0] == '\0') {
+    name_from_path(romPath, name, sizeof(name));
+  }
+
+  if (library != NULL) {
+    return check(library, romPath, name, instructions, cyclesPerFrame);
+  }
+
+  static chip8_t chip8;
+  init_chip8(&chip8, 1);
+  if (load_rom(&chip8, romPath) != 0) {
+    fprintf(stderr, "Failed to load ROM: %s\n", romPath);
+    return 1;
+  }
+
+  FILE *out = outputPath ? fopen(outputPath, "w") : stdout;
+  if (out == NULL) {
+    fprintf(stderr, "Failed to open %s\n", outputPath);
+    return 1;
+  }
+  int blocks = chip8_aot_translate(&chip8, name, out);
+  if (out != stdout) {
+    fclose(out);
+  }
+  if (blocks < 0) {
+    fprintf(stderr, "Out of memory translating %s\n", romPath);
+    return 1;
+  }
+  return 0;
+}
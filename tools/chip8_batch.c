@@ -0,0 +1,339 @@
+#define _POSIX_C_SOURCE 200809L
+#include "batch.h"
+#include "chip8.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Defaults match the interactive frontend's pacing
+#define DEFAULT_FRAMES 600
+#define DEFAULT_CYCLES_PER_FRAME 10
+
+typedef struct {
+  char *path;
+  chip8_batch_input_t *steps;
+  size_t count;
+} script_t;
+
+typedef struct {
+  chip8_batch_job_t *jobs;
+  size_t count;
+  size_t capacity;
+  script_t *scripts;
+  size_t script_count;
+} job_list_t;
+
+typedef struct {
+  unsigned threads;
+  uint32_t frames;
+  uint32_t cycles_per_frame;
+  uint32_t seed;
+  uint32_t seeds;
+  uint32_t stop_mask;
+  const char *script;
+  int display;
+} options_t;
+
+void handle_help() {
+  printf("Usage: chip8-batch [options] [rom...]\n");
+  printf("Runs every ROM x seed x input script job headlessly and prints one "
+         "line per job.\n");
+  printf("Options:\n");
+  printf("  --jobs <file> -f     Read jobs from file (\"-\" for stdin), one "
+         "per line:\n");
+  printf("                       ROM [SEED [FRAMES [SCRIPT]]]\n");
+  printf("  --threads <n> -j     Worker threads (default: all CPUs)\n");
+  printf("  --frames <n> -n      Frames per job (default %d)\n",
+         DEFAULT_FRAMES);
+  printf("  --ipf <n> -c         Instructions per frame (default %d)\n",
+         DEFAULT_CYCLES_PER_FRAME);
+  printf("  --seed <n> -s        Seed for jobs that do not give one "
+         "(default 1)\n");
+  printf("  --seeds <n> -S       Run each job with n consecutive seeds\n");
+  printf("  --script <file> -i   Input script for jobs that do not give one:\n");
+  printf("                       FRAME KEYS per line, KEYS a hex key mask\n");
+  printf("  --stop <list> -x     Events that end a job early, comma separated:\n");
+  printf("                       draw,key-wait,timer,invalid (default invalid)\n");
+  printf("  --display -d         Append the final framebuffer to each line\n");
+  printf("  --help -h            Show this help message and exit\n");
+}
+
+static char *copy_string(const char *text) {
+  size_t len = strlen(text) + 1;
+  char *copy = (char *)malloc(len);
+  if (copy != NULL) {
+    memcpy(copy, text, len);
+  }
+  return copy;
+}
+
+static const char *reason_name(int status, chip8_exit_reason_t reason) {
+  static const char *names[] = {"budget", "draw",       "key-wait",
+                                "timer",  "breakpoint", "invalid"};
+  if (status != 0) {
+    return "load-error";
+  }
+  return names[reason];
+}
+
+static int parse_stop_mask(const char *list, uint32_t *mask) {
+  static const struct {
+    const char *name;
+    uint32_t bit;
+  } events[] = {{"draw", CHIP8_STOP_DRAW},
+                {"key-wait", CHIP8_STOP_KEY_WAIT},
+                {"timer", CHIP8_STOP_TIMER},
+                {"invalid", CHIP8_STOP_INVALID}};
+
+  *mask = 0;
+  while (*list) {
+    size_t len = strcspn(list, ",");
+    size_t i;
+    for (i = 0; i < sizeof(events) / sizeof(events[0]); ++i) {
+      if (strlen(events[i].name) == len &&
+          strncmp(list, events[i].name, len) == 0) {
+        *mask |= events[i].bit;
+        break;
+      }
+    }
+    if (i == sizeof(events) / sizeof(events[0]) && len > 0) {
+      fprintf(stderr, "Unknown stop event: %.*s\n", (int)len, list);
+      return -1;
+    }
+    list += len;
+    if (*list == ',') {
+      ++list;
+    }
+  }
+  return 0;
+}
+
+// Load an input script once and share it between every job that names it
+static script_t *load_script(job_list_t *list, const char *path) {
+  for (size_t i = 0; i < list->script_count; ++i) {
+    if (strcmp(list->scripts[i].path, path) == 0) {
+      return &list->scripts[i];
+    }
+  }
+
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    fprintf(stderr, "Failed to open input script: %s\n", path);
+    return NULL;
+  }
+
+  script_t script = {copy_string(path), NULL, 0};
+  size_t capacity = 0;
+  unsigned long frame;
+  unsigned int keys;
+  while (fscanf(file, "%lu %x", &frame, &keys) == 2) {
+    if (script.count == capacity) {
+      capacity = capacity ? capacity * 2 : 16;
+      script.steps = (chip8_batch_input_t *)realloc(
+          script.steps, capacity * sizeof(chip8_batch_input_t));
+    }
+    script.steps[script.count].frame = (uint32_t)frame;
+    script.steps[script.count].keys = (uint16_t)keys;
+    ++script.count;
+  }
+  fclose(file);
+
+  list->scripts = (script_t *)realloc(
+      list->scripts, (list->script_count + 1) * sizeof(script_t));
+  list->scripts[list->script_count] = script;
+  return &list->scripts[list->script_count++];
+}
+
+static int add_jobs(job_list_t *list, const options_t *options,
+                    const char *rom, uint32_t seed, uint32_t frames,
+                    const char *scriptPath) {
+  script_t *script = NULL;
+  if (scriptPath != NULL) {
+    script = load_script(list, scriptPath);
+    if (script == NULL) {
+      return -1;
+    }
+  }
+
+  char *romCopy = copy_string(rom);
+  for (uint32_t s = 0; s < options->seeds; ++s) {
+    if (list->count == list->capacity) {
+      list->capacity = list->capacity ? list->capacity * 2 : 64;
+      list->jobs = (chip8_batch_job_t *)realloc(
+          list->jobs, list->capacity * sizeof(chip8_batch_job_t));
+    }
+
+    chip8_batch_job_t *job = &list->jobs[list->count++];
+    job->rom = romCopy;
+    job->seed = seed + s;
+    job->frames = frames;
+    job->cycles_per_frame = options->cycles_per_frame;
+    job->stop_mask = options->stop_mask;
+    job->inputs = script ? script->steps : NULL;
+    job->input_count = script ? script->count : 0;
+  }
+  return 0;
+}
+
+static int read_job_file(job_list_t *list, const options_t *options,
+                         const char *path) {
+  FILE *file = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+  if (file == NULL) {
+    fprintf(stderr, "Failed to open job file: %s\n", path);
+    return -1;
+  }
+
+  char line[4096];
+  int status = 0;
+  while (status == 0 && fgets(line, sizeof(line), file) != NULL) {
+    char rom[1024], script[1024];
+    unsigned long seed = options->seed, frames = options->frames;
+    script[0] = '\0';
+
+    if (line[0] == '#') {
+      continue;
+    }
+    int fields = sscanf(line, "%1023s %lu %lu %1023s", rom, &seed, &frames,
+                        script);
+    if (fields < 1) {
+      continue;
+    }
+    const char *scriptPath = script[0] ? script : options->script;
+    status = add_jobs(list, options, rom, (uint32_t)seed, (uint32_t)frames,
+                      scriptPath);
+  }
+
+  if (file != stdin) {
+    fclose(file);
+  }
+  return status;
+}
+
+static void print_result(size_t index, const chip8_batch_job_t *job,
+                         const chip8_batch_result_t *result, int display) {
+  printf("%zu\t%s\t%u\t%s\t%u\t%llu\t%016llx", index, job->rom, job->seed,
+         reason_name(result->status, result->reason), result->frames,
+         (unsigned long long)result->cycles,
+         (unsigned long long)result->state_hash);
+  if (display) {
+    for (int y = 0; y < DISPLAY_HEIGHT; ++y) {
+      printf("%c%016llx", y == 0 ? '\t' : ',',
+             (unsigned long long)result->display[y]);
+    }
+  }
+  printf("\n");
+}
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char *argv[]) {
+  options_t options = {0,
+                       DEFAULT_FRAMES,
+                       DEFAULT_CYCLES_PER_FRAME,
+                       1,
+                       1,
+                       CHIP8_STOP_INVALID,
+                       NULL,
+                       0};
+  job_list_t list = {NULL, 0, 0, NULL, 0};
+
+  // Options first so they apply to every job regardless of order
+  for (int i = 1; i < argc; i++) {
+    int hasValue = i + 1 < argc;
+    if ((strcmp(argv[i], "--help") == 0) || (strcmp(argv[i], "-h") == 0)) {
+      handle_help();
+      return 0;
+    } else if ((strcmp(argv[i], "--threads") == 0 ||
+                strcmp(argv[i], "-j") == 0) && hasValue) {
+      options.threads = (unsigned)strtoul(argv[++i], NULL, 10);
+    } else if ((strcmp(argv[i], "--frames") == 0 ||
+                strcmp(argv[i], "-n") == 0) && hasValue) {
+      options.frames = (uint32_t)strtoul(argv[++i], NULL, 10);
+    } else if ((strcmp(argv[i], "--ipf") == 0 ||
+                strcmp(argv[i], "-c") == 0) && hasValue) {
+      options.cycles_per_frame = (uint32_t)strtoul(argv[++i], NULL, 10);
+    } else if ((strcmp(argv[i], "--seed") == 0 ||
+                strcmp(argv[i], "-s") == 0) && hasValue) {
+      options.seed = (uint32_t)strtoul(argv[++i], NULL, 0);
+    } else if ((strcmp(argv[i], "--seeds") == 0 ||
+                strcmp(argv[i], "-S") == 0) && hasValue) {
+      options.seeds = (uint32_t)strtoul(argv[++i], NULL, 10);
+    } else if ((strcmp(argv[i], "--script") == 0 ||
+                strcmp(argv[i], "-i") == 0) && hasValue) {
+      options.script = argv[++i];
+    } else if ((strcmp(argv[i], "--stop") == 0 ||
+                strcmp(argv[i], "-x") == 0) && hasValue) {
+      if (parse_stop_mask(argv[++i], &options.stop_mask) != 0) {
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--display") == 0 ||
+               strcmp(argv[i], "-d") == 0) {
+      options.display = 1;
+    } else if ((strcmp(argv[i], "--jobs") == 0 ||
+                strcmp(argv[i], "-f") == 0) && hasValue) {
+      ++i; // Read below, once every option is known
+    } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+      fprintf(stderr, "Unknown option: %s\n", argv[i]);
+      fprintf(stderr, "Use --help or -h for usage information.\n");
+      return 1;
+    }
+  }
+
+  for (int i = 1; i < argc; i++) {
+    int status = 0;
+    if ((strcmp(argv[i], "--jobs") == 0 || strcmp(argv[i], "-f") == 0) &&
+        i + 1 < argc) {
+      status = read_job_file(&list, &options, argv[++i]);
+    } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+      // Skip the option and its value
+      if (strcmp(argv[i], "--display") != 0 && strcmp(argv[i], "-d") != 0) {
+        ++i;
+      }
+    } else {
+      status = add_jobs(&list, &options, argv[i], options.seed, options.frames,
+                        options.script);
+    }
+    if (status != 0) {
+      return 1;
+    }
+  }
+
+  if (list.count == 0) {
+    handle_help();
+    return 1;
+  }
+
+  chip8_batch_result_t *results = (chip8_batch_result_t *)malloc(
+      list.count * sizeof(chip8_batch_result_t));
+  if (results == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+
+  double start = now_seconds();
+  if (chip8_batch_run(list.jobs, results, list.count, options.threads) != 0) {
+    fprintf(stderr, "Failed to start batch workers\n");
+    return 1;
+  }
+  double elapsed = now_seconds() - start;
+
+  uint64_t cycles = 0;
+  int failures = 0;
+  for (size_t i = 0; i < list.count; ++i) {
+    print_result(i, &list.jobs[i], &results[i], options.display);
+    cycles += results[i].cycles;
+    failures += results[i].status != 0;
+  }
+
+  fprintf(stderr, "%zu jobs, %llu instructions in %.3f s (%.1f MIPS)\n",
+          list.count, (unsigned long long)cycles, elapsed,
+          elapsed > 0 ? (double)cycles / elapsed / 1e6 : 0.0);
+
+  free(results);
+  return failures ? 2 : 0;
+}
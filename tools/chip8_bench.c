@@ -0,0 +1,463 @@
+#define _POSIX_C_SOURCE 200809L
+#include "chip8.h"
+#include "chip8_jit.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_SAMPLES 5
+#define DEFAULT_INSTRUCTIONS 5000000
+#define DEFAULT_CYCLES_PER_FRAME 1000
+#define DEFAULT_THRESHOLD 10.0
+#define MAX_SAMPLES 64
+
+// Microbenchmark layout: setup, then the body repeated up to LOOP_END and a
+// jump back to LOOP_START
+#define LOOP_START 0x220
+#define LOOP_END 0xA00
+#define SUBROUTINE_ADDRESS 0xD00 // 00EE for call benchmarks
+#define SPRITE_ADDRESS 0xC00     // 15 rows of sprite data
+#define STORE_ADDRESS 0xE00      // Target of Fx33 and Fx55
+
+typedef struct {
+  const char *name;
+  uint16_t setup[4]; // Run once, 0 ends the list
+  uint16_t body[2];  // Repeated to fill the loop, 0 ends the list
+} micro_t;
+
+typedef struct {
+  const char *name;
+  uint16_t program[16]; // Loaded at START_ADDRESS, 0 ends the program
+} workload_t;
+
+typedef struct {
+  const char *group;
+  const char *name;
+  uint64_t instructions; // Per sample
+  double ns;             // Median ns per instruction
+  double spread;         // Standard deviation, % of the mean
+  double idle;           // Idle-loop instructions, % of all
+} result_t;
+
+typedef struct {
+  unsigned samples;
+  uint64_t instructions;
+  uint32_t cycles_per_frame;
+  bool jit;
+} options_t;
+
+// One class of handler per entry. Registers: VA and VB are the operands.
+static const micro_t micros[] = {
+    {"6xkk", {0}, {0x6A12}},
+    {"7xkk", {0}, {0x7A01}},
+    {"8xy0", {0x6B37}, {0x8AB0}},
+    {"8xy1", {0x6A5C, 0x6B37}, {0x8AB1}},
+    {"8xy2", {0x6A5C, 0x6B37}, {0x8AB2}},
+    {"8xy3", {0x6A5C, 0x6B37}, {0x8AB3}},
+    {"8xy4", {0x6A5C, 0x6B37}, {0x8AB4}},
+    {"8xy5", {0x6A5C, 0x6B37}, {0x8AB5}},
+    {"8xy6", {0x6A5C}, {0x8AB6}},
+    {"8xy7", {0x6A5C, 0x6B37}, {0x8AB7}},
+    {"8xyE", {0x6A5C}, {0x8ABE}},
+    {"Annn", {0}, {0xA123}},
+    {"Cxkk", {0}, {0xCAFF}},
+    {"3xkk/taken", {0x6A12}, {0x3A12}},
+    {"3xkk/not-taken", {0x6A12}, {0x3A13}},
+    {"4xkk/not-taken", {0x6A12}, {0x4A12}},
+    {"5xy0/taken", {0x6A12, 0x6B12}, {0x5AB0}},
+    {"9xy0/not-taken", {0x6A12, 0x6B12}, {0x9AB0}},
+    {"ExA1/taken", {0x6A05}, {0xEAA1}},
+    {"Ex9E/not-taken", {0x6A05}, {0xEA9E}},
+    {"2nnn+00EE", {0}, {0x2000 | SUBROUTINE_ADDRESS}},
+    {"00E0", {0}, {0x00E0}},
+    {"Dxyn/h1", {0xA000 | SPRITE_ADDRESS, 0x6A08, 0x6B04}, {0xDAB1}},
+    {"Dxyn/h5", {0xA000 | SPRITE_ADDRESS, 0x6A08, 0x6B04}, {0xDAB5}},
+    {"Dxyn/h15", {0xA000 | SPRITE_ADDRESS, 0x6A08, 0x6B04}, {0xDABF}},
+    {"Dxyn/h5/unaligned", {0xA000 | SPRITE_ADDRESS, 0x6A0B, 0x6B04}, {0xDAB5}},
+    {"Dxyn/h15/clip-right",
+     {0xA000 | SPRITE_ADDRESS, 0x6A3C, 0x6B04},
+     {0xDABF}},
+    {"Dxyn/h15/clip-bottom",
+     {0xA000 | SPRITE_ADDRESS, 0x6A08, 0x6B18},
+     {0xDABF}},
+    {"Dxyn/h5/wrap", {0xA000 | SPRITE_ADDRESS, 0x6A4B, 0x6B25}, {0xDAB5}},
+    {"Fx07", {0}, {0xFA07}},
+    {"Fx15", {0}, {0xFA15}},
+    {"Fx1E", {0x6A01}, {0xFA1E}},
+    {"Fx29", {0x6A07}, {0xFA29}},
+    {"Fx33", {0xA000 | STORE_ADDRESS, 0x6AFE}, {0xFA33}},
+    {"Fx55/V0", {0xA000 | STORE_ADDRESS}, {0xF055}},
+    {"Fx55/V0-VF", {0xA000 | STORE_ADDRESS}, {0xFF55}},
+    {"Fx65/V0", {0xA000 | STORE_ADDRESS}, {0xF065}},
+    {"Fx65/V0-VF", {0xA000 | STORE_ADDRESS}, {0xFF65}},
+};
+
+// Synthetic programs with the instruction mix of a kind of game
+static const workload_t workloads[] = {
+    // A sprite walks the screen: one in four instructions is a 15-row draw
+    {"draw",
+     {0xA000 | SPRITE_ADDRESS, 0x6000, 0x6100, 0xD01F, 0x7005, 0x7103,
+      0x1206}},
+    // Register arithmetic with no branches but the loop
+    {"alu",
+     {0x6A01, 0x6B03, 0x8AB4, 0x8BA5, 0x8A06, 0x8BAE, 0x8AB3, 0x8BA1, 0x7A07,
+      0x8AB2, 0x8BA7, 0x1204}},
+    // Random skips, jumps and calls
+    {"branch",
+     {0xC003, 0x3000, 0x120A, 0x7101, 0x1200, 0x4001, 0x2214, 0x9010, 0x7201,
+      0x1200, 0x7301, 0x00EE}},
+};
+
+void handle_help() {
+  printf("Usage: chip8-bench [options] [rom...]\n");
+  printf("Measures handler microbenchmarks, synthetic workloads and whole "
+         "ROMs.\n");
+  printf("Options:\n");
+  printf("  --samples <n> -r      Timed samples per benchmark (default %d)\n",
+         DEFAULT_SAMPLES);
+  printf("  --instructions <n>    Instructions per sample (default %d)\n",
+         DEFAULT_INSTRUCTIONS);
+  printf("  --ipf <n> -c          Instructions per frame for ROMs (default "
+         "%d)\n", DEFAULT_CYCLES_PER_FRAME);
+  printf("  --filter <text> -f    Only benchmarks whose name contains text\n");
+  printf("  --jit                 Run through the JIT (x86-64)\n");
+  printf("  --tsv <file>          Also write the results as tab-separated "
+         "values\n");
+  printf("  --baseline <file>     Compare with results written by --tsv\n");
+  printf("  --threshold <pct>     Slowdown reported as a regression (default "
+         "%.0f)\n", DEFAULT_THRESHOLD);
+  printf("  --help -h             Show this help message and exit\n");
+}
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void write_words(chip8_t *chip8, uint16_t addr, const uint16_t *words,
+                        size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    chip8->memory[addr + i * 2] = words[i] >> 8;
+    chip8->memory[addr + i * 2 + 1] = words[i] & 0xFF;
+  }
+  chip8_invalidate(chip8, addr, (uint16_t)(count * 2));
+}
+
+// Memory every synthetic program may use: a sprite and a subroutine
+static void load_fixtures(chip8_t *chip8) {
+  for (int i = 0; i < 15; ++i) {
+    chip8->memory[SPRITE_ADDRESS + i] = (i & 1) ? 0x5A : 0xA5;
+  }
+  chip8_invalidate(chip8, SPRITE_ADDRESS, 15);
+  uint16_t ret = 0x00EE;
+  write_words(chip8, SUBROUTINE_ADDRESS, &ret, 1);
+}
+
+static void load_micro(chip8_t *chip8, const micro_t *micro) {
+  uint16_t addr = START_ADDRESS;
+  for (int i = 0; i < 4 && micro->setup[i] != 0; ++i, addr += 2) {
+    write_words(chip8, addr, &micro->setup[i], 1);
+  }
+  uint16_t jump = 0x1000 | LOOP_START;
+  write_words(chip8, addr, &jump, 1);
+
+  size_t length = micro->body[1] != 0 ? 2 : 1;
+  for (addr = LOOP_START; addr + length * 2 <= LOOP_END;
+       addr += (uint16_t)(length * 2)) {
+    write_words(chip8, addr, micro->body, length);
+  }
+  write_words(chip8, addr, &jump, 1);
+}
+
+static void load_workload(chip8_t *chip8, const workload_t *workload) {
+  size_t count = 0;
+  while (count < 16 && workload->program[count] != 0) {
+    ++count;
+  }
+  write_words(chip8, START_ADDRESS, workload->program, count);
+}
+
+// Run budget instructions without stopping for events
+static void run_budget(chip8_t *chip8, chip8_jit_t *jit, uint64_t budget) {
+  while (budget > 0) {
+    uint32_t slice = budget > UINT32_MAX ? UINT32_MAX : (uint32_t)budget;
+    chip8_exit_t stop;
+    if (jit) {
+      chip8_jit_run(jit, slice, &stop);
+    } else {
+      chip8_run(chip8, slice, &stop);
+    }
+    budget -= stop.cycles;
+  }
+}
+
+// Run whole frames, ticking the timers between them, until budget is spent
+static void run_frames(chip8_t *chip8, chip8_jit_t *jit, uint64_t budget,
+                       uint32_t cyclesPerFrame) {
+  uint64_t end = chip8->cycles + budget;
+  while (chip8->cycles < end) {
+    run_budget(chip8, jit, cyclesPerFrame);
+    update_timers(chip8);
+  }
+}
+
+static int compare_doubles(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// Time one benchmark. Each sample starts from the same state; the first run
+// is a warm-up and is not counted.
+static void measure(result_t *result, const chip8_t *start, const char *rom,
+                    const options_t *options) {
+  static chip8_t chip8;
+  double ns[MAX_SAMPLES];
+  uint64_t instructions = 0;
+  uint64_t idle = 0;
+
+  for (unsigned sample = 0; sample <= options->samples; ++sample) {
+    chip8 = *start;
+    chip8_jit_t *jit = options->jit ? chip8_jit_create(&chip8) : NULL;
+
+    double began = now_seconds();
+    if (rom != NULL) {
+      run_frames(&chip8, jit, options->instructions,
+                 options->cycles_per_frame);
+    } else {
+      run_budget(&chip8, jit, options->instructions);
+    }
+    double elapsed = now_seconds() - began;
+
+    if (jit) {
+      chip8_jit_destroy(jit);
+    }
+    instructions = chip8.cycles - start->cycles;
+    idle = chip8.idle_cycles - start->idle_cycles;
+    if (sample > 0) {
+      ns[sample - 1] = elapsed * 1e9 / (double)instructions;
+    }
+  }
+
+  double mean = 0.0;
+  for (unsigned i = 0; i < options->samples; ++i) {
+    mean += ns[i];
+  }
+  mean /= options->samples;
+  double variance = 0.0;
+  for (unsigned i = 0; i < options->samples; ++i) {
+    variance += (ns[i] - mean) * (ns[i] - mean);
+  }
+  if (options->samples > 1) {
+    variance /= options->samples - 1;
+  }
+  qsort(ns, options->samples, sizeof(ns[0]), compare_doubles);
+
+  result->instructions = instructions;
+  result->ns = ns[options->samples / 2];
+  result->spread = mean > 0.0 ? 100.0 * sqrt(variance) / mean : 0.0;
+  result->idle = 100.0 * (double)idle / (double)instructions;
+}
+
+static const char *base_name(const char *path) {
+  const char *slash = strrchr(path, '/');
+  return slash ? slash + 1 : path;
+}
+
+// Baseline lookup: the ns column of the matching line in a --tsv file
+static bool find_baseline(FILE *baseline, const result_t *result, double *ns) {
+  char line[512];
+  rewind(baseline);
+  while (fgets(line, sizeof(line), baseline)) {
+    if (line[0] == '#') {
+      continue;
+    }
+    char *group = strtok(line, "\t");
+    char *name = strtok(NULL, "\t");
+    strtok(NULL, "\t"); // instructions
+    strtok(NULL, "\t"); // MIPS
+    char *value = strtok(NULL, "\t");
+    if (value && strcmp(group, result->group) == 0 &&
+        strcmp(name, result->name) == 0) {
+      *ns = strtod(value, NULL);
+      return *ns > 0.0;
+    }
+  }
+  return false;
+}
+
+// Print one result; returns true if it is a regression against the baseline
+static bool report(const result_t *result, FILE *tsv, FILE *baseline,
+                   double threshold) {
+  printf("%-9s %-22s %8.1f %8.2f %6.1f%% %6.1f%%", result->group,
+         result->name, 1e3 / result->ns, result->ns, result->spread,
+         result->idle);
+  bool regressed = false;
+  double base;
+  if (baseline && find_baseline(baseline, result, &base)) {
+    double change = 100.0 * (result->ns - base) / base;
+    regressed = change > threshold;
+    printf("  %+6.1f%%%s", change, regressed ? "  REGRESSION" : "");
+  }
+  printf("\n");
+  fflush(stdout);
+
+  if (tsv) {
+    fprintf(tsv, "%s\t%s\t%llu\t%.2f\t%.3f\t%.2f\t%.2f\n", result->group,
+            result->name, (unsigned long long)result->instructions,
+            1e3 / result->ns, result->ns, result->spread, result->idle);
+  }
+  return regressed;
+}
+
+int main(int argc, char *argv[]) {
+  options_t options = {DEFAULT_SAMPLES, DEFAULT_INSTRUCTIONS,
+                       DEFAULT_CYCLES_PER_FRAME, false};
+  const char *filter = NULL;
+  const char *tsvPath = NULL;
+  const char *baselinePath = NULL;
+  double threshold = DEFAULT_THRESHOLD;
+  const char **roms = (const char **)calloc((size_t)argc, sizeof(char *));
+  int romCount = 0;
+
+  for (int i = 1; i < argc; i++) {
+    int hasValue = i + 1 < argc;
+    if ((strcmp(argv[i], "--help") == 0) || (strcmp(argv[i], "-h") == 0)) {
+      handle_help();
+      free(roms);
+      return 0;
+    } else if ((strcmp(argv[i], "--samples") == 0 ||
+                strcmp(argv[i], "-r") == 0) && hasValue) {
+      options.samples = (unsigned)strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--instructions") == 0 && hasValue) {
+      options.instructions = strtoull(argv[++i], NULL, 10);
+    } else if ((strcmp(argv[i], "--ipf") == 0 || strcmp(argv[i], "-c") == 0) &&
+               hasValue) {
+      options.cycles_per_frame = (uint32_t)strtoul(argv[++i], NULL, 10);
+    } else if ((strcmp(argv[i], "--filter") == 0 ||
+                strcmp(argv[i], "-f") == 0) && hasValue) {
+      filter = argv[++i];
+    } else if (strcmp(argv[i], "--jit") == 0) {
+      options.jit = true;
+    } else if (strcmp(argv[i], "--tsv") == 0 && hasValue) {
+      tsvPath = argv[++i];
+    } else if (strcmp(argv[i], "--baseline") == 0 && hasValue) {
+      baselinePath = argv[++i];
+    } else if (strcmp(argv[i], "--threshold") == 0 && hasValue) {
+      threshold = strtod(argv[++i], NULL);
+    } else if (argv[i][0] == '-') {
+      fprintf(stderr, "Unknown option: %s\n", argv[i]);
+      fprintf(stderr, "Use --help or -h for usage information.\n");
+      free(roms);
+      return 1;
+    } else {
+      roms[romCount++] = argv[i];
+    }
+  }
+  if (options.samples == 0 || options.samples > MAX_SAMPLES ||
+      options.instructions == 0 || options.cycles_per_frame == 0) {
+    fprintf(stderr, "Samples must be 1-%d, instructions and --ipf above 0\n",
+            MAX_SAMPLES);
+    free(roms);
+    return 1;
+  }
+
+  if (options.jit) {
+    static chip8_t probe;
+    chip8_jit_t *jit = chip8_jit_create(&probe);
+    if (jit == NULL) {
+      fprintf(stderr, "JIT unavailable, using the interpreter\n");
+      options.jit = false;
+    }
+    chip8_jit_destroy(jit);
+  }
+
+  FILE *tsv = tsvPath ? fopen(tsvPath, "w") : NULL;
+  FILE *baseline = baselinePath ? fopen(baselinePath, "r") : NULL;
+  if ((tsvPath && tsv == NULL) || (baselinePath && baseline == NULL)) {
+    fprintf(stderr, "Failed to open %s\n",
+            tsvPath && tsv == NULL ? tsvPath : baselinePath);
+    free(roms);
+    return 1;
+  }
+
+#ifdef CHIP8_CORE_THREADED
+  const char *core = options.jit ? "jit" : "threaded";
+#else
+  const char *core = options.jit ? "jit" : "table";
+#endif
+  printf("core %s, %u samples of %llu instructions\n\n", core,
+         options.samples, (unsigned long long)options.instructions);
+  printf("%-9s %-22s %8s %8s %7s %7s%s\n", "group", "benchmark", "MIPS",
+         "ns/inst", "stddev", "idle", baseline ? "  change" : "");
+  if (tsv) {
+    fprintf(tsv, "# core %s, %u samples of %llu instructions\n", core,
+            options.samples, (unsigned long long)options.instructions);
+    fprintf(tsv, "# group\tbenchmark\tinstructions\tmips\tns_per_inst\t"
+                 "stddev_pct\tidle_pct\n");
+  }
+
+  static chip8_t start;
+  int regressions = 0;
+  int status = 0;
+
+  for (size_t i = 0; i < sizeof(micros) / sizeof(micros[0]); ++i) {
+    if (filter && strstr(micros[i].name, filter) == NULL) {
+      continue;
+    }
+    init_chip8(&start, 1);
+    start.stop_mask = 0;
+    load_fixtures(&start);
+    load_micro(&start, &micros[i]);
+    result_t result = {"op", micros[i].name, 0, 0.0, 0.0, 0.0};
+    measure(&result, &start, NULL, &options);
+    regressions += report(&result, tsv, baseline, threshold);
+  }
+
+  for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); ++i) {
+    if (filter && strstr(workloads[i].name, filter) == NULL) {
+      continue;
+    }
+    init_chip8(&start, 1);
+    start.stop_mask = 0;
+    load_fixtures(&start);
+    load_workload(&start, &workloads[i]);
+    result_t result = {"workload", workloads[i].name, 0, 0.0, 0.0, 0.0};
+    measure(&result, &start, NULL, &options);
+    regressions += report(&result, tsv, baseline, threshold);
+  }
+
+  for (int i = 0; i < romCount; ++i) {
+    const char *name = base_name(roms[i]);
+    if (filter && strstr(name, filter) == NULL) {
+      continue;
+    }
+    init_chip8(&start, 1);
+    start.stop_mask = 0;
+    if (load_rom(&start, roms[i]) != 0) {
+      fprintf(stderr, "Failed to load ROM: %s\n", roms[i]);
+      status = 2;
+      continue;
+    }
+    result_t result = {"rom", name, 0, 0.0, 0.0, 0.0};
+    measure(&result, &start, roms[i], &options);
+    regressions += report(&result, tsv, baseline, threshold);
+  }
+
+  if (baseline) {
+    printf("\n%d regression%s over %.0f%%\n", regressions,
+           regressions == 1 ? "" : "s", threshold);
+    fclose(baseline);
+    if (regressions > 0 && status == 0) {
+      status = 3;
+    }
+  }
+  if (tsv) {
+    fclose(tsv);
+  }
+  free(roms);
+  return status;
+}
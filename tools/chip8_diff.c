@@ -0,0 +1,157 @@
+#define _POSIX_C_SOURCE 200809L
+#include "chip8_diff.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_PROGRAMS 100
+#define DEFAULT_INSTRUCTIONS 1000000
+#define DEFAULT_CYCLES_PER_FRAME 1000
+
+void handle_help() {
+  printf("Usage: chip8-diff [options] [rom...]\n");
+  printf("Runs generated programs and ROMs on cycle() and on another core in "
+         "lockstep,\nand reports the first instruction where they "
+         "disagree.\n");
+  printf("Options:\n");
+  printf("  --core <name>         Core to check: interpreter (chip8_run) or "
+         "jit\n");
+  printf("                        (default interpreter)\n");
+  printf("  --programs <n> -p     Generated programs of each kind (default "
+         "%d)\n", DEFAULT_PROGRAMS);
+  printf("  --kind <kind>         random, structured or all (default all)\n");
+  printf("  --instructions <n>    Instructions per program or ROM (default "
+         "%d)\n", DEFAULT_INSTRUCTIONS);
+  printf("  --ipf <n> -c          Instructions per frame (default %d)\n",
+         DEFAULT_CYCLES_PER_FRAME);
+  printf("  --seed <n> -s         First program and input seed (default 1)\n");
+  printf("  --help -h             Show this help message and exit\n");
+}
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static chip8_diff_result_t result;
+
+// Check one program; prints the divergence and returns false on failure
+static bool check(const char *label, const chip8_t *start,
+                  const chip8_diff_core_t *core,
+                  const chip8_diff_options_t *options, uint64_t *total) {
+  bool agreed = chip8_diff_run(start, core, options, &result);
+  *total += result.agreed;
+  if (!agreed) {
+    printf("%s: ", label);
+    chip8_diff_print(&result, stdout);
+  }
+  return agreed;
+}
+
+int main(int argc, char *argv[]) {
+  const chip8_diff_core_t *core = &chip8_diff_interpreter;
+  uint32_t programs = DEFAULT_PROGRAMS;
+  bool random = true;
+  bool structured = true;
+  uint32_t seed = 1;
+  chip8_diff_options_t options = {DEFAULT_INSTRUCTIONS,
+                                  DEFAULT_CYCLES_PER_FRAME, 1};
+  const char **roms = (const char **)calloc((size_t)argc, sizeof(char *));
+  int romCount = 0;
+
+  for (int i = 1; i < argc; i++) {
+    int hasValue = i + 1 < argc;
+    if ((strcmp(argv[i], "--help") == 0) || (strcmp(argv[i], "-h") == 0)) {
+      handle_help();
+      free(roms);
+      return 0;
+    } else if (strcmp(argv[i], "--core") == 0 && hasValue) {
+      ++i;
+      if (strcmp(argv[i], "interpreter") == 0) {
+        core = &chip8_diff_interpreter;
+      } else if (strcmp(argv[i], "jit") == 0) {
+        core = &chip8_diff_jit;
+      } else {
+        fprintf(stderr, "Unknown core: %s\n", argv[i]);
+        free(roms);
+        return 1;
+      }
+    } else if ((strcmp(argv[i], "--programs") == 0 ||
+                strcmp(argv[i], "-p") == 0) && hasValue) {
+      programs = (uint32_t)strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--kind") == 0 && hasValue) {
+      ++i;
+      random = strcmp(argv[i], "random") == 0 || strcmp(argv[i], "all") == 0;
+      structured =
+          strcmp(argv[i], "structured") == 0 || strcmp(argv[i], "all") == 0;
+      if (!random && !structured) {
+        fprintf(stderr, "Unknown program kind: %s\n", argv[i]);
+        free(roms);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--instructions") == 0 && hasValue) {
+      options.instructions = strtoull(argv[++i], NULL, 10);
+    } else if ((strcmp(argv[i], "--ipf") == 0 || strcmp(argv[i], "-c") == 0) &&
+               hasValue) {
+      options.cycles_per_frame = (uint32_t)strtoul(argv[++i], NULL, 10);
+    } else if ((strcmp(argv[i], "--seed") == 0 || strcmp(argv[i], "-s") == 0) &&
+               hasValue) {
+      seed = (uint32_t)strtoul(argv[++i], NULL, 0);
+    } else if (argv[i][0] == '-') {
+      fprintf(stderr, "Unknown option: %s\n", argv[i]);
+      fprintf(stderr, "Use --help or -h for usage information.\n");
+      free(roms);
+      return 1;
+    } else {
+      roms[romCount++] = argv[i];
+    }
+  }
+
+  static chip8_t start;
+  uint64_t total = 0;
+  uint32_t checked = 0;
+  uint32_t failed = 0;
+  int status = 0;
+  double began = now_seconds();
+
+  for (uint32_t p = 0; p < programs; ++p) {
+    for (int kind = 0; kind < 2; ++kind) {
+      if (!(kind == CHIP8_DIFF_RANDOM ? random : structured)) {
+        continue;
+      }
+      char label[64];
+      snprintf(label, sizeof(label), "%s program %u",
+               kind == CHIP8_DIFF_RANDOM ? "random" : "structured", seed + p);
+      init_chip8(&start, seed + p);
+      chip8_diff_generate(&start, (chip8_diff_program_t)kind, seed + p);
+      options.input_seed = seed + p;
+      failed += !check(label, &start, core, &options, &total);
+      ++checked;
+    }
+  }
+
+  for (int i = 0; i < romCount; ++i) {
+    init_chip8(&start, seed);
+    if (load_rom(&start, roms[i]) != 0) {
+      fprintf(stderr, "Failed to load ROM: %s\n", roms[i]);
+      status = 2;
+      continue;
+    }
+    options.input_seed = seed;
+    failed += !check(roms[i], &start, core, &options, &total);
+    ++checked;
+  }
+
+  double elapsed = now_seconds() - began;
+  printf("%s: %u of %u programs agree, %llu instructions compared in "
+         "%.2f s (%.1f M/s)\n",
+         core->name, checked - failed, checked, (unsigned long long)total,
+         elapsed, elapsed > 0.0 ? (double)total / elapsed * 1e-6 : 0.0);
+  free(roms);
+  if (failed > 0) {
+    return 3;
+  }
+  return status;
+}
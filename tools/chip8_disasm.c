@@ -0,0 +1,180 @@
+#include "chip8_analyze.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void handle_help() {
+  printf("Usage: chip8-disasm [options] rom\n");
+  printf("Prints a disassembly listing of a ROM, with code reached from 0x200 "
+         "told\napart from data.\n");
+  printf("Options:\n");
+  printf("  --all -a           List the address space up to 0xFFF, not only "
+         "the ROM\n");
+  printf("  --summary -s       Print the summary only\n");
+  printf("  --help -h          Show this help message and exit\n");
+}
+
+static long file_size(const char *filename) {
+  FILE *file = fopen(filename, "rb");
+  if (file == NULL) {
+    return -1;
+  }
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  fclose(file);
+  return size;
+}
+
+static void print_summary(const char *filename, long size,
+                          const chip8_analysis_t *analysis) {
+  unsigned code = 0, sprites = 0, read = 0, written = 0, unreached = 0;
+  for (long i = 0; i < size; ++i) {
+    uint16_t flags = analysis->flags[START_ADDRESS + i];
+    code += (flags & (CHIP8_BYTE_CODE | CHIP8_BYTE_OPERAND)) != 0;
+    sprites += (flags & CHIP8_BYTE_SPRITE) != 0;
+    read += (flags & CHIP8_BYTE_READ) != 0;
+    written += (flags & CHIP8_BYTE_WRITTEN) != 0;
+    unreached += flags == 0;
+  }
+
+  printf("; %s: %ld bytes\n", filename, size);
+  printf("; %u instructions, %u subroutine%s, %u indirect jump%s\n",
+         analysis->instructions, analysis->subroutine_count,
+         analysis->subroutine_count == 1 ? "" : "s", analysis->indirect_count,
+         analysis->indirect_count == 1 ? "" : "s");
+  printf("; code %u bytes, sprites %u, read %u, written %u, unreached %u\n",
+         code, sprites, read, written, unreached);
+  if (analysis->self_modifying) {
+    printf("; self-modifying: stores reach code\n");
+  }
+  if (analysis->unknown_writes) {
+    printf("; some stores use an I the analysis could not follow\n");
+  }
+  for (uint16_t i = 0; i < analysis->indirect_count; ++i) {
+    printf("; indirect jump at %03X, targets not followed\n",
+           analysis->indirect[i]);
+  }
+  if (analysis->truncated) {
+    printf("; too many subroutines or indirect jumps, lists truncated\n");
+  }
+}
+
+static void print_data(const chip8_t *chip8, uint16_t addr, uint16_t flags) {
+  uint8_t value = chip8->memory[addr];
+  char bits[9];
+  for (int bit = 0; bit < 8; ++bit) {
+    bits[bit] = (value >> (7 - bit)) & 1u ? '#' : '.';
+  }
+  bits[8] = '\0';
+
+  printf("%03X  %02X          .byte 0x%02X     ; %s", addr, value, value, bits);
+  if (flags & CHIP8_BYTE_SPRITE) {
+    printf(" sprite");
+  }
+  if (flags & CHIP8_BYTE_READ) {
+    printf(" read");
+  }
+  if (flags & CHIP8_BYTE_WRITTEN) {
+    printf(" written");
+  }
+  if ((flags & CHIP8_BYTE_REFERENCED) &&
+      !(flags & (CHIP8_BYTE_SPRITE | CHIP8_BYTE_READ | CHIP8_BYTE_WRITTEN))) {
+    printf(" referenced");
+  }
+  if (flags == 0) {
+    printf(" unreached");
+  }
+  printf("\n");
+}
+
+static void print_listing(const chip8_t *chip8,
+                          const chip8_analysis_t *analysis, uint16_t end) {
+  uint16_t subroutine = 0;
+  uint16_t addr = START_ADDRESS;
+  while (addr < end) {
+    uint16_t flags = analysis->flags[addr];
+    if (flags & CHIP8_BYTE_SUBROUTINE) {
+      while (subroutine < analysis->subroutine_count &&
+             analysis->subroutines[subroutine].entry < addr) {
+        ++subroutine;
+      }
+      printf("\n        sub_%03X:", addr);
+      if (subroutine < analysis->subroutine_count &&
+          analysis->subroutines[subroutine].entry == addr) {
+        printf("              ; to %03X",
+               analysis->subroutines[subroutine].end);
+      }
+      printf("\n");
+    } else if (flags & CHIP8_BYTE_LABEL) {
+      printf("        L%03X:\n", addr);
+    }
+
+    if (!(flags & CHIP8_BYTE_CODE)) {
+      print_data(chip8, addr, flags);
+      ++addr;
+      continue;
+    }
+
+    uint16_t opcode = (uint16_t)(chip8->memory[addr] << 8 |
+                                 chip8->memory[(addr + 1) & 0x0FFFu]);
+    char text[24];
+    chip8_disassemble(opcode, text, sizeof(text));
+    printf("%03X  %04X        %s", addr, opcode, text);
+    if (analysis->flags[addr] & CHIP8_BYTE_WRITTEN ||
+        analysis->flags[(addr + 1) & 0x0FFFu] & CHIP8_BYTE_WRITTEN) {
+      printf("     ; rewritten by the program");
+    }
+    printf("\n");
+
+    // An instruction that starts inside this one is listed on its own
+    addr += analysis->flags[(addr + 1) & 0x0FFFu] & CHIP8_BYTE_CODE ? 1 : 2;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  const char *filename = NULL;
+  bool all = false;
+  bool summaryOnly = false;
+
+  for (int i = 1; i < argc; i++) {
+    if ((strcmp(argv[i], "--help") == 0) || (strcmp(argv[i], "-h") == 0)) {
+      handle_help();
+      return 0;
+    } else if ((strcmp(argv[i], "--all") == 0) ||
+               (strcmp(argv[i], "-a") == 0)) {
+      all = true;
+    } else if ((strcmp(argv[i], "--summary") == 0) ||
+               (strcmp(argv[i], "-s") == 0)) {
+      summaryOnly = true;
+    } else if (argv[i][0] == '-') {
+      fprintf(stderr, "Unknown option: %s\n", argv[i]);
+      fprintf(stderr, "Use --help or -h for usage information.\n");
+      return 1;
+    } else {
+      filename = argv[i];
+    }
+  }
+  if (filename == NULL) {
+    handle_help();
+    return 1;
+  }
+
+  static chip8_t chip8;
+  static chip8_analysis_t analysis;
+  init_chip8(&chip8, 1);
+  long size = file_size(filename);
+  if (size < 0 || load_rom(&chip8, filename) != 0) {
+    fprintf(stderr, "Failed to load ROM: %s\n", filename);
+    return 1;
+  }
+  if (all) {
+    size = MEMORY_SIZE - START_ADDRESS;
+  }
+
+  chip8_analyze(&chip8, &analysis);
+  print_summary(filename, size, &analysis);
+  if (!summaryOnly) {
+    print_listing(&chip8, &analysis, (uint16_t)(START_ADDRESS + size));
+  }
+  return 0;
+}
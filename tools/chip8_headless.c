@@ -0,0 +1,264 @@
+#include "chip8.h"
+#include "chip8_jit.h"
+#include "chip8_movie.h"
+#include "chip8_profile.h"
+#include "chip8_trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Defaults match the interactive frontend's pacing
+#define DEFAULT_FRAMES 600
+#define DEFAULT_CYCLES_PER_FRAME 10
+
+void handle_help() {
+  printf("Usage: chip8-headless [options] rom\n");
+  printf("       chip8-headless [options] --play movie\n");
+  printf("Runs a ROM without a window and prints how it ended.\n");
+  printf("Options:\n");
+  printf("  --frames <n> -n    Frames to run (default %d, or the whole "
+         "movie)\n", DEFAULT_FRAMES);
+  printf("  --ipf <n> -c       Instructions per frame (default %d)\n",
+         DEFAULT_CYCLES_PER_FRAME);
+  printf("  --seed <n> -s      RNG seed (default 1)\n");
+  printf("  --keys <hex> -k    Keys held for the whole run, as a hex mask\n");
+  printf("  --jit              Translate hot blocks to native code (x86-64)\n");
+  printf("  --trace <file>     Record every instruction (build with "
+         "TRACE=1)\n");
+  printf("  --profile <file>   Write a profile report and heatmap, - for "
+         "stdout (build\n"
+         "                     with PROFILE=1)\n");
+  printf("  --play <file>      Replay a movie instead of running a ROM\n");
+  printf("  --from <n>         Start the replay at frame n\n");
+  printf("  --print -p         Print the final display\n");
+  printf("  --help -h          Show this help message and exit\n");
+}
+
+static void print_display(const chip8_t *chip8) {
+  for (int y = 0; y < DISPLAY_HEIGHT; ++y) {
+    char line[DISPLAY_WIDTH + 1];
+    uint64_t row = chip8->display[y];
+    for (int x = 0; x < DISPLAY_WIDTH; ++x) {
+      line[x] = (row >> (63 - x)) & 1u ? '#' : '.';
+    }
+    line[DISPLAY_WIDTH] = '\0';
+    printf("%s\n", line);
+  }
+}
+
+static chip8_profile_t profile;
+
+static void attach_tools(chip8_tracer_t *tracer, const char *profilePath,
+                         chip8_t *chip8) {
+  if (tracer && !chip8_trace_attach(tracer, chip8, 0)) {
+    fprintf(stderr, "Tracing is compiled out, rebuild with TRACE=1\n");
+  }
+  if (profilePath && !chip8_profile_attach(chip8, &profile)) {
+    fprintf(stderr, "Profiling is compiled out, rebuild with PROFILE=1\n");
+  }
+}
+
+static void detach_tools(chip8_t *chip8, const char *profilePath) {
+  chip8_trace_detach(chip8);
+  if (profilePath == NULL || chip8->profile == NULL) {
+    return;
+  }
+  chip8_profile_detach(chip8);
+  FILE *out = strcmp(profilePath, "-") == 0 ? stdout : fopen(profilePath, "w");
+  if (out == NULL) {
+    fprintf(stderr, "Failed to write profile: %s\n", profilePath);
+    return;
+  }
+  chip8_profile_report(&profile, out, 32);
+  fprintf(out, "\n");
+  chip8_profile_heatmap(&profile, out);
+  if (out != stdout) {
+    fclose(out);
+  }
+}
+
+// Replay a movie at full speed and check it ends where the recording did
+static int play_movie(const char *path, uint32_t from, uint32_t frames,
+                      bool print, chip8_tracer_t *tracer,
+                      const char *profilePath) {
+  chip8_movie_t *movie = chip8_movie_open(path);
+  if (movie == NULL) {
+    fprintf(stderr, "Failed to load movie: %s\n", path);
+    return 1;
+  }
+  chip8_movie_info_t info;
+  chip8_movie_info(movie, &info);
+
+  static chip8_t chip8;
+  init_chip8(&chip8, info.seed);
+  if (!chip8_movie_seek(movie, &chip8, from)) {
+    fprintf(stderr, "Movie has only %u frames\n", info.frames);
+    chip8_movie_close(movie);
+    return 1;
+  }
+  attach_tools(tracer, profilePath, &chip8);
+
+  uint32_t frame = 0;
+  while (frame < frames && chip8_movie_play_frame(movie, &chip8)) {
+    ++frame;
+  }
+
+  printf("frames %u, instructions %llu, state %016llx\n", frame,
+         (unsigned long long)chip8.cycles,
+         (unsigned long long)chip8_hash_state(&chip8));
+  if (print) {
+    print_display(&chip8);
+  }
+
+  int status = 0;
+  if (!info.complete) {
+    printf("movie was cut short after %u frames\n", info.frames);
+  } else if (chip8_movie_position(movie) == info.frames) {
+    if (chip8_hash_state(&chip8) == info.final_hash) {
+      printf("replay matches recording\n");
+    } else {
+      printf("replay differs from recording, which ended in state %016llx\n",
+             (unsigned long long)info.final_hash);
+      status = 3;
+    }
+  }
+  detach_tools(&chip8, profilePath);
+  chip8_movie_close(movie);
+  return status;
+}
+
+// Run a ROM with the same frame loop as the SDL frontend
+static int run_rom(const char *filename, uint32_t frames,
+                   uint32_t cyclesPerFrame, uint32_t seed, uint16_t keys,
+                   bool useJit, bool print, chip8_tracer_t *tracer,
+                   const char *profilePath) {
+  static chip8_t chip8;
+  init_chip8(&chip8, seed);
+  chip8.stop_mask = CHIP8_STOP_INVALID;
+  for (int key = 0; key < KEYS_COUNT; ++key) {
+    chip8.keypad[key] = (keys >> key) & 1u;
+  }
+
+  if (load_rom(&chip8, filename) != 0) {
+    fprintf(stderr, "Failed to load ROM: %s\n", filename);
+    return 1;
+  }
+  attach_tools(tracer, profilePath, &chip8);
+
+  chip8_jit_t *jit = useJit ? chip8_jit_create(&chip8) : NULL;
+  if (useJit && jit == NULL) {
+    fprintf(stderr, "JIT unavailable, using the interpreter\n");
+  }
+
+  // Same frame loop as the SDL frontend, minus the window
+  chip8_exit_t stop = {CHIP8_EXIT_BUDGET, 0, 0, chip8.pc, 0};
+  uint32_t frame = 0;
+  while (frame < frames && stop.reason == CHIP8_EXIT_BUDGET) {
+    ++frame;
+    uint32_t budget = cyclesPerFrame;
+    while (budget > 0 && stop.reason == CHIP8_EXIT_BUDGET) {
+      if (jit) {
+        chip8_jit_run(jit, budget, &stop);
+      } else {
+        chip8_run(&chip8, budget, &stop);
+      }
+      budget -= stop.cycles;
+    }
+    if (stop.reason == CHIP8_EXIT_BUDGET) {
+      update_timers(&chip8);
+    }
+  }
+
+  if (stop.reason == CHIP8_EXIT_INVALID) {
+    printf("invalid opcode %04X at %03X\n", stop.opcode, stop.pc);
+  }
+  printf("frames %u, instructions %llu, state %016llx\n", frame,
+         (unsigned long long)chip8.cycles,
+         (unsigned long long)chip8_hash_state(&chip8));
+  if (print) {
+    print_display(&chip8);
+  }
+
+  detach_tools(&chip8, profilePath);
+  if (jit) {
+    chip8_jit_destroy(jit);
+  }
+  return stop.reason == CHIP8_EXIT_INVALID ? 2 : 0;
+}
+
+int main(int argc, char *argv[]) {
+  const char *filename = NULL;
+  const char *playPath = NULL;
+  const char *tracePath = NULL;
+  const char *profilePath = NULL;
+  uint32_t from = 0;
+  uint32_t frames = DEFAULT_FRAMES;
+  bool framesSet = false;
+  uint32_t cyclesPerFrame = DEFAULT_CYCLES_PER_FRAME;
+  uint32_t seed = 1;
+  uint16_t keys = 0;
+  bool useJit = false;
+  bool print = false;
+
+  for (int i = 1; i < argc; i++) {
+    int hasValue = i + 1 < argc;
+    if ((strcmp(argv[i], "--help") == 0) || (strcmp(argv[i], "-h") == 0)) {
+      handle_help();
+      return 0;
+    } else if ((strcmp(argv[i], "--frames") == 0 ||
+                strcmp(argv[i], "-n") == 0) && hasValue) {
+      frames = (uint32_t)strtoul(argv[++i], NULL, 10);
+      framesSet = true;
+    } else if ((strcmp(argv[i], "--ipf") == 0 ||
+                strcmp(argv[i], "-c") == 0) && hasValue) {
+      cyclesPerFrame = (uint32_t)strtoul(argv[++i], NULL, 10);
+    } else if ((strcmp(argv[i], "--seed") == 0 ||
+                strcmp(argv[i], "-s") == 0) && hasValue) {
+      seed = (uint32_t)strtoul(argv[++i], NULL, 0);
+    } else if ((strcmp(argv[i], "--keys") == 0 ||
+                strcmp(argv[i], "-k") == 0) && hasValue) {
+      keys = (uint16_t)strtoul(argv[++i], NULL, 16);
+    } else if (strcmp(argv[i], "--trace") == 0 && hasValue) {
+      tracePath = argv[++i];
+    } else if (strcmp(argv[i], "--profile") == 0 && hasValue) {
+      profilePath = argv[++i];
+    } else if (strcmp(argv[i], "--play") == 0 && hasValue) {
+      playPath = argv[++i];
+    } else if (strcmp(argv[i], "--from") == 0 && hasValue) {
+      from = (uint32_t)strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--jit") == 0) {
+      useJit = true;
+    } else if (strcmp(argv[i], "--print") == 0 || strcmp(argv[i], "-p") == 0) {
+      print = true;
+    } else if (argv[i][0] == '-') {
+      fprintf(stderr, "Unknown option: %s\n", argv[i]);
+      fprintf(stderr, "Use --help or -h for usage information.\n");
+      return 1;
+    } else {
+      filename = argv[i];
+    }
+  }
+
+  if (playPath == NULL && filename == NULL) {
+    handle_help();
+    return 1;
+  }
+
+  chip8_tracer_t *tracer = NULL;
+  if (tracePath) {
+    tracer = chip8_tracer_create(tracePath, 0);
+    if (tracer == NULL) {
+      fprintf(stderr, "Failed to create trace: %s\n", tracePath);
+      return 1;
+    }
+  }
+  int status = playPath ? play_movie(playPath, from,
+                                     framesSet ? frames : UINT32_MAX, print,
+                                     tracer, profilePath)
+                        : run_rom(filename, frames, cyclesPerFrame, seed,
+                                  keys, useJit, print, tracer, profilePath);
+  if (chip8_tracer_destroy(tracer) != 0) {
+    fprintf(stderr, "Failed to write trace: %s\n", tracePath);
+  }
+  return status;
+}
@@ -0,0 +1,148 @@
+#include "chip8_trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void handle_help() {
+  printf("Usage: chip8-trace [options] trace\n");
+  printf("Prints the records of a trace written with --trace.\n");
+  printf("Options:\n");
+  printf("  --instance <n> -i  Only records of instance n\n");
+  printf("  --pc <a[-b]>       Only steps at address a, or from a to b\n");
+  printf("  --op <pattern>     Only steps whose opcode matches, e.g. Dxyn or "
+         "F?0A\n");
+  printf("  --from <n>         Skip records before instruction n\n");
+  printf("  --limit <n> -n     Stop after printing n records\n");
+  printf("  --steps            Print steps only, no idle or sync records\n");
+  printf("  --help -h          Show this help message and exit\n");
+}
+
+// An opcode pattern: four hex digits, any other character matches anything
+static int parse_pattern(const char *text, uint16_t *mask, uint16_t *value) {
+  if (strlen(text) != 4) {
+    return -1;
+  }
+  *mask = 0;
+  *value = 0;
+  for (int i = 0; i < 4; ++i) {
+    char digit[2] = {text[i], '\0'};
+    char *end;
+    unsigned long nibble = strtoul(digit, &end, 16);
+    int shift = 12 - 4 * i;
+    if (*end == '\0') {
+      *mask |= (uint16_t)(0xF << shift);
+      *value |= (uint16_t)(nibble << shift);
+    }
+  }
+  return 0;
+}
+
+static void print_registers(const chip8_trace_record_t *record,
+                            uint16_t which) {
+  for (int reg = 0; reg < V_REG_COUNT; ++reg) {
+    if (which >> reg & 1u) {
+      printf(" V%X=%02X", reg, record->registers[reg]);
+    }
+  }
+}
+
+static void print_record(const chip8_trace_record_t *record) {
+  printf("%10llu %2u ", (unsigned long long)record->cycle, record->instance);
+  switch (record->kind) {
+  case CHIP8_TRACE_STEP:
+    printf("%03X  %04X  I=%03X", record->pc, record->opcode, record->index);
+    print_registers(record, record->written);
+    break;
+  case CHIP8_TRACE_IDLE:
+    printf("%03X  idle %u instructions", record->pc, record->count);
+    break;
+  case CHIP8_TRACE_SYNC:
+    printf("%03X  sync  I=%03X", record->pc, record->index);
+    print_registers(record, 0xFFFF);
+    if (record->count != 0) {
+      printf("  (%u instructions lost)", record->count);
+    }
+    break;
+  }
+  printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+  const char *filename = NULL;
+  long instance = -1;
+  uint16_t pcLow = 0;
+  uint16_t pcHigh = 0xFFFF;
+  uint16_t opMask = 0;
+  uint16_t opValue = 0;
+  unsigned long long from = 0;
+  unsigned long long limit = 0;
+  bool stepsOnly = false;
+
+  for (int i = 1; i < argc; i++) {
+    int hasValue = i + 1 < argc;
+    if ((strcmp(argv[i], "--help") == 0) || (strcmp(argv[i], "-h") == 0)) {
+      handle_help();
+      return 0;
+    } else if ((strcmp(argv[i], "--instance") == 0 ||
+                strcmp(argv[i], "-i") == 0) && hasValue) {
+      instance = strtol(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "--pc") == 0 && hasValue) {
+      char *end;
+      pcLow = (uint16_t)strtoul(argv[++i], &end, 16);
+      pcHigh = *end == '-' ? (uint16_t)strtoul(end + 1, NULL, 16) : pcLow;
+      stepsOnly = true;
+    } else if (strcmp(argv[i], "--op") == 0 && hasValue) {
+      if (parse_pattern(argv[++i], &opMask, &opValue) != 0) {
+        fprintf(stderr, "Opcode patterns are four characters: %s\n", argv[i]);
+        return 1;
+      }
+      stepsOnly = true;
+    } else if (strcmp(argv[i], "--from") == 0 && hasValue) {
+      from = strtoull(argv[++i], NULL, 10);
+    } else if ((strcmp(argv[i], "--limit") == 0 ||
+                strcmp(argv[i], "-n") == 0) && hasValue) {
+      limit = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--steps") == 0) {
+      stepsOnly = true;
+    } else if (argv[i][0] == '-') {
+      fprintf(stderr, "Unknown option: %s\n", argv[i]);
+      fprintf(stderr, "Use --help or -h for usage information.\n");
+      return 1;
+    } else {
+      filename = argv[i];
+    }
+  }
+  if (filename == NULL) {
+    handle_help();
+    return 1;
+  }
+
+  chip8_trace_reader_t *reader = chip8_trace_reader_open(filename);
+  if (reader == NULL) {
+    fprintf(stderr, "Failed to load trace: %s\n", filename);
+    return 1;
+  }
+
+  chip8_trace_record_t record;
+  unsigned long long printed = 0;
+  while ((limit == 0 || printed < limit) &&
+         chip8_trace_read(reader, &record)) {
+    if ((instance >= 0 && record.instance != (uint32_t)instance) ||
+        record.cycle < from) {
+      continue;
+    }
+    if (record.kind != CHIP8_TRACE_STEP) {
+      // Lost instructions are always worth knowing about
+      if (stepsOnly && !(record.kind == CHIP8_TRACE_SYNC && record.count)) {
+        continue;
+      }
+    } else if (record.pc < pcLow || record.pc > pcHigh ||
+               (record.opcode & opMask) != opValue) {
+      continue;
+    }
+    print_record(&record);
+    ++printed;
+  }
+  chip8_trace_reader_close(reader);
+  return 0;
+}